@@ -1,28 +1,66 @@
-; load 'dh' sectors from drive 'dl' into ES:BX
+; 1.44 MB floppy geometry, used to turn sector numbers into CHS addresses
+SECTORS_PER_TRACK equ 18
+HEADS equ 2
+
+; load 'cx' sectors starting at LBA 'si' from drive [BOOT_DRIVE] into es:0
+; onwards, es ends up past them. A read goes up to the end of the track,
+; or the next 64 KiB boundary which floppy DMA can't cross, so the kernel
+; takes a few int 0x13 calls rather than one per sector.
 disk_load:
     pusha
-    ; reading from disk requires setting specific values in all registers
-    ; so we will overwrite our input parameters from 'dx'. Let's save it
-    ; to the stack for later use.
-    push dx
+    mov bp, cx ; bp <- sectors left
+
+disk_load_next:
+    ; LBA -> CHS: sector = LBA % spt + 1, head = LBA / spt % heads,
+    ; cylinder = LBA / spt / heads
+    mov ax, si
+    xor dx, dx
+    mov bx, SECTORS_PER_TRACK
+    div bx
+    mov cl, dl ; cl <- sector (0x01 .. 0x12)
+    inc cl
+    mov di, SECTORS_PER_TRACK
+    sub di, dx ; di <- sectors up to the end of the track
+    xor dx, dx
+    mov bx, HEADS
+    div bx
+    mov ch, al ; ch <- cylinder, a floppy has less than 256
+    mov dh, dl ; dh <- head number
+
+    ; es is sector aligned, a sector is 32 paragraphs
+    mov ax, es
+    and ax, 0xfff
+    sub ax, 0x1000
+    neg ax
+    shr ax, 5 ; ax <- sectors up to the 64 KiB boundary
+    cmp di, ax
+    jbe disk_load_clamp
+    mov di, ax
+disk_load_clamp:
+    cmp di, bp
+    jbe disk_load_read
+    mov di, bp
 
+disk_load_read:
+    mov dl, [BOOT_DRIVE] ; dl <- drive number
+    xor bx, bx ; [es:bx] <- pointer to buffer where the data will be stored
+    mov ax, di ; al <- number of sectors to read
     mov ah, 0x02 ; ah <- int 0x13 function. 0x02 = 'read'
-    mov al, dh   ; al <- number of sectors to read (0x01 .. 0x80)
-    mov cl, 0x02 ; cl <- sector (0x01 .. 0x11)
-                 ; 0x01 is our boot sector, 0x02 is the first 'available' sector
-    mov ch, 0x00 ; ch <- cylinder (0x0 .. 0x3FF, upper 2 bits in 'cl')
-    ; dl <- drive number. Our caller sets it as a parameter and gets it from BIOS
-    ; (0 = floppy, 1 = floppy2, 0x80 = hdd, 0x81 = hdd2)
-    mov dh, 0x00 ; dh <- head number (0x0 .. 0xF)
-
-    ; [es:bx] <- pointer to buffer where the data will be stored
-    ; caller sets it up for us, and it is actually the standard location for int 13h
-    int 0x13      ; BIOS interrupt
+    int 0x13 ; BIOS interrupt
     jc disk_error ; if error (stored in the carry bit)
-
-    pop dx
-    cmp al, dh    ; BIOS also sets 'al' to the # of sectors read. Compare it.
+    mov bx, di
+    cmp al, bl ; BIOS also sets 'al' to the # of sectors read. Compare it.
     jne sectors_error
+
+    mov ax, di ; the next sectors go that much further
+    shl ax, 5
+    mov bx, es
+    add ax, bx
+    mov es, ax
+    add si, di
+    sub bp, di
+    jnz disk_load_next
+
     popa
     ret
 
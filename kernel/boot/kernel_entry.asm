@@ -1,4 +1,100 @@
 [bits 32]
 [extern main] ; Define calling point. Must have same name as kernel.c 'main' function
+
+%ifdef __x86_64__
+; The MBR calls in here in 32-bit protected mode. Long mode needs PAE
+; paging first: the first 4 GiB are identity mapped with 2 MiB pages,
+; enough until vmm_init() sets up the kernel's own tables. The APs go
+; through the same steps in cpu/trampoline.asm.
+global boot_pml4
+global gdt64_descriptor
+
+PTE_PRESENT equ 1 << 0
+PTE_WRITE equ 1 << 1
+PTE_LARGE equ 1 << 7
+CR0_PG equ 1 << 31
+CR4_PAE equ 1 << 5
+MSR_EFER equ 0xC0000080
+EFER_LME equ 1 << 8
+
+; Same selectors as boot/gdt.asm
+CODE_SEG equ 0x08
+DATA_SEG equ 0x10
+
+    ; the loader doesn't clear the bss, it holds whatever was in memory
+    mov edi, boot_pml4
+    mov ecx, (boot_tables_end - boot_pml4) / 4
+    xor eax, eax
+    rep stosd
+
+    mov dword [boot_pml4], boot_pdpt + PTE_PRESENT + PTE_WRITE
+    mov edi, boot_pdpt
+    mov eax, boot_directories + PTE_PRESENT + PTE_WRITE
+    mov ecx, 4
+fill_pdpt:
+    mov [edi], eax
+    add eax, 4096
+    add edi, 8
+    loop fill_pdpt
+
+    mov edi, boot_directories
+    mov eax, PTE_PRESENT + PTE_WRITE + PTE_LARGE
+    mov ecx, 4 * 512
+fill_directories:
+    mov [edi], eax
+    add eax, 0x200000
+    add edi, 8
+    loop fill_directories
+
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov eax, boot_pml4
+    mov cr3, eax
+    mov ecx, MSR_EFER
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG ; long mode is active from here, in 32-bit compatibility mode
+    mov cr0, eax
+
+    lgdt [gdt64_descriptor]
+    jmp CODE_SEG:long_mode
+
+[bits 64]
+long_mode:
+    mov ax, DATA_SEG
+    mov ds, ax
+    mov ss, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov esp, esp ; the upper half is undefined after the switch, this clears it
+
+    call main
+    jmp $
+
+; The flat code segment has the L bit set instead of D
+align 8
+gdt64:
+    dq 0x0
+    dq 0x00af9a000000ffff ; code
+    dq 0x00cf92000000ffff ; data
+gdt64_descriptor:
+    dw gdt64_descriptor - gdt64 - 1
+    dq gdt64
+
+section .bss
+alignb 4096
+boot_pml4:
+    resb 4096
+boot_pdpt:
+    resb 4096
+boot_directories:
+    resb 4 * 4096
+boot_tables_end:
+%else
 call main ; Calls the C function. The linker will know where it is placed in memory
 jmp $
+%endif
@@ -0,0 +1,8 @@
+; Where the boot stages put things, shared by boot/mbr.asm and boot/stage2.asm
+KERNEL_OFFSET equ 0x10000 ; The same one we used when linking the kernel
+; The kernel with its bss has to end below the AP stacks at 0x70000
+; Stage 2 follows the boot sector, on the disk and in memory
+STAGE2_OFFSET equ 0x7e00
+STAGE2_SECTORS equ 2
+; The compressed kernel follows stage 2 on the disk
+KERNEL_LBA equ 1 + STAGE2_SECTORS
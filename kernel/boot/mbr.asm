@@ -1,33 +1,27 @@
 [bits 16]
 [org 0x7c00]
 
-KERNEL_OFFSET equ 0x1000 ; The same one we used when linking the kernel
+%include "boot/layout.asm"
 
 mov [BOOT_DRIVE], dl ; Remember that the BIOS sets us the boot drive in 'dl' on boot
 mov bp, 0x9000
 mov sp, bp
 
-call load_kernel ; read the kernel from disk
-call switch_to_32bit ; disable interrupts, load GDT,  etc. Finally jumps to 'BEGIN_PM'
-jmp $ ; Never executed
+call load_stage2 ; the rest of the boot doesn't fit in 512 bytes
+mov dl, [BOOT_DRIVE]
+jmp STAGE2_OFFSET ; Never returns
 
 %include "boot/disk.asm"
-%include "boot/gdt.asm"
-%include "boot/switch-to-32bit.asm"
 
 [bits 16]
-load_kernel:
-    mov bx, KERNEL_OFFSET ; Read from disk and store in 0x1000
-    mov dh, 31
-    mov dl, [BOOT_DRIVE]
+load_stage2:
+    mov ax, STAGE2_OFFSET / 16
+    mov es, ax
+    mov si, 1
+    mov cx, STAGE2_SECTORS
     call disk_load
     ret
 
-[bits 32]
-BEGIN_32BIT:
-    call KERNEL_OFFSET ; Give control to the kernel
-    jmp $ ; Stay here when the kernel returns control to us (if ever)
-
 
 BOOT_DRIVE db 0 ; It is a good idea to store it in memory because 'dl' may get overwritten
 
@@ -0,0 +1,34 @@
+; Ask the BIOS for the memory map (int 0x15, eax = 0xE820) and store it for
+; the kernel: a dword entry count at MEMORY_MAP, 24 byte entries after it
+MEMORY_MAP equ 0x1000 ; MEMORY_MAP_ADDRESS in mm/memory_map.h, page 0 gets unmapped
+MEMORY_MAP_MAX_ENTRIES equ 32
+SMAP equ 0x534d4150 ; 'SMAP', the BIOS returns it in eax when it succeeds
+
+[bits 16]
+load_memory_map:
+    pusha
+    xor ax, ax
+    mov es, ax ; entries are stored at es:di
+    mov dword [MEMORY_MAP], 0
+    mov di, MEMORY_MAP + 4
+    xor ebx, ebx ; continuation value, 0 asks for the first entry
+
+memory_map_next:
+    mov eax, 0xe820
+    mov ecx, 24
+    mov edx, SMAP
+    mov dword [di + 20], 1 ; ACPI 3.0 attributes, valid unless the BIOS clears them
+    int 0x15
+    jc memory_map_done ; carry on the first call means E820 isn't supported
+    cmp eax, SMAP
+    jne memory_map_done
+    inc dword [MEMORY_MAP]
+    add di, 24
+    cmp dword [MEMORY_MAP], MEMORY_MAP_MAX_ENTRIES
+    je memory_map_done
+    test ebx, ebx ; 0 after the last entry
+    jnz memory_map_next
+
+memory_map_done:
+    popa
+    ret
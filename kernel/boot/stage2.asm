@@ -0,0 +1,122 @@
+; Stage 2, loaded by the MBR right after itself. It reads the compressed
+; kernel in a few large reads, switches to protected mode and decompresses
+; it to KERNEL_OFFSET.
+%include "boot/layout.asm"
+
+[bits 16]
+[org STAGE2_OFFSET]
+
+; The kernel is in the LZ4 legacy frame format: this magic, the size of the
+; compressed block and the block. The Makefile runs `lz4 -l`.
+LZ4_LEGACY_MAGIC equ 0x184c2102
+LZ4_HEADER_SIZE equ 8
+; Read to the AP stacks, which are unused until the kernel starts the APs.
+; The limit keeps clear of the boot stack at 0x90000.
+COMPRESSED_OFFSET equ 0x70000
+COMPRESSED_MAX equ 0x18000
+
+stage2:
+    mov [BOOT_DRIVE], dl
+    call load_memory_map ; the kernel can't call the BIOS once in protected mode
+    call load_kernel
+    call switch_to_32bit ; disable interrupts, load GDT,  etc. Finally jumps to 'BEGIN_32BIT'
+    jmp $ ; Never executed
+
+%include "boot/disk.asm"
+%include "boot/memory_map.asm"
+%include "boot/gdt.asm"
+%include "boot/switch-to-32bit.asm"
+
+[bits 16]
+load_kernel:
+    ; the first sector has the header with the size of the rest
+    mov ax, COMPRESSED_OFFSET / 16
+    mov es, ax
+    mov si, KERNEL_LBA
+    mov cx, 1
+    call disk_load
+    mov ax, COMPRESSED_OFFSET / 16
+    mov es, ax
+    cmp dword [es:0], LZ4_LEGACY_MAGIC
+    jne kernel_error
+    mov eax, [es:4]
+    cmp eax, COMPRESSED_MAX - LZ4_HEADER_SIZE
+    ja kernel_error
+    mov [compressed_size], eax
+
+    ; all of it again, the first sector is part of the first read anyway
+    add eax, LZ4_HEADER_SIZE + 511
+    shr eax, 9
+    mov cx, ax
+    mov si, KERNEL_LBA
+    call disk_load
+    ret
+
+kernel_error:
+    jmp $
+
+[bits 32]
+BEGIN_32BIT:
+    mov esi, COMPRESSED_OFFSET + LZ4_HEADER_SIZE
+    mov edx, esi
+    add edx, [compressed_size]
+    mov edi, KERNEL_OFFSET
+    call lz4_decompress
+    call KERNEL_OFFSET ; Give control to the kernel
+    jmp $ ; Stay here when the kernel returns control to us (if ever)
+
+; Decompresses the LZ4 block at esi, up to edx, to edi. A sequence is a
+; token, literals to copy and a match to copy from earlier output, given
+; as a 16-bit offset back. The last sequence has no match. Both lengths
+; are 4 bits of the token, 15 means more bytes add to it.
+lz4_decompress:
+    push ebp
+    cld
+lz4_sequence:
+    movzx ebx, byte [esi] ; ebx <- token
+    inc esi
+    mov eax, ebx
+    shr eax, 4
+    call lz4_length
+    mov ecx, eax
+    rep movsb ; literals
+    cmp esi, edx
+    jae lz4_done
+
+    movzx ebp, word [esi] ; ebp <- offset
+    add esi, 2
+    mov eax, ebx
+    and eax, 0xf
+    call lz4_length
+    lea ecx, [eax + 4] ; matches are at least 4 bytes
+    push esi
+    mov esi, edi
+    sub esi, ebp
+    rep movsb ; byte by byte, a match may overlap what it writes
+    pop esi
+    jmp lz4_sequence
+
+lz4_done:
+    pop ebp
+    ret
+
+; eax <- the length starting with the 4 bits in eax, reading any extra
+; bytes from esi
+lz4_length:
+    cmp eax, 15
+    jne lz4_length_done
+lz4_length_next:
+    movzx ecx, byte [esi]
+    inc esi
+    add eax, ecx
+    cmp ecx, 255
+    je lz4_length_next
+lz4_length_done:
+    ret
+
+
+BOOT_DRIVE db 0
+compressed_size dd 0
+
+; padding, and an error if stage 2 outgrows its sectors
+times STAGE2_SECTORS * 512 - ($-$$) db 0
@@ -0,0 +1,128 @@
+#include "apic.h"
+
+/* Register offsets */
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_LVT_NMI 0x400
+#define LAPIC_LVT_EXTINT 0x700
+#define LAPIC_TIMER_DEADLINE 0x40000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+#define MSR_TSC_DEADLINE 0x6E0
+#define CPUID_ECX_TSC_DEADLINE (1 << 24)
+
+/* IO APIC registers, accessed through the select/window pair */
+#define IOAPIC_SELECT 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_REDIRECTION 0x10
+
+#define LAPIC_ICR_FIXED 0x000
+#define LAPIC_ICR_INIT 0x500
+#define LAPIC_ICR_STARTUP 0x600
+#define LAPIC_ICR_PENDING 0x1000
+#define LAPIC_ICR_ASSERT 0x4000
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return *(volatile uint32_t*)(uintptr_t)(LAPIC_BASE + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t*)(uintptr_t)(LAPIC_BASE + reg) = value;
+}
+
+void lapic_init(bool bsp)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_LINT0, bsp ? LAPIC_LVT_EXTINT : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, bsp ? LAPIC_LVT_NMI : LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+}
+
+uint8_t lapic_id()
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi()
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void send_ipi(uint8_t apic_id, uint32_t command)
+{
+    // writing the low half sends the IPI
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+        asm volatile("pause");
+}
+
+void lapic_send_init(uint8_t apic_id)
+{
+    send_ipi(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT);
+}
+
+void lapic_send_startup(uint8_t apic_id, uint8_t vector)
+{
+    send_ipi(apic_id, LAPIC_ICR_STARTUP | LAPIC_ICR_ASSERT | vector);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector)
+{
+    send_ipi(apic_id, LAPIC_ICR_FIXED | LAPIC_ICR_ASSERT | vector);
+}
+
+bool lapic_timer_has_deadline()
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+    return ecx & CPUID_ECX_TSC_DEADLINE;
+}
+
+void lapic_timer_init(bool deadline)
+{
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    lapic_write(LAPIC_LVT_TIMER, (deadline ? LAPIC_TIMER_DEADLINE : 0) | LAPIC_TIMER_VECTOR);
+}
+
+void lapic_timer_oneshot(uint32_t count)
+{
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+uint32_t lapic_timer_count()
+{
+    return lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+void lapic_timer_deadline(uint64_t tsc)
+{
+    asm volatile("wrmsr" : : "c"(MSR_TSC_DEADLINE), "a"((uint32_t)tsc), "d"((uint32_t)(tsc >> 32)));
+}
+
+void ioapic_route(uint8_t irq, uint8_t vector, uint8_t apic_id)
+{
+    volatile uint32_t* select = (volatile uint32_t*)(uintptr_t)(IOAPIC_BASE + IOAPIC_SELECT);
+    volatile uint32_t* window = (volatile uint32_t*)(uintptr_t)(IOAPIC_BASE + IOAPIC_WINDOW);
+
+    // destination first, the entry is unmasked by writing the low half
+    *select = IOAPIC_REDIRECTION + irq * 2 + 1;
+    *window = (uint32_t)apic_id << 24;
+    *select = IOAPIC_REDIRECTION + irq * 2;
+    *window = vector;
+}
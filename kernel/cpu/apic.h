@@ -0,0 +1,42 @@
+#ifndef _KERNEL_APIC_H_
+#define _KERNEL_APIC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Physical addresses of the APIC registers, vmm_init() identity maps
+ * them uncached */
+#define LAPIC_BASE 0xFEE00000
+#define IOAPIC_BASE 0xFEC00000
+
+/* Local APIC vectors, above the remapped PIC */
+#define LAPIC_TIMER_VECTOR 48
+#define LAPIC_CALL_VECTOR 49
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+/* Software enable the local APIC of the calling CPU. LINT0 is left in
+ * virtual wire mode on the BSP in case the PIC is still in use. */
+void lapic_init(bool bsp);
+uint8_t lapic_id();
+void lapic_eoi();
+
+void lapic_send_init(uint8_t apic_id);
+void lapic_send_startup(uint8_t apic_id, uint8_t vector);
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+
+/* The timer interrupts once on LAPIC_TIMER_VECTOR, either when the TSC
+ * reaches a deadline or when a count of APIC bus cycles divided by 16
+ * runs out */
+bool lapic_timer_has_deadline();
+void lapic_timer_init(bool deadline);
+/* Counting mode, 0 stops the timer */
+void lapic_timer_oneshot(uint32_t count);
+uint32_t lapic_timer_count();
+/* TSC deadline mode, 0 stops the timer */
+void lapic_timer_deadline(uint64_t tsc);
+
+/* Deliver ISA interrupt `irq` as `vector` to the CPU with `apic_id`, edge
+ * triggered like on the PIC */
+void ioapic_route(uint8_t irq, uint8_t vector, uint8_t apic_id);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _KERNEL_ATOMIC_H_
+#define _KERNEL_ATOMIC_H_
+
+#include <stdbool.h>
+
+/* Atomic operations on naturally aligned integers and pointers of any
+ * width up to a word (and uint64_t on long mode), the compiler picks
+ * the locked instruction. Plain loads and stores of shared variables
+ * go through atomic_read() and atomic_write() so the compiler neither
+ * tears nor caches them. */
+
+/* The load sees everything stored before the atomic_write() it reads */
+#define atomic_read(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define atomic_write(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+
+/* The new value */
+#define atomic_add(ptr, value) __atomic_add_fetch(ptr, value, __ATOMIC_SEQ_CST)
+#define atomic_sub(ptr, value) __atomic_sub_fetch(ptr, value, __ATOMIC_SEQ_CST)
+/* The value before */
+#define atomic_fetch_add(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST)
+#define atomic_inc(ptr) atomic_add(ptr, 1)
+#define atomic_dec(ptr) atomic_sub(ptr, 1)
+/* Stores `value` and returns the old one */
+#define atomic_xchg(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST)
+/* Stores `new` if *ptr is still `*old` and returns true. Otherwise *old
+ * is what *ptr holds now, ready for the next try of a loop. */
+#define atomic_cmpxchg(ptr, old, new) \
+    __atomic_compare_exchange_n(ptr, old, new, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+/* Full barrier, a store before it is visible to other CPUs before any
+ * load after it. x86 only reorders that pair, the rest is ordered anyway
+ * and needs no more than the compiler barrier. */
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define barrier() asm volatile("" : : : "memory")
+
+/* In spin loops, leaves the core to a hyperthread sibling and keeps the
+ * loop from flooding the memory pipeline */
+#define cpu_relax() asm volatile("pause" : : : "memory")
+
+#endif
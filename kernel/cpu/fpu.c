@@ -0,0 +1,225 @@
+#include <stddef.h>
+
+#include "fpu.h"
+#include "../kernel/console.h"
+#include "../kernel/printk.h"
+#include "isr.h"
+#include "smp.h"
+
+#define CPUID_EDX_FXSR (1 << 24)
+#define CPUID_EDX_SSE2 (1 << 26)
+#define CPUID_ECX_XSAVE (1 << 26)
+#define CPUID_ECX_AVX (1 << 28)
+/* Size of the XSAVE image for what XCR0 enables, in EBX */
+#define CPUID_XSAVE_LEAF 0xd
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+#define CR0_NE (1 << 5)
+#define CR4_OSFXSR (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE (1 << 18)
+
+#define XCR0_X87 (1 << 0)
+#define XCR0_SSE (1 << 1)
+#define XCR0_AVX (1 << 2)
+
+#define EFLAGS_IF (1 << 9)
+
+#define DEVICE_NOT_AVAILABLE 7
+
+/* What the registers of a CPU hold */
+struct fpu_cpu {
+    /* State loaded in the registers, NULL if they are nobody's */
+    struct fpu_state* owner;
+    /* Of the thread running */
+    struct fpu_state* current;
+    /* Nested fpu_begin() calls */
+    uint32_t claims;
+};
+
+/* The same on every CPU */
+static uint32_t features = 0;
+static bool has_fxsr = false;
+static struct fpu_cpu fpu_cpus[SMP_MAX_CPUS];
+
+static void cpuid(uint32_t leaf, uint32_t sub, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(sub));
+}
+
+static void set_ts()
+{
+    uintptr_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    // writing CR0 serializes, skip it when there is nothing to change
+    if (!(cr0 & CR0_TS))
+        asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+static bool ts_set()
+{
+    uintptr_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    return cr0 & CR0_TS;
+}
+
+static void clear_ts()
+{
+    if (ts_set())
+        asm volatile("clts");
+}
+
+/* Load the running thread's registers, saving whoever's were loaded */
+static bool fpu_trap()
+{
+    if (!ts_set())
+        return false;
+
+    struct fpu_cpu* cpu = &fpu_cpus[this_cpu()->id];
+    asm volatile("clts");
+    if (cpu->owner == cpu->current)
+        return true;
+    if (cpu->owner != NULL)
+        fpu_save(cpu->owner);
+    // before the first switch there is no thread state to load
+    if (cpu->current != NULL)
+        fpu_restore(cpu->current);
+    cpu->owner = cpu->current;
+    return true;
+}
+
+static void device_not_available(registers_t* regs)
+{
+    if (fpu_trap())
+        return;
+
+    printk(LOG_ERR, "FPU used without being enabled, ip %p", (void*)REGISTERS_IP(regs));
+    console_flush();
+    while (1)
+        asm volatile("cli; hlt");
+}
+
+/* XCR0 with as much as the CPU and struct fpu_state have room for */
+static void enable_xsave(uint32_t ecx)
+{
+    uintptr_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_OSXSAVE));
+
+    uint32_t xcr0 = XCR0_X87 | XCR0_SSE;
+    if (ecx & CPUID_ECX_AVX)
+        xcr0 |= XCR0_AVX;
+    asm volatile("xsetbv" : : "c"(0), "a"(xcr0), "d"(0));
+
+    uint32_t eax, size, unused;
+    cpuid(CPUID_XSAVE_LEAF, 0, &eax, &size, &unused, &unused);
+    if (size > FPU_STATE_SIZE) {
+        xcr0 = XCR0_X87 | XCR0_SSE;
+        asm volatile("xsetbv" : : "c"(0), "a"(xcr0), "d"(0));
+    }
+
+    features |= FPU_XSAVE;
+    if (xcr0 & XCR0_AVX)
+        features |= FPU_AVX;
+}
+
+bool fpu_init()
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+
+    uintptr_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    asm volatile("mov %0, %%cr0" : : "r"(cr0));
+    asm volatile("fninit");
+    register_interrupt_handler(DEVICE_NOT_AVAILABLE, device_not_available);
+
+    has_fxsr = edx & CPUID_EDX_FXSR;
+    if ((edx & (CPUID_EDX_FXSR | CPUID_EDX_SSE2)) != (CPUID_EDX_FXSR | CPUID_EDX_SSE2))
+        return false;
+
+    uintptr_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile("mov %0, %%cr4" : : "r"(cr4));
+    features |= FPU_SSE2;
+
+    if (ecx & CPUID_ECX_XSAVE)
+        enable_xsave(ecx);
+    return true;
+}
+
+uint32_t fpu_features()
+{
+    return features;
+}
+
+/* XSAVE and XRSTOR take a mask of the state components in EDX:EAX, all
+ * of what XCR0 enables is wanted */
+void fpu_save(struct fpu_state* state)
+{
+    if (features & FPU_XSAVE)
+        asm volatile("xsave %0" : "+m"(*state) : "a"(-1), "d"(-1));
+    else if (has_fxsr)
+        asm volatile("fxsave %0" : "=m"(*state));
+    else
+        asm volatile("fnsave %0" : "=m"(*state));
+}
+
+void fpu_restore(struct fpu_state* state)
+{
+    if (features & FPU_XSAVE)
+        asm volatile("xrstor %0" : : "m"(*state), "a"(-1), "d"(-1));
+    else if (has_fxsr)
+        asm volatile("fxrstor %0" : : "m"(*state));
+    else
+        asm volatile("frstor %0" : : "m"(*state));
+}
+
+void fpu_switch(struct fpu_state* next)
+{
+    struct fpu_cpu* cpu = &fpu_cpus[this_cpu()->id];
+    cpu->current = next;
+    // back to the thread whose registers are still loaded, nothing to trap
+    if (cpu->owner == next)
+        clear_ts();
+    else
+        set_ts();
+}
+
+void fpu_release(struct fpu_state* state)
+{
+    struct fpu_cpu* cpu = &fpu_cpus[this_cpu()->id];
+    if (cpu->owner == state)
+        cpu->owner = NULL;
+}
+
+uint32_t fpu_begin()
+{
+    uintptr_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+
+    struct fpu_cpu* cpu = &fpu_cpus[this_cpu()->id];
+    if (cpu->claims++ == 0) {
+        clear_ts();
+        if (cpu->owner != NULL)
+            fpu_save(cpu->owner);
+        cpu->owner = NULL;
+    }
+    return flags;
+}
+
+void fpu_end(uint32_t flags)
+{
+    struct fpu_cpu* cpu = &fpu_cpus[this_cpu()->id];
+    // the registers hold nobody's state now, the next thread to use them
+    // traps and loads its own
+    if (--cpu->claims == 0)
+        set_ts();
+    if (flags & EFLAGS_IF)
+        asm volatile("sti");
+}
@@ -0,0 +1,52 @@
+#ifndef _KERNEL_FPU_H_
+#define _KERNEL_FPU_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Room for the XSAVE image of x87, SSE and AVX state (832 bytes). CPUs
+ * without XSAVE use the 512 byte FXSAVE image, or the smaller FNSAVE
+ * one without FXSR. */
+#define FPU_STATE_SIZE 1024
+
+/* What fpu_init() found and enabled */
+#define FPU_SSE2 (1 << 0)
+#define FPU_XSAVE (1 << 1)
+#define FPU_AVX (1 << 2)
+
+struct fpu_state {
+    uint8_t data[FPU_STATE_SIZE];
+} __attribute__((aligned(64)));
+
+/* Enable the x87 FPU and whatever of SSE2, XSAVE and AVX the CPU has on
+ * the calling CPU. Every CPU needs to call it. Returns whether SSE2 is
+ * usable. */
+bool fpu_init();
+/* FPU_* bits, the same on every CPU */
+uint32_t fpu_features();
+
+/* The FPU and SSE registers of the calling CPU. FNSAVE reinitializes the
+ * FPU, the state is only good for fpu_restore() afterwards. */
+void fpu_save(struct fpu_state* state);
+void fpu_restore(struct fpu_state* state);
+
+/* Threads switch lazily: the registers stay loaded on a switch and CR0.TS
+ * is set, the first FPU instruction of another thread traps (#NM) and
+ * only then are they saved and the new thread's loaded. The scheduler
+ * calls fpu_switch() with interrupts off and the state of the thread it
+ * switches to. */
+void fpu_switch(struct fpu_state* next);
+/* Forgets `state` if the calling CPU's registers hold it, for a thread
+ * that exits */
+void fpu_release(struct fpu_state* state);
+
+/* Claims the registers for kernel code, in threads and interrupt handlers
+ * alike. Whatever thread state they hold is saved first. Interrupts are
+ * off until fpu_end() with what fpu_begin() returned:
+ *     uint32_t flags = fpu_begin();
+ *     ... SSE or AVX instructions ...
+ *     fpu_end(flags); */
+uint32_t fpu_begin();
+void fpu_end(uint32_t flags);
+
+#endif
@@ -0,0 +1,105 @@
+#include "gdt.h"
+#include "smp.h"
+
+/* Flat 4 GiB segments. The long mode code segments have the L bit set
+ * instead of D, their base and limit are ignored. */
+#ifdef __x86_64__
+#define KERNEL_CODE 0x00af9a000000ffffull
+#define USER_CODE 0x00affa000000ffffull
+#else
+#define KERNEL_CODE 0x00cf9a000000ffffull
+#define USER_CODE 0x00cffa000000ffffull
+#endif
+#define KERNEL_DATA 0x00cf92000000ffffull
+#define USER_DATA 0x00cff2000000ffffull
+
+/* Present, DPL 0, available TSS */
+#define TSS_TYPE 0x89ull
+
+/* A TSS per CPU after the segments, in long mode its descriptor takes two
+ * entries */
+#define FIRST_TSS 5
+#ifdef __x86_64__
+#define TSS_ENTRIES 2
+#else
+#define TSS_ENTRIES 1
+#endif
+#define GDT_ENTRIES (FIRST_TSS + SMP_MAX_CPUS * TSS_ENTRIES)
+
+/* Only the kernel stack is used, there is no hardware task switching. The
+ * offsets of esp0/rsp0 and rsp2 are known to cpu/syscall.asm. */
+#ifdef __x86_64__
+struct tss {
+    uint32_t reserved0;
+    uint64_t rsp0;
+    uint64_t rsp1;
+    /* Ring 2 is never used, the SYSCALL entry keeps the user rsp here */
+    uint64_t rsp2;
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed));
+#else
+struct tss {
+    uint32_t link;
+    uint32_t esp0;
+    uint32_t ss0;
+    /* esp1 up to the LDT selector, the state of a hardware task switch */
+    uint32_t unused[22];
+    uint16_t trap;
+    uint16_t iomap_base;
+};
+#endif
+
+struct gdt_register {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed));
+
+#ifdef __x86_64__
+static uint64_t gdt[GDT_ENTRIES] = { 0, KERNEL_CODE, KERNEL_DATA, USER_DATA, USER_CODE };
+#else
+static uint64_t gdt[GDT_ENTRIES] = { 0, KERNEL_CODE, KERNEL_DATA, USER_CODE, USER_DATA };
+#endif
+static struct tss tss[SMP_MAX_CPUS];
+
+void gdt_init()
+{
+    int cpu = this_cpu()->id;
+    struct tss* task = &tss[cpu];
+    // past the end, there is no IO permission bitmap
+    task->iomap_base = sizeof(struct tss);
+#ifndef __x86_64__
+    task->ss0 = KERNEL_DS;
+#endif
+
+    uintptr_t base = (uintptr_t)task;
+    int idx = FIRST_TSS + cpu * TSS_ENTRIES;
+    gdt[idx] = (sizeof(struct tss) - 1) | (uint64_t)(base & 0xffffff) << 16 | TSS_TYPE << 40
+        | (uint64_t)((base >> 24) & 0xff) << 56;
+#ifdef __x86_64__
+    gdt[idx + 1] = base >> 32;
+#endif
+
+    // the kernel selectors mean what they did, the segment registers can
+    // stay loaded
+    struct gdt_register reg = { sizeof(gdt) - 1, (uintptr_t)gdt };
+    asm volatile("lgdt %0" : : "m"(reg));
+    asm volatile("ltr %w0" : : "r"(idx * 8));
+}
+
+void tss_set_kernel_stack(int cpu, uintptr_t sp)
+{
+#ifdef __x86_64__
+    tss[cpu].rsp0 = sp;
+#else
+    tss[cpu].esp0 = sp;
+#endif
+}
+
+uintptr_t tss_address(int cpu)
+{
+    return (uintptr_t)&tss[cpu];
+}
@@ -0,0 +1,30 @@
+#ifndef _KERNEL_GDT_H_
+#define _KERNEL_GDT_H_
+
+#include <stdint.h>
+
+/* Segment selectors. The kernel ones are those boot/gdt.asm and the long
+ * mode boot GDT use too. SYSEXIT takes the user segments from fixed
+ * offsets after the kernel code segment, SYSRET from after the kernel
+ * data segment and in the other order, hence the two layouts. */
+#define KERNEL_CS 0x08
+#define KERNEL_DS 0x10
+#ifdef __x86_64__
+#define USER_DS 0x1b
+#define USER_CS 0x23
+#else
+#define USER_CS 0x1b
+#define USER_DS 0x23
+#endif
+
+/* Loads the GDT with the user segments and the calling CPU's TSS. Every
+ * CPU needs to call it before running user code. */
+void gdt_init();
+
+/* Where interrupts and system calls from user mode start on `cpu`, the
+ * top of the running thread's stack */
+void tss_set_kernel_stack(int cpu, uintptr_t sp);
+/* The TSS of `cpu`, the system call entry finds the kernel stack in it */
+uintptr_t tss_address(int cpu);
+
+#endif
@@ -6,18 +6,28 @@
 idt_gate_t idt[IDT_ENTRIES];
 idt_register_t idt_reg;
 
-void set_idt_gate(int n, uint32_t handler)
+void set_idt_gate(int n, uintptr_t handler)
 {
     idt[n].low_offset = low_16(handler);
     idt[n].sel = KERNEL_CS;
     idt[n].always0 = 0;
     idt[n].flags = 0x8E;
     idt[n].high_offset = high_16(handler);
+#ifdef __x86_64__
+    idt[n].upper_offset = handler >> 32;
+    idt[n].reserved = 0;
+#endif
+}
+
+void set_idt_user_gate(int n, uintptr_t handler)
+{
+    set_idt_gate(n, handler);
+    idt[n].flags = 0xEE; // DPL 3
 }
 
 void load_idt()
 {
-    idt_reg.base = (uint32_t)&idt;
+    idt_reg.base = (uintptr_t)&idt;
     idt_reg.limit = IDT_ENTRIES * sizeof(idt_gate_t) - 1;
     /* Don't make the mistake of loading &idt -- always load &idt_reg */
     asm volatile("lidt (%0)" : : "r"(&idt_reg));
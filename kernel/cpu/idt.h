@@ -3,8 +3,7 @@
 
 #include <stdint.h>
 
-/* Segment selectors */
-#define KERNEL_CS 0x08
+#include "gdt.h"
 
 /* How every interrupt gate (handler) is defined */
 typedef struct {
@@ -15,21 +14,28 @@ typedef struct {
      * Bit 7: "Interrupt is present"
      * Bits 6-5: Privilege level of caller (0=kernel..3=user)
      * Bit 4: Set to 0 for interrupt gates
-     * Bits 3-0: bits 1110 = decimal 14 = "32 bit interrupt gate" */
+     * Bits 3-0: bits 1110 = decimal 14 = "32 bit interrupt gate", a 64 bit
+     * one in long mode */
     uint8_t flags;
     uint16_t high_offset; /* Higher 16 bits of handler function address */
+#ifdef __x86_64__
+    uint32_t upper_offset; /* Bits 32-63 of the handler address */
+    uint32_t reserved;
+#endif
 } __attribute__((packed)) idt_gate_t;
 
 /* A pointer to the array of interrupt handlers.
  * Assembly instruction 'lidt' will read it */
 typedef struct {
     uint16_t limit;
-    uint32_t base;
+    uintptr_t base;
 } __attribute__((packed)) idt_register_t;
 
 #define IDT_ENTRIES 256
 
-void set_idt_gate(int n, uint32_t handler);
+void set_idt_gate(int n, uintptr_t handler);
+/* The same, but user mode can raise it with an int instruction */
+void set_idt_user_gate(int n, uintptr_t handler);
 
 void load_idt();
 
@@ -2,6 +2,92 @@
 [extern isr_handler]
 [extern irq_handler]
 
+%ifdef __x86_64__
+[bits 64]
+; In long mode the processor always pushes ss, rsp, rflags, cs and rip,
+; and aligns the stack to 16 bytes first. There is no pusha, the
+; registers are pushed one by one in the order of registers_t in isr.h.
+; Data segments aren't used and stay as they are. User mode may have left
+; the direction flag set, the kernel expects it clear.
+isr_common_stub:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    cld
+
+    mov rdi, rsp ; registers_t *r, the stack is 16 byte aligned again
+    call isr_handler
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16 ; the error code and the interrupt number
+    iretq
+
+irq_common_stub:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    cld
+
+    mov rdi, rsp
+    call irq_handler
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16
+    iretq
+
+%else
 ; Common ISR code
 isr_common_stub:
     ; 1. Save CPU state
@@ -13,6 +99,7 @@ isr_common_stub:
 	mov es, ax
 	mov fs, ax
 	mov gs, ax
+	cld ; user mode may have set it
 
     ; 2. Call C handler
     push esp ; push registers_t *r pointer
@@ -41,6 +128,7 @@ irq_common_stub:
     mov es, ax
     mov fs, ax
     mov gs, ax
+    cld
 
     ; 2. Call C handler
     push esp
@@ -57,6 +145,8 @@ irq_common_stub:
     add esp, 8
     iret
 
+%endif
+
 ; We don't get information about which interrupt was caller
 ; when the handler is run, so we will need to have a different handler
 ; for every interrupt.
@@ -382,3 +472,34 @@ irq15:
 	push byte 15
 	push byte 47
 	jmp irq_common_stub
+
+; Local APIC interrupts, the vectors match cpu/apic.h
+global lapic_timer_irq
+global lapic_call_irq
+global lapic_spurious_irq
+
+lapic_timer_irq:
+	push byte 0
+	push byte 48
+	jmp irq_common_stub
+
+lapic_call_irq:
+	push byte 0
+	push byte 49
+	jmp irq_common_stub
+
+; Only counted, spurious interrupts don't get an EOI. The vector doesn't
+; fit a sign extended byte, it's pushed as a word.
+lapic_spurious_irq:
+	push byte 0
+	push 255
+	jmp irq_common_stub
+
+; int 0x80, the system call path for CPUs without the fast one. Handled
+; like an exception, see task/syscall.c
+global syscall_irq
+
+syscall_irq:
+	push byte 0
+	push 128
+	jmp isr_common_stub
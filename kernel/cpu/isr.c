@@ -1,46 +1,58 @@
+#include <stddef.h>
+
 #include "isr.h"
+#include "../kernel/printk.h"
+#include "../kernel/trace.h"
 #include "../kernel/util.h"
-#include "../kernel/vga.h"
+#include "../task/sched.h"
+#include "../task/user.h"
+#include "apic.h"
+#include "atomic.h"
 #include "idt.h"
+#include "smp.h"
 
-isr_t interrupt_handlers[256];
+/* Registered while other CPUs may take interrupts, read once per interrupt */
+static isr_t interrupt_handlers[256];
+static char* interrupt_names[ISR_COUNTED_VECTORS];
+static bool apic_mode = false;
+static struct irq_stats stats[SMP_MAX_CPUS];
 
 /* Can't do this with a loop because we need the address
  * of the function names */
 void isr_install()
 {
-    set_idt_gate(0, (uint32_t)isr0);
-    set_idt_gate(1, (uint32_t)isr1);
-    set_idt_gate(2, (uint32_t)isr2);
-    set_idt_gate(3, (uint32_t)isr3);
-    set_idt_gate(4, (uint32_t)isr4);
-    set_idt_gate(5, (uint32_t)isr5);
-    set_idt_gate(6, (uint32_t)isr6);
-    set_idt_gate(7, (uint32_t)isr7);
-    set_idt_gate(8, (uint32_t)isr8);
-    set_idt_gate(9, (uint32_t)isr9);
-    set_idt_gate(10, (uint32_t)isr10);
-    set_idt_gate(11, (uint32_t)isr11);
-    set_idt_gate(12, (uint32_t)isr12);
-    set_idt_gate(13, (uint32_t)isr13);
-    set_idt_gate(14, (uint32_t)isr14);
-    set_idt_gate(15, (uint32_t)isr15);
-    set_idt_gate(16, (uint32_t)isr16);
-    set_idt_gate(17, (uint32_t)isr17);
-    set_idt_gate(18, (uint32_t)isr18);
-    set_idt_gate(19, (uint32_t)isr19);
-    set_idt_gate(20, (uint32_t)isr20);
-    set_idt_gate(21, (uint32_t)isr21);
-    set_idt_gate(22, (uint32_t)isr22);
-    set_idt_gate(23, (uint32_t)isr23);
-    set_idt_gate(24, (uint32_t)isr24);
-    set_idt_gate(25, (uint32_t)isr25);
-    set_idt_gate(26, (uint32_t)isr26);
-    set_idt_gate(27, (uint32_t)isr27);
-    set_idt_gate(28, (uint32_t)isr28);
-    set_idt_gate(29, (uint32_t)isr29);
-    set_idt_gate(30, (uint32_t)isr30);
-    set_idt_gate(31, (uint32_t)isr31);
+    set_idt_gate(0, (uintptr_t)isr0);
+    set_idt_gate(1, (uintptr_t)isr1);
+    set_idt_gate(2, (uintptr_t)isr2);
+    set_idt_gate(3, (uintptr_t)isr3);
+    set_idt_gate(4, (uintptr_t)isr4);
+    set_idt_gate(5, (uintptr_t)isr5);
+    set_idt_gate(6, (uintptr_t)isr6);
+    set_idt_gate(7, (uintptr_t)isr7);
+    set_idt_gate(8, (uintptr_t)isr8);
+    set_idt_gate(9, (uintptr_t)isr9);
+    set_idt_gate(10, (uintptr_t)isr10);
+    set_idt_gate(11, (uintptr_t)isr11);
+    set_idt_gate(12, (uintptr_t)isr12);
+    set_idt_gate(13, (uintptr_t)isr13);
+    set_idt_gate(14, (uintptr_t)isr14);
+    set_idt_gate(15, (uintptr_t)isr15);
+    set_idt_gate(16, (uintptr_t)isr16);
+    set_idt_gate(17, (uintptr_t)isr17);
+    set_idt_gate(18, (uintptr_t)isr18);
+    set_idt_gate(19, (uintptr_t)isr19);
+    set_idt_gate(20, (uintptr_t)isr20);
+    set_idt_gate(21, (uintptr_t)isr21);
+    set_idt_gate(22, (uintptr_t)isr22);
+    set_idt_gate(23, (uintptr_t)isr23);
+    set_idt_gate(24, (uintptr_t)isr24);
+    set_idt_gate(25, (uintptr_t)isr25);
+    set_idt_gate(26, (uintptr_t)isr26);
+    set_idt_gate(27, (uintptr_t)isr27);
+    set_idt_gate(28, (uintptr_t)isr28);
+    set_idt_gate(29, (uintptr_t)isr29);
+    set_idt_gate(30, (uintptr_t)isr30);
+    set_idt_gate(31, (uintptr_t)isr31);
 
     // Remap the PIC
     port_byte_out(0x20, 0x11);
@@ -55,22 +67,26 @@ void isr_install()
     port_byte_out(0xA1, 0x0);
 
     // Install the IRQs
-    set_idt_gate(32, (uint32_t)irq0);
-    set_idt_gate(33, (uint32_t)irq1);
-    set_idt_gate(34, (uint32_t)irq2);
-    set_idt_gate(35, (uint32_t)irq3);
-    set_idt_gate(36, (uint32_t)irq4);
-    set_idt_gate(37, (uint32_t)irq5);
-    set_idt_gate(38, (uint32_t)irq6);
-    set_idt_gate(39, (uint32_t)irq7);
-    set_idt_gate(40, (uint32_t)irq8);
-    set_idt_gate(41, (uint32_t)irq9);
-    set_idt_gate(42, (uint32_t)irq10);
-    set_idt_gate(43, (uint32_t)irq11);
-    set_idt_gate(44, (uint32_t)irq12);
-    set_idt_gate(45, (uint32_t)irq13);
-    set_idt_gate(46, (uint32_t)irq14);
-    set_idt_gate(47, (uint32_t)irq15);
+    set_idt_gate(32, (uintptr_t)irq0);
+    set_idt_gate(33, (uintptr_t)irq1);
+    set_idt_gate(34, (uintptr_t)irq2);
+    set_idt_gate(35, (uintptr_t)irq3);
+    set_idt_gate(36, (uintptr_t)irq4);
+    set_idt_gate(37, (uintptr_t)irq5);
+    set_idt_gate(38, (uintptr_t)irq6);
+    set_idt_gate(39, (uintptr_t)irq7);
+    set_idt_gate(40, (uintptr_t)irq8);
+    set_idt_gate(41, (uintptr_t)irq9);
+    set_idt_gate(42, (uintptr_t)irq10);
+    set_idt_gate(43, (uintptr_t)irq11);
+    set_idt_gate(44, (uintptr_t)irq12);
+    set_idt_gate(45, (uintptr_t)irq13);
+    set_idt_gate(46, (uintptr_t)irq14);
+    set_idt_gate(47, (uintptr_t)irq15);
+
+    set_idt_gate(LAPIC_TIMER_VECTOR, (uintptr_t)lapic_timer_irq);
+    set_idt_gate(LAPIC_CALL_VECTOR, (uintptr_t)lapic_call_irq);
+    set_idt_gate(LAPIC_SPURIOUS_VECTOR, (uintptr_t)lapic_spurious_irq);
 
     load_idt(); // Load with ASM
 }
@@ -116,31 +132,155 @@ char* exception_messages[] = {
 
 void isr_handler(registers_t* r)
 {
-    print_string("received interrupt: ");
-    char s[3];
-    int_to_string(r->int_no, s);
-    print_string(s);
-    print_nl();
-    print_string(exception_messages[r->int_no]);
-    print_nl();
+    // int 0x80 system calls come here too, they aren't counted
+    if (r->int_no < ISR_COUNTED_VECTORS)
+        stats[this_cpu()->id].count[r->int_no]++;
+
+    // exceptions the kernel knows how to handle, like page faults
+    isr_t handler = atomic_read(&interrupt_handlers[r->int_no]);
+    if (handler != 0) {
+        handler(r);
+        return;
+    }
+
+    printk(LOG_ERR, "received interrupt: %u", (uint32_t)r->int_no);
+    printk(LOG_ERR, "%s, error code 0x%08x at %p", exception_messages[r->int_no], (uint32_t)r->err_code,
+        (void*)REGISTERS_IP(r));
+
+    // NMIs and the debug traps resume after the instruction, returning
+    // from a fault would only run into it again
+    if (r->int_no >= 1 && r->int_no <= 4)
+        return;
+    if (REGISTERS_USER(r))
+        user_kill();
+    printk(LOG_ERR, "CPU halted");
+    asm volatile("cli");
+    while (1)
+        asm volatile("hlt");
+}
+
+void isr_use_apic()
+{
+    port_byte_out(0x21, 0xff);
+    port_byte_out(0xA1, 0xff);
+    apic_mode = true;
 }
 
 void register_interrupt_handler(uint8_t n, isr_t handler)
 {
-    interrupt_handlers[n] = handler;
+    atomic_write(&interrupt_handlers[n], handler);
+}
+
+void set_interrupt_name(uint8_t n, char* name)
+{
+    if (n < ISR_COUNTED_VECTORS)
+        interrupt_names[n] = name;
+}
+
+char* interrupt_name(uint8_t n)
+{
+    if (n < IRQ0)
+        return exception_messages[n];
+    return n < ISR_COUNTED_VECTORS ? interrupt_names[n] : NULL;
+}
+
+/* A PIC raises its lowest priority IRQ when the line dropped before the
+ * CPU took the interrupt, without setting the in-service bit */
+static bool pic_spurious(uint8_t vector)
+{
+    if (vector == IRQ7) {
+        port_byte_out(0x20, 0x0B); /* read the ISR */
+        return !(port_byte_in(0x20) & 0x80);
+    }
+    if (vector == IRQ15) {
+        port_byte_out(0xA0, 0x0B);
+        if (port_byte_in(0xA0) & 0x80)
+            return false;
+        // the leader did take the cascade IRQ from the follower
+        port_byte_out(0x20, 0x20);
+        return true;
+    }
+    return false;
 }
 
 void irq_handler(registers_t* r)
 {
+    uint64_t start = rdtsc();
+    struct irq_stats* cpu_stats = &stats[this_cpu()->id];
+
+    if (r->int_no == LAPIC_SPURIOUS_VECTOR || (!apic_mode && pic_spurious(r->int_no))) {
+        cpu_stats->spurious++;
+        return;
+    }
+    cpu_stats->count[r->int_no]++;
+    trace(TRACE_IRQ_ENTER, r->int_no, 0);
+
+    int irq = r->int_no - IRQ0;
+    uint32_t raised = __atomic_exchange_n(&cpu_stats->raised[irq], 0, __ATOMIC_RELAXED);
+    // a timer reprogrammed with its old interrupt pending looks early
+    int32_t latency = (uint32_t)start - raised;
+    if (raised != 0 && latency >= 0)
+        histogram_record(&cpu_stats->latency[irq], latency);
+
     /* Handle the interrupt in a more modular way */
-    if (interrupt_handlers[r->int_no] != 0) {
-        isr_t handler = interrupt_handlers[r->int_no];
+    isr_t handler = atomic_read(&interrupt_handlers[r->int_no]);
+    if (handler != 0)
         handler(r);
-    }
+    histogram_record(&cpu_stats->handler[irq], (uint32_t)(rdtsc() - start));
 
     // EOI
-    if (r->int_no >= 40) {
-        port_byte_out(0xA0, 0x20); /* follower */
+    if (apic_mode || r->int_no >= LAPIC_TIMER_VECTOR) {
+        lapic_eoi();
+    } else {
+        if (r->int_no >= 40) {
+            port_byte_out(0xA0, 0x20); /* follower */
+        }
+        port_byte_out(0x20, 0x20); /* leader */
     }
-    port_byte_out(0x20, 0x20); /* leader */
+    histogram_record(&cpu_stats->irq_off, (uint32_t)(rdtsc() - start));
+    trace(TRACE_IRQ_EXIT, r->int_no, 0);
+
+    // acknowledged first, the thread switched to may run for a while
+    sched_preempt();
+}
+
+const struct irq_stats* isr_stats(int cpu)
+{
+    return &stats[cpu];
+}
+
+const struct histogram* isr_irq_off(int cpu)
+{
+    return &stats[cpu].irq_off;
+}
+
+/* An interrupt racing with this may leave a stray count behind */
+void isr_reset_stats()
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        for (int irq = 0; irq < ISR_TIMED_VECTORS; irq++) {
+            histogram_reset(&stats[cpu].handler[irq]);
+            histogram_reset(&stats[cpu].latency[irq]);
+        }
+        histogram_reset(&stats[cpu].irq_off);
+    }
+}
+
+/* 0 means no raise time, the odd cycle off doesn't matter */
+static uint32_t raise_time(uint64_t tsc)
+{
+    return (uint32_t)tsc | 1;
+}
+
+void isr_expect(uint8_t vector, uint64_t tsc)
+{
+    uint32_t raised = tsc == 0 ? 0 : raise_time(tsc);
+    __atomic_store_n(&stats[this_cpu()->id].raised[vector - IRQ0], raised, __ATOMIC_RELAXED);
+}
+
+void isr_ipi_sent(int cpu, uint8_t vector)
+{
+    uint32_t none = 0;
+    __atomic_compare_exchange_n(&stats[cpu].raised[vector - IRQ0], &none, raise_time(rdtsc()),
+        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
 }
@@ -3,6 +3,9 @@
 
 #include <stdint.h>
 
+#include "../kernel/histogram.h"
+#include "apic.h"
+
 /* ISRs reserved for CPU exceptions */
 extern void isr0();
 extern void isr1();
@@ -55,6 +58,12 @@ extern void irq13();
 extern void irq14();
 extern void irq15();
 
+/* Local APIC */
+extern void lapic_timer_irq();
+extern void lapic_call_irq();
+extern void lapic_spurious_irq();
+extern void syscall_irq();
+
 #define IRQ0 32
 #define IRQ1 33
 #define IRQ2 34
@@ -78,20 +87,74 @@ extern void irq15();
  * - `push byte`s on the isr-specific code: error code, then int number
  * - All the registers by pusha
  * - `push eax` whose lower 16-bits contain DS
+ * In long mode there is no pusha and no DS, the stubs push the registers
+ * one by one and the processor always pushes SS and RSP.
  */
+#ifdef __x86_64__
+typedef struct {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t int_no, err_code;
+    uint64_t rip, cs, rflags, rsp, ss;
+} registers_t;
+#define REGISTERS_IP(r) ((r)->rip)
+#else
 typedef struct {
     uint32_t ds; /* Data segment selector */
     uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax; /* Pushed by pusha. */
     uint32_t int_no, err_code; /* Interrupt number and error code (if applicable) */
     uint32_t eip, cs, eflags, useresp, ss; /* Pushed by the processor automatically */
 } registers_t;
+#define REGISTERS_IP(r) ((r)->eip)
+#endif
+/* Whether the interrupt came from user mode */
+#define REGISTERS_USER(r) (((r)->cs & 3) == 3)
 
 void isr_install();
+/* Mask the PIC, interrupts come through the IO APIC and local APIC from now on */
+void isr_use_apic();
 
 void isr_handler(registers_t* r);
 
 typedef void (*isr_t)(registers_t*);
 
 void register_interrupt_handler(uint8_t n, isr_t handler);
+/* What the INTERRUPTS command shows next to an IRQ or local APIC vector */
+void set_interrupt_name(uint8_t n, char* name);
+/* Exception message, the name set above or NULL */
+char* interrupt_name(uint8_t n);
+
+/* Vectors up to the call IPI are counted, the IRQs among them timed */
+#define ISR_COUNTED_VECTORS (LAPIC_CALL_VECTOR + 1)
+#define ISR_TIMED_VECTORS (ISR_COUNTED_VECTORS - IRQ0)
+
+/* Written by the interrupts of one CPU, in cycles. Entry latency is only
+ * known when the raise time was, see isr_expect() and isr_ipi_sent(). */
+struct irq_stats {
+    uint32_t count[ISR_COUNTED_VECTORS];
+    /* PIC IRQ7 and IRQ15 without their in-service bit, and the local APIC
+     * spurious vector */
+    uint32_t spurious;
+    /* Entry to the return of the handler, per vector from IRQ0 */
+    struct histogram handler[ISR_TIMED_VECTORS];
+    struct histogram latency[ISR_TIMED_VECTORS];
+    /* Entry to the EOI, over all vectors */
+    struct histogram irq_off;
+    /* Low half of the TSC the pending interrupt was raised at, 0 for none */
+    uint32_t raised[ISR_TIMED_VECTORS];
+};
+
+const struct irq_stats* isr_stats(int cpu);
+/* Cycles `cpu` spent in IRQ handlers up to the EOI, with interrupts off */
+const struct histogram* isr_irq_off(int cpu);
+/* The histograms only, counts keep going like in /proc/interrupts */
+void isr_reset_stats();
+
+/* The next `vector` interrupt of the calling CPU is due at `tsc`, 0 if
+ * it isn't coming. For the timer, which knows its deadline. */
+void isr_expect(uint8_t vector, uint64_t tsc);
+/* Called right before sending `vector` to `cpu`. An IPI still in flight
+ * keeps its earlier time, the two end up as one interrupt. */
+void isr_ipi_sent(int cpu, uint8_t vector);
 
 #endif
@@ -0,0 +1,278 @@
+#include "kvmclock.h"
+#include "../kernel/util.h"
+#include "atomic.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define KVM_CPUID_SIGNATURE 0x40000000
+#define KVM_CPUID_FEATURES 0x40000001
+/* "KVMKVMKVM\0\0\0" */
+#define KVM_SIGNATURE_EBX 0x4b4d564b
+#define KVM_SIGNATURE_ECX 0x564b4d56
+#define KVM_SIGNATURE_EDX 0x4d
+#define KVM_FEATURE_CLOCKSOURCE2 (1 << 3)
+#define KVM_FEATURE_CLOCKSOURCE_STABLE_BIT (1 << 24)
+
+#define CPUID_EXT_MAX 0x80000000
+#define CPUID_EXT_FEATURES 0x80000001
+#define CPUID_EDX_RDTSCP (1 << 27)
+/* The start of AuthenticAMD and HygonGenuine, their hypercall is vmmcall */
+#define CPUID_AMD_EBX 0x68747541
+#define CPUID_HYGON_EBX 0x6f677948
+
+#define MSR_KVM_WALL_CLOCK_NEW 0x4b564d00
+#define MSR_KVM_SYSTEM_TIME_NEW 0x4b564d01
+#define MSR_TSC_AUX 0xc0000103
+#define SYSTEM_TIME_ENABLE 1
+
+/* In the flags of every CPU's structure when they all tick together */
+#define PVCLOCK_TSC_STABLE_BIT (1 << 0)
+
+#define KVM_HC_CLOCK_PAIRING 9
+#define KVM_CLOCK_PAIRING_WALLCLOCK 0
+
+/* Written by the host, the version is odd while it writes, like the
+ * sequence number of a seqlock */
+struct pvclock_time_info {
+    uint32_t version;
+    uint32_t pad0;
+    uint64_t tsc_timestamp;
+    uint64_t system_time;
+    /* Cycles to nanoseconds as a 32 bit fraction, after the shift */
+    uint32_t tsc_to_system_mul;
+    int8_t tsc_shift;
+    uint8_t flags;
+    uint8_t pad[2];
+};
+
+/* The wall clock time kvmclock counts from */
+struct pvclock_wall_clock {
+    uint32_t version;
+    uint32_t sec;
+    uint32_t nsec;
+};
+
+struct kvm_clock_pairing {
+    int64_t sec;
+    int64_t nsec;
+    uint64_t tsc;
+    uint32_t flags;
+    uint32_t pad[9];
+};
+
+/* Handed to the host by physical address, the kernel is identity mapped.
+ * A structure must not cross a page, 32 bytes aligned to 32 never do. */
+static struct pvclock_time_info clocks[SMP_MAX_CPUS] __attribute__((aligned(32)));
+static struct pvclock_wall_clock wall_clock;
+static struct kvm_clock_pairing pairing;
+static struct spinlock pairing_lock;
+
+static bool enabled = false;
+static bool stable_bit = false;
+static bool has_rdtscp = false;
+static bool amd = false;
+/* kvmclock at kvmclock_init() and the wall clock at kvmclock 0 */
+static uint64_t base_ns;
+static uint64_t boot_wall_ns;
+/* Latest time handed out while the CPUs' clocks may differ */
+static uint64_t last_ns;
+
+static void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* atomic_cmpxchg() for 64 bits, which i386 has no builtin for. Starting
+ * from a guessed *old, a failed swap fetches the value. */
+static bool cmpxchg64(uint64_t* ptr, uint64_t* old, uint64_t new)
+{
+#ifdef __x86_64__
+    return atomic_cmpxchg(ptr, old, new);
+#else
+    uint32_t low = (uint32_t)*old;
+    uint32_t high = (uint32_t)(*old >> 32);
+    bool swapped;
+    asm volatile("lock cmpxchg8b %1; sete %0"
+                 : "=q"(swapped), "+m"(*ptr), "+a"(low), "+d"(high)
+                 : "b"((uint32_t)new), "c"((uint32_t)(new >> 32))
+                 : "memory", "cc");
+    *old = ((uint64_t)high << 32) | low;
+    return swapped;
+#endif
+}
+
+/* The fence keeps rdtsc after the version load before it */
+static uint64_t rdtsc_ordered()
+{
+    uint32_t low, high;
+    asm volatile("lfence; rdtsc" : "=a"(low), "=d"(high) : : "memory");
+    return ((uint64_t)high << 32) | low;
+}
+
+/* (delta << shift) * mul / 2^32, in halves on 32 bit like tsc.c does */
+static uint64_t scale_delta(uint64_t delta, uint32_t mul, int8_t shift)
+{
+    if (shift < 0)
+        delta >>= -shift;
+    else
+        delta <<= shift;
+#ifdef __x86_64__
+    return (uint64_t)((unsigned __int128)delta * mul >> 32);
+#else
+    return ((uint64_t)(uint32_t)delta * mul >> 32) + (uint64_t)(uint32_t)(delta >> 32) * mul;
+#endif
+}
+
+/* Nanoseconds since the VM started, and the flags that went with them */
+static uint64_t read_clock(struct pvclock_time_info* info, uint8_t* flags)
+{
+    uint32_t version;
+    uint64_t ns;
+    do {
+        version = atomic_read(&info->version);
+        ns = info->system_time
+            + scale_delta(rdtsc_ordered() - info->tsc_timestamp, info->tsc_to_system_mul, info->tsc_shift);
+        *flags = info->flags;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((version & 1) || version != __atomic_load_n(&info->version, __ATOMIC_RELAXED));
+    return ns;
+}
+
+/* The calling CPU's structure. rdtscp reads the CPU from TSC_AUX, cheaper
+ * than this_cpu() and its LAPIC read. A CPU not registered yet reads the
+ * boot CPU's. */
+static struct pvclock_time_info* cpu_clock()
+{
+    uint32_t cpu = 0;
+    if (has_rdtscp)
+        asm volatile("rdtscp" : "=c"(cpu) : : "eax", "edx");
+    else if (cpu_count > 0)
+        cpu = this_cpu()->id;
+    if (cpu >= SMP_MAX_CPUS || clocks[cpu].tsc_to_system_mul == 0)
+        cpu = 0;
+    return &clocks[cpu];
+}
+
+bool kvmclock_init()
+{
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(KVM_CPUID_SIGNATURE, &eax, &ebx, &ecx, &edx);
+    if (ebx != KVM_SIGNATURE_EBX || ecx != KVM_SIGNATURE_ECX || edx != KVM_SIGNATURE_EDX
+        || eax < KVM_CPUID_FEATURES)
+        return false;
+    cpuid(KVM_CPUID_FEATURES, &eax, &ebx, &ecx, &edx);
+    if (!(eax & KVM_FEATURE_CLOCKSOURCE2))
+        return false;
+    stable_bit = eax & KVM_FEATURE_CLOCKSOURCE_STABLE_BIT;
+
+    cpuid(0, &eax, &ebx, &ecx, &edx);
+    amd = ebx == CPUID_AMD_EBX || ebx == CPUID_HYGON_EBX;
+    cpuid(CPUID_EXT_MAX, &eax, &ebx, &ecx, &edx);
+    if (eax >= CPUID_EXT_FEATURES) {
+        cpuid(CPUID_EXT_FEATURES, &eax, &ebx, &ecx, &edx);
+        has_rdtscp = edx & CPUID_EDX_RDTSCP;
+    }
+
+    enabled = true;
+    kvmclock_init_cpu();
+
+    // an exit, the host writes the structure once for it
+    wrmsr(MSR_KVM_WALL_CLOCK_NEW, (uintptr_t)&wall_clock);
+    uint32_t version;
+    do {
+        version = atomic_read(&wall_clock.version);
+        boot_wall_ns = wall_clock.sec * NSEC_PER_SEC + wall_clock.nsec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((version & 1) || version != __atomic_load_n(&wall_clock.version, __ATOMIC_RELAXED));
+
+    uint8_t flags;
+    base_ns = read_clock(&clocks[0], &flags);
+    last_ns = base_ns;
+    return true;
+}
+
+void kvmclock_init_cpu()
+{
+    if (!enabled)
+        return;
+    int cpu = this_cpu()->id;
+    wrmsr(MSR_KVM_SYSTEM_TIME_NEW, (uintptr_t)&clocks[cpu] | SYSTEM_TIME_ENABLE);
+    if (has_rdtscp)
+        wrmsr(MSR_TSC_AUX, cpu);
+}
+
+bool kvmclock_enabled()
+{
+    return enabled;
+}
+
+bool kvmclock_stable()
+{
+    return stable_bit && (atomic_read(&clocks[0].flags) & PVCLOCK_TSC_STABLE_BIT);
+}
+
+uint64_t kvmclock_ns()
+{
+    uint8_t flags;
+    if (kvmclock_stable()) {
+        // every CPU's structure says the same then, the shared one stays
+        // in every cache
+        uint64_t ns = read_clock(&clocks[0], &flags);
+        if (flags & PVCLOCK_TSC_STABLE_BIT)
+            return ns - base_ns;
+    }
+
+    // each CPU's clock is a little off the others, a time older than one
+    // already handed out never is
+    uint64_t ns = read_clock(cpu_clock(), &flags);
+    uint64_t last = base_ns;
+    while (!cmpxchg64(&last_ns, &last, ns)) {
+        if (ns <= last)
+            return last - base_ns;
+    }
+    return ns - base_ns;
+}
+
+uint32_t kvmclock_tsc_khz()
+{
+    if (!enabled)
+        return 0;
+    struct pvclock_time_info* info = &clocks[0];
+    uint64_t khz = div_u64(1000000ull << 32, info->tsc_to_system_mul);
+    return info->tsc_shift < 0 ? khz << -info->tsc_shift : khz >> info->tsc_shift;
+}
+
+uint64_t kvmclock_wall_ns()
+{
+    return boot_wall_ns + base_ns + kvmclock_ns();
+}
+
+bool kvmclock_host_time(uint64_t* wall_ns, uint64_t* tsc)
+{
+    if (!enabled)
+        return false;
+
+    // the host writes the one buffer
+    uint32_t flags = spin_lock_irqsave(&pairing_lock);
+    intptr_t ret;
+    if (amd)
+        asm volatile("vmmcall"
+                     : "=a"(ret)
+                     : "a"(KVM_HC_CLOCK_PAIRING), "b"((uintptr_t)&pairing), "c"(KVM_CLOCK_PAIRING_WALLCLOCK)
+                     : "memory");
+    else
+        asm volatile("vmcall"
+                     : "=a"(ret)
+                     : "a"(KVM_HC_CLOCK_PAIRING), "b"((uintptr_t)&pairing), "c"(KVM_CLOCK_PAIRING_WALLCLOCK)
+                     : "memory");
+    *wall_ns = pairing.sec * NSEC_PER_SEC + pairing.nsec;
+    *tsc = pairing.tsc;
+    spin_unlock_irqrestore(&pairing_lock, flags);
+    return ret == 0;
+}
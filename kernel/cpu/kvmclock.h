@@ -0,0 +1,37 @@
+#ifndef _KERNEL_KVMCLOCK_H_
+#define _KERNEL_KVMCLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* KVM's paravirtual clock. Each CPU hands the host the address of a
+ * pvclock structure, the host keeps in it the TSC at some point and the
+ * nanoseconds since the VM started at that TSC, plus the factor from TSC
+ * cycles to nanoseconds. Reading the time is a rdtsc and a multiply, no
+ * exit. The host rewrites the structure when the TSC rate changes or the
+ * VM's clock is set back after a snapshot is restored, so the time stays
+ * right where a TSC frequency measured at boot would drift. */
+
+/* Registers the boot CPU's structure and reads the host's wall clock.
+ * False when CPUID shows no KVM with kvmclock. */
+bool kvmclock_init();
+/* Registers the calling AP's structure, nothing without kvmclock */
+void kvmclock_init_cpu();
+bool kvmclock_enabled();
+/* Whether the host says every CPU's clock is one and the same, readers
+ * then skip keeping it monotonic across CPUs */
+bool kvmclock_stable();
+
+/* Nanoseconds since kvmclock_init(), monotonic over all CPUs */
+uint64_t kvmclock_ns();
+/* The TSC frequency the host scales by */
+uint32_t kvmclock_tsc_khz();
+/* Host wall clock now, nanoseconds since 1970 */
+uint64_t kvmclock_wall_ns();
+
+/* Asks the host with the KVM_HC_CLOCK_PAIRING hypercall for its wall
+ * clock and the TSC at the same instant. An exit every time, false if
+ * the host's clocksource isn't the TSC. */
+bool kvmclock_host_time(uint64_t* wall_ns, uint64_t* tsc);
+
+#endif
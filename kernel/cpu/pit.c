@@ -0,0 +1,51 @@
+#include "pit.h"
+#include "../kernel/util.h"
+
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+/* Gate of channel 2 in bit 0, its output in bit 5, bit 1 drives the
+ * speaker from it */
+#define PIT_CONTROL 0x61
+
+#define CONTROL_GATE2 0x01
+#define CONTROL_SPEAKER 0x02
+#define CONTROL_OUT2 0x20
+
+/* Channel 2, low then high byte, mode 0 (interrupt on terminal count) */
+#define COMMAND_CHANNEL2_MODE0 0xb0
+/* Copies channel 0's count to be read, low then high byte */
+#define COMMAND_LATCH0 0x00
+
+/* Polls before giving up on a missing PIT. Every one is an exit to the
+ * host, 54 ms take far fewer than this. */
+#define MAX_POLLS 10000000
+
+bool pit_wait(uint32_t ms)
+{
+    uint32_t count = PIT_HZ / 1000 * ms;
+
+    // gate low reloads the count, output low until it runs out
+    uint8_t control = port_byte_in(PIT_CONTROL) & ~(CONTROL_GATE2 | CONTROL_SPEAKER);
+    port_byte_out(PIT_CONTROL, control);
+    port_byte_out(PIT_COMMAND, COMMAND_CHANNEL2_MODE0);
+    port_byte_out(PIT_CHANNEL2, count & 0xff);
+    port_byte_out(PIT_CHANNEL2, count >> 8);
+    port_byte_out(PIT_CONTROL, control | CONTROL_GATE2);
+
+    // an empty port reads all ones
+    if (port_byte_in(PIT_CONTROL) & CONTROL_OUT2)
+        return false;
+    for (uint32_t poll = 0; poll < MAX_POLLS; poll++) {
+        if (port_byte_in(PIT_CONTROL) & CONTROL_OUT2)
+            return true;
+    }
+    return false;
+}
+
+uint16_t pit_read()
+{
+    port_byte_out(PIT_COMMAND, COMMAND_LATCH0);
+    uint8_t low = port_byte_in(PIT_CHANNEL0);
+    return low | port_byte_in(PIT_CHANNEL0) << 8;
+}
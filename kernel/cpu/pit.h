@@ -0,0 +1,20 @@
+#ifndef _KERNEL_PIT_H_
+#define _KERNEL_PIT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Input clock of the 8254 */
+#define PIT_HZ 1193182
+
+/* Busy waits `ms`, at most 54, on channel 2 of the PIT. The channel is
+ * gated through port 0x61 and polled, no interrupt is involved. False if
+ * no PIT answered. */
+bool pit_wait(uint32_t ms);
+
+/* The count of channel 0, going down at PIT_HZ, the time source there is
+ * without a TSC. Latching and reading it are three port accesses, each
+ * an exit under KVM. */
+uint16_t pit_read();
+
+#endif
@@ -0,0 +1,38 @@
+#include "seqlock.h"
+#include "atomic.h"
+
+void seqlock_init(struct seqlock* lock)
+{
+    lock->seq = 0;
+    spin_lock_init(&lock->lock);
+}
+
+uint32_t write_seqlock_irqsave(struct seqlock* lock)
+{
+    uint32_t flags = spin_lock_irqsave(&lock->lock);
+    __atomic_store_n(&lock->seq, lock->seq + 1, __ATOMIC_RELAXED);
+    // the odd number is out before any of the data changes
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return flags;
+}
+
+void write_sequnlock_irqrestore(struct seqlock* lock, uint32_t flags)
+{
+    atomic_write(&lock->seq, lock->seq + 1);
+    spin_unlock_irqrestore(&lock->lock, flags);
+}
+
+uint32_t read_seqbegin(struct seqlock* lock)
+{
+    uint32_t seq;
+    while ((seq = atomic_read(&lock->seq)) & 1)
+        cpu_relax();
+    return seq;
+}
+
+bool read_seqretry(struct seqlock* lock, uint32_t seq)
+{
+    // the data is read before the number is checked again
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&lock->seq, __ATOMIC_RELAXED) != seq;
+}
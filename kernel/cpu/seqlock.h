@@ -0,0 +1,41 @@
+#ifndef _KERNEL_SEQLOCK_H_
+#define _KERNEL_SEQLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "spinlock.h"
+
+/* Data written rarely and read often, like a clock. Writers take the
+ * spinlock and bump the sequence number before and after they write, so
+ * it is odd while a write is going on. Readers never wait for a lock and
+ * never write, they retry when the number was odd or moved:
+ *
+ *     uint32_t seq;
+ *     do {
+ *         seq = read_seqbegin(&lock);
+ *         copy = data;
+ *     } while (read_seqretry(&lock, seq));
+ *
+ * A reader may see a torn copy before it retries, it must not follow
+ * pointers in it or divide by values from it until read_seqretry() said
+ * the copy is good. An interrupt handler can read, but it must not read
+ * on a CPU in the middle of a write, hence the _irqsave writer. */
+struct seqlock {
+    uint32_t seq;
+    struct spinlock lock;
+};
+
+/* A zeroed seqlock is ready too */
+void seqlock_init(struct seqlock* lock);
+
+uint32_t write_seqlock_irqsave(struct seqlock* lock);
+void write_sequnlock_irqrestore(struct seqlock* lock, uint32_t flags);
+
+/* The sequence number to hand to read_seqretry(), spins while a write is
+ * going on */
+uint32_t read_seqbegin(struct seqlock* lock);
+/* True when the data read since read_seqbegin() may be torn */
+bool read_seqretry(struct seqlock* lock, uint32_t seq);
+
+#endif
@@ -0,0 +1,161 @@
+#include <stddef.h>
+
+#include "smp.h"
+#include "../kernel/printk.h"
+#include "../libc/string.h"
+#include "../mm/vmm.h"
+#include "../task/sched.h"
+#include "../task/softirq.h"
+#include "../task/syscall.h"
+#include "apic.h"
+#include "fpu.h"
+#include "gdt.h"
+#include "idt.h"
+#include "isr.h"
+#include "kvmclock.h"
+#include "timer.h"
+
+#define CPUID_EDX_HTT (1 << 28)
+
+/* How long to wait for an AP to come up after a startup IPI. KVM doesn't
+ * need the delays real hardware wants between INIT and startup IPIs, so
+ * a second startup IPI is only sent if the first one didn't bring the CPU
+ * up in time. */
+#define AP_START_NS NSEC_PER_SEC
+
+/* Defined in trampoline.asm */
+extern char trampoline_start[];
+extern char trampoline_end[];
+extern char trampoline_stack[];
+
+struct cpu cpus[SMP_MAX_CPUS];
+int cpu_count = 0;
+
+struct cpu* this_cpu()
+{
+    // the host hands out APIC IDs in order from 0
+    return &cpus[lapic_id()];
+}
+
+/* Work runs right in the interrupt, whatever thread the CPU is running.
+ * The IPI also gets a CPU to reschedule after a wakeup from elsewhere. */
+static void call_callback(registers_t* regs)
+{
+    struct cpu* cpu = this_cpu();
+    smp_func_t work = __atomic_load_n(&cpu->work, __ATOMIC_ACQUIRE);
+    if (work != NULL) {
+        work(cpu->work_arg);
+        __atomic_store_n(&cpu->work, NULL, __ATOMIC_RELEASE);
+    }
+}
+
+/* Entered from the trampoline on the CPU's own stack */
+void ap_main()
+{
+    struct cpu* cpu = this_cpu();
+
+    vmm_init_ap();
+    load_idt();
+    gdt_init();
+    syscall_init_cpu();
+    fpu_init();
+    lapic_init(false);
+    kvmclock_init_cpu();
+    sched_init_cpu();
+    softirq_init_cpu();
+    timer_start();
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    printk(LOG_DEBUG, "CPU %d online, APIC ID %d", cpu->id, cpu->apic_id);
+
+    sched_idle();
+}
+
+static bool start_ap(struct cpu* cpu)
+{
+    uint32_t* stack = (uint32_t*)(SMP_TRAMPOLINE + (trampoline_stack - trampoline_start));
+    *stack = cpu->stack_top;
+
+    lapic_send_init(cpu->apic_id);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        lapic_send_startup(cpu->apic_id, SMP_TRAMPOLINE >> 12);
+        uint64_t deadline = now_ns() + AP_START_NS;
+        while (now_ns() < deadline) {
+            if (__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE))
+                return true;
+            asm volatile("pause");
+        }
+    }
+
+    return false;
+}
+
+static int cpuid_cpu_count()
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+
+    if (!(edx & CPUID_EDX_HTT))
+        return 1;
+    int count = (ebx >> 16) & 0xff;
+    if (count > SMP_MAX_CPUS)
+        count = SMP_MAX_CPUS;
+    return count > 0 ? count : 1;
+}
+
+void smp_init()
+{
+    int count = cpuid_cpu_count();
+
+    register_interrupt_handler(LAPIC_CALL_VECTOR, call_callback);
+    set_interrupt_name(LAPIC_CALL_VECTOR, "call IPI");
+
+    struct cpu* bsp = &cpus[0];
+    bsp->id = 0;
+    bsp->apic_id = lapic_id();
+    bsp->stack_top = SMP_STACK_TOP;
+    bsp->online = true;
+    lapic_init(true);
+    timer_start();
+    cpu_count = 1;
+
+    // the PIC can only interrupt the BSP, the IO APIC can target any CPU.
+    // The shell runs on the BSP so the keyboard stays there.
+    asm volatile("cli");
+    isr_use_apic();
+    ioapic_route(1, IRQ1, bsp->apic_id);
+    asm volatile("sti");
+
+    memcpy((void*)SMP_TRAMPOLINE, trampoline_start, trampoline_end - trampoline_start);
+
+    // one at a time, they share the trampoline. Stop at the first one that
+    // fails so the online CPUs stay numbered without gaps.
+    for (int id = 1; id < count; id++) {
+        struct cpu* cpu = &cpus[id];
+        cpu->id = id;
+        cpu->apic_id = id;
+        cpu->stack_top = SMP_STACK_TOP - id * SMP_STACK_SIZE;
+        if (!start_ap(cpu))
+            break;
+        cpu_count++;
+    }
+}
+
+void smp_call(int count, smp_func_t func, void* arg)
+{
+    if (count > cpu_count)
+        count = cpu_count;
+
+    for (int id = 1; id < count; id++) {
+        cpus[id].work_arg = arg;
+        __atomic_store_n(&cpus[id].work, func, __ATOMIC_RELEASE);
+        isr_ipi_sent(id, LAPIC_CALL_VECTOR);
+        lapic_send_ipi(cpus[id].apic_id, LAPIC_CALL_VECTOR);
+    }
+
+    func(arg);
+
+    for (int id = 1; id < count; id++) {
+        while (__atomic_load_n(&cpus[id].work, __ATOMIC_ACQUIRE) != NULL)
+            asm volatile("pause");
+    }
+}
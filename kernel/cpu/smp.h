@@ -0,0 +1,46 @@
+#ifndef _KERNEL_SMP_H_
+#define _KERNEL_SMP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SMP_MAX_CPUS 8
+
+/* The AP startup code is copied to this page, the startup IPI vector is
+ * its page number. The kernel is loaded at 0x10000 so this page is free. */
+#define SMP_TRAMPOLINE 0x8000
+
+/* CPU n's stack grows down from SMP_STACK_TOP - n * SMP_STACK_SIZE, the
+ * BSP keeps the boot stack */
+#define SMP_STACK_TOP 0x90000
+#define SMP_STACK_SIZE 0x4000
+
+typedef void (*smp_func_t)(void* arg);
+
+struct cpu {
+    /* Index in `cpus`, the same as the APIC ID */
+    uint8_t id;
+    uint8_t apic_id;
+    bool online;
+    uint32_t stack_top;
+    /* LAPIC timer interrupts taken by this CPU */
+    uint32_t ticks;
+    /* Work handed over by smp_call, NULL once it's done */
+    smp_func_t work;
+    void* work_arg;
+};
+
+extern struct cpu cpus[SMP_MAX_CPUS];
+/* CPUs online, they are always cpus[0 .. cpu_count - 1] */
+extern int cpu_count;
+
+/* Switch from the PIC to the APICs, start the local APIC timer on the BSP
+ * and bring up the APs */
+void smp_init();
+struct cpu* this_cpu();
+/* Run `func` on the first `count` CPUs, the caller being CPU 0, and wait
+ * for all of them to finish. The others run it in an interrupt handler,
+ * ahead of whatever thread they are running. */
+void smp_call(int count, smp_func_t func, void* arg);
+
+#endif
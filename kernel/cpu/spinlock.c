@@ -0,0 +1,63 @@
+#include "spinlock.h"
+#include "../kernel/util.h"
+#include "atomic.h"
+
+#define EFLAGS_IF (1 << 9)
+
+uint32_t irq_save()
+{
+    // pushf pushes a whole word, IF is in the low half
+    uintptr_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void irq_restore(uint32_t flags)
+{
+    if (flags & EFLAGS_IF)
+        asm volatile("sti" : : : "memory");
+}
+
+void lock_stats_released(struct lock_stats* stats, uint64_t acquired_at)
+{
+    uint64_t held = rdtsc() - acquired_at;
+    stats->hold_cycles += held;
+    if (held > stats->max_hold_cycles)
+        stats->max_hold_cycles = held;
+}
+
+void spin_lock_init(struct spinlock* lock)
+{
+    lock->locked = false;
+    lock->acquired_at = 0;
+    lock->stats = (struct lock_stats) { 0 };
+}
+
+uint32_t spin_lock_irqsave(struct spinlock* lock)
+{
+    uint32_t flags = irq_save();
+    if (!__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE)) {
+        lock->acquired_at = rdtsc();
+        lock->stats.acquired++;
+        return flags;
+    }
+
+    // the clock only runs for the slow path
+    uint64_t start = rdtsc();
+    do {
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+            cpu_relax();
+    } while (__atomic_test_and_set(&lock->locked, __ATOMIC_ACQUIRE));
+    lock->acquired_at = rdtsc();
+    lock->stats.acquired++;
+    lock->stats.contended++;
+    lock->stats.wait_cycles += lock->acquired_at - start;
+    return flags;
+}
+
+void spin_unlock_irqrestore(struct spinlock* lock, uint32_t flags)
+{
+    lock_stats_released(&lock->stats, lock->acquired_at);
+    __atomic_clear(&lock->locked, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
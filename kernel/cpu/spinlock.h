@@ -0,0 +1,58 @@
+#ifndef _KERNEL_SPINLOCK_H_
+#define _KERNEL_SPINLOCK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* IRQ safety rules for every lock here:
+ * - Locks are only taken with the _irqsave calls. An interrupt handler
+ *   spinning on a lock the thread it interrupted holds never gets it, so
+ *   interrupts stay off on the holding CPU, whether or not any handler
+ *   takes that lock today.
+ * - Nothing sleeps, switches threads or waits for another CPU with a lock
+ *   held. wait_queue_sleep() is the one exception, it lets go of the
+ *   queue lock itself.
+ * - Locks nest in one order only. The scheduler run queues are innermost
+ *   and softirq_raise() can wake a thread, so it is never called with a
+ *   run queue lock held.
+ * - Data an interrupt handler shares with one consumer goes through a
+ *   lock-free ring from libc/ring.h instead, writers on several CPUs use
+ *   an mpsc_ring. Data read far more often than written, and readers that
+ *   must never wait, use a seqlock.
+ * - State only the owning CPU touches needs irq_save() at most. */
+
+/* Counters kept by the lock itself, updated while it is held so they need
+ * no atomics. Waiting and holding are in TSC cycles. */
+struct lock_stats {
+    uint32_t acquired;
+    /* Times the lock was taken and someone had to wait */
+    uint32_t contended;
+    uint64_t wait_cycles;
+    uint64_t hold_cycles;
+    uint64_t max_hold_cycles;
+};
+
+struct spinlock {
+    bool locked;
+    /* TSC when it was taken, for the hold time */
+    uint64_t acquired_at;
+    struct lock_stats stats;
+};
+
+/* A zeroed lock is unlocked too, static locks need no call */
+void spin_lock_init(struct spinlock* lock);
+
+/* Interrupts stay off while the lock is held so an interrupt handler on
+ * the same CPU can take it too. Returns the flags to restore. */
+uint32_t spin_lock_irqsave(struct spinlock* lock);
+void spin_unlock_irqrestore(struct spinlock* lock, uint32_t flags);
+
+/* Interrupts off without a lock, for state only the calling CPU touches */
+uint32_t irq_save();
+void irq_restore(uint32_t flags);
+
+/* Adds a hold from `acquired_at` up to now, for the lock implementations
+ * when they let go */
+void lock_stats_released(struct lock_stats* stats, uint64_t acquired_at);
+
+#endif
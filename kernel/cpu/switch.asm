@@ -0,0 +1,41 @@
+; void switch_context(uintptr_t* old_sp, uintptr_t new_sp)
+; Saves the callee-saved registers on the current stack, stores the stack
+; pointer to *old_sp and continues on new_sp, which has to point to a
+; stack saved the same way. A new thread's stack is set up to look like
+; one by thread_create() in task/sched.c.
+global switch_context
+
+%ifdef __x86_64__
+[bits 64]
+switch_context:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret
+%else
+switch_context:
+    mov eax, [esp + 4]
+    mov edx, [esp + 8]
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret
+%endif
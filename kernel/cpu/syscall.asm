@@ -0,0 +1,129 @@
+; The fast system call entry and the way into user mode, see task/syscall.c
+[extern syscall_dispatch]
+global user_enter
+
+%ifdef __x86_64__
+[bits 64]
+global syscall_entry
+
+; Selectors from cpu/gdt.h, offsets in its struct tss
+USER_DS equ 0x1b
+USER_CS equ 0x23
+TSS_RSP0 equ 4
+TSS_RSP2 equ 20
+RFLAGS_IF equ 1 << 9
+
+; SYSCALL leaves the user rip in rcx and rflags in r11, MSR_SFMASK clears
+; IF and DF. The stack stays the user's: the kernel GS base points at this
+; CPU's TSS, which has the kernel stack and a free slot for the user one.
+; The number is in rax, the arguments in rdi, rsi and rdx and the result
+; goes back in rax. The other caller saved registers are clobbered.
+syscall_entry:
+    swapgs
+    mov [gs:TSS_RSP2], rsp
+    mov rsp, [gs:TSS_RSP0]
+    push qword [gs:TSS_RSP2]
+    swapgs
+    push rcx
+    push r11
+    sub rsp, 8 ; the call wants the stack 16 byte aligned
+    sti
+
+    mov rcx, rdx
+    mov rdx, rsi
+    mov rsi, rdi
+    mov rdi, rax
+    call syscall_dispatch
+
+    cli ; no interrupts while on the user stack in kernel mode
+    add rsp, 8
+    pop r11
+    pop rcx
+    pop rsp
+    o64 sysret
+
+; user_enter(entry, stack), never returns. Nothing of the kernel is left
+; in the registers.
+user_enter:
+    push USER_DS
+    push rsi
+    push RFLAGS_IF
+    push USER_CS
+    push rdi
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    xor r8, r8
+    xor r9, r9
+    xor r10, r10
+    xor r11, r11
+    xor r12, r12
+    xor r13, r13
+    xor r14, r14
+    xor r15, r15
+    iretq
+
+%else
+[bits 32]
+global sysenter_entry
+
+USER_CS equ 0x1b
+USER_DS equ 0x23
+TSS_ESP0 equ 4
+EFLAGS_IF equ 1 << 9
+
+; SYSENTER saves nothing. The user stub passes its stack pointer in ecx
+; and where to return to in edx, esp starts at this CPU's TSS and
+; interrupts are off. The number is in eax, the arguments in ebx, esi and
+; edi and the result goes back in eax, ecx and edx are clobbered.
+sysenter_entry:
+    mov esp, [esp + TSS_ESP0]
+    push ecx
+    push edx
+    ; whatever user mode left in them, the flat user segment works for
+    ; the kernel too
+    mov cx, USER_DS
+    mov ds, cx
+    mov es, cx
+    cld
+    sti
+
+    push edi
+    push esi
+    push ebx
+    push eax
+    call syscall_dispatch
+    add esp, 16
+
+    pop edx
+    pop ecx
+    sysexit
+
+; user_enter(entry, stack), never returns. Nothing of the kernel is left
+; in the registers.
+user_enter:
+    mov edx, [esp + 4]
+    mov ecx, [esp + 8]
+    mov ax, USER_DS
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    push USER_DS
+    push ecx
+    push EFLAGS_IF
+    push USER_CS
+    push edx
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    iret
+%endif
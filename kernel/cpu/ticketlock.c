@@ -0,0 +1,40 @@
+#include "ticketlock.h"
+#include "../kernel/util.h"
+#include "atomic.h"
+
+void ticket_lock_init(struct ticket_lock* lock)
+{
+    lock->next = 0;
+    lock->owner = 0;
+    lock->acquired_at = 0;
+    lock->stats = (struct lock_stats) { 0 };
+}
+
+uint32_t ticket_lock_irqsave(struct ticket_lock* lock)
+{
+    uint32_t flags = irq_save();
+    // 16 bit tickets wrap, they only need to tell SMP_MAX_CPUS apart
+    uint16_t ticket = atomic_fetch_add(&lock->next, 1);
+    if (atomic_read(&lock->owner) == ticket) {
+        lock->acquired_at = rdtsc();
+        lock->stats.acquired++;
+        return flags;
+    }
+
+    uint64_t start = rdtsc();
+    while (atomic_read(&lock->owner) != ticket)
+        cpu_relax();
+    lock->acquired_at = rdtsc();
+    lock->stats.acquired++;
+    lock->stats.contended++;
+    lock->stats.wait_cycles += lock->acquired_at - start;
+    return flags;
+}
+
+void ticket_unlock_irqrestore(struct ticket_lock* lock, uint32_t flags)
+{
+    lock_stats_released(&lock->stats, lock->acquired_at);
+    // only the holder writes owner
+    atomic_write(&lock->owner, lock->owner + 1);
+    irq_restore(flags);
+}
@@ -0,0 +1,26 @@
+#ifndef _KERNEL_TICKETLOCK_H_
+#define _KERNEL_TICKETLOCK_H_
+
+#include <stdint.h>
+
+#include "spinlock.h"
+
+/* A spinlock that hands itself out in the order CPUs asked for it, so
+ * none of them starves under contention. A CPU takes the next ticket and
+ * waits until the lock serves it. The IRQ safety rules of spinlock.h
+ * apply, it is taken with interrupts off too. */
+struct ticket_lock {
+    /* Ticket the next CPU to come gets */
+    uint16_t next;
+    /* Ticket of the holder, the one served */
+    uint16_t owner;
+    uint64_t acquired_at;
+    struct lock_stats stats;
+};
+
+/* A zeroed lock is unlocked too */
+void ticket_lock_init(struct ticket_lock* lock);
+uint32_t ticket_lock_irqsave(struct ticket_lock* lock);
+void ticket_unlock_irqrestore(struct ticket_lock* lock, uint32_t flags);
+
+#endif
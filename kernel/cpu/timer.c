@@ -1,32 +1,339 @@
+#include <stddef.h>
+
 #include "timer.h"
 #include "../kernel/util.h"
-#include "../kernel/vga.h"
+#include "apic.h"
 #include "isr.h"
+#include "kvmclock.h"
+#include "spinlock.h"
+#include "tsc.h"
+
+/* Four levels of 64 slots. A slot of level n covers 64^n jiffies, so the
+ * wheel reaches 64^4 jiffies, about 4.9 hours, and later timers wait on
+ * the last level. Arming and cancelling is a list insert or unlink, the
+ * slots of a level are pushed down a level each time the one below has
+ * gone around. */
+#define LEVELS 4
+#define SLOT_BITS 6
+#define SLOTS (1 << SLOT_BITS)
+#define SLOT_MASK (SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * SLOT_BITS)
+#define WHEEL_RANGE (1ull << LEVEL_SHIFT(LEVELS))
+
+#define NO_JIFFY (~0ull)
+
+/* TSC time the LAPIC timer is counted against without TSC deadlines */
+#define LAPIC_CALIBRATE_NS NSEC_PER_MSEC
+
+struct timer_wheel {
+    struct spinlock lock;
+    /* Next jiffy to run, the ones before have run */
+    uint64_t clock;
+    /* Bit per slot with timers */
+    uint64_t pending[LEVELS];
+    struct timer* slots[LEVELS][SLOTS];
+    uint32_t armed;
+    /* Jiffy the LAPIC timer interrupts at, NO_JIFFY if stopped. Skips
+     * the MSR or register write, an exit, when it doesn't change. */
+    uint64_t programmed;
+};
+
+static struct timer_wheel wheels[SMP_MAX_CPUS];
+static bool deadline_mode;
+static bool use_kvmclock;
+/* LAPIC timer counts per millisecond without deadline mode */
+static uint32_t lapic_counts_per_ms;
+
+uint64_t now_ns()
+{
+    if (use_kvmclock)
+        return kvmclock_ns();
+    return tsc_now_ns();
+}
+
+bool clock_gettime(enum clock_id clock, struct timespec* ts)
+{
+    uint64_t ns;
+    if (clock == CLOCK_MONOTONIC)
+        ns = now_ns();
+    else if (use_kvmclock)
+        ns = kvmclock_wall_ns();
+    else
+        return false;
+    ts->sec = div_u64(ns, NSEC_PER_SEC);
+    ts->nsec = ns - ts->sec * NSEC_PER_SEC;
+    return true;
+}
+
+/* The TSC deadline for `ns` on the now_ns() clock. kvmclock is no fixed
+ * function of the TSC, the host can change its rate, so only the time
+ * left is converted. */
+static uint64_t deadline_tsc(uint64_t ns)
+{
+    if (!use_kvmclock)
+        return tsc_at_ns(ns);
+    uint64_t tsc = rdtsc();
+    uint64_t now = now_ns();
+    return ns > now ? tsc + ns_to_tsc(ns - now) + 1 : tsc;
+}
+
+static uint64_t ns_to_jiffy(uint64_t ns)
+{
+    // rounded up so a timer never runs early
+    return (ns + (1 << TIMER_JIFFY_SHIFT) - 1) >> TIMER_JIFFY_SHIFT;
+}
 
-uint32_t tick = 0;
+static void enqueue(struct timer_wheel* wheel, struct timer* timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires < wheel->clock)
+        expires = wheel->clock;
+    uint64_t delta = expires - wheel->clock;
+    // the timer keeps its real expiry, it moves on once it gets closer
+    if (delta >= WHEEL_RANGE)
+        expires = wheel->clock + WHEEL_RANGE - 1;
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= 1ull << LEVEL_SHIFT(level + 1))
+        level++;
+    int slot = (expires >> LEVEL_SHIFT(level)) & SLOT_MASK;
+
+    struct timer** head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (*head != NULL)
+        (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+    wheel->pending[level] |= 1ull << slot;
+}
+
+static void unlink(struct timer_wheel* wheel, struct timer* timer)
+{
+    // the head of its slot, the slot is empty once it's gone
+    uint32_t index = timer->pprev - &wheel->slots[0][0];
+    if (index < LEVELS * SLOTS && timer->next == NULL)
+        wheel->pending[index / SLOTS] &= ~(1ull << (index % SLOTS));
+
+    *timer->pprev = timer->next;
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+}
+
+/* Bits of `bits` starting at `first`, wrapping around */
+static uint64_t rotate(uint64_t bits, int first)
+{
+    return first == 0 ? bits : bits >> first | bits << (64 - first);
+}
+
+/* __builtin_ctzll() would be a libgcc call, `bits` isn't 0 */
+static int lowest_bit(uint64_t bits)
+{
+    uint32_t low = (uint32_t)bits;
+    return low != 0 ? __builtin_ctz(low) : 32 + __builtin_ctz((uint32_t)(bits >> 32));
+}
+
+/* First jiffy from the clock on that has timers to run or a slot to
+ * push down */
+static uint64_t next_jiffy(struct timer_wheel* wheel)
+{
+    uint64_t next = NO_JIFFY;
+    for (int level = 0; level < LEVELS; level++) {
+        if (wheel->pending[level] == 0)
+            continue;
+        int shift = LEVEL_SHIFT(level);
+        uint64_t index = wheel->clock >> shift;
+        // a level's current slot was pushed down when the clock entered
+        // it, unless that is just now
+        int skip = (wheel->clock & ((1ull << shift) - 1)) == 0 ? 0 : 1;
+        if (level == 0)
+            skip = 0;
+        uint64_t bits = rotate(wheel->pending[level], (index + skip) & SLOT_MASK);
+        uint64_t jiffy = (index + skip + lowest_bit(bits)) << shift;
+        if (jiffy < next)
+            next = jiffy;
+    }
+    return next;
+}
+
+/* Moves the timers of a slot to lower levels, at the jiffy it starts */
+static void cascade(struct timer_wheel* wheel, int level, int slot)
+{
+    struct timer* timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->pending[level] &= ~(1ull << slot);
+    while (timer != NULL) {
+        struct timer* next = timer->next;
+        enqueue(wheel, timer);
+        timer = next;
+    }
+}
+
+static void program(struct timer_wheel* wheel)
+{
+    uint64_t next = next_jiffy(wheel);
+    if (next == wheel->programmed)
+        return;
+    wheel->programmed = next;
+
+    if (deadline_mode) {
+        uint64_t deadline = next == NO_JIFFY ? 0 : deadline_tsc(next << TIMER_JIFFY_SHIFT);
+        isr_expect(LAPIC_TIMER_VECTOR, deadline);
+        lapic_timer_deadline(deadline);
+        return;
+    }
+    if (next == NO_JIFFY) {
+        isr_expect(LAPIC_TIMER_VECTOR, 0);
+        lapic_timer_oneshot(0);
+        return;
+    }
+
+    uint64_t when = next << TIMER_JIFFY_SHIFT;
+    uint64_t now = now_ns();
+    uint64_t ms = when > now ? div_u64(when - now, NSEC_PER_MSEC) + 1 : 1;
+    uint64_t count = ms * lapic_counts_per_ms;
+    // as close as the calibration of the LAPIC timer gets
+    isr_expect(LAPIC_TIMER_VECTOR, count > 0xffffffff ? 0 : rdtsc() + ns_to_tsc(ms * NSEC_PER_MSEC));
+    lapic_timer_oneshot(count > 0xffffffff ? 0xffffffff : (uint32_t)count);
+}
+
+/* Runs everything due, the lock dropped around each callback */
+static void run_timers(struct timer_wheel* wheel)
+{
+    uint32_t flags = spin_lock_irqsave(&wheel->lock);
+    uint64_t now = now_ns() >> TIMER_JIFFY_SHIFT;
+
+    while (wheel->clock <= now) {
+        uint64_t jiffy = next_jiffy(wheel);
+        if (jiffy > now) {
+            wheel->clock = now + 1;
+            break;
+        }
+        wheel->clock = jiffy;
+
+        // a level goes on to the one above once its index wraps to 0
+        for (int level = 1; level < LEVELS; level++) {
+            if (jiffy & ((1ull << LEVEL_SHIFT(level)) - 1))
+                break;
+            cascade(wheel, level, (jiffy >> LEVEL_SHIFT(level)) & SLOT_MASK);
+        }
+
+        int slot = jiffy & SLOT_MASK;
+        struct timer* timer;
+        while ((timer = wheel->slots[0][slot]) != NULL) {
+            wheel->slots[0][slot] = timer->next;
+            if (timer->next != NULL)
+                timer->next->pprev = &wheel->slots[0][slot];
+            timer->pprev = NULL;
+            wheel->armed--;
+
+            spin_unlock_irqrestore(&wheel->lock, flags);
+            timer->func(timer->arg);
+            flags = spin_lock_irqsave(&wheel->lock);
+        }
+        wheel->pending[0] &= ~(1ull << slot);
+        wheel->clock = jiffy + 1;
+    }
+
+    // the interrupt used up what was programmed
+    wheel->programmed = NO_JIFFY;
+    program(wheel);
+    spin_unlock_irqrestore(&wheel->lock, flags);
+}
 
 static void timer_callback(registers_t* regs)
 {
-    tick++;
-    print_string("Tick: ");
+    struct cpu* cpu = this_cpu();
+    cpu->ticks++;
+    run_timers(&wheels[cpu->id]);
+}
+
+/* Counts the LAPIC timer makes in a millisecond of the TSC */
+static void calibrate_lapic()
+{
+    lapic_timer_init(false);
+    lapic_timer_oneshot(0xffffffff);
+    uint64_t end = now_ns() + LAPIC_CALIBRATE_NS;
+    while (now_ns() < end)
+        asm volatile("pause");
+    lapic_counts_per_ms = 0xffffffff - lapic_timer_count();
+    lapic_timer_oneshot(0);
+}
 
-    char tick_ascii[256];
-    int_to_string(tick, tick_ascii);
-    print_string(tick_ascii);
-    print_nl();
+void timer_init()
+{
+    // the host's clock needs no calibration and follows it changing the
+    // TSC rate
+    use_kvmclock = kvmclock_init();
+    tsc_calibrate();
+    deadline_mode = lapic_timer_has_deadline();
+    if (!deadline_mode)
+        calibrate_lapic();
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        wheels[cpu].programmed = NO_JIFFY;
+    register_interrupt_handler(LAPIC_TIMER_VECTOR, timer_callback);
+    set_interrupt_name(LAPIC_TIMER_VECTOR, "LAPIC timer");
 }
 
-void init_timer(uint32_t freq)
+void timer_start()
 {
-    /* Install the function we just wrote */
-    register_interrupt_handler(IRQ0, timer_callback);
+    struct timer_wheel* wheel = &wheels[this_cpu()->id];
+    uint32_t flags = spin_lock_irqsave(&wheel->lock);
+    lapic_timer_init(deadline_mode);
+    if (wheel->armed == 0)
+        wheel->clock = now_ns() >> TIMER_JIFFY_SHIFT;
+    // timers armed before the LAPIC was set up weren't programmed
+    wheel->programmed = NO_JIFFY;
+    program(wheel);
+    spin_unlock_irqrestore(&wheel->lock, flags);
+}
 
-    /* Get the PIT value: hardware clock at 1193180 Hz */
-    uint32_t divisor = 1193180 / freq;
-    uint8_t low = (uint8_t)(divisor & 0xFF);
-    uint8_t high = (uint8_t)((divisor >> 8) & 0xFF);
-    /* Send the command */
-    port_byte_out(0x43, 0x36); /* Command port */
-    port_byte_out(0x40, low);
-    port_byte_out(0x40, high);
+void timer_setup(struct timer* timer, timer_callback_t func, void* arg)
+{
+    timer->pprev = NULL;
+    timer->func = func;
+    timer->arg = arg;
+}
+
+void timer_arm(struct timer* timer, uint64_t when)
+{
+    timer_cancel(timer);
+
+    struct cpu* cpu = this_cpu();
+    struct timer_wheel* wheel = &wheels[cpu->id];
+    uint32_t flags = spin_lock_irqsave(&wheel->lock);
+    timer->expires = ns_to_jiffy(when);
+    timer->cpu = cpu->id;
+    enqueue(wheel, timer);
+    wheel->armed++;
+    // unchanged unless it's the first timer now, a later one is left for
+    // the interrupt to set up
+    program(wheel);
+    spin_unlock_irqrestore(&wheel->lock, flags);
+}
+
+bool timer_cancel(struct timer* timer)
+{
+    if (!timer_pending(timer))
+        return false;
+
+    struct timer_wheel* wheel = &wheels[timer->cpu];
+    uint32_t flags = spin_lock_irqsave(&wheel->lock);
+    bool armed = timer_pending(timer);
+    if (armed) {
+        unlink(wheel, timer);
+        wheel->armed--;
+    }
+    spin_unlock_irqrestore(&wheel->lock, flags);
+    return armed;
+}
+
+void timer_get_info(struct timer_info* info)
+{
+    info->tsc_khz = tsc_khz();
+    info->pit_calibrated = tsc_source() == TSC_SOURCE_PIT;
+    info->kvmclock = use_kvmclock;
+    info->deadline_mode = deadline_mode;
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++)
+        info->armed[cpu] = wheels[cpu].armed;
 }
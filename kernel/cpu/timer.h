@@ -1,8 +1,77 @@
 #ifndef _KERNEL_TIMER_H_
 #define _KERNEL_TIMER_H_
 
+#include <stdbool.h>
 #include <stdint.h>
 
-void init_timer(uint32_t freq);
+#include "smp.h"
+
+#define NSEC_PER_MSEC 1000000ull
+#define NSEC_PER_SEC 1000000000ull
+
+/* Scheduler ticks per second while a CPU runs threads, idle CPUs take no
+ * interrupt until their next timer */
+#define TIMER_HZ 100
+
+/* Timers expire on jiffies of 2^20 ns, about a millisecond */
+#define TIMER_JIFFY_SHIFT 20
+
+typedef void (*timer_callback_t)(void* arg);
+
+/* A callback run once, from the timer interrupt of the CPU that armed it
+ * with interrupts off */
+struct timer {
+    struct timer* next;
+    /* Link pointing at this timer, NULL while not armed */
+    struct timer** pprev;
+    /* Jiffy it runs on */
+    uint64_t expires;
+    timer_callback_t func;
+    void* arg;
+    uint8_t cpu;
+};
+
+struct timer_info {
+    uint32_t tsc_khz;
+    bool pit_calibrated;
+    /* now_ns() reads kvmclock, the TSC frequency came from it too */
+    bool kvmclock;
+    bool deadline_mode;
+    /* Timers armed on each CPU */
+    uint32_t armed[SMP_MAX_CPUS];
+};
+
+/* Calibrates the TSC against the PIT and installs the timer interrupt */
+void timer_init();
+/* Starts timers on the calling CPU, its LAPIC enabled */
+void timer_start();
+
+/* Monotonic nanoseconds since timer_init(), from kvmclock under KVM and
+ * from the TSC elsewhere. Either is a rdtsc and a multiply, no exit. */
+uint64_t now_ns();
+
+enum clock_id {
+    CLOCK_MONOTONIC,
+    CLOCK_REALTIME,
+};
+
+struct timespec {
+    uint64_t sec;
+    uint32_t nsec;
+};
+
+/* Like POSIX. CLOCK_MONOTONIC is now_ns(), CLOCK_REALTIME the host's wall
+ * clock, which needs kvmclock and is false without. */
+bool clock_gettime(enum clock_id clock, struct timespec* ts);
+
+void timer_setup(struct timer* timer, timer_callback_t func, void* arg);
+/* Runs the callback on the calling CPU once now_ns() reaches `when`, at
+ * most a jiffy later. Arming an armed timer moves it. */
+void timer_arm(struct timer* timer, uint64_t when);
+/* True if it was armed, a callback already running isn't waited for */
+bool timer_cancel(struct timer* timer);
+#define timer_pending(timer) ((timer)->pprev != 0)
+
+void timer_get_info(struct timer_info* info);
 
 #endif
@@ -0,0 +1,111 @@
+; Application processors start here in real mode after the startup IPI.
+; smp.c copies this to SMP_TRAMPOLINE so everything up to the jump into
+; the kernel is addressed relative to that copy.
+TRAMPOLINE equ 0x8000 ; SMP_TRAMPOLINE in smp.h
+%define RELOCATED(label) (TRAMPOLINE + (label - trampoline_start))
+
+[extern ap_main]
+%ifdef __x86_64__
+[extern boot_pml4]
+[extern gdt64_descriptor]
+
+CR0_PG equ 1 << 31
+CR4_PAE equ 1 << 5
+MSR_EFER equ 0xC0000080
+EFER_LME equ 1 << 8
+%endif
+
+global trampoline_start
+global trampoline_end
+global trampoline_stack
+
+[bits 16]
+trampoline_start:
+    cli
+    xor ax, ax ; cs is the page number, data is addressed from 0
+    mov ds, ax
+    lgdt [RELOCATED(trampoline_gdt_descriptor)]
+    mov eax, cr0
+    or eax, 0x1
+    mov cr0, eax
+    jmp dword 0x08:RELOCATED(trampoline_32bit)
+
+[bits 32]
+trampoline_32bit:
+    mov ax, 0x10
+    mov ds, ax
+    mov ss, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+%ifdef __x86_64__
+    ; into long mode on the boot page tables like boot/kernel_entry.asm,
+    ; vmm_init_ap() switches to the kernel's own
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov eax, boot_pml4
+    mov cr3, eax
+    mov ecx, MSR_EFER
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG
+    mov cr0, eax
+
+    ; the kernel's GDT, the selectors are the same
+    lgdt [gdt64_descriptor]
+    jmp 0x08:RELOCATED(trampoline_64bit)
+
+[bits 64]
+trampoline_64bit:
+    mov ax, 0x10
+    mov ds, ax
+    mov ss, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    mov esp, [RELOCATED(trampoline_stack)] ; zero extended
+    mov rbp, rsp
+
+    mov rax, ap_main
+    call rax
+    jmp $
+%else
+    mov esp, [RELOCATED(trampoline_stack)] ; set by the BSP for each AP
+    mov ebp, esp
+
+    mov eax, ap_main ; absolute, a relative call would be off by the copy
+    call eax
+    jmp $
+%endif
+
+; Same flat segments as boot/gdt.asm, the MBR's copy can't be relied on
+align 8
+trampoline_gdt:
+    dd 0x0
+    dd 0x0
+    ; code
+    dw 0xffff
+    dw 0x0
+    db 0x0
+    db 10011010b
+    db 11001111b
+    db 0x0
+    ; data
+    dw 0xffff
+    dw 0x0
+    db 0x0
+    db 10010010b
+    db 11001111b
+    db 0x0
+trampoline_gdt_descriptor:
+    dw trampoline_gdt_descriptor - trampoline_gdt - 1
+    dd RELOCATED(trampoline_gdt)
+
+trampoline_stack:
+    dd 0x0
+trampoline_end:
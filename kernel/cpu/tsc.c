@@ -0,0 +1,108 @@
+#include "tsc.h"
+#include "../kernel/util.h"
+#include "kvmclock.h"
+#include "pit.h"
+
+/* Length of the PIT calibration window */
+#define CALIBRATE_MS 10
+
+/* Conversions are a multiply and a shift, the factors scaled by 2^22 */
+#define SCALE_SHIFT 22
+
+static uint32_t khz;
+static enum tsc_source source = TSC_SOURCE_NONE;
+static uint64_t boot_tsc;
+static uint32_t ns_per_cycle;
+static uint32_t cycles_per_ns;
+
+static void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx)
+{
+    asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static uint32_t cpuid_khz()
+{
+    uint32_t max_leaf, eax, ebx, ecx, edx;
+    cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+
+    // crystal clock times the TSC/crystal ratio, the crystal is often left 0
+    if (max_leaf >= 0x15) {
+        cpuid(0x15, &eax, &ebx, &ecx, &edx);
+        if (eax != 0 && ebx != 0 && ecx != 0)
+            return ecx / 1000 * ebx / eax;
+    }
+    // base frequency in MHz, the TSC runs at it on invariant TSC parts
+    if (max_leaf >= 0x16) {
+        cpuid(0x16, &eax, &ebx, &ecx, &edx);
+        if ((eax & 0xffff) != 0)
+            return (eax & 0xffff) * 1000;
+    }
+    return 0;
+}
+
+/* value * factor / 2^SCALE_SHIFT without losing the top bits. In halves
+ * so both products are 32 by 32 bit, one 64 by 64 bit multiply into 128
+ * bits in long mode. */
+static uint64_t scale(uint64_t value, uint32_t factor)
+{
+#ifdef __x86_64__
+    return (uint64_t)((unsigned __int128)value * factor >> SCALE_SHIFT);
+#else
+    uint64_t high = (uint64_t)(uint32_t)(value >> 32) * factor;
+    uint64_t low = (uint64_t)(uint32_t)value * factor;
+    return (high << (32 - SCALE_SHIFT)) + (low >> SCALE_SHIFT);
+#endif
+}
+
+bool tsc_calibrate()
+{
+    uint64_t start = rdtsc();
+    if (kvmclock_tsc_khz() != 0) {
+        khz = kvmclock_tsc_khz();
+        source = TSC_SOURCE_KVMCLOCK;
+    } else if (pit_wait(CALIBRATE_MS)) {
+        // a 10 ms window stays in 32 bits below 400 GHz
+        khz = (uint32_t)(rdtsc() - start) / CALIBRATE_MS;
+        source = TSC_SOURCE_PIT;
+    } else {
+        khz = cpuid_khz();
+        source = khz != 0 ? TSC_SOURCE_CPUID : TSC_SOURCE_NONE;
+        if (khz == 0)
+            khz = 1000000;
+    }
+
+    ns_per_cycle = div_u64(1000000ull << SCALE_SHIFT, khz);
+    cycles_per_ns = div_u64((uint64_t)khz << SCALE_SHIFT, 1000000);
+    boot_tsc = rdtsc();
+    return source != TSC_SOURCE_NONE;
+}
+
+uint32_t tsc_khz()
+{
+    return khz;
+}
+
+enum tsc_source tsc_source()
+{
+    return source;
+}
+
+uint64_t tsc_now_ns()
+{
+    return scale(rdtsc() - boot_tsc, ns_per_cycle);
+}
+
+uint64_t tsc_to_ns(uint64_t cycles)
+{
+    return scale(cycles, ns_per_cycle);
+}
+
+uint64_t ns_to_tsc(uint64_t ns)
+{
+    return scale(ns, cycles_per_ns);
+}
+
+uint64_t tsc_at_ns(uint64_t ns)
+{
+    return boot_tsc + scale(ns, cycles_per_ns);
+}
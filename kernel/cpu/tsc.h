@@ -0,0 +1,31 @@
+#ifndef _KERNEL_TSC_H_
+#define _KERNEL_TSC_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Where the TSC frequency came from */
+enum tsc_source {
+    TSC_SOURCE_NONE,
+    TSC_SOURCE_PIT,
+    TSC_SOURCE_CPUID,
+    TSC_SOURCE_KVMCLOCK,
+};
+
+/* Takes the frequency kvmclock scales by when kvmclock_init() found it,
+ * else measures the TSC against the PIT, or takes what CPUID says (leaf
+ * 0x15, else the base frequency in leaf 0x16) without a PIT. The clock starts
+ * at 0 here. False when neither worked, 1 GHz is assumed then. */
+bool tsc_calibrate();
+/* TSC frequency in kHz, 0 before tsc_calibrate() */
+uint32_t tsc_khz();
+enum tsc_source tsc_source();
+
+/* Nanoseconds since tsc_calibrate(), the TSCs of all CPUs are synced */
+uint64_t tsc_now_ns();
+uint64_t tsc_to_ns(uint64_t cycles);
+uint64_t ns_to_tsc(uint64_t ns);
+/* TSC value at `ns` on the tsc_now_ns() clock */
+uint64_t tsc_at_ns(uint64_t ns);
+
+#endif
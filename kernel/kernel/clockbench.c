@@ -0,0 +1,83 @@
+#include "clockbench.h"
+#include "../cpu/kvmclock.h"
+#include "../cpu/pit.h"
+#include "../cpu/timer.h"
+#include "../cpu/tsc.h"
+#include "../libc/stdio.h"
+#include "console.h"
+#include "util.h"
+
+#define ROUNDS 10000
+/* For the clocks that exit every read */
+#define EXIT_ROUNDS 500
+
+typedef uint64_t (*clock_read_t)();
+
+/* Takes every value read so none is optimized away */
+static uint64_t sink;
+
+static uint64_t read_rdtsc()
+{
+    return rdtsc();
+}
+
+static uint64_t read_tsc_ns()
+{
+    return tsc_now_ns();
+}
+
+static uint64_t read_kvmclock()
+{
+    return kvmclock_ns();
+}
+
+static uint64_t read_realtime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.nsec;
+}
+
+static uint64_t read_pit()
+{
+    return pit_read();
+}
+
+static uint64_t read_hypercall()
+{
+    uint64_t wall_ns, tsc;
+    kvmclock_host_time(&wall_ns, &tsc);
+    return wall_ns;
+}
+
+static void run(char* name, clock_read_t read, uint32_t rounds)
+{
+    char line[64];
+    uint64_t start = rdtsc();
+    for (uint32_t round = 0; round < rounds; round++)
+        sink += read();
+    uint32_t cycles = (uint32_t)div_u64(rdtsc() - start, rounds);
+
+    snprintf(line, sizeof(line), "%-24s %8u cycles\n", name, cycles);
+    print_string(line);
+    console_flush();
+}
+
+void clock_benchmark()
+{
+    uint64_t wall_ns, tsc;
+
+    run("rdtsc", read_rdtsc, ROUNDS);
+    run("TSC nanoseconds", read_tsc_ns, ROUNDS);
+    if (kvmclock_enabled()) {
+        run(kvmclock_stable() ? "kvmclock" : "kvmclock, per CPU", read_kvmclock, ROUNDS);
+        run("clock_gettime realtime", read_realtime, ROUNDS);
+        if (kvmclock_host_time(&wall_ns, &tsc))
+            run("clock pairing hypercall", read_hypercall, EXIT_ROUNDS);
+        else
+            print_string("clock pairing hypercall  not supported by the host\n");
+    } else {
+        print_string("kvmclock                 not available\n");
+    }
+    run("PIT counter", read_pit, EXIT_ROUNDS);
+}
@@ -0,0 +1,8 @@
+#ifndef _KERNEL_CLOCKBENCH_H_
+#define _KERNEL_CLOCKBENCH_H_
+
+/* Cycles a read of each clock costs: the raw TSC, the kernel clocks on
+ * top of it, kvmclock, and the PIT and a hypercall, which exit */
+void clock_benchmark();
+
+#endif
@@ -0,0 +1,288 @@
+#include <stdint.h>
+
+#include "console.h"
+#include "../cpu/spinlock.h"
+#include "../libc/string.h"
+#include "trace.h"
+#include "vga.h"
+
+/* Once the screen reaches the end of the text buffer, this many rows
+ * ending with the screen are written again at the top, from the back
+ * buffer since reading video memory back is slow. Scrolling costs a
+ * copy of SCROLLBACK_KEEP rows every VGA_BUFFER_ROWS - SCROLLBACK_KEEP
+ * lines, and at least SCROLLBACK_KEEP - MAX_ROWS rows of history stay. */
+#define SCROLLBACK_KEEP (2 * MAX_ROWS)
+
+/* The screen and the newest history as a ring of rows. Screen row 0 is
+ * at `ring_top`, the history rows above it have negative numbers. */
+static uint16_t back_buffer[SCROLLBACK_KEEP * MAX_COLS];
+static int ring_top = 0;
+/* Row of the VGA text buffer the screen starts at. Scrolling moves it
+ * down instead of moving the text, the rows above it are the scrollback. */
+static int top_row = 0;
+/* Rows the view is scrolled back into the history */
+static int view_back = 0;
+/* Cursor position in cells, relative to the screen */
+static int cursor = 0;
+/* Bit per screen row that differs from video memory */
+static uint32_t dirty_rows = 0;
+/* The hardware cursor or start address don't match */
+static int cursor_dirty = 1;
+static int start_dirty = 1;
+static int batch_depth = 0;
+/* Threads print while the keyboard softirq echoes, everything above is
+ * only touched with it held */
+static struct spinlock console_lock;
+
+static int vga_color = WHITE_ON_BLACK;
+
+#define ALL_ROWS ((1u << MAX_ROWS) - 1)
+
+static uint16_t* row_cells(int row)
+{
+    return &back_buffer[((ring_top + row + SCROLLBACK_KEEP) % SCROLLBACK_KEEP) * MAX_COLS];
+}
+
+static uint16_t* cell_at(int cell)
+{
+    return row_cells(cell / MAX_COLS) + cell % MAX_COLS;
+}
+
+static void mark_dirty(int cell)
+{
+    dirty_rows |= 1u << (cell / MAX_COLS);
+}
+
+static void move_cursor(int cell)
+{
+    if (cell != cursor) {
+        cursor = cell;
+        cursor_dirty = 1;
+    }
+}
+
+static void flush_row(int row)
+{
+    vga_write_cells((top_row + row) * MAX_COLS, row_cells(row), MAX_COLS);
+    dirty_rows &= ~(1u << row);
+}
+
+static void flush_rows()
+{
+    while (dirty_rows != 0)
+        flush_row(__builtin_ctz(dirty_rows));
+}
+
+/* Leave the scrollback and show the live screen again */
+static void view_live()
+{
+    if (view_back != 0) {
+        view_back = 0;
+        start_dirty = 1;
+    }
+}
+
+static void scroll_ln()
+{
+    if (top_row + MAX_ROWS == VGA_BUFFER_ROWS) {
+        top_row = SCROLLBACK_KEEP - MAX_ROWS;
+        for (int row = -top_row; row < MAX_ROWS; row++)
+            vga_write_cells((top_row + row) * MAX_COLS, row_cells(row), MAX_COLS);
+        dirty_rows = 0;
+    }
+
+    // the top row becomes history, video memory needs to have it first
+    if (dirty_rows & 1)
+        flush_row(0);
+
+    top_row++;
+    ring_top = (ring_top + 1) % SCROLLBACK_KEEP;
+    dirty_rows >>= 1;
+    uint16_t* row = row_cells(MAX_ROWS - 1);
+    for (int col = 0; col < MAX_COLS; col++)
+        row[col] = VGA_CELL(' ', vga_color);
+    mark_dirty((MAX_ROWS - 1) * MAX_COLS);
+
+    start_dirty = 1;
+    cursor_dirty = 1;
+    move_cursor(cursor - MAX_COLS);
+}
+
+static void put_char(char character)
+{
+    if (cursor >= MAX_ROWS * MAX_COLS)
+        scroll_ln();
+
+    // scroll right away so the cursor stays on screen
+    if (character == '\n') {
+        move_cursor((cursor / MAX_COLS + 1) * MAX_COLS);
+        if (cursor >= MAX_ROWS * MAX_COLS)
+            scroll_ln();
+        return;
+    }
+
+    *cell_at(cursor) = VGA_CELL(character, vga_color);
+    mark_dirty(cursor);
+    move_cursor(cursor + 1);
+}
+
+static void flush()
+{
+    trace(TRACE_CONSOLE_FLUSH_BEGIN, 0, dirty_rows);
+    flush_rows();
+
+    if (start_dirty) {
+        vga_set_start((top_row - view_back) * MAX_COLS);
+        start_dirty = 0;
+    }
+    // off the screen while scrolled back, which hides it
+    if (cursor_dirty) {
+        vga_set_cursor(top_row * MAX_COLS + cursor);
+        cursor_dirty = 0;
+    }
+    trace(TRACE_CONSOLE_FLUSH_END, 0, 0);
+}
+
+/* Implicit flush at the end of every print call, output also brings the
+ * view back from the scrollback */
+static void write_done()
+{
+    view_live();
+    if (batch_depth == 0)
+        flush();
+}
+
+void console_flush()
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_batch_begin()
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    batch_depth++;
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_batch_end()
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    if (batch_depth > 0 && --batch_depth == 0)
+        flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+static void recolor_screen()
+{
+    for (int row = 0; row < MAX_ROWS; row++) {
+        uint16_t* cells = row_cells(row);
+        for (int col = 0; col < MAX_COLS; col++)
+            cells[col] = VGA_CELL(cells[col] & 0xff, vga_color);
+    }
+    dirty_rows = ALL_ROWS;
+}
+
+void set_bg_color(int bg)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    vga_color = (vga_color & 0x0f) | (bg << 4);
+    recolor_screen();
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void set_fg_color(int fg)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    vga_color = (vga_color & 0xf0) | fg;
+    recolor_screen();
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void print_string(char* string)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    for (int idx = 0; string[idx] != 0; idx++)
+        put_char(string[idx]);
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_write_line(char* string)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    if (cursor % MAX_COLS != 0)
+        put_char('\n');
+    for (int idx = 0; string[idx] != 0; idx++)
+        put_char(string[idx]);
+    put_char('\n');
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void clear_screen()
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    for (int row = 0; row < MAX_ROWS; row++) {
+        uint16_t* cells = row_cells(row);
+        for (int col = 0; col < MAX_COLS; col++)
+            cells[col] = VGA_CELL(' ', vga_color);
+    }
+    dirty_rows = ALL_ROWS;
+    move_cursor(0);
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void print_nl()
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    put_char('\n');
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void print_backspace()
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    if (cursor > 0) {
+        move_cursor(cursor - 1);
+        *cell_at(cursor) = VGA_CELL(' ', vga_color);
+        mark_dirty(cursor);
+        write_done();
+    }
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_move_cursor(int cells)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    int target = cursor + cells;
+    if (target < 0)
+        target = 0;
+    if (target >= MAX_ROWS * MAX_COLS)
+        target = MAX_ROWS * MAX_COLS - 1;
+    move_cursor(target);
+    write_done();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+void console_scroll_view(int rows)
+{
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    int target = view_back + rows;
+    if (target > top_row)
+        target = top_row;
+    if (target < 0)
+        target = 0;
+    if (target != view_back) {
+        view_back = target;
+        start_dirty = 1;
+    }
+    if (batch_depth == 0)
+        flush();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
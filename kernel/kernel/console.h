@@ -0,0 +1,36 @@
+#ifndef _KERNEL_CONSOLE_H_
+#define _KERNEL_CONSOLE_H_
+
+/* Text console. Output goes to a back buffer in RAM and the cursor is
+ * tracked in memory. Changed lines are copied to video memory and the
+ * hardware cursor is moved once per call, or once per batch. Scrolling
+ * moves the CRTC start address down the text buffer, so the lines that
+ * scrolled off stay in video memory as scrollback. */
+
+void clear_screen();
+void print_string(char* string);
+void print_nl();
+/* Prints `string` on a line of its own, a line already started, like a
+ * shell prompt, is left as it is */
+void console_write_line(char* string);
+void print_backspace();
+/* Move the cursor `cells` forward, or back when negative, without
+ * touching the text */
+void console_move_cursor(int cells);
+
+void set_bg_color(int bg);
+void set_fg_color(int fg);
+
+/* Defer the flush of every print call until the matching
+ * console_batch_end(), batches nest */
+void console_batch_begin();
+void console_batch_end();
+/* Copy dirty lines to video memory and update the hardware cursor, also
+ * inside a batch */
+void console_flush();
+
+/* Move the view `rows` further back into the scrollback, negative moves
+ * towards the live screen. Any output returns to the live screen. */
+void console_scroll_view(int rows);
+
+#endif
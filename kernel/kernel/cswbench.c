@@ -0,0 +1,113 @@
+#include <stddef.h>
+
+#include "cswbench.h"
+#include "../task/sched.h"
+#include "console.h"
+#include "util.h"
+
+#define ROUNDS 10000
+
+/* State two benchmark threads share */
+struct pingpong {
+    /* Set when the second thread couldn't be created */
+    bool abort;
+    uint32_t done;
+    uint64_t start;
+    uint64_t end;
+    /* Whose turn it is in the wait queue handoff */
+    int turn;
+    struct wait_queue queues[2];
+    /* The shell waiting for both to finish */
+    struct wait_queue done_queue;
+};
+
+struct player {
+    struct pingpong* shared;
+    int side;
+};
+
+/* The waiter is on the same CPU below both threads, it doesn't return and
+ * take `shared` off its stack before they have exited */
+static void finish(struct pingpong* shared)
+{
+    if (__atomic_add_fetch(&shared->done, 1, __ATOMIC_ACQ_REL) == 2)
+        shared->end = rdtsc();
+    wake_up(&shared->done_queue);
+}
+
+static void yield_loop(void* arg)
+{
+    struct player* player = arg;
+    if (player->side == 0)
+        player->shared->start = rdtsc();
+    for (int round = 0; round < ROUNDS && !player->shared->abort; round++)
+        thread_yield();
+    finish(player->shared);
+}
+
+static void handoff_loop(void* arg)
+{
+    struct player* player = arg;
+    struct pingpong* shared = player->shared;
+    struct wait_queue* own = &shared->queues[player->side];
+    struct wait_queue* other = &shared->queues[!player->side];
+
+    if (player->side == 0)
+        shared->start = rdtsc();
+    for (int round = 0; round < ROUNDS && !shared->abort; round++) {
+        uint32_t flags = spin_lock_irqsave(&own->lock);
+        while (__atomic_load_n(&shared->turn, __ATOMIC_ACQUIRE) != player->side)
+            flags = wait_queue_sleep(own, flags);
+        spin_unlock_irqrestore(&own->lock, flags);
+
+        __atomic_store_n(&shared->turn, !player->side, __ATOMIC_RELEASE);
+        wake_up(other);
+    }
+    finish(shared);
+}
+
+static void wait_done(struct pingpong* shared, uint32_t threads)
+{
+    struct wait_queue* queue = &shared->done_queue;
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    while (__atomic_load_n(&shared->done, __ATOMIC_ACQUIRE) < threads)
+        flags = wait_queue_sleep(queue, flags);
+    spin_unlock_irqrestore(&queue->lock, flags);
+}
+
+static void run(char* name, thread_func_t func)
+{
+    struct pingpong shared = { 0 };
+    struct player players[2] = { { &shared, 0 }, { &shared, 1 } };
+    char str[12];
+
+    wait_queue_init(&shared.queues[0]);
+    wait_queue_init(&shared.queues[1]);
+    wait_queue_init(&shared.done_queue);
+    // above everything else so the two only switch between each other
+    if (thread_create(name, func, &players[0], THREAD_PRIORITY_MAX) == NULL) {
+        print_string("Out of memory\n");
+        return;
+    }
+    if (thread_create(name, func, &players[1], THREAD_PRIORITY_MAX) == NULL) {
+        shared.abort = true;
+        wait_done(&shared, 1);
+        print_string("Out of memory\n");
+        return;
+    }
+    wait_done(&shared, 2);
+
+    // 2 * ROUNDS switches, kcycles keep it in 32 bits
+    uint32_t kcycles = (uint32_t)((shared.end - shared.start) >> 10);
+    print_string(name);
+    print_string(": ");
+    int_to_string(kcycles * 1024 / (2 * ROUNDS), str);
+    print_string(str);
+    print_string(" cycles per switch\n");
+}
+
+void context_switch_benchmark()
+{
+    run("yield", yield_loop);
+    run("wait queue", handoff_loop);
+}
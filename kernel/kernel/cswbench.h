@@ -0,0 +1,8 @@
+#ifndef _KERNEL_CSWBENCH_H_
+#define _KERNEL_CSWBENCH_H_
+
+/* Time thread switches on the calling CPU: two threads yielding to each
+ * other and two handing a turn back and forth through wait queues */
+void context_switch_benchmark();
+
+#endif
@@ -0,0 +1,68 @@
+#include "histogram.h"
+#include "../libc/string.h"
+#include "console.h"
+#include "util.h"
+
+void histogram_record(struct histogram* hist, uint32_t value)
+{
+    int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+    if (bucket >= HISTOGRAM_BUCKETS)
+        bucket = HISTOGRAM_BUCKETS - 1;
+    hist->buckets[bucket]++;
+    hist->count++;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+void histogram_reset(struct histogram* hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+void histogram_merge(struct histogram* into, const struct histogram* from)
+{
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+        into->buckets[bucket] += from->buckets[bucket];
+    into->count += from->count;
+    if (from->max > into->max)
+        into->max = from->max;
+}
+
+uint32_t histogram_percentile(const struct histogram* hist, uint32_t permille)
+{
+    if (hist->count == 0)
+        return 0;
+
+    // split so the product stays in 32 bits
+    uint32_t target = hist->count / 1000 * permille + hist->count % 1000 * permille / 1000;
+    uint32_t seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += hist->buckets[bucket];
+        if (seen > target) {
+            uint32_t upper = bucket == 0 ? 0 : (1u << bucket) - 1;
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static void print_value(char* label, uint32_t value)
+{
+    char str[12];
+    print_string(label);
+    uint_to_string(value, str);
+    print_string(str);
+}
+
+void histogram_print(char* name, const struct histogram* hist, char* unit)
+{
+    print_string(name);
+    print_value(": count ", hist->count);
+    print_value(", p50 ", histogram_percentile(hist, 500));
+    print_value(", p99 ", histogram_percentile(hist, 990));
+    print_value(", p99.9 ", histogram_percentile(hist, 999));
+    print_value(", max ", hist->max);
+    print_string(" ");
+    print_string(unit);
+    print_nl();
+}
@@ -0,0 +1,26 @@
+#ifndef _KERNEL_HISTOGRAM_H_
+#define _KERNEL_HISTOGRAM_H_
+
+#include <stdint.h>
+
+#define HISTOGRAM_BUCKETS 32
+
+/* Power of two histogram like the host's. Bucket n counts values in
+ * [2^(n-1), 2^n), recording one is a bit scan and an increment. Each
+ * histogram has a single writer, on one CPU with interrupts off. */
+struct histogram {
+    uint32_t buckets[HISTOGRAM_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+};
+
+void histogram_record(struct histogram* hist, uint32_t value);
+void histogram_reset(struct histogram* hist);
+/* Adds `from` to `into` */
+void histogram_merge(struct histogram* into, const struct histogram* from);
+/* Upper bound of the bucket holding the `permille` (0-1000) */
+uint32_t histogram_percentile(const struct histogram* hist, uint32_t permille);
+/* One line: count, p50, p99, p99.9 and max in `unit` */
+void histogram_print(char* name, const struct histogram* hist, char* unit);
+
+#endif
@@ -1,18 +1,68 @@
+#include "../cpu/fpu.h"
+#include "../cpu/gdt.h"
 #include "../cpu/isr.h"
+#include "../cpu/smp.h"
+#include "../cpu/timer.h"
+#include "../libc/string.h"
+#include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/vmm.h"
+#include "../task/sched.h"
+#include "../task/softirq.h"
+#include "../task/syscall.h"
+#include "../task/user.h"
+#include "console.h"
 #include "keyboard.h"
-#include "vga.h"
+#include "printk.h"
+#include "serial.h"
+#include "shell.h"
+#include "trace.h"
 
 void main()
 {
+    trace_init();
     clear_screen();
-    print_string("Installing interrupt service routines (ISRs).\n");
+    serial_init();
+    printk(LOG_INFO, "Initializing the physical memory manager.");
+    pmm_init();
+    slab_init();
+
+    printk(LOG_INFO, "Enabling paging.");
+    vmm_init();
+
+    printk(LOG_INFO, "Installing interrupt service routines (ISRs).");
     isr_install();
 
-    print_string("Enabling external interrupts.\n");
+    printk(LOG_INFO, "Setting up user mode and system calls.");
+    gdt_init();
+    syscall_init();
+    user_init();
+
+    printk(LOG_INFO, "Enabling external interrupts.");
     asm volatile("sti");
 
-    print_string("Initializing keyboard (IRQ 1).\n");
+    printk(LOG_INFO, "Initializing keyboard (IRQ 1).");
     init_keyboard();
 
+    // the APs enable it too before they run anything
+    if (fpu_init())
+        string_use_simd(fpu_features() & FPU_AVX ? STRING_SIMD_AVX : STRING_SIMD_SSE);
+
+    printk(LOG_INFO, "Calibrating the TSC.");
+    timer_init();
+
+    printk(LOG_INFO, "Starting the scheduler.");
+    sched_init();
+    softirq_init_cpu();
+    printk_init();
+
+    printk(LOG_INFO, "Starting application processors.");
+    smp_init();
+    printk(LOG_INFO, "%d CPUs online.", cpu_count);
+
+    // the prompt goes after the boot messages
+    printk_flush();
+    shell_start();
     print_string("> ");
+    sched_idle();
 }
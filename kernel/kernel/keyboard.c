@@ -1,15 +1,33 @@
 #include "keyboard.h"
 #include "../cpu/isr.h"
-#include "shell.h"
+#include "../libc/ring.h"
+#include "../task/softirq.h"
+#include "console.h"
+#include "tty.h"
 #include "util.h"
-#include "vga.h"
 
 #define BACKSPACE 0x0E
 #define LSHIFT 0x2A
 #define ENTER 0x1C
+#define PAGE_UP 0x49
+#define PAGE_DOWN 0x51
+#define HOME 0x47
+#define LEFT 0x4B
+#define RIGHT 0x4D
+#define END 0x4F
+#define DELETE 0x53
+#define EXTENDED 0xE0
 
-static char key_buffer[256];
-static uint8_t shit_down = 0;
+/* Rows Page Up/Down scroll, a screen less a line kept for context */
+#define PAGE_ROWS 24
+
+/* Only the keyboard softirq reads and writes it, one CPU at a time */
+static bool shift_down = false;
+
+/* Scancodes the interrupt read and the softirq hasn't handled yet */
+#define SCANCODE_RING_SIZE 256
+static uint32_t scancode_entries[SCANCODE_RING_SIZE];
+static struct ring scancodes;
 
 #define SC_MAX 57
 
@@ -30,43 +48,86 @@ const char sc_ascii_upper[] = { '?', '?', '!', '@', '#', '$', '%', '^',
     'H', 'J', 'K', 'L', ':', '"', '|', '?', '\\', 'Z', 'X', 'C', 'V',
     'B', 'N', 'M', '<', '>', '?', '?', '?', '?', ' ' };
 
-static void keyboard_callback(registers_t* regs)
+/* False when the tty is full, the scancode is handled again later */
+static bool handle_scancode(uint8_t scancode)
 {
-    uint8_t scancode = port_byte_in(0x60);
     uint8_t keyup = scancode & 0x80;
     uint8_t base_key = scancode & 0x7f;
 
+    // the arrows and the block above them send it first, they map to
+    // the same keys as the keypad
+    if (scancode == EXTENDED)
+        return true;
+
     if (base_key == LSHIFT) {
         if (keyup)
-            shit_down = 0;
+            shift_down = false;
         else
-            shit_down = 1;
-        return;
+            shift_down = true;
+        return true;
     }
 
-    if (scancode > SC_MAX)
-        return;
-    if (scancode == BACKSPACE) {
-        if (backspace(key_buffer)) {
-            print_backspace();
-        }
-    } else if (scancode == ENTER) {
-        print_nl();
-        execute_command(key_buffer);
-        key_buffer[0] = '\0';
-    } else {
-        char letter;
-        if (shit_down)
-            letter = sc_ascii_upper[(int)scancode];
-        else
-            letter = sc_ascii[(int)scancode];
-        append(key_buffer, letter);
-        char str[2] = { letter, '\0' };
-        print_string(str);
+    if (scancode == PAGE_UP) {
+        console_scroll_view(PAGE_ROWS);
+        return true;
+    } else if (scancode == PAGE_DOWN) {
+        console_scroll_view(-PAGE_ROWS);
+        return true;
     }
+
+    if (scancode == LEFT)
+        return tty_input(TTY_KEY_LEFT);
+    if (scancode == RIGHT)
+        return tty_input(TTY_KEY_RIGHT);
+    if (scancode == HOME)
+        return tty_input(TTY_KEY_HOME);
+    if (scancode == END)
+        return tty_input(TTY_KEY_END);
+    if (scancode == DELETE)
+        return tty_input(TTY_KEY_DELETE);
+
+    if (scancode > SC_MAX)
+        return true;
+    if (scancode == BACKSPACE)
+        return tty_input('\b');
+    if (scancode == ENTER)
+        return tty_input('\n');
+    if (shift_down)
+        return tty_input(sc_ascii_upper[(int)scancode]);
+    return tty_input(sc_ascii[(int)scancode]);
+}
+
+/* Echoes a whole burst of keys, a paste too, with one cursor update.
+ * Stops at a key the tty has no room for, which stays in the ring. */
+static void keyboard_softirq()
+{
+    uint32_t scancode;
+    console_batch_begin();
+    while (ring_peek(&scancodes, &scancode) && handle_scancode(scancode))
+        ring_pop(&scancodes, &scancode);
+    // the shell may be in the middle of a batch of its own
+    console_flush();
+    console_batch_end();
+}
+
+/* A reader emptied some of the tty, from the shell thread on this CPU */
+static void keyboard_room()
+{
+    softirq_raise(SOFTIRQ_KEYBOARD);
+}
+
+/* Only reads the controller, keys typed while the ring is full are lost */
+static void keyboard_callback(registers_t* regs)
+{
+    ring_push(&scancodes, port_byte_in(0x60));
+    softirq_raise(SOFTIRQ_KEYBOARD);
 }
 
 void init_keyboard()
 {
+    ring_init(&scancodes, scancode_entries, SCANCODE_RING_SIZE);
+    tty_init(keyboard_room);
+    softirq_register(SOFTIRQ_KEYBOARD, keyboard_softirq);
     register_interrupt_handler(IRQ1, keyboard_callback);
+    set_interrupt_name(IRQ1, "keyboard");
 }
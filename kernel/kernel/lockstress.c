@@ -0,0 +1,250 @@
+#include "lockstress.h"
+#include "../cpu/atomic.h"
+#include "../cpu/seqlock.h"
+#include "../cpu/smp.h"
+#include "../cpu/spinlock.h"
+#include "../cpu/ticketlock.h"
+#include "../libc/ring.h"
+#include "../libc/stdio.h"
+#include "../mm/slab.h"
+#include "console.h"
+#include "util.h"
+
+/* Per CPU and test */
+#define ROUNDS 5000
+/* Small so the producers fill the rings and wait for the consumer */
+#define RING_SIZE 64
+/* Seqlock rounds that write, one in this many */
+#define WRITE_EVERY 4
+
+struct stress_job {
+    int cpus;
+
+    struct spinlock spinlock;
+    struct ticket_lock ticket_lock;
+    uint32_t spin_count;
+    uint32_t ticket_count;
+
+    uint32_t atomic_count;
+    uint32_t cmpxchg_count;
+
+    struct seqlock seqlock;
+    /* Always written the same, a reader seeing them differ got a torn
+     * copy past read_seqretry() */
+    uint32_t low;
+    uint32_t high;
+    uint32_t reads;
+    uint32_t retries;
+    uint32_t torn;
+
+    struct mpsc_ring mpsc;
+    struct mpsc_slot mpsc_slots[RING_SIZE];
+    struct ring spsc;
+    uint32_t spsc_entries[RING_SIZE];
+    /* Values the consumer got, and those out of order for their producer */
+    uint32_t received;
+    uint32_t misordered;
+};
+
+static void stress_locks(void* arg)
+{
+    struct stress_job* job = (struct stress_job*)arg;
+    for (int round = 0; round < ROUNDS; round++) {
+        uint32_t flags = spin_lock_irqsave(&job->spinlock);
+        job->spin_count++;
+        spin_unlock_irqrestore(&job->spinlock, flags);
+
+        flags = ticket_lock_irqsave(&job->ticket_lock);
+        job->ticket_count++;
+        ticket_unlock_irqrestore(&job->ticket_lock, flags);
+    }
+}
+
+static void stress_atomics(void* arg)
+{
+    struct stress_job* job = (struct stress_job*)arg;
+    for (int round = 0; round < ROUNDS; round++) {
+        atomic_inc(&job->atomic_count);
+
+        uint32_t old = atomic_read(&job->cmpxchg_count);
+        while (!atomic_cmpxchg(&job->cmpxchg_count, &old, old + 1))
+            cpu_relax();
+    }
+}
+
+static void stress_seqlock(void* arg)
+{
+    struct stress_job* job = (struct stress_job*)arg;
+    uint32_t cpu = this_cpu()->id;
+
+    for (uint32_t round = 0; round < ROUNDS; round++) {
+        if (round % WRITE_EVERY == 0) {
+            uint32_t value = cpu << 16 | round;
+            uint32_t flags = write_seqlock_irqsave(&job->seqlock);
+            __atomic_store_n(&job->low, value, __ATOMIC_RELAXED);
+            __atomic_store_n(&job->high, value, __ATOMIC_RELAXED);
+            write_sequnlock_irqrestore(&job->seqlock, flags);
+            continue;
+        }
+
+        uint32_t seq, low, high;
+        bool retry = false;
+        do {
+            if (retry)
+                atomic_inc(&job->retries);
+            seq = read_seqbegin(&job->seqlock);
+            low = __atomic_load_n(&job->low, __ATOMIC_RELAXED);
+            high = __atomic_load_n(&job->high, __ATOMIC_RELAXED);
+            retry = true;
+        } while (read_seqretry(&job->seqlock, seq));
+        atomic_inc(&job->reads);
+        if (low != high)
+            atomic_inc(&job->torn);
+    }
+}
+
+/* Takes everything queued, checking each producer's values come in the
+ * order it pushed them */
+static void drain_mpsc(struct stress_job* job, uint32_t* expected)
+{
+    uint32_t value;
+    while (mpsc_ring_pop(&job->mpsc, &value)) {
+        uint32_t producer = value >> 16;
+        if (producer >= SMP_MAX_CPUS || (value & 0xffff) != expected[producer])
+            job->misordered++;
+        else
+            expected[producer]++;
+        job->received++;
+    }
+}
+
+/* Every CPU produces, CPU 0 consumes as well */
+static void stress_mpsc(void* arg)
+{
+    struct stress_job* job = (struct stress_job*)arg;
+    uint32_t cpu = this_cpu()->id;
+    uint32_t expected[SMP_MAX_CPUS] = { 0 };
+    uint32_t total = job->cpus * ROUNDS;
+
+    for (uint32_t round = 0; round < ROUNDS;) {
+        if (mpsc_ring_push(&job->mpsc, cpu << 16 | round))
+            round++;
+        else if (cpu != 0)
+            cpu_relax();
+        if (cpu == 0)
+            drain_mpsc(job, expected);
+    }
+    if (cpu != 0)
+        return;
+    while (job->received < total) {
+        drain_mpsc(job, expected);
+        cpu_relax();
+    }
+}
+
+/* CPU 1 produces, CPU 0 consumes */
+static void stress_spsc(void* arg)
+{
+    struct stress_job* job = (struct stress_job*)arg;
+    uint32_t value;
+
+    if (this_cpu()->id == 1) {
+        for (uint32_t round = 0; round < ROUNDS;) {
+            if (ring_push(&job->spsc, round))
+                round++;
+            else
+                cpu_relax();
+        }
+        return;
+    }
+
+    while (job->received < ROUNDS) {
+        if (!ring_pop(&job->spsc, &value)) {
+            cpu_relax();
+            continue;
+        }
+        if (value != job->received)
+            job->misordered++;
+        job->received++;
+    }
+}
+
+static void print_result(char* name, bool ok, char* details)
+{
+    char line[128];
+    snprintf(line, sizeof(line), "%-12s %s, %s\n", name, ok ? "OK" : "FAIL", details);
+    print_string(line);
+    // a test can take long under contention, show each as it ends
+    console_flush();
+}
+
+static void print_lock_result(char* name, uint32_t count, struct lock_stats* stats)
+{
+    char details[96];
+    uint32_t expected = ROUNDS * (uint32_t)cpu_count;
+    uint32_t wait = stats->contended == 0 ? 0 : (uint32_t)div_u64(stats->wait_cycles, stats->contended);
+    uint32_t hold = (uint32_t)div_u64(stats->hold_cycles, stats->acquired);
+
+    snprintf(details, sizeof(details), "%u taken, %u contended", stats->acquired, stats->contended);
+    print_result(name, count == expected && stats->acquired == expected, details);
+    snprintf(details, sizeof(details), "             wait %u, hold %u, max hold %llu cycles\n", wait, hold,
+        (unsigned long long)stats->max_hold_cycles);
+    print_string(details);
+}
+
+void lock_stress()
+{
+    char details[96];
+    struct stress_job* job = kmalloc(sizeof(struct stress_job));
+    if (job == NULL) {
+        print_string("Out of memory\n");
+        return;
+    }
+    job->cpus = cpu_count;
+    uint32_t expected = ROUNDS * (uint32_t)cpu_count;
+
+    spin_lock_init(&job->spinlock);
+    ticket_lock_init(&job->ticket_lock);
+    job->spin_count = 0;
+    job->ticket_count = 0;
+    smp_call(cpu_count, stress_locks, job);
+    print_lock_result("spinlock", job->spin_count, &job->spinlock.stats);
+    print_lock_result("ticket lock", job->ticket_count, &job->ticket_lock.stats);
+
+    job->atomic_count = 0;
+    job->cmpxchg_count = 0;
+    smp_call(cpu_count, stress_atomics, job);
+    snprintf(details, sizeof(details), "%u increments, %u compare and swaps", job->atomic_count,
+        job->cmpxchg_count);
+    print_result("atomics", job->atomic_count == expected && job->cmpxchg_count == expected, details);
+
+    seqlock_init(&job->seqlock);
+    job->low = 0;
+    job->high = 0;
+    job->reads = 0;
+    job->retries = 0;
+    job->torn = 0;
+    smp_call(cpu_count, stress_seqlock, job);
+    snprintf(details, sizeof(details), "%u reads, %u retries, %u torn", job->reads, job->retries, job->torn);
+    print_result("seqlock", job->torn == 0, details);
+
+    mpsc_ring_init(&job->mpsc, job->mpsc_slots, RING_SIZE);
+    job->received = 0;
+    job->misordered = 0;
+    smp_call(cpu_count, stress_mpsc, job);
+    snprintf(details, sizeof(details), "%u values from %d CPUs, %u out of order", job->received, cpu_count,
+        job->misordered);
+    print_result("mpsc ring", job->received == expected && job->misordered == 0, details);
+
+    if (cpu_count < 2) {
+        print_result("spsc ring", true, "skipped, needs 2 CPUs");
+    } else {
+        ring_init(&job->spsc, job->spsc_entries, RING_SIZE);
+        job->received = 0;
+        job->misordered = 0;
+        smp_call(2, stress_spsc, job);
+        snprintf(details, sizeof(details), "%u values, %u out of order", job->received, job->misordered);
+        print_result("spsc ring", job->received == ROUNDS && job->misordered == 0, details);
+    }
+    kfree(job);
+}
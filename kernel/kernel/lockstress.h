@@ -0,0 +1,9 @@
+#ifndef _KERNEL_LOCKSTRESS_H_
+#define _KERNEL_LOCKSTRESS_H_
+
+/* Hammers the spinlock, the ticket lock, the atomics, a seqlock and both
+ * lock-free rings from every CPU at once, checks nothing was lost or torn
+ * and prints the contention the locks counted */
+void lock_stress();
+
+#endif
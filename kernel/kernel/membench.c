@@ -0,0 +1,166 @@
+#include "membench.h"
+#include "../cpu/fpu.h"
+#include "../libc/string.h"
+#include "../mm/pmm.h"
+#include "console.h"
+#include "util.h"
+
+/* Source and destination buffer, each half of the pages */
+#define SCRATCH_ORDER 2
+#define SCRATCH_SIZE ((PAGE_SIZE << SCRATCH_ORDER) / 2)
+
+/* Calls timed together, the best of the rounds is reported */
+#define CALLS 16
+#define ROUNDS 8
+
+enum bench_op {
+    OP_BYTE_LOOP,
+    OP_MEMCPY,
+    OP_MEMCPY_SSE,
+    OP_MEMCPY_AVX,
+    OP_MEMMOVE,
+    OP_MEMSET,
+    OP_MEMCMP,
+    OP_STRLEN,
+    OP_STRCMP,
+    OP_COUNT,
+};
+
+static char* op_names[OP_COUNT] = { "bytes", "memcpy", "sse", "avx", "memmove", "memset",
+    "memcmp", "strlen", "strcmp" };
+
+static const int sizes[] = { 16, 256, 3840, 4096 };
+
+static char* src;
+static char* dest;
+
+/* What the kernel used to do, volatile keeps it a byte loop */
+static void byte_copy(volatile char* to, const char* from, int size)
+{
+    for (int idx = 0; idx < size; idx++)
+        to[idx] = from[idx];
+}
+
+static void run_op(enum bench_op op, int size)
+{
+    switch (op) {
+    case OP_BYTE_LOOP:
+        byte_copy(dest, src, size);
+        break;
+    case OP_MEMCPY:
+    case OP_MEMCPY_SSE:
+    case OP_MEMCPY_AVX:
+        memcpy(dest, src, size);
+        break;
+    case OP_MEMMOVE:
+        // overlapping and backwards like scrolling up would be
+        memmove(src + 4, src, size);
+        break;
+    case OP_MEMSET:
+        memset(dest, 0, size);
+        break;
+    case OP_MEMCMP:
+        memcmp(dest, src, size);
+        break;
+    case OP_STRLEN:
+        strlen(src);
+        break;
+    case OP_STRCMP:
+        strcmp(dest, src);
+        break;
+    default:
+        break;
+    }
+}
+
+/* Cycles per byte in hundredths */
+static uint32_t measure(enum bench_op op, int size)
+{
+    uint32_t best = 0xffffffff;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        // equal strings of `size` bytes, memmove shifts src around
+        memset(src, 'a', size);
+        memset(dest, 'a', size);
+        src[size - 1] = '\0';
+        dest[size - 1] = '\0';
+
+        uint64_t start = rdtsc();
+        for (int call = 0; call < CALLS; call++)
+            run_op(op, size);
+        uint32_t cycles = (uint32_t)(rdtsc() - start);
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return best / CALLS * 100 / size;
+}
+
+/* Right aligned, with at least one space in front */
+static void print_column(char* str, int width)
+{
+    print_string(" ");
+    for (int pad = width - 1 - string_length(str); pad > 0; pad--)
+        print_string(" ");
+    print_string(str);
+}
+
+static void print_hundredths(uint32_t value, int width)
+{
+    char str[16];
+    int_to_string(value / 100, str);
+    int len = string_length(str);
+    str[len] = '.';
+    str[len + 1] = '0' + value / 10 % 10;
+    str[len + 2] = '0' + value % 10;
+    str[len + 3] = '\0';
+    print_column(str, width);
+}
+
+void mem_benchmark()
+{
+    enum string_simd simd = string_simd();
+    uint32_t features = fpu_features();
+    char str[12];
+
+    uintptr_t scratch = pmm_alloc_pages(SCRATCH_ORDER);
+    if (scratch == 0) {
+        print_string("Out of memory\n");
+        return;
+    }
+    src = (char*)scratch;
+    dest = src + SCRATCH_SIZE;
+
+    print_string("Cycles per byte, best of ");
+    int_to_string(ROUNDS, str);
+    print_string(str);
+    print_string(" rounds\n");
+    print_column("size", 5);
+    for (int op = 0; op < OP_COUNT; op++)
+        print_column(op_names[op], 8);
+    print_nl();
+
+    for (unsigned idx = 0; idx < sizeof(sizes) / sizeof(sizes[0]); idx++) {
+        int size = sizes[idx];
+        int_to_string(size, str);
+        print_column(str, 5);
+        for (int op = 0; op < OP_COUNT; op++) {
+            if ((op == OP_MEMCPY_SSE && !(features & FPU_SSE2)) || (op == OP_MEMCPY_AVX && !(features & FPU_AVX))) {
+                print_column("-", 8);
+                continue;
+            }
+            if (op == OP_MEMCPY_SSE)
+                string_use_simd(STRING_SIMD_SSE);
+            else if (op == OP_MEMCPY_AVX)
+                string_use_simd(STRING_SIMD_AVX);
+            else
+                string_use_simd(STRING_SIMD_NONE);
+            print_hundredths(measure(op, size), 8);
+        }
+        print_nl();
+        console_flush();
+    }
+
+    string_use_simd(simd);
+    pmm_free_pages(scratch, SCRATCH_ORDER);
+}
@@ -0,0 +1,8 @@
+#ifndef _KERNEL_MEMBENCH_H_
+#define _KERNEL_MEMBENCH_H_
+
+/* Time the libc memory and string functions against a plain byte loop
+ * and print cycles per byte for a few sizes */
+void mem_benchmark();
+
+#endif
@@ -0,0 +1,92 @@
+#include "parallel.h"
+#include "../cpu/smp.h"
+#include "console.h"
+#include "util.h"
+
+/* Numbers handed out at a time, small enough to balance the CPUs */
+#define PRIMES_CHUNK 1024
+
+struct primes_job {
+    uint32_t limit;
+    /* Next number nobody has taken yet */
+    uint32_t next;
+    uint32_t counts[SMP_MAX_CPUS];
+};
+
+static bool is_prime(uint32_t n)
+{
+    if (n < 2)
+        return false;
+    for (uint32_t div = 2; div * div <= n; div++) {
+        if (n % div == 0)
+            return false;
+    }
+    return true;
+}
+
+static void count_primes(void* arg)
+{
+    struct primes_job* job = (struct primes_job*)arg;
+    uint32_t count = 0;
+
+    // chunks are taken dynamically, the larger numbers cost more
+    while (1) {
+        uint32_t start = __atomic_fetch_add(&job->next, PRIMES_CHUNK, __ATOMIC_RELAXED);
+        if (start > job->limit)
+            break;
+        uint32_t end = start + PRIMES_CHUNK;
+        for (uint32_t n = start; n < end && n <= job->limit; n++) {
+            if (is_prime(n))
+                count++;
+        }
+    }
+
+    job->counts[this_cpu()->id] = count;
+}
+
+static void print_int(int value)
+{
+    char str[12];
+    int_to_string(value, str);
+    print_string(str);
+}
+
+void parallel_primes(uint32_t limit)
+{
+    uint32_t single = 0;
+
+    for (int count = 1; count <= cpu_count; count++) {
+        struct primes_job job;
+        job.limit = limit;
+        job.next = 0;
+        for (int id = 0; id < SMP_MAX_CPUS; id++)
+            job.counts[id] = 0;
+
+        uint64_t start = rdtsc();
+        smp_call(count, count_primes, &job);
+        // in units of 1024 cycles so it fits 32 bits
+        uint32_t kcycles = (uint32_t)((rdtsc() - start) >> 10);
+        if (kcycles == 0)
+            kcycles = 1;
+
+        uint32_t primes = 0;
+        for (int id = 0; id < count; id++)
+            primes += job.counts[id];
+        if (count == 1)
+            single = kcycles;
+        uint32_t speedup = single * 100 / kcycles;
+
+        print_int(count);
+        print_string(" CPUs: ");
+        print_int(primes);
+        print_string(" primes, ");
+        print_int(kcycles);
+        print_string(" kcycles, speedup ");
+        print_int(speedup / 100);
+        print_string(speedup % 100 < 10 ? ".0" : ".");
+        print_int(speedup % 100);
+        print_nl();
+        // runs take a while, show each one as it finishes
+        console_flush();
+    }
+}
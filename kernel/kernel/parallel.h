@@ -0,0 +1,10 @@
+#ifndef _KERNEL_PARALLEL_H_
+#define _KERNEL_PARALLEL_H_
+
+#include <stdint.h>
+
+/* Count the primes up to `limit` on 1..cpu_count CPUs and print how the
+ * run time scales */
+void parallel_primes(uint32_t limit);
+
+#endif
@@ -0,0 +1,98 @@
+#include "pmmbench.h"
+#include "../mm/pmm.h"
+#include "console.h"
+#include "util.h"
+
+/* Addresses of the allocated blocks, one page holds them all */
+#define BLOCKS (PAGE_SIZE / sizeof(uintptr_t))
+
+enum free_pattern {
+    /* Newest first, each free merges with the block freed before it */
+    FREE_LIFO,
+    /* Oldest first, merges happen only once both buddies are back */
+    FREE_FIFO,
+};
+
+static void print_result(char* name, uint32_t cycles, uint32_t count)
+{
+    char str[12];
+    print_string(name);
+    int_to_string(cycles / count, str);
+    print_string(str);
+    print_string(" cycles");
+}
+
+/* Allocate `count` blocks of `order` and free them again */
+static void bench_order(uintptr_t* blocks, unsigned order, uint32_t count, enum free_pattern pattern)
+{
+    char str[12];
+    uint32_t allocated = 0;
+
+    uint64_t start = rdtsc();
+    for (; allocated < count; allocated++) {
+        if ((blocks[allocated] = pmm_alloc_pages(order)) == 0)
+            break;
+    }
+    uint32_t alloc_cycles = (uint32_t)(rdtsc() - start);
+
+    start = rdtsc();
+    for (uint32_t idx = 0; idx < allocated; idx++) {
+        uint32_t block = pattern == FREE_LIFO ? allocated - 1 - idx : idx;
+        pmm_free_pages(blocks[block], order);
+    }
+    uint32_t free_cycles = (uint32_t)(rdtsc() - start);
+
+    print_string("order ");
+    int_to_string(order, str);
+    print_string(str);
+    print_string(" x");
+    int_to_string(allocated, str);
+    print_string(str);
+    print_string(pattern == FREE_LIFO ? " lifo: " : " fifo: ");
+    if (allocated == 0) {
+        print_string("out of memory\n");
+        return;
+    }
+    print_result("alloc ", alloc_cycles, allocated);
+    print_result(", free ", free_cycles, allocated);
+    print_nl();
+    console_flush();
+}
+
+/* An allocation immediately freed again, the common case */
+static void bench_pairs(unsigned order, uint32_t count)
+{
+    char str[12];
+
+    uint64_t start = rdtsc();
+    for (uint32_t idx = 0; idx < count; idx++)
+        pmm_free_pages(pmm_alloc_pages(order), order);
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+
+    print_string("order ");
+    int_to_string(order, str);
+    print_string(str);
+    print_result(" alloc+free pair: ", cycles, count);
+    print_nl();
+}
+
+void pmm_benchmark()
+{
+    uint32_t free_before = pmm_free_page_count();
+    uintptr_t table = pmm_alloc_pages(0);
+    if (table == 0) {
+        print_string("Out of memory\n");
+        return;
+    }
+    uintptr_t* blocks = (uintptr_t*)table;
+
+    bench_order(blocks, 0, BLOCKS, FREE_LIFO);
+    bench_order(blocks, 0, BLOCKS, FREE_FIFO);
+    bench_order(blocks, 3, BLOCKS / 8, FREE_LIFO);
+    bench_order(blocks, 3, BLOCKS / 8, FREE_FIFO);
+    bench_order(blocks, PMM_MAX_ORDER, 8, FREE_FIFO);
+    bench_pairs(0, BLOCKS);
+
+    pmm_free_pages(table, 0);
+    print_string(pmm_free_page_count() == free_before ? "All pages returned\n" : "Pages leaked!\n");
+}
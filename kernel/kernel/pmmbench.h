@@ -0,0 +1,8 @@
+#ifndef _KERNEL_PMMBENCH_H_
+#define _KERNEL_PMMBENCH_H_
+
+/* Time page allocations and frees of a few orders and patterns and check
+ * that every page comes back */
+void pmm_benchmark();
+
+#endif
@@ -0,0 +1,121 @@
+#include <stdarg.h>
+
+#include "printk.h"
+#include "../cpu/smp.h"
+#include "../cpu/spinlock.h"
+#include "../cpu/timer.h"
+#include "../libc/stdio.h"
+#include "../libc/string.h"
+#include "../task/softirq.h"
+#include "console.h"
+#include "serial.h"
+#include "util.h"
+
+/* Sequence number n lives in slot n % LOG_RECORDS. Writers claim numbers
+ * by bumping log_head, so one that is slow to fill in its record only
+ * holds up the readers, never another writer. */
+static struct log_record ring[LOG_RECORDS];
+static uint32_t log_head = 0;
+
+/* The first record the consoles haven't shown, taken in order by
+ * whoever holds drain_lock */
+static uint32_t console_seq = 0;
+static struct spinlock drain_lock;
+static bool deferred = false;
+
+void printk(enum log_level level, const char* format, ...)
+{
+    char text[LOG_LINE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    if (length >= LOG_LINE_LENGTH)
+        length = LOG_LINE_LENGTH - 1;
+    if (length > 0 && text[length - 1] == '\n')
+        text[--length] = '\0';
+
+    // the consoles stop at a claimed record until it's written, an
+    // interrupt can't get in between to hold them up
+    uint32_t flags = irq_save();
+    uint32_t seq = __atomic_fetch_add(&log_head, 1, __ATOMIC_RELAXED);
+    struct log_record* record = &ring[seq % LOG_RECORDS];
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->level = level;
+    // only the BSP runs before smp_init(), maybe without the LAPIC mapped
+    record->cpu = cpu_count > 0 ? this_cpu()->id : 0;
+    record->length = length;
+    record->time_ns = now_ns();
+    memcpy(record->text, text, length + 1);
+    __atomic_store_n(&record->seq, seq + 1, __ATOMIC_RELEASE);
+    irq_restore(flags);
+
+    if (level <= LOG_WARN || !deferred)
+        printk_flush();
+    else if (level <= LOG_CONSOLE_LEVEL)
+        softirq_raise(SOFTIRQ_LOG);
+}
+
+bool log_read(uint32_t* seq, struct log_record* record)
+{
+    while (1) {
+        uint32_t head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+        // the ones before were written over
+        if (head - *seq > LOG_RECORDS)
+            *seq = head - LOG_RECORDS;
+        if (*seq == head)
+            return false;
+
+        struct log_record* slot = &ring[*seq % LOG_RECORDS];
+        uint32_t tag = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (tag == *seq + 1) {
+            memcpy(record, slot, sizeof(*record));
+            // a writer that got the slot meanwhile cleared the tag first
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == tag) {
+                record->text[LOG_LINE_LENGTH - 1] = '\0';
+                (*seq)++;
+                return true;
+            }
+        }
+        // written over, the check above skips ahead, or not written yet
+        head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+        if (head - *seq <= LOG_RECORDS)
+            return false;
+    }
+}
+
+int log_format(const struct log_record* record, char* buffer, int size)
+{
+    uint32_t seconds = div_u64(record->time_ns, NSEC_PER_SEC);
+    uint32_t micros = div_u64(record->time_ns - (uint64_t)seconds * NSEC_PER_SEC, 1000);
+    return snprintf(buffer, size, "[%5u.%06u] %s", seconds, micros, record->text);
+}
+
+void printk_flush()
+{
+    struct log_record record;
+    char line[LOG_LINE_LENGTH + 16];
+
+    // a record at a time, interrupts are only off while one is written
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&drain_lock);
+        bool found = log_read(&console_seq, &record);
+        if (found && record.level <= LOG_CONSOLE_LEVEL) {
+            console_write_line(record.text);
+            log_format(&record, line, sizeof(line));
+            serial_write(line);
+            serial_write("\n");
+        }
+        spin_unlock_irqrestore(&drain_lock, flags);
+        if (!found)
+            return;
+    }
+}
+
+void printk_init()
+{
+    softirq_register(SOFTIRQ_LOG, printk_flush);
+    deferred = true;
+}
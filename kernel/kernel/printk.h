@@ -0,0 +1,52 @@
+#ifndef _KERNEL_PRINTK_H_
+#define _KERNEL_PRINTK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kernel log. printk() formats a line into a ring of records that any
+ * CPU or interrupt handler writes without a lock, the consoles catch up
+ * with it later from the log softirq. The last LOG_RECORDS lines stay for
+ * dmesg. */
+
+enum log_level {
+    LOG_ERR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+};
+
+/* Levels up to this one go to the consoles, the rest only to the ring */
+#define LOG_CONSOLE_LEVEL LOG_INFO
+
+/* A power of two */
+#define LOG_RECORDS 128
+#define LOG_LINE_LENGTH 80
+
+struct log_record {
+    /* 0 while being written, else the sequence number plus one */
+    uint32_t seq;
+    uint8_t level;
+    uint8_t cpu;
+    uint16_t length;
+    uint64_t time_ns;
+    char text[LOG_LINE_LENGTH];
+};
+
+/* A format of libc/stdio.h, a record per call and longer lines are cut,
+ * a trailing newline is dropped. Errors and warnings reach the consoles
+ * before it returns, it's then fine with a run queue lock held. */
+void printk(enum log_level level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+/* Hands the consoles to the log softirq, until then printk() writes them
+ * itself. After softirq_init_cpu(). */
+void printk_init();
+/* Writes whatever the consoles haven't shown yet */
+void printk_flush();
+
+/* Copies record `*seq`, or the oldest after it still in the ring, and
+ * moves `*seq` past it. False once the next one isn't written yet. */
+bool log_read(uint32_t* seq, struct log_record* record);
+/* "[seconds.microseconds] text" */
+int log_format(const struct log_record* record, char* buffer, int size);
+
+#endif
@@ -0,0 +1,71 @@
+#include "serial.h"
+#include "util.h"
+
+#define COM1 0x3f8
+#define UART_DATA 0
+#define UART_IER 1
+#define UART_FCR 2
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+#define UART_MSR 6
+
+#define LCR_DLAB 0x80
+#define LCR_8N1 0x03
+#define FCR_ENABLE_CLEAR 0x07
+#define MCR_DTR_RTS 0x03
+#define MCR_OUTPUTS 0x0f
+#define MCR_LOOPBACK 0x10
+#define MSR_INPUTS 0xf0
+#define LSR_THR_EMPTY 0x20
+
+/* 115200 divided by the baud rate */
+#define DIVISOR 1
+/* A stuck UART drops the character rather than hanging the caller */
+#define SEND_SPINS 100000
+
+static bool present = false;
+
+bool serial_init()
+{
+    // in loopback mode the modem control outputs come back as the status
+    // inputs. A port nothing answers on reads as junk or as whatever was
+    // last written, neither follows both patterns.
+    port_byte_out(COM1 + UART_MCR, MCR_LOOPBACK);
+    if ((port_byte_in(COM1 + UART_MSR) & MSR_INPUTS) != 0)
+        return false;
+    port_byte_out(COM1 + UART_MCR, MCR_LOOPBACK | MCR_OUTPUTS);
+    if ((port_byte_in(COM1 + UART_MSR) & MSR_INPUTS) != MSR_INPUTS)
+        return false;
+
+    port_byte_out(COM1 + UART_IER, 0);
+    port_byte_out(COM1 + UART_LCR, LCR_DLAB);
+    port_byte_out(COM1 + UART_DATA, DIVISOR & 0xff);
+    port_byte_out(COM1 + UART_IER, DIVISOR >> 8);
+    port_byte_out(COM1 + UART_LCR, LCR_8N1);
+    port_byte_out(COM1 + UART_FCR, FCR_ENABLE_CLEAR);
+    port_byte_out(COM1 + UART_MCR, MCR_DTR_RTS);
+    present = true;
+    return true;
+}
+
+static void send(char c)
+{
+    for (int spin = 0; spin < SEND_SPINS; spin++) {
+        if (port_byte_in(COM1 + UART_LSR) & LSR_THR_EMPTY) {
+            port_byte_out(COM1 + UART_DATA, c);
+            return;
+        }
+    }
+}
+
+void serial_write(char* string)
+{
+    if (!present)
+        return;
+    for (; *string != '\0'; string++) {
+        if (*string == '\n')
+            send('\r');
+        send(*string);
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef _KERNEL_SERIAL_H_
+#define _KERNEL_SERIAL_H_
+
+#include <stdbool.h>
+
+/* COM1 as an output only console, polled. True if there's a UART, it's
+ * then set to 115200 baud 8N1. */
+bool serial_init();
+/* Newlines go out as CR LF */
+void serial_write(char* string);
+
+#endif
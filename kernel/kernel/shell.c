@@ -1,5 +1,33 @@
 #include "shell.h"
-#include "vga.h"
+#include "../cpu/fpu.h"
+#include "../cpu/isr.h"
+#include "../cpu/kvmclock.h"
+#include "../cpu/smp.h"
+#include "../cpu/timer.h"
+#include "../libc/stdio.h"
+#include "../mm/memory_map.h"
+#include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/vmm.h"
+#include "../task/sched.h"
+#include "../task/softirq.h"
+#include "../task/user.h"
+#include "clockbench.h"
+#include "console.h"
+#include "cswbench.h"
+#include "lockstress.h"
+#include "membench.h"
+#include "parallel.h"
+#include "pmmbench.h"
+#include "printk.h"
+#include "slabbench.h"
+#include "tty.h"
+
+// ACPI power off as QEMU and the KVM host implement it
+#define POWER_OFF_PORT 0x604
+#define POWER_OFF_VALUE 0x2000
+
+#define PRIMES_DEFAULT_LIMIT 1000000
 
 void execute_fcol(char* input)
 {
@@ -19,10 +47,384 @@ void execute_bcol(char* input)
     set_bg_color(value);
 }
 
-void execute_command(char* input)
+void execute_primes(char* input)
+{
+    // offset to "PRIMES ", the limit is optional
+    int limit = PRIMES_DEFAULT_LIMIT;
+    if (string_starts_with(input, "PRIMES ") == 0)
+        limit = string_to_int(input + 7);
+    parallel_primes(limit);
+}
+
+void execute_cpus()
+{
+    char str[12];
+    for (int id = 0; id < cpu_count; id++) {
+        print_string("CPU ");
+        int_to_string(id, str);
+        print_string(str);
+        print_string(": APIC ID ");
+        int_to_string(cpus[id].apic_id, str);
+        print_string(str);
+        print_string(", ");
+        int_to_string(cpus[id].ticks, str);
+        print_string(str);
+        print_string(" timer interrupts\n");
+    }
+
+    uint32_t features = fpu_features();
+    print_string("FPU: x87");
+    if (features & FPU_SSE2)
+        print_string(" SSE2");
+    if (features & FPU_XSAVE)
+        print_string(" XSAVE");
+    if (features & FPU_AVX)
+        print_string(" AVX");
+    print_nl();
+}
+
+void execute_meminfo()
+{
+    struct memory_map* map = BOOT_MEMORY_MAP;
+    char str[12];
+
+    for (uint32_t idx = 0; idx < map->count; idx++) {
+        struct e820_entry* entry = &map->entries[idx];
+        // the map is only printed up to 4 GiB
+        hex_to_string((uint32_t)entry->base, str);
+        print_string(str);
+        print_string(" - ");
+        hex_to_string((uint32_t)(entry->base + entry->length - 1), str);
+        print_string(str);
+        print_string(entry->type == E820_RAM ? " RAM " : " reserved ");
+        int_to_string((uint32_t)(entry->length >> 10), str);
+        print_string(str);
+        print_string(" KiB\n");
+    }
+
+    print_string("Free pages: ");
+    int_to_string(pmm_free_page_count(), str);
+    print_string(str);
+    print_string(" of ");
+    int_to_string(pmm_total_page_count(), str);
+    print_string(str);
+    print_string("\nFree blocks by order:");
+    for (unsigned order = 0; order <= PMM_MAX_ORDER; order++) {
+        print_string(" ");
+        int_to_string(pmm_free_block_count(order), str);
+        print_string(str);
+    }
+    print_nl();
+}
+
+/* Right aligned in `width` columns */
+static void print_column(uint32_t value, int width)
+{
+    char str[12];
+    int_to_string(value, str);
+    for (int pad = width - string_length(str); pad > 0; pad--)
+        print_string(" ");
+    print_string(str);
+}
+
+void execute_slabinfo()
+{
+    print_string("cache          size  per slab  active   total  slabs  frag%   allocs\n");
+    for (struct kmem_cache* cache = kmem_caches; cache != NULL; cache = cache->next) {
+        uint32_t total = cache->slab_count * cache->objects_per_slab;
+        // the part of the slab pages not holding a live object
+        uint32_t slab_bytes = cache->slab_count * PAGE_SIZE;
+        uint32_t waste = slab_bytes - cache->active_objects * cache->object_size;
+        uint32_t frag = slab_bytes == 0 ? 0 : waste / ((slab_bytes + 99) / 100);
+
+        print_string((char*)cache->name);
+        for (int pad = 12 - string_length((char*)cache->name); pad > 0; pad--)
+            print_string(" ");
+        print_column(cache->object_size, 6);
+        print_column(cache->objects_per_slab, 10);
+        print_column(cache->active_objects, 8);
+        print_column(total, 8);
+        print_column(cache->slab_count, 7);
+        print_column(frag, 7);
+        print_column(cache->allocs, 9);
+        print_nl();
+    }
+}
+
+void execute_vminfo()
+{
+    struct vmm_info info;
+    char str[12];
+
+    vmm_get_info(&info);
+    print_string(LARGE_PAGE_SIZE == 4 << 20 ? "4 MiB pages: " : "2 MiB pages: ");
+    int_to_string(info.large_pages, str);
+    print_string(str);
+    print_string(", page tables: ");
+    int_to_string(info.page_tables, str);
+    print_string(str);
+    print_string(", lazy faults: ");
+    int_to_string(info.lazy_faults, str);
+    print_string(str);
+    print_string("\nGlobal pages ");
+    print_string(info.global_pages ? "on" : "off");
+    print_string(", VGA text ");
+    print_string(info.write_combining ? "write combining\n" : "uncached\n");
+}
+
+#define PS_MAX_THREADS 64
+
+static char* state_names[] = { "running", "ready", "blocked", "sleeping", "dead" };
+
+void execute_ps()
+{
+    struct thread_info* threads = kmalloc(PS_MAX_THREADS * sizeof(struct thread_info));
+    if (threads == NULL) {
+        print_string("Out of memory\n");
+        return;
+    }
+    int count = sched_thread_info(threads, PS_MAX_THREADS);
+
+    print_string("  ID  CPU  PRI  STATE     SWITCHES     KCYCLES  NAME\n");
+    for (int idx = 0; idx < count; idx++) {
+        struct thread_info* thread = &threads[idx];
+        print_column(thread->id, 4);
+        print_column(thread->cpu, 5);
+        print_column(thread->priority, 5);
+        print_string("  ");
+        print_string(state_names[thread->state]);
+        for (int pad = 8 - string_length(state_names[thread->state]); pad > 0; pad--)
+            print_string(" ");
+        print_column(thread->switches, 10);
+        print_column((uint32_t)(thread->cycles >> 10), 12);
+        print_string("  ");
+        print_string(thread->name);
+        print_nl();
+    }
+    kfree(threads);
+}
+
+void execute_irqlat(char* input)
+{
+    if (compare_string(input, "IRQLAT RESET") == 0) {
+        isr_reset_stats();
+        softirq_reset_stats();
+        return;
+    }
+
+    char name[] = "CPU 0 irq off";
+    char delay_name[] = "CPU 0 softirq delay";
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        name[4] = '0' + cpu;
+        delay_name[4] = '0' + cpu;
+        histogram_print(name, isr_irq_off(cpu), "cycles");
+        histogram_print(delay_name, softirq_delay(cpu), "cycles");
+    }
+}
+
+static void print_interrupt_row(char* label, uint32_t* counts, char* name)
+{
+    for (int pad = 4 - string_length(label); pad > 0; pad--)
+        print_string(" ");
+    print_string(label);
+    print_string(":");
+    for (int cpu = 0; cpu < cpu_count; cpu++)
+        print_column(counts[cpu], 10);
+    print_string("  ");
+    print_string(name);
+    print_nl();
+}
+
+/* Like /proc/interrupts, then how long the IRQ handlers took and how late
+ * they ran, over all CPUs */
+void execute_interrupts()
+{
+    uint32_t counts[SMP_MAX_CPUS];
+    char label[12];
+    // "IRQ 15 " and the longest vector name, "Coprocessor Segment Overrun"
+    char name[40];
+
+    print_string("     ");
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        print_string("      CPU");
+        print_column(cpu, 1);
+    }
+    print_nl();
+
+    for (int vector = 0; vector < ISR_COUNTED_VECTORS; vector++) {
+        uint32_t total = 0;
+        for (int cpu = 0; cpu < cpu_count; cpu++) {
+            counts[cpu] = isr_stats(cpu)->count[vector];
+            total += counts[cpu];
+        }
+        if (total == 0)
+            continue;
+
+        char* vector_name = interrupt_name(vector);
+        if (vector >= IRQ0 && vector <= IRQ15)
+            snprintf(name, sizeof(name), "IRQ %d%s%s", vector - IRQ0, vector_name != NULL ? " " : "",
+                vector_name != NULL ? vector_name : "");
+        else
+            snprintf(name, sizeof(name), "%s", vector_name != NULL ? vector_name : "");
+        int_to_string(vector, label);
+        print_interrupt_row(label, counts, name);
+    }
+    for (int cpu = 0; cpu < cpu_count; cpu++)
+        counts[cpu] = isr_stats(cpu)->spurious;
+    print_interrupt_row("SPU", counts, "spurious");
+
+    for (int irq = 0; irq < ISR_TIMED_VECTORS; irq++) {
+        struct histogram handler;
+        struct histogram latency;
+        histogram_reset(&handler);
+        histogram_reset(&latency);
+        for (int cpu = 0; cpu < cpu_count; cpu++) {
+            histogram_merge(&handler, &isr_stats(cpu)->handler[irq]);
+            histogram_merge(&latency, &isr_stats(cpu)->latency[irq]);
+        }
+        if (handler.count == 0)
+            continue;
+
+        snprintf(name, sizeof(name), "%d handler", IRQ0 + irq);
+        histogram_print(name, &handler, "cycles");
+        if (latency.count == 0)
+            continue;
+        snprintf(name, sizeof(name), "%d latency", IRQ0 + irq);
+        histogram_print(name, &latency, "cycles");
+    }
+}
+
+/* UTC date and time of `sec` since 1970, Howard Hinnant's days to civil
+ * date conversion */
+static void print_date(uint64_t sec)
+{
+    char line[32];
+    uint32_t days = (uint32_t)div_u64(sec, 86400);
+    uint32_t time = (uint32_t)(sec - (uint64_t)days * 86400);
+    // eras of 400 years from March 1st of year 0
+    uint32_t shifted = days + 719468;
+    uint32_t era = shifted / 146097;
+    uint32_t day_of_era = shifted - era * 146097;
+    uint32_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    uint32_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    uint32_t month_index = (5 * day_of_year + 2) / 153;
+    uint32_t day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    uint32_t month = month_index < 10 ? month_index + 3 : month_index - 9;
+    uint32_t year = year_of_era + era * 400 + (month <= 2);
+
+    snprintf(line, sizeof(line), "%u-%02u-%02u %02u:%02u:%02u UTC", year, month, day, time / 3600, time / 60 % 60,
+        time % 60);
+    print_string(line);
+}
+
+void execute_clock()
+{
+    struct timer_info info;
+    struct timespec now;
+    char str[12];
+    char line[64];
+
+    timer_get_info(&info);
+    print_string("Uptime: ");
+    int_to_string((uint32_t)div_u64(now_ns(), NSEC_PER_MSEC), str);
+    print_string(str);
+    print_string(" ms\nTSC: ");
+    int_to_string(info.tsc_khz, str);
+    print_string(str);
+    if (info.kvmclock)
+        print_string(" kHz, from kvmclock\n");
+    else
+        print_string(info.pit_calibrated ? " kHz, calibrated against the PIT\n" : " kHz, not from the PIT\n");
+    if (info.kvmclock) {
+        print_string(kvmclock_stable() ? "Clock: kvmclock, one for all CPUs\n"
+                                       : "Clock: kvmclock per CPU, kept monotonic\n");
+        clock_gettime(CLOCK_REALTIME, &now);
+        print_string("Wall clock: ");
+        print_date(now.sec);
+        print_nl();
+
+        // an exit, the host reads its clock right then
+        uint64_t host_ns, tsc;
+        if (kvmclock_host_time(&host_ns, &tsc)) {
+            uint64_t guest_ns = kvmclock_wall_ns();
+            uint64_t apart = host_ns > guest_ns ? host_ns - guest_ns : guest_ns - host_ns;
+            snprintf(line, sizeof(line), "Host clock by hypercall: %s%u us from the wall clock\n",
+                host_ns > guest_ns ? "+" : "-", (uint32_t)div_u64(apart, 1000));
+            print_string(line);
+        }
+    } else {
+        print_string("Clock: TSC\n");
+    }
+    print_string(info.deadline_mode ? "LAPIC timer: TSC deadline\n" : "LAPIC timer: one-shot\n");
+    for (int cpu = 0; cpu < cpu_count; cpu++) {
+        print_string("CPU ");
+        int_to_string(cpu, str);
+        print_string(str);
+        print_string(": ");
+        int_to_string(info.armed[cpu], str);
+        print_string(str);
+        print_string(" timers armed, ");
+        int_to_string(cpus[cpu].ticks, str);
+        print_string(str);
+        print_string(" timer interrupts\n");
+    }
+}
+
+void execute_sleep(char* input)
+{
+    char str[12];
+    uint64_t start = now_ns();
+
+    thread_sleep(string_to_int(input + 6) * NSEC_PER_MSEC);
+    print_string("Slept ");
+    int_to_string((uint32_t)div_u64(now_ns() - start, 1000), str);
+    print_string(str);
+    print_string(" us\n");
+}
+
+void execute_run(char* input)
+{
+    char str[12];
+    int exit_code;
+
+    if (string_starts_with(input, "RUN ") == 0 && user_run(input + 4, &exit_code)) {
+        if (exit_code != 0) {
+            print_string("Exit code ");
+            int_to_string(exit_code, str);
+            print_string(str);
+            print_nl();
+        }
+        return;
+    }
+
+    print_string("Programs:");
+    for (int idx = 0; user_program_name(idx) != NULL; idx++) {
+        print_string(" ");
+        print_string(user_program_name(idx));
+    }
+    print_nl();
+}
+
+/* The whole kernel log still in the ring, debug messages too */
+void execute_dmesg()
+{
+    struct log_record record;
+    char line[LOG_LINE_LENGTH + 16];
+
+    for (uint32_t seq = 0; log_read(&seq, &record);) {
+        log_format(&record, line, sizeof(line));
+        print_string(line);
+        print_nl();
+    }
+}
+
+static void run_command(char* input)
 {
     if (compare_string(input, "EXIT") == 0) {
         print_string("Stopping the CPU. Bye!\n");
+        console_flush();
+        // with an in-kernel APIC a halted CPU never exits to the host
+        port_word_out(POWER_OFF_PORT, POWER_OFF_VALUE);
         asm volatile("hlt");
     } else if (compare_string(input, "CLEAR") == 0) {
         clear_screen();
@@ -36,9 +438,103 @@ void execute_command(char* input)
         execute_bcol(input);
         print_string("> ");
         return;
+    } else if (compare_string(input, "CPUS") == 0) {
+        execute_cpus();
+        print_string("> ");
+        return;
+    } else if (string_starts_with(input, "PRIMES") == 0) {
+        execute_primes(input);
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "MEMBENCH") == 0) {
+        mem_benchmark();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "MEMINFO") == 0) {
+        execute_meminfo();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "PMMBENCH") == 0) {
+        pmm_benchmark();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "SLABINFO") == 0) {
+        execute_slabinfo();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "SLABSTRESS") == 0) {
+        slab_stress();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "LOCKSTRESS") == 0) {
+        lock_stress();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "VMINFO") == 0) {
+        execute_vminfo();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "PS") == 0) {
+        execute_ps();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "CSWBENCH") == 0) {
+        context_switch_benchmark();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "CLOCK") == 0) {
+        execute_clock();
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "CLOCKBENCH") == 0) {
+        clock_benchmark();
+        print_string("> ");
+        return;
+    } else if (string_starts_with(input, "SLEEP ") == 0) {
+        execute_sleep(input);
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "INTERRUPTS") == 0) {
+        execute_interrupts();
+        print_string("> ");
+        return;
+    } else if (string_starts_with(input, "IRQLAT") == 0) {
+        execute_irqlat(input);
+        print_string("> ");
+        return;
+    } else if (compare_string(input, "DMESG") == 0) {
+        execute_dmesg();
+        print_string("> ");
+        return;
+    } else if (string_starts_with(input, "RUN") == 0) {
+        execute_run(input);
+        print_string("> ");
+        return;
     }
 
     print_string("Unknown command: ");
     print_string(input);
     print_string("\n> ");
 }
+
+void execute_command(char* input)
+{
+    // the whole output of a command moves the hardware cursor once
+    console_batch_begin();
+    run_command(input);
+    console_batch_end();
+}
+
+static void shell_thread(void* arg)
+{
+    char line[TTY_LINE_MAX + 1];
+    while (1) {
+        tty_read_line(line, sizeof(line));
+        execute_command(line);
+    }
+}
+
+void shell_start()
+{
+    thread_create("shell", shell_thread, NULL, THREAD_PRIORITY_DEFAULT);
+}
@@ -1,9 +1,12 @@
 #ifndef _KERNEL_SHELL_H_
 #define _KERNEL_SHELL_H_
 
+#include "console.h"
 #include "util.h"
-#include "vga.h"
 
 void execute_command(char* input);
+/* Runs typed commands in a thread of their own on the calling CPU, which
+ * has to be the one taking keyboard interrupts */
+void shell_start();
 
 #endif
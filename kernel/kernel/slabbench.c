@@ -0,0 +1,160 @@
+#include "slabbench.h"
+#include "../cpu/tsc.h"
+#include "../libc/string.h"
+#include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "console.h"
+#include "util.h"
+
+/* Live objects at most, the pointer table fills a page */
+#define SLOTS (PAGE_SIZE / sizeof(void*))
+#define MIX_OPS 50000
+#define PAIRS 10000
+
+static uint32_t random_state = 1;
+
+/* LCG from Numerical Recipes, plenty for picking slots */
+static uint32_t next_random()
+{
+    random_state = random_state * 1664525 + 1013904223;
+    return random_state;
+}
+
+/* Log-uniform between 1 and KMALLOC_MAX_SIZE so every cache sees traffic */
+static uint32_t random_size(uint32_t random)
+{
+    uint32_t mask = (8u << ((random >> 24) % KMALLOC_CACHES)) - 1;
+    return 1 + ((random >> 8) & mask);
+}
+
+static uint8_t pattern(uint32_t slot)
+{
+    return (uint8_t)(slot * 7 + 1);
+}
+
+static bool check_pattern(uint8_t* object, uint32_t size, uint8_t fill)
+{
+    for (uint32_t idx = 0; idx < size; idx++) {
+        if (object[idx] != fill)
+            return false;
+    }
+    return true;
+}
+
+static void print_rate(uint64_t cycles, uint32_t count)
+{
+    char str[12];
+    uint32_t per_op = div_u64(cycles, count);
+
+    int_to_string(per_op, str);
+    print_string(str);
+    print_string(" cycles");
+
+    uint32_t khz = tsc_khz();
+    if (khz != 0 && per_op != 0) {
+        print_string(", ");
+        int_to_string(div_u64((uint64_t)khz * 1000, per_op), str);
+        print_string(str);
+        print_string("/s");
+    }
+    print_nl();
+}
+
+/* The fast path, the same object keeps coming back */
+static void bench_pairs(uint32_t size)
+{
+    char str[12];
+
+    uint64_t start = rdtsc();
+    for (uint32_t idx = 0; idx < PAIRS; idx++)
+        kfree(kmalloc(size));
+    uint64_t cycles = rdtsc() - start;
+
+    print_string("kmalloc(");
+    int_to_string(size, str);
+    print_string(str);
+    print_string(")+kfree: ");
+    print_rate(cycles, PAIRS);
+}
+
+static void free_slot(void** objects, uint16_t* sizes, uint32_t slot, uint32_t* corrupt)
+{
+    if (!check_pattern(objects[slot], sizes[slot], pattern(slot)))
+        (*corrupt)++;
+    kfree(objects[slot]);
+    objects[slot] = NULL;
+}
+
+/* Cached empty slabs would look like a leak */
+static void shrink_caches()
+{
+    for (struct kmem_cache* cache = kmem_caches; cache != NULL; cache = cache->next)
+        kmem_cache_shrink(cache);
+}
+
+void slab_stress()
+{
+    char str[12];
+    shrink_caches();
+    uint32_t free_before = pmm_free_page_count();
+
+    void** objects = kmalloc(SLOTS * sizeof(void*));
+    uint16_t* sizes = kmalloc(SLOTS * sizeof(uint16_t));
+    if (objects == NULL || sizes == NULL) {
+        kfree(objects);
+        kfree(sizes);
+        print_string("Out of memory\n");
+        return;
+    }
+    memset(objects, 0, SLOTS * sizeof(void*));
+
+    bench_pairs(32);
+    bench_pairs(KMALLOC_MAX_SIZE);
+    console_flush();
+
+    uint32_t allocs = 0, failed = 0, corrupt = 0;
+    uint64_t start = rdtsc();
+    for (uint32_t op = 0; op < MIX_OPS; op++) {
+        uint32_t random = next_random();
+        uint32_t slot = (random >> 4) % SLOTS;
+        if (objects[slot] != NULL) {
+            free_slot(objects, sizes, slot, &corrupt);
+            continue;
+        }
+        uint32_t size = random_size(random);
+        if ((objects[slot] = kmalloc(size)) == NULL) {
+            failed++;
+            continue;
+        }
+        sizes[slot] = size;
+        memset(objects[slot], pattern(slot), size);
+        allocs++;
+    }
+    uint64_t cycles = rdtsc() - start;
+
+    for (uint32_t slot = 0; slot < SLOTS; slot++) {
+        if (objects[slot] != NULL)
+            free_slot(objects, sizes, slot, &corrupt);
+    }
+    kfree(objects);
+    kfree(sizes);
+
+    print_string("Random mix, ");
+    int_to_string(MIX_OPS, str);
+    print_string(str);
+    print_string(" ops with fill and check: ");
+    print_rate(cycles, MIX_OPS);
+    print_string("Allocations: ");
+    int_to_string(allocs, str);
+    print_string(str);
+    print_string(", failed: ");
+    int_to_string(failed, str);
+    print_string(str);
+    print_string(", corrupted: ");
+    int_to_string(corrupt, str);
+    print_string(str);
+    print_nl();
+
+    shrink_caches();
+    print_string(pmm_free_page_count() == free_before ? "All pages returned\n" : "Pages leaked!\n");
+}
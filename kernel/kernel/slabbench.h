@@ -0,0 +1,9 @@
+#ifndef _KERNEL_SLABBENCH_H_
+#define _KERNEL_SLABBENCH_H_
+
+/* Random kmalloc/kfree traffic over a table of live objects, checks
+ * every object still holds its fill pattern when it is freed and
+ * reports the allocation rate */
+void slab_stress();
+
+#endif
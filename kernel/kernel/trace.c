@@ -0,0 +1,34 @@
+#include "trace.h"
+#include "../cpu/smp.h"
+#include "../cpu/spinlock.h"
+#include "../libc/string.h"
+#include "util.h"
+
+/* Below 1 MiB, between the boot stack and the EBDA, the PMM doesn't hand
+ * it out */
+#define BUFFER ((struct trace_buffer*)TRACE_ADDRESS)
+
+void trace_init()
+{
+    memset(BUFFER->cpus, 0, sizeof(BUFFER->cpus));
+    __atomic_store_n(&BUFFER->magic, TRACE_MAGIC, __ATOMIC_RELEASE);
+}
+
+void trace(enum trace_id id, uint16_t arg0, uint32_t arg1)
+{
+    if (!__atomic_load_n(&BUFFER->enabled, __ATOMIC_RELAXED))
+        return;
+
+    // an interrupt tracing in between would take the same slot
+    uint32_t flags = irq_save();
+    // only the BSP runs before smp_init(), maybe without the LAPIC mapped
+    struct trace_cpu* cpu = &BUFFER->cpus[cpu_count > 0 ? this_cpu()->id : 0];
+    uint32_t head = cpu->head;
+    struct trace_event* event = &cpu->events[head % TRACE_EVENTS];
+    event->tsc = rdtsc();
+    event->id = id;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+    __atomic_store_n(&cpu->head, head + 1, __ATOMIC_RELEASE);
+    irq_restore(flags);
+}
@@ -0,0 +1,57 @@
+#ifndef _KERNEL_TRACE_H_
+#define _KERNEL_TRACE_H_
+
+#include <stdint.h>
+
+/* Tracepoints into a ring per CPU at a fixed physical address. The KVM
+ * host reads them straight out of guest memory and merges them with its
+ * own exits into one timeline, see kvm/trace.c which has a copy of the
+ * layout. Nothing is written until the host sets `enabled`, a disabled
+ * tracepoint is a load and a branch. */
+#define TRACE_ADDRESS 0x90000
+#define TRACE_MAGIC 0x45435254
+#define TRACE_MAX_CPUS 8
+/* A power of two */
+#define TRACE_EVENTS 256
+
+enum trace_id {
+    TRACE_IRQ_ENTER = 1, /* arg0 vector */
+    TRACE_IRQ_EXIT,
+    TRACE_SOFTIRQ_ENTER, /* arg1 pending softirqs */
+    TRACE_SOFTIRQ_EXIT,
+    TRACE_SCHED_SWITCH, /* arg0 previous thread, arg1 next thread */
+    TRACE_SCHED_WAKEUP, /* arg0 its CPU, arg1 thread */
+    TRACE_CONSOLE_FLUSH_BEGIN, /* arg1 bit per screen row copied */
+    TRACE_CONSOLE_FLUSH_END,
+};
+
+struct trace_event {
+    uint64_t tsc;
+    uint16_t id;
+    uint16_t arg0;
+    uint32_t arg1;
+};
+
+struct trace_cpu {
+    /* Events written, the next goes to events[head % TRACE_EVENTS]. Only
+     * the CPU itself writes here, the host reads while the vCPU is out of
+     * the guest. */
+    uint32_t head;
+    uint32_t reserved[15];
+    struct trace_event events[TRACE_EVENTS];
+};
+
+struct trace_buffer {
+    /* Set by trace_init() */
+    uint32_t magic;
+    /* Set by the host */
+    uint32_t enabled;
+    uint32_t reserved[14];
+    struct trace_cpu cpus[TRACE_MAX_CPUS];
+};
+
+/* Before the first tracepoint, it leaves `enabled` as the host set it */
+void trace_init();
+void trace(enum trace_id id, uint16_t arg0, uint32_t arg1);
+
+#endif
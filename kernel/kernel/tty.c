@@ -0,0 +1,149 @@
+#include <stdint.h>
+
+#include "tty.h"
+#include "../task/sched.h"
+#include "console.h"
+
+#define INPUT_MASK (TTY_INPUT_SIZE - 1)
+
+/* Lines waiting to be read, then the line being edited. The indexes run
+ * freely and wrap. Only the keyboard softirq edits and only readers move
+ * read_pos, the lock of `readers` covers all of it. */
+static char input[TTY_INPUT_SIZE];
+static uint32_t read_pos;
+/* End of the last line ended with Enter */
+static uint32_t line_start;
+static uint32_t line_length;
+/* Where the next key goes, 0 to line_length */
+static uint32_t line_cursor;
+/* A key was refused, tell the keyboard when there's room */
+static bool stalled;
+
+static struct wait_queue readers;
+static tty_room_t room_callback;
+
+#define AT(pos) input[(pos) & INPUT_MASK]
+
+void tty_init(tty_room_t room)
+{
+    wait_queue_init(&readers);
+    room_callback = room;
+}
+
+/* Redraws the line from `from` on, blanking `erase` cells past its end
+ * for what was deleted, and leaves the cursor at `from` */
+static void echo_tail(uint32_t from, int erase)
+{
+    char str[TTY_LINE_MAX + 2];
+    int length = 0;
+    for (uint32_t idx = from; idx < line_length; idx++)
+        str[length++] = AT(line_start + idx);
+    for (int idx = 0; idx < erase; idx++)
+        str[length++] = ' ';
+    str[length] = '\0';
+    print_string(str);
+    console_move_cursor(-length);
+}
+
+static void insert(char character)
+{
+    for (uint32_t idx = line_length; idx > line_cursor; idx--)
+        AT(line_start + idx) = AT(line_start + idx - 1);
+    AT(line_start + line_cursor) = character;
+    line_length++;
+    line_cursor++;
+
+    char str[2] = { character, '\0' };
+    print_string(str);
+    // typing at the end, pasting too, doesn't go over the rest again
+    if (line_cursor < line_length)
+        echo_tail(line_cursor, 0);
+}
+
+/* Removes the character at `at` and redraws from there */
+static void erase(uint32_t at)
+{
+    for (uint32_t idx = at; idx + 1 < line_length; idx++)
+        AT(line_start + idx) = AT(line_start + idx + 1);
+    line_length--;
+    echo_tail(at, 1);
+}
+
+static void move(int cells)
+{
+    line_cursor += cells;
+    console_move_cursor(cells);
+}
+
+static void end_line()
+{
+    AT(line_start + line_length) = '\n';
+    console_move_cursor(line_length - line_cursor);
+    print_nl();
+    line_start += line_length + 1;
+    line_length = 0;
+    line_cursor = 0;
+}
+
+bool tty_input(int key)
+{
+    uint32_t flags = spin_lock_irqsave(&readers.lock);
+    // the newline ending the line needs room too
+    bool full = line_start + line_length + 1 - read_pos >= TTY_INPUT_SIZE;
+
+    if (key == '\n') {
+        end_line();
+    } else if (key == '\b') {
+        if (line_cursor > 0) {
+            move(-1);
+            erase(line_cursor);
+        }
+    } else if (key == TTY_KEY_DELETE) {
+        if (line_cursor < line_length)
+            erase(line_cursor);
+    } else if (key == TTY_KEY_LEFT) {
+        if (line_cursor > 0)
+            move(-1);
+    } else if (key == TTY_KEY_RIGHT) {
+        if (line_cursor < line_length)
+            move(1);
+    } else if (key == TTY_KEY_HOME) {
+        move(-(int)line_cursor);
+    } else if (key == TTY_KEY_END) {
+        move(line_length - line_cursor);
+    } else if (full) {
+        stalled = true;
+        spin_unlock_irqrestore(&readers.lock, flags);
+        return false;
+    } else if (line_length < TTY_LINE_MAX) {
+        insert(key);
+    }
+
+    spin_unlock_irqrestore(&readers.lock, flags);
+    if (key == '\n')
+        wake_up(&readers);
+    return true;
+}
+
+int tty_read_line(char* line, int size)
+{
+    uint32_t flags = spin_lock_irqsave(&readers.lock);
+    while (read_pos == line_start)
+        flags = wait_queue_sleep(&readers, flags);
+
+    int length = 0;
+    char character;
+    while ((character = AT(read_pos++)) != '\n') {
+        if (length < size - 1)
+            line[length++] = character;
+    }
+    line[length] = '\0';
+
+    bool room = stalled;
+    stalled = false;
+    spin_unlock_irqrestore(&readers.lock, flags);
+
+    if (room && room_callback != 0)
+        room_callback();
+    return length;
+}
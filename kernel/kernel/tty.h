@@ -0,0 +1,31 @@
+#ifndef _KERNEL_TTY_H_
+#define _KERNEL_TTY_H_
+
+#include <stdbool.h>
+
+/* Bytes of typed input held for readers, a power of two */
+#define TTY_INPUT_SIZE 4096
+/* Longest line, characters typed past it are refused */
+#define TTY_LINE_MAX 255
+
+/* Editing keys, past the characters */
+#define TTY_KEY_LEFT 0x100
+#define TTY_KEY_RIGHT 0x101
+#define TTY_KEY_HOME 0x102
+#define TTY_KEY_END 0x103
+#define TTY_KEY_DELETE 0x104
+
+/* Called by a reader once it made room after tty_input() refused a key */
+typedef void (*tty_room_t)();
+
+void tty_init(tty_room_t room);
+/* A character, '\b', '\n' or a TTY_KEY_ from the keyboard, echoed as it
+ * is edited. False when the input is full and the key should be handed
+ * in again once `room` is called. Batch the console around bursts of
+ * keys so the cursor moves once. */
+bool tty_input(int key);
+/* Sleeps until a line has been typed and copies it without the newline,
+ * cut at `size` - 1 characters. Returns its length. */
+int tty_read_line(char* line, int size);
+
+#endif
@@ -1,4 +1,5 @@
 #include "util.h"
+#include "../libc/string.h"
 
 // in instruction
 uint8_t port_byte_in(uint16_t port)
@@ -14,12 +15,36 @@ void port_byte_out(uint16_t port, uint8_t data)
     __asm__("out %%al, %%dx" : : "a"(data), "d"(port));
 }
 
+void port_word_out(uint16_t port, uint16_t data)
+{
+    __asm__("out %%ax, %%dx" : : "a"(data), "d"(port));
+}
+
+uint64_t rdtsc()
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+uint64_t div_u64(uint64_t dividend, uint32_t divisor)
+{
+#ifdef __x86_64__
+    return dividend / divisor;
+#else
+    uint32_t high = dividend >> 32;
+    uint32_t remainder = high % divisor;
+    uint32_t low;
+    // the remainder of the high half is below the divisor, so the low
+    // half of the quotient fits divl
+    asm("divl %2" : "=a"(low), "+d"(remainder) : "rm"(divisor), "a"((uint32_t)dividend));
+    return (uint64_t)(high / divisor) << 32 | low;
+#endif
+}
+
 int string_length(char s[])
 {
-    int i = 0;
-    while (s[i] != '\0')
-        ++i;
-    return i;
+    return strlen(s);
 }
 
 void reverse(char s[])
@@ -32,21 +57,83 @@ void reverse(char s[])
     }
 }
 
+/* Two digits per division, "00" to "99" */
+static const char digit_pairs[] = "00010203040506070809101112131415161718192021222324252627282930313233343536373839404142434445464748495051525354555657585960616263646566676869707172737475767778798081828384858687888990919293949596979899";
+
+int decimal_length(uint64_t n)
+{
+    int length = 1;
+    while (n >= 10000) {
+        n = div_u64(n, 10000);
+        length += 4;
+    }
+    uint32_t low = n;
+    if (low >= 100) {
+        low /= 100;
+        length += 2;
+    }
+    return low >= 10 ? length + 1 : length;
+}
+
+/* The digits go backwards from `end`, there's nothing to reverse. The
+ * 64-bit divides stop as soon as the rest fits 32 bits. */
+static void put_decimal(uint64_t n, char* end)
+{
+    while (n > 0xffffffff) {
+        uint64_t quotient = div_u64(n, 100);
+        uint32_t pair = (uint32_t)(n - quotient * 100) * 2;
+        *--end = digit_pairs[pair + 1];
+        *--end = digit_pairs[pair];
+        n = quotient;
+    }
+    uint32_t low = n;
+    while (low >= 100) {
+        uint32_t pair = low % 100 * 2;
+        low /= 100;
+        *--end = digit_pairs[pair + 1];
+        *--end = digit_pairs[pair];
+    }
+    if (low >= 10) {
+        *--end = digit_pairs[low * 2 + 1];
+        *--end = digit_pairs[low * 2];
+    } else {
+        *--end = '0' + low;
+    }
+}
+
+int u64_to_string(uint64_t n, char str[])
+{
+    int length = decimal_length(n);
+    put_decimal(n, str + length);
+    str[length] = '\0';
+    return length;
+}
+
 void int_to_string(int n, char str[])
 {
-    int i, sign;
-    if ((sign = n) < 0)
-        n = -n;
-    i = 0;
-    do {
-        str[i++] = n % 10 + '0';
-    } while ((n /= 10) > 0);
+    if (n < 0) {
+        *str++ = '-';
+        // the negation of INT_MIN only fits unsigned
+        u64_to_string(-(uint32_t)n, str);
+    } else {
+        u64_to_string(n, str);
+    }
+}
 
-    if (sign < 0)
-        str[i++] = '-';
-    str[i] = '\0';
+void uint_to_string(uint32_t n, char str[])
+{
+    u64_to_string(n, str);
+}
 
-    reverse(str);
+void hex_to_string(uint32_t n, char str[])
+{
+    str[0] = '0';
+    str[1] = 'x';
+    for (int idx = 0; idx < 8; idx++) {
+        uint8_t digit = (n >> (28 - idx * 4)) & 0xf;
+        str[2 + idx] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    }
+    str[10] = '\0';
 }
 
 // TODO: handle negative
@@ -85,21 +172,10 @@ bool backspace(char s[])
  * Returns <0 if s1<s2, 0 if s1==s2, >0 if s1>s2 */
 int compare_string(char s1[], char s2[])
 {
-    int i;
-    for (i = 0; s1[i] == s2[i]; i++) {
-        if (s1[i] == '\0')
-            return 0;
-    }
-    return s1[i] - s2[i];
+    return strcmp(s1, s2);
 }
 
 int string_starts_with(char s1[], char s2[])
 {
-    int i;
-    for (i = 0; s1[i] == s2[i] || s2[i] == '\0'; i++) {
-        if (s1[i] == '\0' || s2[i] == '\0')
-            return 0;
-    }
-
-    return s1[i] - s2[i];
+    return strncmp(s1, s2, strlen(s2));
 }
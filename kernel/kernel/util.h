@@ -9,10 +9,24 @@ uint8_t port_byte_in(uint16_t port);
 
 // out instruction
 void port_byte_out(uint16_t port, uint8_t data);
+void port_word_out(uint16_t port, uint16_t data);
+
+// time stamp counter of the calling CPU
+uint64_t rdtsc();
+/* 64 by 32 bit division, there's no libgcc for the 64 by 64 bit one on
+ * 32-bit x86. A plain divide in long mode. */
+uint64_t div_u64(uint64_t dividend, uint32_t divisor);
 
 int string_length(char s[]);
 void reverse(char s[]);
+/* Digits in the decimal form of `n` */
+int decimal_length(uint64_t n);
 void int_to_string(int n, char str[]);
+void uint_to_string(uint32_t n, char str[]);
+/* Returns the number of digits written, without the terminator */
+int u64_to_string(uint64_t n, char str[]);
+/* "0x" and 8 hex digits */
+void hex_to_string(uint32_t n, char str[]);
 void append(char s[], char n);
 bool backspace(char s[]);
 /* K&R
@@ -1,141 +1,45 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "../libc/string.h"
 #include "util.h"
+#include "vga.h"
 
 #define VGA_CTRL_REGISTER 0x3d4
 #define VGA_DATA_REGISTER 0x3d5
-#define VGA_OFFSET_LOW 0x0f
+#define VGA_START_HIGH 0x0c
+#define VGA_START_LOW 0x0d
 #define VGA_OFFSET_HIGH 0x0e
+#define VGA_OFFSET_LOW 0x0f
 
-#define VIDEO_ADDRESS 0xb8000
-#define MAX_ROWS 25
-#define MAX_COLS 80
-#define WHITE_ON_BLACK 0x0f
-
-int vga_color = WHITE_ON_BLACK;
-
-void recolor_screen()
-{
-    uint8_t* vidmem = (uint8_t*)VIDEO_ADDRESS;
-    for (int idx = 0; idx < MAX_COLS * MAX_ROWS; idx++) {
-        vidmem[idx * 2 + 1] = vga_color;
-    }
-}
-
-void set_bg_color(int bg)
-{
-    vga_color = (vga_color & 0x0f) | (bg << 4);
-    recolor_screen();
-}
-
-void set_fg_color(int fg)
-{
-    vga_color = (vga_color & 0xf0) | fg;
-    recolor_screen();
-}
-
-void set_cursor(int offset)
-{
-    offset /= 2;
-    port_byte_out(VGA_CTRL_REGISTER, VGA_OFFSET_HIGH);
-    port_byte_out(VGA_DATA_REGISTER, (uint8_t)(offset >> 8));
-    port_byte_out(VGA_CTRL_REGISTER, VGA_OFFSET_LOW);
-    port_byte_out(VGA_DATA_REGISTER, (uint8_t)(offset & 0xff));
-}
-
-int get_cursor()
-{
-    port_byte_out(VGA_CTRL_REGISTER, VGA_OFFSET_HIGH);
-    int offset = port_byte_in(VGA_DATA_REGISTER) << 8;
-    port_byte_out(VGA_CTRL_REGISTER, VGA_OFFSET_LOW);
-    offset += port_byte_in(VGA_DATA_REGISTER);
-    return offset * 2;
-}
-
-void set_char_at_video_memory(char character, int offset)
-{
-    uint8_t* vidmem = (uint8_t*)VIDEO_ADDRESS;
-    vidmem[offset] = character;
-    vidmem[offset + 1] = vga_color;
-}
-
-void memory_copy(char* source, char* dest, int nbytes)
-{
-    int idx;
-    for (idx = 0; idx < nbytes; idx++) {
-        *(dest + idx) = *(source + idx);
-    }
-}
-
-int get_row_from_offset(int offset)
-{
-    return offset / (2 * MAX_COLS);
-}
-
-int get_offset(int col, int row)
-{
-    return 2 * (row * MAX_COLS + col);
-}
-
-int move_offset_to_new_line(int offset)
-{
-    return get_offset(0, get_row_from_offset(offset) + 1);
-}
-
-int scroll_ln(int offset)
-{
-    memory_copy(
-        (char*)(size_t)(get_offset(0, 1) + VIDEO_ADDRESS),
-        (char*)(size_t)(get_offset(0, 0) + VIDEO_ADDRESS),
-        MAX_COLS * (MAX_ROWS - 1) * 2);
-
-    for (int col = 0; col < MAX_COLS; col++) {
-        set_char_at_video_memory(' ', get_offset(col, MAX_ROWS - 1));
-    }
-
-    return offset - 2 * MAX_COLS;
-}
+/* Last values written to the registers, -1 when unknown */
+static int hw_cursor = -1;
+static int hw_start = -1;
 
-void print_string(char* string)
+/* Write a 16 bit CRTC register pair, the high byte only if it changed */
+static void write_pair(uint8_t high_index, int value, int* shadow)
 {
-    int offset = get_cursor();
-    int idx = 0;
-    while (string[idx] != 0) {
-        if (offset >= MAX_ROWS * MAX_COLS * 2) {
-            offset = scroll_ln(offset);
-        }
-        if (string[idx] == '\n') {
-            offset = move_offset_to_new_line(offset);
-        } else {
-            set_char_at_video_memory(string[idx], offset);
-            offset += 2;
-        }
-        idx++;
+    if (*shadow < 0 || (*shadow >> 8) != (value >> 8)) {
+        port_byte_out(VGA_CTRL_REGISTER, high_index);
+        port_byte_out(VGA_DATA_REGISTER, (uint8_t)(value >> 8));
     }
-    set_cursor(offset);
+    port_byte_out(VGA_CTRL_REGISTER, high_index + 1);
+    port_byte_out(VGA_DATA_REGISTER, (uint8_t)(value & 0xff));
+    *shadow = value;
 }
 
-void clear_screen()
+void vga_set_cursor(int cell)
 {
-    for (int idx = 0; idx < MAX_COLS * MAX_ROWS; idx++) {
-        set_char_at_video_memory(' ', idx * 2);
-    }
-    set_cursor(get_offset(0, 0));
+    write_pair(VGA_OFFSET_HIGH, cell, &hw_cursor);
 }
 
-void print_nl()
+void vga_set_start(int cell)
 {
-    int newOffset = move_offset_to_new_line(get_cursor());
-    if (newOffset >= MAX_ROWS * MAX_COLS * 2) {
-        newOffset = scroll_ln(newOffset);
-    }
-    set_cursor(newOffset);
+    if (cell != hw_start)
+        write_pair(VGA_START_HIGH, cell, &hw_start);
 }
 
-void print_backspace()
+void vga_write_cells(int cell, const uint16_t* cells, int count)
 {
-    int newCursor = get_cursor() - 2;
-    set_char_at_video_memory(' ', newCursor);
-    set_cursor(newCursor);
+    memcpy((uint16_t*)VIDEO_ADDRESS + cell, cells, count * sizeof(uint16_t));
 }
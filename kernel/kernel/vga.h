@@ -1,12 +1,27 @@
 #ifndef _KERNEL_VGA_H_
 #define _KERNEL_VGA_H_
 
-void clear_screen();
-void print_string(char* string);
-void print_nl();
-void print_backspace();
+#include <stdint.h>
 
-void set_bg_color(int bg);
-void set_fg_color(int fg);
+#define VIDEO_ADDRESS 0xb8000
+#define MAX_ROWS 25
+#define MAX_COLS 80
+#define WHITE_ON_BLACK 0x0f
+
+/* Whole rows of the 32 KiB text mode window, the screen shows MAX_ROWS of
+ * them starting at the CRTC start address */
+#define VGA_BUFFER_ROWS (0x8000 / 2 / MAX_COLS)
+
+/* A text mode cell, character in the low byte and attribute in the high */
+#define VGA_CELL(character, attribute) ((uint16_t)(uint8_t)(character) | (uint16_t)(attribute) << 8)
+
+/* Cell positions are offsets into the text buffer, not the screen.
+ * Every register access is a port write, and a VM exit under KVM, so
+ * the high bytes are only written when they change. */
+void vga_set_cursor(int cell);
+/* First cell shown in the top left corner */
+void vga_set_start(int cell);
+/* Copy `count` cells to video memory starting at `cell` */
+void vga_write_cells(int cell, const uint16_t* cells, int count);
 
 #endif
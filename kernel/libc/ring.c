@@ -0,0 +1,91 @@
+#include "ring.h"
+
+void ring_init(struct ring* ring, uint32_t* entries, uint32_t size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+    ring->entries = entries;
+}
+
+/* The indexes run freely and wrap, tail - head is the fill level */
+bool ring_push(struct ring* ring, uint32_t value)
+{
+    uint32_t tail = ring->tail;
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > ring->mask)
+        return false;
+    ring->entries[tail & ring->mask] = value;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool ring_pop(struct ring* ring, uint32_t* value)
+{
+    uint32_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return false;
+    *value = ring->entries[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool ring_peek(struct ring* ring, uint32_t* value)
+{
+    uint32_t head = ring->head;
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+        return false;
+    *value = ring->entries[head & ring->mask];
+    return true;
+}
+
+bool ring_empty(struct ring* ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+void mpsc_ring_init(struct mpsc_ring* ring, struct mpsc_slot* slots, uint32_t size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+    ring->slots = slots;
+    for (uint32_t idx = 0; idx < size; idx++)
+        slots[idx].seq = idx;
+}
+
+bool mpsc_ring_push(struct mpsc_ring* ring, uint32_t value)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    struct mpsc_slot* slot;
+    while (1) {
+        slot = &ring->slots[tail & ring->mask];
+        int32_t turn = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - tail;
+        if (turn == 0) {
+            // a failed swap leaves the tail another producer moved it to
+            if (__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1, true, __ATOMIC_RELAXED,
+                    __ATOMIC_RELAXED))
+                break;
+        } else if (turn < 0) {
+            // the consumer hasn't freed the slot from one lap ago
+            return false;
+        } else {
+            tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+        }
+    }
+    slot->value = value;
+    __atomic_store_n(&slot->seq, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool mpsc_ring_pop(struct mpsc_ring* ring, uint32_t* value)
+{
+    uint32_t head = ring->head;
+    struct mpsc_slot* slot = &ring->slots[head & ring->mask];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1)
+        return false;
+    *value = slot->value;
+    // free for the position one lap ahead
+    __atomic_store_n(&slot->seq, head + ring->mask + 1, __ATOMIC_RELEASE);
+    ring->head = head + 1;
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef _KERNEL_RING_H_
+#define _KERNEL_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Lock-free queue of words between one producer and one consumer, like
+ * an interrupt handler and the thread draining what it queued. Each side
+ * only writes its own index, the other one reads it. */
+struct ring {
+    uint32_t head; /* next to pop, written by the consumer */
+    uint32_t tail; /* next to push, written by the producer */
+    uint32_t mask;
+    uint32_t* entries;
+};
+
+/* `size` is a power of two */
+void ring_init(struct ring* ring, uint32_t* entries, uint32_t size);
+/* False when full, the value is dropped */
+bool ring_push(struct ring* ring, uint32_t value);
+/* False when empty */
+bool ring_pop(struct ring* ring, uint32_t* value);
+/* The value ring_pop() would return, left in the ring */
+bool ring_peek(struct ring* ring, uint32_t* value);
+bool ring_empty(struct ring* ring);
+
+/* A slot of an mpsc_ring. `seq` says whose turn it is: the position a
+ * producer may fill it at, or that position + 1 once the value is in. */
+struct mpsc_slot {
+    uint32_t seq;
+    uint32_t value;
+};
+
+/* Lock-free queue of words from any number of producers, like interrupt
+ * handlers on every CPU, to one consumer. Producers claim a position by
+ * moving tail with a compare and swap, then publish the value through
+ * the slot's sequence number. */
+struct mpsc_ring {
+    uint32_t head; /* next to pop, written by the consumer */
+    uint32_t tail; /* next position to claim, shared by the producers */
+    uint32_t mask;
+    struct mpsc_slot* slots;
+};
+
+/* `size` is a power of two */
+void mpsc_ring_init(struct mpsc_ring* ring, struct mpsc_slot* slots, uint32_t size);
+/* Any CPU or interrupt handler. False when full, the value is dropped. */
+bool mpsc_ring_push(struct mpsc_ring* ring, uint32_t value);
+/* The consumer only. False when empty, or when the next producer in line
+ * claimed its slot but hasn't written it yet. */
+bool mpsc_ring_pop(struct mpsc_ring* ring, uint32_t* value);
+
+#endif
@@ -0,0 +1,162 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "stdio.h"
+#include "../kernel/util.h"
+#include "string.h"
+
+struct output {
+    char* buffer;
+    size_t size;
+    /* What was written or would have been */
+    size_t length;
+};
+
+static void put(struct output* out, char c)
+{
+    if (out->length + 1 < out->size)
+        out->buffer[out->length] = c;
+    out->length++;
+}
+
+static void put_padded(struct output* out, const char* text, int length, int width, bool left, char pad)
+{
+    // zeros go between the sign and the digits
+    if (pad == '0' && length > 0 && text[0] == '-') {
+        put(out, '-');
+        text++;
+        length--;
+        width--;
+    }
+    if (!left) {
+        for (; width > length; width--)
+            put(out, pad);
+    }
+    for (int idx = 0; idx < length; idx++)
+        put(out, text[idx]);
+    for (; width > length; width--)
+        put(out, ' ');
+}
+
+static int hex_digits(uint64_t n, int min_length, char* str)
+{
+    int length = 1;
+    while (length < 16 && (n >> (length * 4)) != 0)
+        length++;
+    if (length < min_length)
+        length = min_length;
+    for (int idx = length - 1; idx >= 0; idx--, n >>= 4)
+        str[idx] = "0123456789abcdef"[n & 0xf];
+    return length;
+}
+
+/* va_arg of int, long or long long for 0, 1 or 2 l's */
+static int64_t signed_arg(va_list* args, int longs)
+{
+    if (longs >= 2)
+        return va_arg(*args, long long);
+    if (longs == 1)
+        return va_arg(*args, long);
+    return va_arg(*args, int);
+}
+
+static uint64_t unsigned_arg(va_list* args, int longs)
+{
+    if (longs >= 2)
+        return va_arg(*args, unsigned long long);
+    if (longs == 1)
+        return va_arg(*args, unsigned long);
+    return va_arg(*args, unsigned int);
+}
+
+int vsnprintf(char* buffer, size_t size, const char* format, va_list list)
+{
+    struct output out = { buffer, size, 0 };
+    // a va_list parameter may be an array turned pointer, a copy can be
+    // passed on by address
+    va_list args;
+    va_copy(args, list);
+    // a sign and 20 digits, or "0x" and 16
+    char digits[24];
+
+    for (; *format != '\0'; format++) {
+        if (*format != '%') {
+            put(&out, *format);
+            continue;
+        }
+
+        bool left = false;
+        char pad = ' ';
+        for (format++; *format == '-' || *format == '0'; format++) {
+            if (*format == '-')
+                left = true;
+            else
+                pad = '0';
+        }
+        int width = 0;
+        for (; *format >= '0' && *format <= '9'; format++)
+            width = width * 10 + *format - '0';
+        int longs = 0;
+        for (; *format == 'l'; format++)
+            longs++;
+
+        const char* text = digits;
+        int length;
+        switch (*format) {
+        case 'd':
+        case 'i': {
+            int64_t value = signed_arg(&args, longs);
+            length = 0;
+            if (value < 0)
+                digits[length++] = '-';
+            length += u64_to_string(value < 0 ? -(uint64_t)value : (uint64_t)value, digits + length);
+            break;
+        }
+        case 'u':
+        case 'x': {
+            uint64_t value = unsigned_arg(&args, longs);
+            length = *format == 'u' ? u64_to_string(value, digits) : hex_digits(value, 1, digits);
+            break;
+        }
+        case 'p':
+            digits[0] = '0';
+            digits[1] = 'x';
+            length = 2 + hex_digits((uintptr_t)va_arg(args, void*), sizeof(void*) * 2, digits + 2);
+            break;
+        case 's':
+            text = va_arg(args, const char*);
+            if (text == NULL)
+                text = "(null)";
+            length = strlen(text);
+            break;
+        case 'c':
+            digits[0] = (char)va_arg(args, int);
+            length = 1;
+            break;
+        case '%':
+            digits[0] = '%';
+            length = 1;
+            break;
+        default:
+            // unknown, or the format ended after the %
+            if (*format == '\0')
+                format--;
+            continue;
+        }
+        put_padded(&out, text, length, width, left, pad);
+    }
+
+    va_end(args);
+    if (size > 0)
+        buffer[out.length < size ? out.length : size - 1] = '\0';
+    return out.length;
+}
+
+int snprintf(char* buffer, size_t size, const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer, size, format, args);
+    va_end(args);
+    return length;
+}
@@ -0,0 +1,14 @@
+#ifndef _KERNEL_STDIO_H_
+#define _KERNEL_STDIO_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/* The formats the kernel needs: %d %i %u %x %p %s %c and %%, with a
+ * width, the - and 0 flags and the l and ll sizes. %p is "0x" and every
+ * hex digit of a pointer. Returns the length the whole output would
+ * have, at most size - 1 characters and the terminator are written. */
+int vsnprintf(char* buffer, size_t size, const char* format, va_list args);
+int snprintf(char* buffer, size_t size, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+#endif
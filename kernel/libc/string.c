@@ -0,0 +1,200 @@
+#include <stdint.h>
+
+#include "string.h"
+#include "../cpu/fpu.h"
+
+/* Copies at least this large go through SSE or AVX when it is enabled,
+ * below it the setup isn't worth it */
+#define SIMD_COPY_MIN 256
+
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+/* Non zero if any byte of `word` is zero */
+#define HAS_ZERO(word) (((word) - ONES) & ~(word) & HIGHS)
+
+/* Word loads that alias any type */
+typedef uint32_t __attribute__((may_alias)) word_t;
+
+static enum string_simd simd = STRING_SIMD_NONE;
+
+void string_use_simd(enum string_simd use)
+{
+    simd = use;
+}
+
+enum string_simd string_simd()
+{
+    return simd;
+}
+
+/* 64 bytes per iteration through xmm0-3, unaligned loads and stores are
+ * as fast as aligned ones on anything with SSE2 that isn't ancient */
+__attribute__((target("sse2"))) static void copy_sse(void* dest, const void* src, size_t blocks)
+{
+    asm volatile("1:\n\t"
+                 "movups 0(%1), %%xmm0\n\t"
+                 "movups 16(%1), %%xmm1\n\t"
+                 "movups 32(%1), %%xmm2\n\t"
+                 "movups 48(%1), %%xmm3\n\t"
+                 "movups %%xmm0, 0(%0)\n\t"
+                 "movups %%xmm1, 16(%0)\n\t"
+                 "movups %%xmm2, 32(%0)\n\t"
+                 "movups %%xmm3, 48(%0)\n\t"
+                 "add $64, %1\n\t"
+                 "add $64, %0\n\t"
+                 "dec %2\n\t"
+                 "jnz 1b"
+                 : "+r"(dest), "+r"(src), "+r"(blocks)
+                 :
+                 : "memory", "cc");
+}
+
+/* The same 128 bytes at a time through ymm0-3. vzeroupper avoids the
+ * penalty SSE code pays after dirty upper halves on some CPUs. */
+__attribute__((target("avx"))) static void copy_avx(void* dest, const void* src, size_t blocks)
+{
+    asm volatile("1:\n\t"
+                 "vmovups 0(%1), %%ymm0\n\t"
+                 "vmovups 32(%1), %%ymm1\n\t"
+                 "vmovups 64(%1), %%ymm2\n\t"
+                 "vmovups 96(%1), %%ymm3\n\t"
+                 "vmovups %%ymm0, 0(%0)\n\t"
+                 "vmovups %%ymm1, 32(%0)\n\t"
+                 "vmovups %%ymm2, 64(%0)\n\t"
+                 "vmovups %%ymm3, 96(%0)\n\t"
+                 "add $128, %1\n\t"
+                 "add $128, %0\n\t"
+                 "dec %2\n\t"
+                 "jnz 1b\n\t"
+                 "vzeroupper"
+                 : "+r"(dest), "+r"(src), "+r"(blocks)
+                 :
+                 : "memory", "cc");
+}
+
+void* memcpy(void* dest, const void* src, size_t n)
+{
+    void* ret = dest;
+
+    // the registers are claimed: this may run in an interrupt handler,
+    // or in a thread whose own SSE state is loaded
+    if (simd != STRING_SIMD_NONE && n >= SIMD_COPY_MIN) {
+        size_t block = simd == STRING_SIMD_AVX ? 128 : 64;
+        uint32_t flags = fpu_begin();
+        if (simd == STRING_SIMD_AVX)
+            copy_avx(dest, src, n / block);
+        else
+            copy_sse(dest, src, n / block);
+        fpu_end(flags);
+        dest = (uint8_t*)dest + (n & ~(block - 1));
+        src = (const uint8_t*)src + (n & ~(block - 1));
+        n &= block - 1;
+    }
+
+    // whole dwords, then the up to 3 bytes left
+    size_t tail = n & 3;
+    n >>= 2;
+    asm volatile("rep movsl" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+    asm volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(tail) : : "memory");
+    return ret;
+}
+
+void* memmove(void* dest, const void* src, size_t n)
+{
+    // a forward copy is safe unless dest starts inside src
+    if ((uintptr_t)dest - (uintptr_t)src >= n)
+        return memcpy(dest, src, n);
+
+    // backwards: the odd tail bytes first, then whole dwords
+    uint8_t* d = (uint8_t*)dest + n - 1;
+    const uint8_t* s = (const uint8_t*)src + n - 1;
+    size_t tail = n & 3;
+    size_t words = n >> 2;
+    asm volatile("std\n\t"
+                 "rep movsb\n\t"
+                 "cld"
+                 : "+D"(d), "+S"(s), "+c"(tail)
+                 :
+                 : "memory");
+    // on to the start of the dword below
+    d -= 3;
+    s -= 3;
+    asm volatile("std\n\t"
+                 "rep movsl\n\t"
+                 "cld"
+                 : "+D"(d), "+S"(s), "+c"(words)
+                 :
+                 : "memory");
+    return dest;
+}
+
+void* memset(void* dest, int value, size_t n)
+{
+    void* ret = dest;
+    uint32_t fill = (uint8_t)value * ONES;
+    size_t tail = n & 3;
+
+    n >>= 2;
+    asm volatile("rep stosl" : "+D"(dest), "+c"(n) : "a"(fill) : "memory");
+    asm volatile("rep stosb" : "+D"(dest), "+c"(tail) : "a"(fill) : "memory");
+    return ret;
+}
+
+int memcmp(const void* s1, const void* s2, size_t n)
+{
+    const uint8_t* a = s1;
+    const uint8_t* b = s2;
+
+    // skip equal words, the differing byte is found below
+    while (n >= 4 && *(const word_t*)a == *(const word_t*)b) {
+        a += 4;
+        b += 4;
+        n -= 4;
+    }
+    for (; n > 0; n--, a++, b++) {
+        if (*a != *b)
+            return *a - *b;
+    }
+    return 0;
+}
+
+size_t strlen(const char* s)
+{
+    const char* start = s;
+
+    // aligned words never cross a page, reading past the end is safe
+    for (; (uintptr_t)s & 3; s++) {
+        if (*s == '\0')
+            return s - start;
+    }
+    while (!HAS_ZERO(*(const word_t*)s))
+        s += 4;
+    while (*s != '\0')
+        s++;
+    return s - start;
+}
+
+int strcmp(const char* s1, const char* s2)
+{
+    // a word at a time while both strings are aligned the same way
+    if ((((uintptr_t)s1 | (uintptr_t)s2) & 3) == 0) {
+        while (*(const word_t*)s1 == *(const word_t*)s2 && !HAS_ZERO(*(const word_t*)s1)) {
+            s1 += 4;
+            s2 += 4;
+        }
+    }
+    while (*s1 != '\0' && *s1 == *s2) {
+        s1++;
+        s2++;
+    }
+    return (uint8_t)*s1 - (uint8_t)*s2;
+}
+
+int strncmp(const char* s1, const char* s2, size_t n)
+{
+    for (; n > 0; n--, s1++, s2++) {
+        if (*s1 != *s2 || *s1 == '\0')
+            return (uint8_t)*s1 - (uint8_t)*s2;
+    }
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef _KERNEL_STRING_H_
+#define _KERNEL_STRING_H_
+
+#include <stddef.h>
+
+/* Freestanding memory and string functions. The compiler also emits calls
+ * to memcpy and memset for struct copies, so these names are required. */
+
+void* memcpy(void* dest, const void* src, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
+void* memset(void* dest, int value, size_t n);
+int memcmp(const void* s1, const void* s2, size_t n);
+size_t strlen(const char* s);
+int strcmp(const char* s1, const char* s2);
+int strncmp(const char* s1, const char* s2, size_t n);
+
+/* What memcpy uses for large copies */
+enum string_simd {
+    STRING_SIMD_NONE,
+    STRING_SIMD_SSE,
+    STRING_SIMD_AVX,
+};
+
+/* Only valid once every CPU has enabled what is asked for, see
+ * fpu_init() */
+void string_use_simd(enum string_simd use);
+enum string_simd string_simd();
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef _KERNEL_MEMORY_MAP_H_
+#define _KERNEL_MEMORY_MAP_H_
+
+#include <stdint.h>
+
+/* Where boot/memory_map.asm leaves the BIOS E820 map */
+#define MEMORY_MAP_ADDRESS 0x1000
+
+#define E820_RAM 1
+#define E820_RESERVED 2
+
+/* ACPI 3.0 sized entry, BIOSes that don't know the attributes leave them */
+struct e820_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t attributes;
+} __attribute__((packed));
+
+struct memory_map {
+    uint32_t count;
+    struct e820_entry entries[];
+} __attribute__((packed));
+
+#define BOOT_MEMORY_MAP ((struct memory_map*)MEMORY_MAP_ADDRESS)
+
+#endif
@@ -0,0 +1,193 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "pmm.h"
+#include "../cpu/spinlock.h"
+#include "../libc/string.h"
+#include "memory_map.h"
+
+/* Only the first 4 GiB are addressable without PAE */
+#define MAX_PFN 0x100000
+
+/* First page of a free block of `order` pages */
+#define PAGE_FREE (1 << 0)
+
+struct page {
+    /* Free list of the block's order, only valid with PAGE_FREE */
+    struct page* next;
+    struct page* prev;
+    uint8_t order;
+    uint8_t flags;
+};
+
+/* Indexed by page frame number, pages that aren't RAM are never free */
+static struct page* pages = NULL;
+static uint32_t page_count = 0;
+
+static struct page* free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_blocks[PMM_MAX_ORDER + 1];
+static uint32_t free_pages = 0;
+static uint32_t total_pages = 0;
+
+/* The shell allocates from its interrupt handler */
+static struct spinlock lock;
+
+static void push_free(struct page* page, unsigned order)
+{
+    page->flags |= PAGE_FREE;
+    page->order = order;
+    page->prev = NULL;
+    page->next = free_lists[order];
+    if (page->next != NULL)
+        page->next->prev = page;
+    free_lists[order] = page;
+    free_blocks[order]++;
+}
+
+static void remove_free(struct page* page)
+{
+    if (page->prev != NULL)
+        page->prev->next = page->next;
+    else
+        free_lists[page->order] = page->next;
+    if (page->next != NULL)
+        page->next->prev = page->prev;
+    page->flags &= ~PAGE_FREE;
+    free_blocks[page->order]--;
+}
+
+/* Give a block back, merging it with its buddy as long as that is free */
+static void free_block(uint32_t pfn, unsigned order)
+{
+    free_pages += 1 << order;
+
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy_pfn = pfn ^ (1 << order);
+        if (buddy_pfn >= page_count)
+            break;
+        struct page* buddy = &pages[buddy_pfn];
+        if (!(buddy->flags & PAGE_FREE) || buddy->order != order)
+            break;
+        remove_free(buddy);
+        pfn &= ~(1 << order);
+        order++;
+    }
+
+    push_free(&pages[pfn], order);
+}
+
+/* Free [start, end) in the largest aligned blocks that fit */
+static void add_range(uint32_t start, uint32_t end)
+{
+    while (start < end) {
+        unsigned order = PMM_MAX_ORDER;
+        while ((start & ((1 << order) - 1)) != 0 || start + (1 << order) > end)
+            order--;
+        total_pages += 1 << order;
+        free_block(start, order);
+        start += 1 << order;
+    }
+}
+
+/* Usable page frames of a map entry, clamped to [PMM_LOW_LIMIT, 4 GiB) */
+static bool entry_pfns(struct e820_entry* entry, uint32_t* start, uint32_t* end)
+{
+    if (entry->type != E820_RAM || entry->base >= (uint64_t)MAX_PFN << PAGE_SHIFT)
+        return false;
+
+    uint64_t base = entry->base < PMM_LOW_LIMIT ? PMM_LOW_LIMIT : entry->base;
+    uint64_t limit = entry->base + entry->length;
+    if (limit > (uint64_t)MAX_PFN << PAGE_SHIFT)
+        limit = (uint64_t)MAX_PFN << PAGE_SHIFT;
+    *start = (base + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    *end = limit >> PAGE_SHIFT;
+    return *start < *end;
+}
+
+void pmm_init()
+{
+    struct memory_map* map = BOOT_MEMORY_MAP;
+    uint32_t start, end;
+
+    for (uint32_t idx = 0; idx < map->count; idx++) {
+        if (entry_pfns(&map->entries[idx], &start, &end) && end > page_count)
+            page_count = end;
+    }
+
+    // the page array goes at the start of the first range it fits in
+    uint32_t array_pages = (page_count * sizeof(struct page) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    uint32_t array_pfn = 0;
+    for (uint32_t idx = 0; idx < map->count && array_pfn == 0; idx++) {
+        if (entry_pfns(&map->entries[idx], &start, &end) && end - start >= array_pages)
+            array_pfn = start;
+    }
+    if (array_pfn == 0) {
+        page_count = 0;
+        return;
+    }
+    pages = (struct page*)((uintptr_t)array_pfn << PAGE_SHIFT);
+    memset(pages, 0, page_count * sizeof(struct page));
+
+    for (uint32_t idx = 0; idx < map->count; idx++) {
+        if (!entry_pfns(&map->entries[idx], &start, &end))
+            continue;
+        if (start == array_pfn)
+            start += array_pages;
+        add_range(start, end);
+    }
+}
+
+uintptr_t pmm_alloc_pages(unsigned order)
+{
+    if (order > PMM_MAX_ORDER)
+        return 0;
+
+    uint32_t flags = spin_lock_irqsave(&lock);
+    unsigned found = order;
+    while (found <= PMM_MAX_ORDER && free_lists[found] == NULL)
+        found++;
+    if (found > PMM_MAX_ORDER) {
+        spin_unlock_irqrestore(&lock, flags);
+        return 0;
+    }
+
+    // split the block, the upper halves go back on the smaller lists
+    struct page* page = free_lists[found];
+    remove_free(page);
+    while (found > order) {
+        found--;
+        push_free(page + (1 << found), found);
+    }
+    page->order = order;
+    free_pages -= 1 << order;
+    spin_unlock_irqrestore(&lock, flags);
+
+    return (uintptr_t)(page - pages) << PAGE_SHIFT;
+}
+
+void pmm_free_pages(uintptr_t address, unsigned order)
+{
+    uint32_t flags = spin_lock_irqsave(&lock);
+    free_block(address >> PAGE_SHIFT, order);
+    spin_unlock_irqrestore(&lock, flags);
+}
+
+unsigned pmm_block_order(uintptr_t address)
+{
+    return pages[address >> PAGE_SHIFT].order;
+}
+
+uint32_t pmm_free_page_count()
+{
+    return free_pages;
+}
+
+uint32_t pmm_total_page_count()
+{
+    return total_pages;
+}
+
+uint32_t pmm_free_block_count(unsigned order)
+{
+    return order <= PMM_MAX_ORDER ? free_blocks[order] : 0;
+}
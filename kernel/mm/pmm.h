@@ -0,0 +1,33 @@
+#ifndef _KERNEL_PMM_H_
+#define _KERNEL_PMM_H_
+
+#include <stdint.h>
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+
+/* Largest block is 2^PMM_MAX_ORDER pages, 4 MiB */
+#define PMM_MAX_ORDER 10
+
+/* Memory below 1 MiB isn't managed. The kernel, the AP trampoline and
+ * stacks and the BIOS areas all live at fixed places in there. */
+#define PMM_LOW_LIMIT 0x100000
+
+/* Buddy allocator over the RAM in the boot memory map, every order has a
+ * free list so an allocation or a free takes at most PMM_MAX_ORDER steps.
+ * RAM is identity mapped, the addresses can be used directly. */
+void pmm_init();
+
+/* 2^order contiguous pages aligned to their size, 0 when out of memory */
+uintptr_t pmm_alloc_pages(unsigned order);
+/* `order` has to be the one the pages were allocated with */
+void pmm_free_pages(uintptr_t address, unsigned order);
+/* Order an allocated block was allocated with */
+unsigned pmm_block_order(uintptr_t address);
+
+uint32_t pmm_free_page_count();
+uint32_t pmm_total_page_count();
+/* Free blocks of exactly 2^order pages */
+uint32_t pmm_free_block_count(unsigned order);
+
+#endif
@@ -0,0 +1,264 @@
+#include "slab.h"
+#include "pmm.h"
+
+/* Smallest alignment, the free list link has to fit aligned */
+#define SLAB_MIN_ALIGN sizeof(void*)
+/* Color offsets are whole cache lines */
+#define SLAB_COLOR_STEP 64
+/* Empty slabs a cache holds on to, an alloc/free pair at a slab
+ * boundary shouldn't go to the page allocator every time */
+#define SLAB_EMPTY_KEEP 1
+
+#define ALIGN_UP(value, align) (((value) + (align) - 1) & ~((align) - 1))
+
+/* Header at the start of every slab page, so the slab of an object is
+ * found by rounding its address down to the page */
+struct slab {
+    struct slab* next;
+    struct slab* prev;
+    struct kmem_cache* cache;
+    void* freelist;
+    uint32_t inuse;
+};
+
+#define SLAB_OF(object) ((struct slab*)((uintptr_t)(object) & ~(uintptr_t)(PAGE_SIZE - 1)))
+#define FREE_LINK(cache, object) (*(void**)((uint8_t*)(object) + (cache)->link_offset))
+
+/* Index of the kmalloc cache for 1 <= size <= KMALLOC_MAX_SIZE */
+#define KMALLOC_INDEX(size) \
+    ((size) <= (1u << KMALLOC_MIN_SHIFT) ? 0 : 32 - __builtin_clz((size) - 1) - KMALLOC_MIN_SHIFT)
+
+struct kmem_cache* kmem_caches = NULL;
+static struct spinlock caches_lock;
+
+/* The struct kmem_cache of kmem_cache_create() comes from here */
+static struct kmem_cache cache_cache;
+static struct kmem_cache kmalloc_caches[KMALLOC_CACHES];
+static const char* kmalloc_names[KMALLOC_CACHES] = {
+    "kmalloc-8",
+    "kmalloc-16",
+    "kmalloc-32",
+    "kmalloc-64",
+    "kmalloc-128",
+    "kmalloc-256",
+    "kmalloc-512",
+    "kmalloc-1024",
+};
+
+static void list_push(struct slab** list, struct slab* slab)
+{
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list != NULL)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void list_remove(struct slab** list, struct slab* slab)
+{
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+}
+
+static struct slab* slab_create(struct kmem_cache* cache)
+{
+    uintptr_t page = pmm_alloc_pages(0);
+    if (page == 0)
+        return NULL;
+
+    struct slab* slab = (struct slab*)page;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = NULL;
+
+    uint8_t* first = (uint8_t*)page + cache->objects_offset + cache->next_color * cache->color_step;
+    if (++cache->next_color == cache->colors)
+        cache->next_color = 0;
+
+    // linked backwards so the objects are handed out in address order
+    for (uint32_t idx = cache->objects_per_slab; idx-- > 0;) {
+        uint8_t* object = first + idx * cache->stride;
+        if (cache->ctor != NULL)
+            cache->ctor(object);
+        FREE_LINK(cache, object) = slab->freelist;
+        slab->freelist = object;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+static void slab_destroy(struct kmem_cache* cache, struct slab* slab)
+{
+    cache->slab_count--;
+    pmm_free_pages((uintptr_t)slab, 0);
+}
+
+static void cache_register(struct kmem_cache* cache)
+{
+    uint32_t flags = spin_lock_irqsave(&caches_lock);
+    cache->next = kmem_caches;
+    kmem_caches = cache;
+    spin_unlock_irqrestore(&caches_lock, flags);
+}
+
+static bool cache_setup(struct kmem_cache* cache, const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor)
+{
+    if (align < SLAB_MIN_ALIGN)
+        align = SLAB_MIN_ALIGN;
+    if ((align & (align - 1)) != 0 || size == 0)
+        return false;
+
+    cache->name = name;
+    cache->object_size = size;
+    cache->ctor = ctor;
+    cache->link_offset = 0;
+    cache->stride = size;
+    if (ctor != NULL) {
+        cache->link_offset = ALIGN_UP(size, sizeof(void*));
+        cache->stride = cache->link_offset + sizeof(void*);
+    }
+    cache->stride = ALIGN_UP(cache->stride < sizeof(void*) ? sizeof(void*) : cache->stride, align);
+    cache->objects_offset = ALIGN_UP(sizeof(struct slab), align);
+    if (cache->objects_offset + cache->stride > PAGE_SIZE)
+        return false;
+    cache->objects_per_slab = (PAGE_SIZE - cache->objects_offset) / cache->stride;
+
+    // the space the objects leave over decides how many colors there are
+    uint32_t left_over = PAGE_SIZE - cache->objects_offset - cache->objects_per_slab * cache->stride;
+    cache->color_step = align > SLAB_COLOR_STEP ? align : SLAB_COLOR_STEP;
+    cache->colors = left_over / cache->color_step + 1;
+    cache->next_color = 0;
+
+    cache->partial = NULL;
+    cache->full = NULL;
+    cache->empty = NULL;
+    spin_lock_init(&cache->lock);
+    cache->slab_count = 0;
+    cache->empty_count = 0;
+    cache->active_objects = 0;
+    cache->allocs = 0;
+    cache->frees = 0;
+
+    cache_register(cache);
+    return true;
+}
+
+void slab_init()
+{
+    cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, NULL);
+    for (int idx = 0; idx < KMALLOC_CACHES; idx++)
+        cache_setup(&kmalloc_caches[idx], kmalloc_names[idx], 1u << (idx + KMALLOC_MIN_SHIFT), 0, NULL);
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor)
+{
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+    if (cache == NULL)
+        return NULL;
+    if (!cache_setup(cache, name, size, align, ctor)) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+
+    // the fast path is the first partial slab having a free object
+    struct slab* slab = cache->partial;
+    if (slab == NULL) {
+        if ((slab = cache->empty) != NULL) {
+            list_remove(&cache->empty, slab);
+            cache->empty_count--;
+        } else if ((slab = slab_create(cache)) == NULL) {
+            spin_unlock_irqrestore(&cache->lock, flags);
+            return NULL;
+        }
+        list_push(&cache->partial, slab);
+    }
+
+    void* object = slab->freelist;
+    slab->freelist = FREE_LINK(cache, object);
+    if (++slab->inuse == cache->objects_per_slab) {
+        list_remove(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+    cache->active_objects++;
+    cache->allocs++;
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* object)
+{
+    struct slab* slab = SLAB_OF(object);
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+
+    FREE_LINK(cache, object) = slab->freelist;
+    slab->freelist = object;
+    bool was_full = slab->inuse == cache->objects_per_slab;
+    slab->inuse--;
+    cache->active_objects--;
+    cache->frees++;
+
+    // only a slab that was full or is now empty changes lists
+    if (was_full || slab->inuse == 0) {
+        list_remove(was_full ? &cache->full : &cache->partial, slab);
+        if (slab->inuse != 0) {
+            list_push(&cache->partial, slab);
+        } else if (cache->empty_count < SLAB_EMPTY_KEEP) {
+            list_push(&cache->empty, slab);
+            cache->empty_count++;
+        } else {
+            slab_destroy(cache, slab);
+        }
+    }
+
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void kmem_cache_shrink(struct kmem_cache* cache)
+{
+    uint32_t flags = spin_lock_irqsave(&cache->lock);
+    while (cache->empty != NULL) {
+        struct slab* slab = cache->empty;
+        list_remove(&cache->empty, slab);
+        slab_destroy(cache, slab);
+    }
+    cache->empty_count = 0;
+    spin_unlock_irqrestore(&cache->lock, flags);
+}
+
+void* kmalloc(size_t size)
+{
+    // size 0 wraps around and falls through
+    if (size - 1 < KMALLOC_MAX_SIZE)
+        return kmem_cache_alloc(&kmalloc_caches[KMALLOC_INDEX(size)]);
+    // checked before the order, a 64-bit size won't fit __builtin_clz()
+    if (size == 0 || size > (size_t)PAGE_SIZE << PMM_MAX_ORDER)
+        return NULL;
+
+    unsigned order = size <= PAGE_SIZE ? 0 : 32 - __builtin_clz((uint32_t)(size - 1)) - PAGE_SHIFT;
+    return (void*)pmm_alloc_pages(order);
+}
+
+void kfree(void* object)
+{
+    if (object == NULL)
+        return;
+
+    // slab objects never start a page, the slab header is there
+    if (((uintptr_t)object & (PAGE_SIZE - 1)) == 0) {
+        pmm_free_pages((uintptr_t)object, pmm_block_order((uintptr_t)object));
+        return;
+    }
+    kmem_cache_free(SLAB_OF(object)->cache, object);
+}
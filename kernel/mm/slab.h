@@ -0,0 +1,77 @@
+#ifndef _KERNEL_SLAB_H_
+#define _KERNEL_SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../cpu/spinlock.h"
+
+/* Objects up to this size come from a kmalloc cache, larger ones are
+ * whole blocks from the page allocator */
+#define KMALLOC_MAX_SIZE 1024
+/* kmalloc caches are 8, 16, ... KMALLOC_MAX_SIZE bytes */
+#define KMALLOC_MIN_SHIFT 3
+#define KMALLOC_CACHES 8
+
+/* Runs once per object when its slab is created, not on every
+ * allocation. Freed objects have to be handed back in that state. */
+typedef void (*kmem_ctor_t)(void* object);
+
+struct slab;
+
+/* Objects of one size carved out of single page slabs. A slab is on the
+ * partial, full or empty list by how many of its objects are in use. */
+struct kmem_cache {
+    const char* name;
+    uint32_t object_size;
+    /* Distance between objects, the size rounded up to the alignment */
+    uint32_t stride;
+    /* Where the free list link lives in a free object. Past the object
+     * when there is a constructor, so the constructed state survives. */
+    uint32_t link_offset;
+    /* Where the first object starts without color, past the slab header */
+    uint32_t objects_offset;
+    uint32_t objects_per_slab;
+    kmem_ctor_t ctor;
+
+    /* Slabs start their objects at a different cache line offset so the
+     * first objects of every slab don't all fall in the same cache sets */
+    uint32_t colors;
+    uint32_t color_step;
+    uint32_t next_color;
+
+    struct slab* partial;
+    struct slab* full;
+    struct slab* empty;
+    struct spinlock lock;
+
+    uint32_t slab_count;
+    uint32_t empty_count;
+    uint32_t active_objects;
+    uint32_t allocs;
+    uint32_t frees;
+
+    struct kmem_cache* next;
+};
+
+/* Every cache, the SLABINFO command walks them */
+extern struct kmem_cache* kmem_caches;
+
+/* Sets up the kmalloc caches, needs pmm_init() first */
+void slab_init();
+
+/* `align` is a power of two, 0 for the default. NULL if the object
+ * doesn't fit a slab with the alignment. */
+struct kmem_cache* kmem_cache_create(const char* name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+/* NULL when out of memory */
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* object);
+/* Gives the empty slabs back to the page allocator */
+void kmem_cache_shrink(struct kmem_cache* cache);
+
+/* NULL when out of memory or for a size of 0 */
+void* kmalloc(size_t size);
+/* NULL is ignored */
+void kfree(void* object);
+
+#endif
@@ -0,0 +1,576 @@
+#include "vmm.h"
+#include "../cpu/isr.h"
+#include "../cpu/smp.h"
+#include "../cpu/spinlock.h"
+#include "../kernel/console.h"
+#include "../kernel/printk.h"
+#include "../libc/string.h"
+#include "../task/user.h"
+#include "memory_map.h"
+#include "pmm.h"
+#include "slab.h"
+
+#define PTE_PRESENT (1 << 0)
+#define PTE_WRITE VMM_WRITE
+#define PTE_USER VMM_USER
+#define PTE_LARGE (1 << 7)
+#define PTE_GLOBAL (1 << 8)
+/* Available to software. Not present: back on the first access. Present:
+ * the page came from the page allocator and goes back on unmap. */
+#define PTE_LAZY VMM_LAZY
+#define PTE_FLAGS 0xfff
+#define PTE_ADDRESS(entry) ((entry) & ~PTE_FLAGS)
+/* Permissions are checked on the page table entries, a directory entry
+ * pointing to a table allows everything */
+#define PDE_TABLE (PTE_PRESENT | PTE_WRITE | PTE_USER)
+
+#ifdef __x86_64__
+/* Long mode has four levels of 64-bit entries. Only the first 4 GiB are
+ * used: one PML4 entry, one PDPT entry per page directory, and the four
+ * directories back to back index like a single one. */
+typedef uint64_t pte_t;
+#define TABLE_ENTRIES 512
+#else
+typedef uint32_t pte_t;
+#define TABLE_ENTRIES 1024
+#endif
+#define DIRECTORY_ENTRIES (1 << (32 - LARGE_PAGE_SHIFT))
+
+#define PDE_INDEX(virt) ((virt) >> LARGE_PAGE_SHIFT)
+#define PTE_INDEX(virt) (((virt) >> PAGE_SHIFT) & (TABLE_ENTRIES - 1))
+#define LARGE_OFFSET(virt) ((virt) & (LARGE_PAGE_SIZE - 1))
+
+#define CPUID_EDX_PGE (1 << 13)
+#define CPUID_EDX_PAT (1 << 16)
+#define CR0_PG (1u << 31)
+#define CR4_PSE (1 << 4)
+#define CR4_PGE (1 << 7)
+
+/* The power-on PAT with entry 1 changed from write through to write
+ * combining, so PWT alone selects it. Entries 4-7 are never used. */
+#define MSR_PAT 0x277
+#define PAT_LOW 0x00070106
+#define PAT_HIGH 0x00070406
+
+#define VGA_TEXT_START 0xb8000
+#define VGA_TEXT_END 0xc0000
+/* The IO APIC and the local APIC share this 4 MiB, two large pages in
+ * long mode */
+#define APIC_WINDOW 0xfec00000
+#define APIC_WINDOW_END 0xff000000
+
+/* Above this many pages one flush of the whole TLB is cheaper than
+ * invalidating them one by one */
+#define FLUSH_ALL_PAGES 32
+
+#define PAGE_FAULT 14
+#define PF_PRESENT (1 << 0)
+#define PF_WRITE (1 << 1)
+
+struct vmm_space {
+    /* What CR3 points to. A copy of the kernel's page directory, or in
+     * long mode a PML4 over a PDPT of its own which shares the kernel's
+     * four directories and adds one for the user window. */
+    pte_t* top;
+#ifdef __x86_64__
+    pte_t* pdpt;
+    pte_t* user_directory;
+#else
+    /* Kernel directory entries are copied into every space */
+    struct vmm_space* next;
+#endif
+    /* The one entry covering the user window */
+    pte_t* user_pde;
+};
+
+static pte_t page_directory[DIRECTORY_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+#ifdef __x86_64__
+static pte_t pml4[TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static pte_t pdpt[TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+#define TOP_TABLE pml4
+#else
+#define TOP_TABLE page_directory
+#endif
+/* The first large page, part of the kernel image so it is never freed */
+static pte_t low_table[TABLE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+
+static struct spinlock lock;
+/* What each CPU has loaded, NULL for the kernel's own tables */
+static struct vmm_space* loaded[SMP_MAX_CPUS];
+#ifndef __x86_64__
+static struct vmm_space* spaces = NULL;
+#endif
+static bool has_pge = false;
+static bool has_pat = false;
+static struct vmm_info info;
+
+struct flush_range {
+    uintptr_t virt;
+    uint32_t size;
+};
+
+static pte_t entry_flags(uint32_t flags)
+{
+    pte_t entry = flags & (VMM_WRITE | VMM_USER | VMM_UNCACHED | VMM_LAZY);
+    // PWT on its own would be write through
+    if (!has_pat && (flags & VMM_WRITE_COMBINE))
+        entry |= VMM_UNCACHED;
+    if (!(flags & VMM_LAZY))
+        entry |= PTE_PRESENT;
+    // the same in every address space, they survive CR3 reloads
+    if (has_pge && !(flags & VMM_USER))
+        entry |= PTE_GLOBAL;
+    return entry;
+}
+
+/* The directory entry covering `virt`. NULL in the user window while the
+ * CPU has no user space loaded, and above 4 GiB otherwise. */
+static pte_t* pde_for(uintptr_t virt)
+{
+    if (virt - USER_BASE < USER_SIZE) {
+        struct vmm_space* space = loaded[this_cpu()->id];
+        return space != NULL ? space->user_pde : NULL;
+    }
+    if (PDE_INDEX(virt) >= DIRECTORY_ENTRIES)
+        return NULL;
+    return &page_directory[PDE_INDEX(virt)];
+}
+
+static void set_pde(pte_t* pde, pte_t value)
+{
+    *pde = value;
+#ifndef __x86_64__
+    if (pde >= page_directory && pde < page_directory + DIRECTORY_ENTRIES) {
+        for (struct vmm_space* space = spaces; space != NULL; space = space->next)
+            space->top[pde - page_directory] = value;
+    }
+#endif
+}
+
+static void flush_all()
+{
+    uintptr_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        // global entries only go when PGE is toggled
+        asm volatile("mov %0, %%cr4" : : "r"(cr4 & ~CR4_PGE) : "memory");
+        asm volatile("mov %0, %%cr4" : : "r"(cr4) : "memory");
+    } else {
+        uintptr_t cr3;
+        asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+    }
+}
+
+static void flush_local(void* arg)
+{
+    struct flush_range* range = arg;
+    if ((range->size >> PAGE_SHIFT) > FLUSH_ALL_PAGES) {
+        flush_all();
+        return;
+    }
+    for (uint32_t offset = 0; offset < range->size; offset += PAGE_SIZE)
+        asm volatile("invlpg (%0)" : : "r"(range->virt + offset) : "memory");
+}
+
+/* Every CPU, the lock has to be dropped first: a CPU spinning on it with
+ * interrupts off would never take the IPI */
+static void flush_tlb(uintptr_t virt, uint32_t size)
+{
+    struct flush_range range = { virt, size };
+    smp_call(cpu_count, flush_local, &range);
+}
+
+/* Pages unmapped by clear_range() are linked through their first word
+ * and only freed after the flush, until then other CPUs may still use
+ * them through a stale TLB entry */
+static void defer_free(uintptr_t* freed, uintptr_t page)
+{
+    *(uintptr_t*)page = *freed;
+    *freed = page;
+}
+
+static void release_pages(uintptr_t freed)
+{
+    while (freed != 0) {
+        uintptr_t next = *(uintptr_t*)freed;
+        pmm_free_pages(freed, 0);
+        freed = next;
+    }
+}
+
+/* The page table covering `virt`. A large page is split into one with the
+ * same translation when `create` is set, an empty one is allocated if
+ * there is none. NULL otherwise or when out of memory. */
+static pte_t* page_table(uintptr_t virt, bool create)
+{
+    pte_t* pde = pde_for(virt);
+
+    if (pde == NULL)
+        return NULL;
+    if (*pde & PTE_PRESENT && !(*pde & PTE_LARGE))
+        return (pte_t*)PTE_ADDRESS(*pde);
+    if (!create)
+        return NULL;
+
+    uintptr_t table = pmm_alloc_pages(0);
+    if (table == 0)
+        return NULL;
+    pte_t* entries = (pte_t*)table;
+
+    if (*pde & PTE_PRESENT) {
+        pte_t base = *pde & ~(LARGE_PAGE_SIZE - 1);
+        pte_t flags = *pde & PTE_FLAGS & ~PTE_LARGE;
+        for (int idx = 0; idx < TABLE_ENTRIES; idx++)
+            entries[idx] = (base + idx * PAGE_SIZE) | flags;
+        info.large_pages--;
+    } else {
+        memset(entries, 0, PAGE_SIZE);
+    }
+
+    set_pde(pde, table | PDE_TABLE);
+    info.page_tables++;
+    // the translation is the same but the large entry may still be cached
+    asm volatile("invlpg (%0)" : : "r"(virt) : "memory");
+    return entries;
+}
+
+static bool clear_entry(pte_t* entry, uintptr_t* freed)
+{
+    bool present = *entry & PTE_PRESENT;
+    if (present && (*entry & PTE_LAZY))
+        defer_free(freed, PTE_ADDRESS(*entry));
+    *entry = 0;
+    return present;
+}
+
+/* Removes everything in [virt, virt + size), true if any of it was
+ * mapped and needs a TLB flush. `ok` turns false if a large page couldn't
+ * be split, that part stays mapped. */
+static bool clear_range(uintptr_t virt, uint32_t size, uintptr_t* freed, bool* ok)
+{
+    bool present = false;
+
+    for (uint32_t offset = 0; offset < size;) {
+        uintptr_t addr = virt + offset;
+        pte_t* pde = pde_for(addr);
+        bool whole = LARGE_OFFSET(addr) == 0 && size - offset >= LARGE_PAGE_SIZE;
+
+        if (pde == NULL || !(*pde & PTE_PRESENT)) {
+            offset += LARGE_PAGE_SIZE - LARGE_OFFSET(addr);
+            continue;
+        }
+        if (whole && (*pde & PTE_LARGE)) {
+            set_pde(pde, 0);
+            info.large_pages--;
+            present = true;
+            offset += LARGE_PAGE_SIZE;
+            continue;
+        }
+        if (whole && PTE_ADDRESS(*pde) != (uintptr_t)low_table) {
+            pte_t* table = (pte_t*)PTE_ADDRESS(*pde);
+            for (int idx = 0; idx < TABLE_ENTRIES; idx++)
+                clear_entry(&table[idx], freed);
+            defer_free(freed, (uintptr_t)table);
+            set_pde(pde, 0);
+            info.page_tables--;
+            present = true;
+            offset += LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        pte_t* table = page_table(addr, true);
+        if (table == NULL) {
+            *ok = false;
+            offset += LARGE_PAGE_SIZE - LARGE_OFFSET(addr);
+            continue;
+        }
+        present |= clear_entry(&table[PTE_INDEX(addr)], freed);
+        offset += PAGE_SIZE;
+    }
+    return present;
+}
+
+static bool unmap(uintptr_t virt, uint32_t size)
+{
+    uintptr_t freed = 0;
+    bool ok = true;
+
+    uint32_t flags = spin_lock_irqsave(&lock);
+    bool present = clear_range(virt, size, &freed, &ok);
+    spin_unlock_irqrestore(&lock, flags);
+
+    if (present)
+        flush_tlb(virt, size);
+    release_pages(freed);
+    return ok;
+}
+
+bool vmm_map(uintptr_t virt, uintptr_t phys, uint32_t size, uint32_t flags)
+{
+    pte_t entry = entry_flags(flags);
+    bool ok = unmap(virt, size);
+
+    uint32_t irq_flags = spin_lock_irqsave(&lock);
+    for (uint32_t offset = 0; ok && offset < size;) {
+        uintptr_t addr = virt + offset;
+        uintptr_t target = phys + offset;
+
+        pte_t* pde = pde_for(addr);
+        if (pde == NULL) {
+            ok = false;
+            break;
+        }
+        if (!(flags & VMM_LAZY) && LARGE_OFFSET(addr | target) == 0 && size - offset >= LARGE_PAGE_SIZE) {
+            set_pde(pde, target | entry | PTE_LARGE);
+            info.large_pages++;
+            offset += LARGE_PAGE_SIZE;
+            continue;
+        }
+
+        pte_t* table = page_table(addr, true);
+        if (table == NULL) {
+            ok = false;
+            break;
+        }
+        table[PTE_INDEX(addr)] = (flags & VMM_LAZY ? 0 : target) | entry;
+        offset += PAGE_SIZE;
+    }
+    spin_unlock_irqrestore(&lock, irq_flags);
+    return ok;
+}
+
+void vmm_unmap(uintptr_t virt, uint32_t size)
+{
+    unmap(virt, size);
+}
+
+uintptr_t vmm_translate(uintptr_t virt)
+{
+    pte_t* entry = pde_for(virt);
+    if (entry == NULL || !(*entry & PTE_PRESENT))
+        return 0;
+    pte_t pde = *entry;
+    if (pde & PTE_LARGE)
+        return (pde & ~(LARGE_PAGE_SIZE - 1)) | LARGE_OFFSET(virt);
+
+    pte_t pte = ((pte_t*)PTE_ADDRESS(pde))[PTE_INDEX(virt)];
+    if (!(pte & PTE_PRESENT))
+        return 0;
+    return PTE_ADDRESS(pte) | (virt & (PAGE_SIZE - 1));
+}
+
+void vmm_get_info(struct vmm_info* out)
+{
+    *out = info;
+}
+
+static pte_t* alloc_table()
+{
+    uintptr_t table = pmm_alloc_pages(0);
+    if (table != 0)
+        memset((void*)table, 0, PAGE_SIZE);
+    return (pte_t*)table;
+}
+
+struct vmm_space* vmm_space_create()
+{
+    struct vmm_space* space = kmalloc(sizeof(struct vmm_space));
+    if (space == NULL)
+        return NULL;
+    space->user_pde = NULL;
+    space->top = alloc_table();
+#ifdef __x86_64__
+    space->pdpt = alloc_table();
+    space->user_directory = alloc_table();
+    if (space->top == NULL || space->pdpt == NULL || space->user_directory == NULL) {
+        vmm_space_destroy(space);
+        return NULL;
+    }
+    // the kernel's directories are shared, only the window is added
+    for (int idx = 0; idx < DIRECTORY_ENTRIES / TABLE_ENTRIES; idx++)
+        space->pdpt[idx] = pdpt[idx];
+    space->pdpt[USER_BASE >> 30] = (uintptr_t)space->user_directory | PDE_TABLE;
+    space->top[0] = (uintptr_t)space->pdpt | PDE_TABLE;
+    space->user_pde = &space->user_directory[(USER_BASE >> LARGE_PAGE_SHIFT) % TABLE_ENTRIES];
+#else
+    if (space->top == NULL) {
+        kfree(space);
+        return NULL;
+    }
+    uint32_t flags = spin_lock_irqsave(&lock);
+    memcpy(space->top, page_directory, PAGE_SIZE);
+    space->next = spaces;
+    spaces = space;
+    spin_unlock_irqrestore(&lock, flags);
+    space->user_pde = &space->top[PDE_INDEX(USER_BASE)];
+#endif
+    return space;
+}
+
+void vmm_space_destroy(struct vmm_space* space)
+{
+    uintptr_t freed = 0;
+    uint32_t flags = spin_lock_irqsave(&lock);
+#ifndef __x86_64__
+    struct vmm_space** link = &spaces;
+    while (*link != space)
+        link = &(*link)->next;
+    *link = space->next;
+#endif
+    pte_t* pde = space->user_pde;
+    if (pde != NULL && (*pde & PTE_PRESENT)) {
+        if (*pde & PTE_LARGE) {
+            info.large_pages--;
+        } else {
+            pte_t* table = (pte_t*)PTE_ADDRESS(*pde);
+            for (int idx = 0; idx < TABLE_ENTRIES; idx++)
+                clear_entry(&table[idx], &freed);
+            defer_free(&freed, (uintptr_t)table);
+            info.page_tables--;
+        }
+    }
+    spin_unlock_irqrestore(&lock, flags);
+
+    release_pages(freed);
+    if (space->top != NULL)
+        pmm_free_pages((uintptr_t)space->top, 0);
+#ifdef __x86_64__
+    if (space->pdpt != NULL)
+        pmm_free_pages((uintptr_t)space->pdpt, 0);
+    if (space->user_directory != NULL)
+        pmm_free_pages((uintptr_t)space->user_directory, 0);
+#endif
+    kfree(space);
+}
+
+void vmm_switch(struct vmm_space* space)
+{
+    loaded[this_cpu()->id] = space;
+    uintptr_t top = space != NULL ? (uintptr_t)space->top : (uintptr_t)TOP_TABLE;
+    asm volatile("mov %0, %%cr3" : : "r"(top) : "memory");
+}
+
+/* Backs a lazy page, true if the access can be retried. User mode only
+ * gets its own pages backed. */
+static bool fault_in(uintptr_t address, bool user)
+{
+    bool handled = false;
+    uint32_t flags = spin_lock_irqsave(&lock);
+
+    pte_t* table = page_table(address, false);
+    pte_t* pte = table != NULL ? &table[PTE_INDEX(address)] : NULL;
+    if (pte != NULL && (*pte & PTE_PRESENT)) {
+        // another CPU got here first
+        handled = true;
+    } else if (pte != NULL && (*pte & PTE_LAZY) && (!user || (*pte & PTE_USER))) {
+        uintptr_t page = pmm_alloc_pages(0);
+        if (page != 0) {
+            memset((void*)page, 0, PAGE_SIZE);
+            *pte = page | (*pte & PTE_FLAGS) | PTE_PRESENT;
+            info.lazy_faults++;
+            handled = true;
+        }
+    }
+
+    spin_unlock_irqrestore(&lock, flags);
+    return handled;
+}
+
+static void page_fault(registers_t* regs)
+{
+    uintptr_t address;
+    asm volatile("mov %%cr2, %0" : "=r"(address));
+
+    if (!(regs->err_code & PF_PRESENT) && fault_in(address, REGISTERS_USER(regs)))
+        return;
+
+    printk(LOG_ERR, "Page fault at %p, %s%s, ip %p", (void*)address, regs->err_code & PF_WRITE ? "write" : "read",
+        regs->err_code & PF_PRESENT ? " denied" : " of an unmapped page", (void*)REGISTERS_IP(regs));
+    console_flush();
+
+    if (REGISTERS_USER(regs))
+        user_kill();
+    // nothing to return to, the access would fault again
+    while (1)
+        asm volatile("cli; hlt");
+}
+
+static void enable_paging()
+{
+    uintptr_t cr0, cr4;
+
+    if (has_pat)
+        asm volatile("wrmsr" : : "c"(MSR_PAT), "a"(PAT_LOW), "d"(PAT_HIGH));
+
+    // long mode is already paging, on the boot tables, PSE is ignored
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE));
+    asm volatile("mov %0, %%cr3" : : "r"(TOP_TABLE));
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_PG) : "memory");
+
+    // global pages are only turned on once paging is
+    if (has_pge)
+        asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_PSE | CR4_PGE));
+}
+
+/* End of the highest RAM range below 4 GiB */
+static uint32_t ram_end()
+{
+    struct memory_map* map = BOOT_MEMORY_MAP;
+    uint64_t end = 0;
+
+    for (uint32_t idx = 0; idx < map->count; idx++) {
+        struct e820_entry* entry = &map->entries[idx];
+        if (entry->type == E820_RAM && entry->base + entry->length > end)
+            end = entry->base + entry->length;
+    }
+    return end > APIC_WINDOW ? APIC_WINDOW : (uint32_t)end;
+}
+
+void vmm_init()
+{
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    // PSE itself goes back to the Pentium, it isn't checked
+    has_pge = edx & CPUID_EDX_PGE;
+    has_pat = edx & CPUID_EDX_PAT;
+    info.global_pages = has_pge;
+    info.write_combining = has_pat;
+
+    // page 0 stays unmapped
+    pte_t kernel = entry_flags(VMM_WRITE);
+    for (uint32_t idx = 1; idx < TABLE_ENTRIES; idx++)
+        low_table[idx] = (idx << PAGE_SHIFT) | kernel;
+    // the console never reads it back, even scrolling rewrites it from
+    // the back buffer, so writes can go out in bursts
+    pte_t vga = entry_flags(VMM_WRITE | VMM_WRITE_COMBINE);
+    for (uint32_t addr = VGA_TEXT_START; addr < VGA_TEXT_END; addr += PAGE_SIZE)
+        low_table[addr >> PAGE_SHIFT] = addr | vga;
+    page_directory[0] = (uintptr_t)low_table | PDE_TABLE;
+    info.page_tables = 1;
+#ifdef __x86_64__
+    pml4[0] = (uintptr_t)pdpt | PDE_TABLE;
+    for (int idx = 0; idx < DIRECTORY_ENTRIES / TABLE_ENTRIES; idx++)
+        pdpt[idx] = (uintptr_t)&page_directory[idx * TABLE_ENTRIES] | PDE_TABLE;
+#endif
+
+    uint32_t end = ram_end();
+    for (uint32_t addr = LARGE_PAGE_SIZE; addr < end; addr += LARGE_PAGE_SIZE) {
+        page_directory[PDE_INDEX(addr)] = addr | kernel | PTE_LARGE;
+        info.large_pages++;
+    }
+    pte_t apic = entry_flags(VMM_WRITE | VMM_UNCACHED) | PTE_LARGE;
+    for (uint32_t addr = APIC_WINDOW; addr < APIC_WINDOW_END; addr += LARGE_PAGE_SIZE) {
+        page_directory[PDE_INDEX(addr)] = addr | apic;
+        info.large_pages++;
+    }
+
+    register_interrupt_handler(PAGE_FAULT, page_fault);
+    enable_paging();
+}
+
+void vmm_init_ap()
+{
+    enable_paging();
+}
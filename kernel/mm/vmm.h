@@ -0,0 +1,76 @@
+#ifndef _KERNEL_VMM_H_
+#define _KERNEL_VMM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 4 MiB, 2 MiB with the 64-bit entries of long mode */
+#ifdef __x86_64__
+#define LARGE_PAGE_SHIFT 21
+#else
+#define LARGE_PAGE_SHIFT 22
+#endif
+#define LARGE_PAGE_SIZE (1 << LARGE_PAGE_SHIFT)
+
+/* Mapping flags, the hardware bits where there is one */
+#define VMM_WRITE (1 << 1)
+#define VMM_USER (1 << 2)
+/* Through the PAT entry vmm_init() sets up, uncached without a PAT */
+#define VMM_WRITE_COMBINE (1 << 3)
+#define VMM_UNCACHED ((1 << 3) | (1 << 4))
+/* Not backed yet, the first access faults in a zeroed page */
+#define VMM_LAZY (1 << 9)
+
+/* User programs run in one large page of their own address space, above
+ * anything the kernel maps: past the APIC window, or in long mode past
+ * the first 4 GiB */
+#ifdef __x86_64__
+#define USER_BASE 0x100000000ul
+#else
+#define USER_BASE 0xff000000u
+#endif
+#define USER_SIZE LARGE_PAGE_SIZE
+#define USER_END (USER_BASE + USER_SIZE)
+
+struct vmm_info {
+    uint32_t large_pages;
+    uint32_t page_tables;
+    uint32_t lazy_faults;
+    bool global_pages;
+    bool write_combining;
+};
+
+/* Turns paging on with the kernel's address space. RAM is identity
+ * mapped with global large pages, except the first large page which uses
+ * small pages: page 0 stays unmapped to catch NULL pointers and the VGA
+ * text buffer is write combining. Needs pmm_init() first. */
+void vmm_init();
+/* Loads the same address space on an AP */
+void vmm_init_ap();
+
+/* Maps [virt, virt + size) to [phys, phys + size), both page aligned.
+ * Aligned large page stretches get large pages unless the mapping is lazy.
+ * False when a page table couldn't be allocated. */
+bool vmm_map(uintptr_t virt, uintptr_t phys, uint32_t size, uint32_t flags);
+/* Lazily backed pages are given back to the page allocator. Other CPUs
+ * are flushed through smp_call(), so only CPU 0 can unmap. */
+void vmm_unmap(uintptr_t virt, uint32_t size);
+/* Physical address `virt` maps to, 0 when nothing is mapped there */
+uintptr_t vmm_translate(uintptr_t virt);
+
+/* The kernel's mappings plus a user window of its own. vmm_map() and
+ * vmm_unmap() on the user window work on the space the calling CPU has
+ * loaded. */
+struct vmm_space;
+
+/* With an empty user window, NULL when out of memory */
+struct vmm_space* vmm_space_create();
+/* Gives back what the user window had lazily backed. The space can't be
+ * loaded on any CPU, so nothing needs flushing. */
+void vmm_space_destroy(struct vmm_space* space);
+/* Loads `space` on the calling CPU, NULL for the kernel's own */
+void vmm_switch(struct vmm_space* space);
+
+void vmm_get_info(struct vmm_info* info);
+
+#endif
@@ -0,0 +1,99 @@
+#include <stdbool.h>
+
+#include "elf.h"
+#include "../libc/string.h"
+
+/* "\x7fELF" read little endian */
+#define ELF_MAGIC 0x464c457f
+#define ELF_LITTLE_ENDIAN 1
+#define ET_EXEC 2
+#define PT_LOAD 1
+#ifdef __x86_64__
+#define ELF_CLASS 2
+#define ELF_MACHINE 62
+#else
+#define ELF_CLASS 1
+#define ELF_MACHINE 3
+#endif
+
+/* The addresses and offsets are the size of a pointer in both classes */
+struct elf_header {
+    uint32_t magic;
+    uint8_t class;
+    uint8_t data;
+    uint8_t ident_version;
+    uint8_t ident_pad[9];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uintptr_t entry;
+    uintptr_t phoff;
+    uintptr_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed));
+
+/* The program headers aren't, the flags moved */
+#ifdef __x86_64__
+struct elf_segment {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+    uint64_t align;
+};
+#else
+struct elf_segment {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+};
+#endif
+
+static bool segment_valid(const struct elf_segment* segment, uintptr_t size, uintptr_t low, uintptr_t high)
+{
+    return segment->filesz <= segment->memsz && segment->offset <= size && segment->filesz <= size - segment->offset
+        && segment->vaddr >= low && segment->vaddr <= high && segment->memsz <= high - segment->vaddr;
+}
+
+uintptr_t elf_load(const uint8_t* image, uintptr_t size, uintptr_t low, uintptr_t high)
+{
+    const struct elf_header* header = (const struct elf_header*)image;
+    if (size < sizeof(struct elf_header) || header->magic != ELF_MAGIC || header->class != ELF_CLASS
+        || header->data != ELF_LITTLE_ENDIAN || header->type != ET_EXEC || header->machine != ELF_MACHINE)
+        return 0;
+    if (header->phentsize != sizeof(struct elf_segment) || header->phoff > size
+        || header->phnum > (size - header->phoff) / sizeof(struct elf_segment))
+        return 0;
+    if (header->entry < low || header->entry >= high)
+        return 0;
+
+    // all of it is checked before anything is copied
+    const struct elf_segment* segments = (const struct elf_segment*)(image + header->phoff);
+    for (int idx = 0; idx < header->phnum; idx++) {
+        if (segments[idx].type == PT_LOAD && !segment_valid(&segments[idx], size, low, high))
+            return 0;
+    }
+
+    for (int idx = 0; idx < header->phnum; idx++) {
+        const struct elf_segment* segment = &segments[idx];
+        if (segment->type != PT_LOAD)
+            continue;
+        memcpy((void*)segment->vaddr, image + segment->offset, segment->filesz);
+        memset((void*)(segment->vaddr + segment->filesz), 0, segment->memsz - segment->filesz);
+    }
+    return header->entry;
+}
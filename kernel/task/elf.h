@@ -0,0 +1,12 @@
+#ifndef _KERNEL_ELF_H_
+#define _KERNEL_ELF_H_
+
+#include <stdint.h>
+
+/* Copies the loadable segments of a static executable for the mode the
+ * kernel runs in to their addresses, zeroing what the file leaves out.
+ * Every segment has to fit in [low, high), which is mapped. Returns the
+ * entry point, 0 when `image` isn't such an executable. */
+uintptr_t elf_load(const uint8_t* image, uintptr_t size, uintptr_t low, uintptr_t high);
+
+#endif
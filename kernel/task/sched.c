@@ -0,0 +1,473 @@
+#include "sched.h"
+#include "../cpu/apic.h"
+#include "../cpu/gdt.h"
+#include "../cpu/isr.h"
+#include "../cpu/smp.h"
+#include "../kernel/console.h"
+#include "../kernel/printk.h"
+#include "../kernel/trace.h"
+#include "../kernel/util.h"
+#include "../libc/string.h"
+#include "../mm/pmm.h"
+#include "../mm/slab.h"
+#include "../mm/vmm.h"
+
+#define THREAD_STACK_SIZE (PAGE_SIZE << THREAD_STACK_ORDER)
+#define STACK_CANARY 0x57ac6e11
+/* A new thread starts with interrupts on */
+#define EFLAGS_IF (1 << 9)
+
+struct run_queue {
+    struct spinlock lock;
+    /* Bit per priority with ready threads, the highest set bit is the
+     * next list to run from */
+    uint32_t ready_mask;
+    struct thread* heads[SCHED_PRIORITIES];
+    struct thread* tails[SCHED_PRIORITIES];
+
+    struct thread* current;
+    /* Runs when nothing else is ready, never on the lists */
+    struct thread* idle;
+    /* Armed while a thread other than the idle one runs */
+    struct timer tick;
+    /* Exited, freed once the CPU is off its stack */
+    struct thread* dead;
+    bool need_resched;
+    /* TSC at the last switch, the CPU time of `current` starts there */
+    uint64_t switch_time;
+};
+
+/* Defined in switch.asm, which saves ebp, ebx, esi and edi, or rbp, rbx
+ * and r12-r15 in long mode */
+extern void switch_context(uintptr_t* old_sp, uintptr_t new_sp);
+#ifdef __x86_64__
+#define SWITCH_SAVED_REGS 6
+#else
+#define SWITCH_SAVED_REGS 4
+#endif
+
+static struct run_queue run_queues[SMP_MAX_CPUS];
+static struct kmem_cache* thread_cache;
+/* What a thread's FPU registers start as */
+static struct fpu_state initial_fpu;
+
+static struct spinlock threads_lock;
+static struct thread* all_threads = NULL;
+static uint32_t next_id = 0;
+
+static struct run_queue* this_rq()
+{
+    return &run_queues[this_cpu()->id];
+}
+
+static void enqueue(struct run_queue* rq, struct thread* thread)
+{
+    uint8_t priority = thread->priority;
+    thread->next = NULL;
+    if (rq->heads[priority] == NULL)
+        rq->heads[priority] = thread;
+    else
+        rq->tails[priority]->next = thread;
+    rq->tails[priority] = thread;
+    rq->ready_mask |= 1u << priority;
+}
+
+static struct thread* dequeue(struct run_queue* rq)
+{
+    if (rq->ready_mask == 0)
+        return NULL;
+
+    int priority = 31 - __builtin_clz(rq->ready_mask);
+    struct thread* thread = rq->heads[priority];
+    rq->heads[priority] = thread->next;
+    if (rq->heads[priority] == NULL)
+        rq->ready_mask &= ~(1u << priority);
+    return thread;
+}
+
+/* With the run queue locked */
+static void make_ready(struct run_queue* rq, struct thread* thread)
+{
+    thread->state = THREAD_READY;
+    enqueue(rq, thread);
+    if (rq->current == rq->idle || thread->priority > rq->current->priority)
+        rq->need_resched = true;
+}
+
+static void thread_free(struct thread* thread)
+{
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    struct thread** link = &all_threads;
+    while (*link != thread)
+        link = &(*link)->all_next;
+    *link = thread->all_next;
+    spin_unlock_irqrestore(&threads_lock, flags);
+
+    if (thread->space != NULL)
+        vmm_space_destroy(thread->space);
+    pmm_free_pages(thread->stack, THREAD_STACK_ORDER);
+    kmem_cache_free(thread_cache, thread);
+}
+
+/* The first thing the CPU does on the new thread's stack after a switch */
+static void finish_switch(struct run_queue* rq, uint32_t flags)
+{
+    struct thread* dead = rq->dead;
+    rq->dead = NULL;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    if (dead != NULL)
+        thread_free(dead);
+}
+
+static void check_stack(struct thread* thread)
+{
+    if (thread->stack == 0 || *(uint32_t*)thread->stack == STACK_CANARY)
+        return;
+
+    printk(LOG_ERR, "Stack overflow in thread %s", thread->name);
+    console_flush();
+    while (1)
+        asm volatile("cli; hlt");
+}
+
+/* Picks the next thread and switches to it. Called with the run queue
+ * locked, `flags` from locking it, returns with it unlocked once the
+ * calling thread runs again. */
+static void schedule_locked(struct run_queue* rq, uint32_t flags)
+{
+    struct thread* prev = rq->current;
+    if (prev->state == THREAD_RUNNING && prev != rq->idle) {
+        prev->state = THREAD_READY;
+        enqueue(rq, prev);
+    }
+
+    struct thread* next = dequeue(rq);
+    if (next == NULL)
+        next = rq->idle;
+    rq->need_resched = false;
+    next->state = THREAD_RUNNING;
+    next->slice = SCHED_SLICE_TICKS;
+    // an idle CPU takes no ticks, the tick stops by not being rearmed
+    if (next != rq->idle && !timer_pending(&rq->tick))
+        timer_arm(&rq->tick, now_ns() + SCHED_TICK_NS);
+    if (next == prev) {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    check_stack(prev);
+    if (prev == rq->idle)
+        prev->state = THREAD_READY;
+    uint64_t now = rdtsc();
+    prev->cycles += now - rq->switch_time;
+    rq->switch_time = now;
+    next->switches++;
+    rq->current = next;
+    trace(TRACE_SCHED_SWITCH, prev->id, next->id);
+
+    // the FPU registers follow lazily, on next's first use of them
+    if (prev->state == THREAD_DEAD)
+        fpu_release(&prev->fpu);
+    fpu_switch(&next->fpu);
+    if (next->space != prev->space)
+        vmm_switch(next->space);
+    // where interrupts from next's user mode enter the kernel
+    if (next->space != NULL)
+        tss_set_kernel_stack(rq - run_queues, next->stack + THREAD_STACK_SIZE);
+    switch_context(&prev->sp, next->sp);
+
+    // `prev` runs again, on the same CPU as threads don't migrate
+    finish_switch(rq, flags);
+}
+
+static void thread_start()
+{
+    struct run_queue* rq = this_rq();
+    finish_switch(rq, EFLAGS_IF);
+
+    struct thread* self = rq->current;
+    self->func(self->arg);
+    thread_exit();
+}
+
+static void copy_name(char* dest, const char* name)
+{
+    int idx = 0;
+    for (; idx < THREAD_NAME_LENGTH - 1 && name[idx] != '\0'; idx++)
+        dest[idx] = name[idx];
+    dest[idx] = '\0';
+}
+
+static void sleep_expired(void* arg)
+{
+    struct thread* thread = arg;
+    struct run_queue* rq = &run_queues[thread->cpu];
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    if (thread->state == THREAD_SLEEPING)
+        make_ready(rq, thread);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+static struct thread* thread_alloc(const char* name, int priority)
+{
+    struct thread* thread = kmem_cache_alloc(thread_cache);
+    if (thread == NULL)
+        return NULL;
+
+    thread->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    copy_name(thread->name, name);
+    thread->priority = priority;
+    thread->cpu = this_cpu()->id;
+    thread->stack = 0;
+    thread->slice = SCHED_SLICE_TICKS;
+    thread->cycles = 0;
+    thread->switches = 0;
+    thread->next = NULL;
+    thread->space = NULL;
+    thread->process = NULL;
+    timer_setup(&thread->sleep_timer, sleep_expired, thread);
+    memcpy(&thread->fpu, &initial_fpu, sizeof(initial_fpu));
+    return thread;
+}
+
+static void thread_register(struct thread* thread)
+{
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    thread->all_next = all_threads;
+    all_threads = thread;
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+void sched_init()
+{
+    thread_cache = kmem_cache_create("thread", sizeof(struct thread), __alignof__(struct thread), NULL);
+    uint32_t flags = fpu_begin();
+    fpu_save(&initial_fpu);
+    fpu_restore(&initial_fpu);
+    fpu_end(flags);
+    sched_init_cpu();
+}
+
+/* Counts down the slice of the running thread */
+static void tick(void* arg)
+{
+    struct run_queue* rq = arg;
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    struct thread* current = rq->current;
+    if (current != rq->idle) {
+        if (--current->slice == 0)
+            rq->need_resched = true;
+        timer_arm(&rq->tick, now_ns() + SCHED_TICK_NS);
+    }
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+void sched_init_cpu()
+{
+    struct run_queue* rq = this_rq();
+    timer_setup(&rq->tick, tick, rq);
+    char name[THREAD_NAME_LENGTH] = "idle";
+    int_to_string(this_cpu()->id, name + 4);
+
+    struct thread* idle = thread_alloc(name, 0);
+    idle->state = THREAD_RUNNING;
+    thread_register(idle);
+
+    rq->idle = idle;
+    rq->switch_time = rdtsc();
+    rq->current = idle;
+    fpu_switch(&idle->fpu);
+}
+
+void sched_idle()
+{
+    // a wakeup ends the hlt and the interrupt switches away on its way out.
+    // Threads made ready by this CPU itself have no interrupt coming now
+    // that idle CPUs take no tick, they are checked for first. Nothing
+    // gets in between sti and hlt.
+    while (1) {
+        asm volatile("cli");
+        if (this_rq()->need_resched)
+            sched_preempt();
+        else
+            asm volatile("sti; hlt");
+    }
+}
+
+struct thread* thread_create(const char* name, thread_func_t func, void* arg, int priority)
+{
+    if (priority < 0 || priority > THREAD_PRIORITY_MAX)
+        return NULL;
+
+    struct thread* thread = thread_alloc(name, priority);
+    if (thread == NULL)
+        return NULL;
+    thread->stack = pmm_alloc_pages(THREAD_STACK_ORDER);
+    if (thread->stack == 0) {
+        kmem_cache_free(thread_cache, thread);
+        return NULL;
+    }
+    thread->func = func;
+    thread->arg = arg;
+    *(uint32_t*)thread->stack = STACK_CANARY;
+
+    // what switch_context() pops: the callee saved registers and the
+    // return address, thread_start() sees a return address of 0 above
+    uintptr_t* stack = (uintptr_t*)(thread->stack + THREAD_STACK_SIZE);
+    *--stack = 0;
+    *--stack = (uintptr_t)thread_start;
+    for (int reg = 0; reg < SWITCH_SAVED_REGS; reg++)
+        *--stack = 0;
+    thread->sp = (uintptr_t)stack;
+
+    thread_register(thread);
+
+    struct run_queue* rq = this_rq();
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    make_ready(rq, thread);
+    spin_unlock_irqrestore(&rq->lock, flags);
+    return thread;
+}
+
+struct thread* thread_current()
+{
+    return this_rq()->current;
+}
+
+void thread_yield()
+{
+    struct run_queue* rq = this_rq();
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    schedule_locked(rq, flags);
+}
+
+void thread_sleep(uint64_t ns)
+{
+    struct run_queue* rq = this_rq();
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+
+    // the timer runs on this CPU, not before the switch with interrupts off
+    struct thread* current = rq->current;
+    current->state = THREAD_SLEEPING;
+    timer_arm(&current->sleep_timer, now_ns() + ns);
+    schedule_locked(rq, flags);
+}
+
+void thread_exit()
+{
+    struct run_queue* rq = this_rq();
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+
+    rq->current->state = THREAD_DEAD;
+    rq->dead = rq->current;
+    schedule_locked(rq, flags);
+    while (1)
+        ;
+}
+
+void thread_set_space(struct vmm_space* space)
+{
+    struct run_queue* rq = this_rq();
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+
+    struct thread* current = rq->current;
+    current->space = space;
+    vmm_switch(space);
+    tss_set_kernel_stack(rq - run_queues, current->stack + THREAD_STACK_SIZE);
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+void sched_preempt()
+{
+    struct run_queue* rq = this_rq();
+    if (!rq->need_resched)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    schedule_locked(rq, flags);
+}
+
+int sched_thread_info(struct thread_info* info, int max)
+{
+    int count = 0;
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    for (struct thread* thread = all_threads; thread != NULL && count < max; thread = thread->all_next) {
+        struct thread_info* out = &info[count++];
+        out->id = thread->id;
+        memcpy(out->name, thread->name, THREAD_NAME_LENGTH);
+        out->state = thread->state;
+        out->priority = thread->priority;
+        out->cpu = thread->cpu;
+        out->cycles = thread->cycles;
+        out->switches = thread->switches;
+    }
+    spin_unlock_irqrestore(&threads_lock, flags);
+    return count;
+}
+
+void wait_queue_init(struct wait_queue* queue)
+{
+    spin_lock_init(&queue->lock);
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+uint32_t wait_queue_sleep(struct wait_queue* queue, uint32_t flags)
+{
+    struct run_queue* rq = this_rq();
+    struct thread* current = rq->current;
+
+    current->state = THREAD_BLOCKED;
+    current->next = NULL;
+    if (queue->head == NULL)
+        queue->head = current;
+    else
+        queue->tail->next = current;
+    queue->tail = current;
+
+    // interrupts stay off until the switch, a waker on another CPU finds
+    // the thread on the queue and makes it ready again if it gets there first
+    spin_unlock_irqrestore(&queue->lock, 0);
+    spin_lock_irqsave(&rq->lock);
+    schedule_locked(rq, 0);
+
+    spin_lock_irqsave(&queue->lock);
+    return flags;
+}
+
+static void wake_thread(struct thread* thread)
+{
+    struct run_queue* rq = &run_queues[thread->cpu];
+    uint32_t flags = spin_lock_irqsave(&rq->lock);
+    if (thread->state == THREAD_BLOCKED) {
+        make_ready(rq, thread);
+        trace(TRACE_SCHED_WAKEUP, thread->cpu, thread->id);
+    }
+    bool kick = rq->need_resched && thread->cpu != this_cpu()->id;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    // the call IPI finds no work, switching on its way out is all it does
+    if (kick) {
+        isr_ipi_sent(thread->cpu, LAPIC_CALL_VECTOR);
+        lapic_send_ipi(cpus[thread->cpu].apic_id, LAPIC_CALL_VECTOR);
+    }
+}
+
+bool wake_up(struct wait_queue* queue)
+{
+    uint32_t flags = spin_lock_irqsave(&queue->lock);
+    struct thread* thread = queue->head;
+    if (thread != NULL) {
+        queue->head = thread->next;
+        wake_thread(thread);
+    }
+    spin_unlock_irqrestore(&queue->lock, flags);
+    return thread != NULL;
+}
+
+void wake_up_all(struct wait_queue* queue)
+{
+    while (wake_up(queue))
+        ;
+}
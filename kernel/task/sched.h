@@ -0,0 +1,126 @@
+#ifndef _KERNEL_SCHED_H_
+#define _KERNEL_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../cpu/fpu.h"
+#include "../cpu/spinlock.h"
+#include "../cpu/timer.h"
+
+/* Higher runs first, the idle threads are below all of them */
+#define SCHED_PRIORITIES 32
+#define THREAD_PRIORITY_DEFAULT 16
+#define THREAD_PRIORITY_MAX (SCHED_PRIORITIES - 1)
+/* Timer ticks a thread runs before others of its priority get a turn.
+ * The tick only runs while a CPU isn't idle. */
+#define SCHED_SLICE_TICKS 5
+#define SCHED_TICK_NS (NSEC_PER_SEC / TIMER_HZ)
+
+#define THREAD_NAME_LENGTH 16
+/* 16 KiB stacks, interrupts run on whatever thread they interrupted. A
+ * canary at the bottom is checked on switches. */
+#define THREAD_STACK_ORDER 2
+
+enum thread_state {
+    THREAD_RUNNING,
+    THREAD_READY,
+    /* On a wait queue */
+    THREAD_BLOCKED,
+    THREAD_SLEEPING,
+    THREAD_DEAD,
+};
+
+typedef void (*thread_func_t)(void* arg);
+
+struct user_process;
+struct vmm_space;
+
+/* Threads stay on the CPU they were created on, so a run queue is only
+ * ever touched by other CPUs to wake one of its threads */
+struct thread {
+    /* Where switch_context() left the stack */
+    uintptr_t sp;
+    uint32_t id;
+    char name[THREAD_NAME_LENGTH];
+    enum thread_state state;
+    uint8_t priority;
+    uint8_t cpu;
+    /* Bottom of the stack pages, 0 for the boot stacks of idle threads */
+    uintptr_t stack;
+    thread_func_t func;
+    void* arg;
+
+    uint32_t slice;
+    /* Wakes the thread from thread_sleep() */
+    struct timer sleep_timer;
+    /* TSC cycles spent running, up to the last switch */
+    uint64_t cycles;
+    uint32_t switches;
+
+    /* Run queue or wait queue, a thread is on one at most */
+    struct thread* next;
+    struct thread* all_next;
+
+    /* Set for threads running a user program, see task/user.c */
+    struct vmm_space* space;
+    struct user_process* process;
+
+    struct fpu_state fpu;
+};
+
+/* Threads waiting for something, woken in the order they came */
+struct wait_queue {
+    struct spinlock lock;
+    struct thread* head;
+    struct thread* tail;
+};
+
+/* What the PS command shows of a thread */
+struct thread_info {
+    uint32_t id;
+    char name[THREAD_NAME_LENGTH];
+    enum thread_state state;
+    uint8_t priority;
+    uint8_t cpu;
+    uint64_t cycles;
+    uint32_t switches;
+};
+
+/* Makes what the BSP is running its idle thread, before the timer starts */
+void sched_init();
+/* The same on an AP */
+void sched_init_cpu();
+/* The idle loop, never returns */
+void sched_idle();
+
+/* Ready to run on the calling CPU, NULL when out of memory */
+struct thread* thread_create(const char* name, thread_func_t func, void* arg, int priority);
+struct thread* thread_current();
+void thread_yield();
+void thread_sleep(uint64_t ns);
+void thread_exit() __attribute__((noreturn));
+/* Switches the calling thread to `space` for good, it is destroyed along
+ * with the thread */
+void thread_set_space(struct vmm_space* space);
+
+/* At the end of an interrupt, switches if a tick or a wakeup asked for it */
+void sched_preempt();
+
+/* Up to `max` threads, returns how many were filled in */
+int sched_thread_info(struct thread_info* info, int max);
+
+void wait_queue_init(struct wait_queue* queue);
+/* Sleeps until woken. The caller holds queue->lock, `flags` from taking
+ * it, and checks its condition again once this returns with the lock
+ * held again:
+ *     uint32_t flags = spin_lock_irqsave(&queue->lock);
+ *     while (!condition)
+ *         flags = wait_queue_sleep(queue, flags);
+ *     spin_unlock_irqrestore(&queue->lock, flags); */
+uint32_t wait_queue_sleep(struct wait_queue* queue, uint32_t flags);
+/* Wakes the first waiter, true if there was one */
+bool wake_up(struct wait_queue* queue);
+void wake_up_all(struct wait_queue* queue);
+
+#endif
@@ -0,0 +1,83 @@
+#include "softirq.h"
+#include "../cpu/smp.h"
+#include "../kernel/trace.h"
+#include "../kernel/util.h"
+#include "sched.h"
+
+struct softirq_cpu {
+    /* Bit n set while softirq n is raised and hasn't run */
+    uint32_t pending;
+    /* When pending last went from 0 to something */
+    uint64_t raise_time;
+    struct wait_queue queue;
+    struct histogram delay;
+};
+
+static softirq_handler_t handlers[SOFTIRQ_COUNT];
+static struct softirq_cpu softirq_cpus[SMP_MAX_CPUS];
+
+static void softirq_thread(void* arg)
+{
+    struct softirq_cpu* cpu = arg;
+
+    while (1) {
+        uint32_t flags = spin_lock_irqsave(&cpu->queue.lock);
+        while (cpu->pending == 0)
+            flags = wait_queue_sleep(&cpu->queue, flags);
+        // with interrupts off nothing raises in between
+        uint32_t pending = cpu->pending;
+        cpu->pending = 0;
+        histogram_record(&cpu->delay, (uint32_t)(rdtsc() - cpu->raise_time));
+        spin_unlock_irqrestore(&cpu->queue.lock, flags);
+
+        trace(TRACE_SOFTIRQ_ENTER, 0, pending);
+        for (int nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if ((pending & (1 << nr)) && handlers[nr] != 0)
+                handlers[nr]();
+        }
+        trace(TRACE_SOFTIRQ_EXIT, 0, pending);
+    }
+}
+
+void softirq_init_cpu()
+{
+    struct softirq_cpu* cpu = &softirq_cpus[this_cpu()->id];
+    char name[THREAD_NAME_LENGTH] = "softirq";
+    int_to_string(this_cpu()->id, name + 7);
+
+    wait_queue_init(&cpu->queue);
+    thread_create(name, softirq_thread, cpu, SOFTIRQ_PRIORITY);
+}
+
+void softirq_register(enum softirq nr, softirq_handler_t handler)
+{
+    handlers[nr] = handler;
+}
+
+/* Raised before the thread exists, it finds the bit set once it starts */
+void softirq_raise(enum softirq nr)
+{
+    struct softirq_cpu* cpu = &softirq_cpus[this_cpu()->id];
+
+    uint32_t flags = spin_lock_irqsave(&cpu->queue.lock);
+    if (cpu->pending == 0)
+        cpu->raise_time = rdtsc();
+    cpu->pending |= 1 << nr;
+    spin_unlock_irqrestore(&cpu->queue.lock, flags);
+    wake_up(&cpu->queue);
+}
+
+const struct histogram* softirq_delay(int cpu)
+{
+    return &softirq_cpus[cpu].delay;
+}
+
+void softirq_reset_stats()
+{
+    for (int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        struct softirq_cpu* softirq_cpu = &softirq_cpus[cpu];
+        uint32_t flags = spin_lock_irqsave(&softirq_cpu->queue.lock);
+        histogram_reset(&softirq_cpu->delay);
+        spin_unlock_irqrestore(&softirq_cpu->queue.lock, flags);
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef _KERNEL_SOFTIRQ_H_
+#define _KERNEL_SOFTIRQ_H_
+
+#include "../kernel/histogram.h"
+
+/* Work an interrupt handler leaves for later. The handler acknowledges
+ * the device, queues what it read and raises its softirq. A thread on
+ * the same CPU then does the rest with interrupts on, switched to as the
+ * interrupt returns. */
+enum softirq {
+    SOFTIRQ_KEYBOARD,
+    /* The consoles catching up with the kernel log */
+    SOFTIRQ_LOG,
+    SOFTIRQ_COUNT,
+};
+
+/* Above the default so bottom halves run ahead of ordinary threads */
+#define SOFTIRQ_PRIORITY (THREAD_PRIORITY_MAX - 1)
+
+typedef void (*softirq_handler_t)();
+
+/* Starts the softirq thread of the calling CPU, after sched_init_cpu() */
+void softirq_init_cpu();
+void softirq_register(enum softirq nr, softirq_handler_t handler);
+/* From an interrupt handler or a thread, the handler runs on the calling
+ * CPU */
+void softirq_raise(enum softirq nr);
+
+/* Cycles from the first softirq_raise() until the thread starts on it */
+const struct histogram* softirq_delay(int cpu);
+void softirq_reset_stats();
+
+#endif
@@ -0,0 +1,138 @@
+#include "syscall.h"
+#include "../cpu/gdt.h"
+#include "../cpu/idt.h"
+#include "../cpu/isr.h"
+#include "../cpu/smp.h"
+#include "../kernel/console.h"
+#include "../libc/string.h"
+#include "../mm/vmm.h"
+#include "sched.h"
+#include "user.h"
+
+#define CPUID_EDX_SEP (1 << 11)
+#define MSR_SYSENTER_CS 0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+#define MSR_EFER 0xc0000080
+#define EFER_SCE (1 << 0)
+#define MSR_STAR 0xc0000081
+#define MSR_LSTAR 0xc0000082
+#define MSR_SFMASK 0xc0000084
+#define MSR_KERNEL_GS_BASE 0xc0000102
+/* Cleared by SYSCALL: TF, IF and DF */
+#define SFMASK 0x700
+
+/* SYS_WRITE goes to the console this much at a time */
+#define WRITE_CHUNK 64
+
+typedef intptr_t (*syscall_t)(uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+
+/* Defined in cpu/syscall.asm */
+#ifdef __x86_64__
+extern void syscall_entry();
+#else
+extern void sysenter_entry();
+#endif
+
+static void write_msr(uint32_t msr, uint64_t value)
+{
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* Inside the user window, which is all a program can pass */
+static bool user_range(uintptr_t start, uintptr_t size)
+{
+    return start >= USER_BASE && start <= USER_END && size <= USER_END - start;
+}
+
+static intptr_t sys_exit(uintptr_t code, uintptr_t unused1, uintptr_t unused2)
+{
+    user_exit(code);
+}
+
+static intptr_t sys_write(uintptr_t buf, uintptr_t length, uintptr_t unused)
+{
+    if (!user_range(buf, length))
+        return -1;
+
+    char chunk[WRITE_CHUNK + 1];
+    for (uintptr_t done = 0; done < length;) {
+        uint32_t size = length - done < WRITE_CHUNK ? length - done : WRITE_CHUNK;
+        memcpy(chunk, (const char*)buf + done, size);
+        chunk[size] = '\0';
+        print_string(chunk);
+        done += size;
+    }
+    return length;
+}
+
+static intptr_t sys_yield(uintptr_t unused1, uintptr_t unused2, uintptr_t unused3)
+{
+    thread_yield();
+    return 0;
+}
+
+static intptr_t sys_gettid(uintptr_t unused1, uintptr_t unused2, uintptr_t unused3)
+{
+    return thread_current()->id;
+}
+
+static const syscall_t syscalls[SYS_COUNT] = {
+    [SYS_EXIT] = sys_exit,
+    [SYS_WRITE] = sys_write,
+    [SYS_YIELD] = sys_yield,
+    [SYS_GETTID] = sys_gettid,
+};
+
+intptr_t syscall_dispatch(uintptr_t number, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3)
+{
+    if (number >= SYS_COUNT)
+        return -1;
+    return syscalls[number](arg1, arg2, arg3);
+}
+
+/* int 0x80, with the arguments where the fast entry has them */
+static void syscall_interrupt(registers_t* r)
+{
+    // the interrupt gate turned them off
+    asm volatile("sti");
+#ifdef __x86_64__
+    r->rax = syscall_dispatch(r->rax, r->rdi, r->rsi, r->rdx);
+#else
+    r->eax = syscall_dispatch(r->eax, r->ebx, r->esi, r->edi);
+#endif
+}
+
+void syscall_init()
+{
+    set_idt_user_gate(SYSCALL_VECTOR, (uintptr_t)syscall_irq);
+    register_interrupt_handler(SYSCALL_VECTOR, syscall_interrupt);
+    syscall_init_cpu();
+}
+
+void syscall_init_cpu()
+{
+    int cpu = this_cpu()->id;
+#ifdef __x86_64__
+    uint32_t low, high;
+    asm volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(MSR_EFER));
+    write_msr(MSR_EFER, ((uint64_t)high << 32 | low) | EFER_SCE);
+    // SYSCALL loads CS from bits 32-47 and SS 8 past it, SYSRET SS from 8
+    // and CS from 16 past bits 48-63
+    write_msr(MSR_STAR, (uint64_t)KERNEL_CS << 32 | (uint64_t)(USER_DS - 8) << 48);
+    write_msr(MSR_LSTAR, (uintptr_t)syscall_entry);
+    write_msr(MSR_SFMASK, SFMASK);
+    // swapgs in the entry makes it GS
+    write_msr(MSR_KERNEL_GS_BASE, tss_address(cpu));
+#else
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    // programs get #UD and are killed, they'd need int 0x80
+    if (!(edx & CPUID_EDX_SEP))
+        return;
+    // SYSENTER starts on the TSS, the entry loads esp0 from it
+    write_msr(MSR_SYSENTER_CS, KERNEL_CS);
+    write_msr(MSR_SYSENTER_ESP, tss_address(cpu));
+    write_msr(MSR_SYSENTER_EIP, (uintptr_t)sysenter_entry);
+#endif
+}
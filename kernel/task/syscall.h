@@ -0,0 +1,26 @@
+#ifndef _KERNEL_SYSCALL_H_
+#define _KERNEL_SYSCALL_H_
+
+#include <stdint.h>
+
+/* System call numbers, the programs in user/ use them too */
+#define SYS_EXIT 0
+#define SYS_WRITE 1
+#define SYS_YIELD 2
+#define SYS_GETTID 3
+#define SYS_COUNT 4
+
+/* The slow way in, for CPUs without SYSENTER */
+#define SYSCALL_VECTOR 0x80
+
+/* Installs the int 0x80 gate and the fast entry of the BSP, after
+ * gdt_init() */
+void syscall_init();
+/* The fast entry of an AP */
+void syscall_init_cpu();
+
+/* What both entries call, with interrupts on. Returns the result for the
+ * program, -1 for a bad number or bad arguments. */
+intptr_t syscall_dispatch(uintptr_t number, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+
+#endif
@@ -0,0 +1,120 @@
+#include <stddef.h>
+
+#include "user.h"
+#include "../kernel/printk.h"
+#include "../libc/string.h"
+#include "../mm/vmm.h"
+#include "elf.h"
+#include "sched.h"
+
+/* Defined in cpu/syscall.asm */
+extern void user_enter(uintptr_t entry, uintptr_t stack) __attribute__((noreturn));
+
+/* ELF images from user/, see user/programs.asm */
+extern const uint8_t hello_elf[], hello_elf_end[];
+extern const uint8_t sysbench_elf[], sysbench_elf_end[];
+extern const uint8_t fault_elf[], fault_elf_end[];
+
+struct program {
+    char* name;
+    const uint8_t* start;
+    const uint8_t* end;
+};
+
+static const struct program programs[] = {
+    { "hello", hello_elf, hello_elf_end },
+    { "sysbench", sysbench_elf, sysbench_elf_end },
+    { "fault", fault_elf, fault_elf_end },
+};
+
+#define PROGRAM_COUNT (int)(sizeof(programs) / sizeof(programs[0]))
+
+/* On the stack of user_run() */
+struct user_process {
+    const struct program* program;
+    int exit_code;
+    bool exited;
+};
+
+/* All waiters share it: once woken a waiter may return and its
+ * user_process is gone, so the exiting thread can't hold on to a queue
+ * in it */
+static struct wait_queue exits;
+
+void user_init()
+{
+    wait_queue_init(&exits);
+}
+
+static void fail(const struct program* program, char* message)
+{
+    printk(LOG_WARN, "%s%s", program->name, message);
+    user_exit(-1);
+}
+
+static void user_main(void* arg)
+{
+    struct user_process* process = arg;
+    const struct program* program = process->program;
+    thread_current()->process = process;
+
+    struct vmm_space* space = vmm_space_create();
+    if (space == NULL)
+        fail(program, ": out of memory");
+    thread_set_space(space);
+
+    // pages are only backed as the program touches them
+    if (!vmm_map(USER_BASE, 0, USER_SIZE, VMM_USER | VMM_WRITE | VMM_LAZY))
+        fail(program, ": out of memory");
+    uintptr_t entry = elf_load(program->start, program->end - program->start, USER_BASE, USER_END);
+    if (entry == 0)
+        fail(program, ": not an executable");
+
+    // a slot for a return address, _start is entered as if it was called
+    user_enter(entry, USER_END - sizeof(uintptr_t));
+}
+
+bool user_run(const char* name, int* exit_code)
+{
+    const struct program* program = NULL;
+    for (int idx = 0; idx < PROGRAM_COUNT; idx++) {
+        if (strcmp(programs[idx].name, name) == 0)
+            program = &programs[idx];
+    }
+    if (program == NULL)
+        return false;
+
+    struct user_process process = { program, 0, false };
+    if (thread_create(program->name, user_main, &process, THREAD_PRIORITY_DEFAULT) == NULL)
+        return false;
+
+    uint32_t flags = spin_lock_irqsave(&exits.lock);
+    while (!process.exited)
+        flags = wait_queue_sleep(&exits, flags);
+    spin_unlock_irqrestore(&exits.lock, flags);
+    *exit_code = process.exit_code;
+    return true;
+}
+
+char* user_program_name(int idx)
+{
+    return idx < PROGRAM_COUNT ? programs[idx].name : NULL;
+}
+
+void user_exit(int code)
+{
+    struct user_process* process = thread_current()->process;
+    uint32_t flags = spin_lock_irqsave(&exits.lock);
+    process->exit_code = code;
+    process->exited = true;
+    spin_unlock_irqrestore(&exits.lock, flags);
+
+    wake_up_all(&exits);
+    thread_exit();
+}
+
+void user_kill()
+{
+    printk(LOG_WARN, "%s killed", thread_current()->name);
+    user_exit(-1);
+}
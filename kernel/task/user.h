@@ -0,0 +1,20 @@
+#ifndef _KERNEL_USER_H_
+#define _KERNEL_USER_H_
+
+#include <stdbool.h>
+
+void user_init();
+
+/* Runs the built-in program `name` in ring 3, in a thread and address
+ * space of its own on the calling CPU, and waits for it to exit. False
+ * when there is no such program or no memory for the thread. */
+bool user_run(const char* name, int* exit_code);
+/* The built-in programs by index, NULL past the last */
+char* user_program_name(int idx);
+
+/* Ends the program the calling thread runs */
+void user_exit(int code) __attribute__((noreturn));
+/* The same with -1, after a fault in user mode the caller reported */
+void user_kill() __attribute__((noreturn));
+
+#endif
@@ -0,0 +1,9 @@
+#include "lib.h"
+
+/* The kernel's pages aren't user accessible, the program gets killed and
+ * the kernel carries on */
+int main()
+{
+    print("Reading kernel memory at 0x10000\n");
+    return *(volatile uint32_t*)0x10000;
+}
@@ -0,0 +1,9 @@
+#include "lib.h"
+
+int main()
+{
+    print("Hello from ring 3, thread ");
+    print_uint(syscall(SYS_GETTID, 0, 0, 0));
+    print("\n");
+    return 0;
+}
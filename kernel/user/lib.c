@@ -0,0 +1,78 @@
+#include "lib.h"
+
+/* Where the kernel enters a program */
+void _start()
+{
+    exit(main());
+}
+
+intptr_t syscall(uintptr_t number, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3)
+{
+    intptr_t result = number;
+#ifdef __x86_64__
+    // the kernel's C code may change the argument registers
+    asm volatile("syscall"
+                 : "+a"(result), "+D"(arg1), "+S"(arg2), "+d"(arg3)
+                 :
+                 : "rcx", "r8", "r9", "r10", "r11", "memory", "cc");
+#else
+    // the kernel returns to the label on the stack it is given
+    asm volatile("mov %%esp, %%ecx\n\t"
+                 "lea 1f, %%edx\n\t"
+                 "sysenter\n"
+                 "1:"
+                 : "+a"(result)
+                 : "b"(arg1), "S"(arg2), "D"(arg3)
+                 : "ecx", "edx", "memory", "cc");
+#endif
+    return result;
+}
+
+intptr_t syscall_int80(uintptr_t number, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3)
+{
+    intptr_t result = number;
+#ifdef __x86_64__
+    asm volatile("int $0x80" : "+a"(result) : "D"(arg1), "S"(arg2), "d"(arg3) : "memory", "cc");
+#else
+    asm volatile("int $0x80" : "+a"(result) : "b"(arg1), "S"(arg2), "D"(arg3) : "memory", "cc");
+#endif
+    return result;
+}
+
+void exit(int code)
+{
+    syscall(SYS_EXIT, code, 0, 0);
+    while (1)
+        ;
+}
+
+int write(const char* buf, int length)
+{
+    return syscall(SYS_WRITE, (uintptr_t)buf, length, 0);
+}
+
+void print(const char* str)
+{
+    int length = 0;
+    while (str[length] != '\0')
+        length++;
+    write(str, length);
+}
+
+void print_uint(uint32_t value)
+{
+    char str[11];
+    int idx = sizeof(str);
+    do {
+        str[--idx] = value % 10 + '0';
+        value /= 10;
+    } while (value > 0);
+    write(str + idx, sizeof(str) - idx);
+}
+
+uint32_t cycles()
+{
+    uint32_t low, high;
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+    return low;
+}
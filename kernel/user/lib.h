@@ -0,0 +1,25 @@
+#ifndef _USER_LIB_H_
+#define _USER_LIB_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../task/syscall.h"
+
+/* All the programs here have instead of a C library. syscall() takes the
+ * fast path, SYSENTER or in long mode SYSCALL, syscall_int80() the
+ * interrupt gate. */
+intptr_t syscall(uintptr_t number, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+intptr_t syscall_int80(uintptr_t number, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3);
+
+void exit(int code) __attribute__((noreturn));
+int write(const char* buf, int length);
+void print(const char* str);
+void print_uint(uint32_t value);
+/* The low half of the TSC, enough for short intervals */
+uint32_t cycles();
+
+/* Every program has one, what it returns is the exit code */
+int main();
+
+#endif
@@ -0,0 +1,36 @@
+; The programs user_run() can start, ELF images built from user/*.c by the
+; Makefile. The names are those task/user.c expects.
+section .rodata
+global hello_elf
+global hello_elf_end
+global sysbench_elf
+global sysbench_elf_end
+global fault_elf
+global fault_elf_end
+
+align 16
+hello_elf:
+%ifdef __x86_64__
+    incbin "user/hello.64.elf"
+%else
+    incbin "user/hello.elf"
+%endif
+hello_elf_end:
+
+align 16
+sysbench_elf:
+%ifdef __x86_64__
+    incbin "user/sysbench.64.elf"
+%else
+    incbin "user/sysbench.elf"
+%endif
+sysbench_elf_end:
+
+align 16
+fault_elf:
+%ifdef __x86_64__
+    incbin "user/fault.64.elf"
+%else
+    incbin "user/fault.elf"
+%endif
+fault_elf_end:
@@ -0,0 +1,39 @@
+#include "lib.h"
+
+/* Rounds of round trips, the best round counts */
+#define CALLS 1000
+#define ROUNDS 8
+
+#ifdef __x86_64__
+#define FAST_NAME "syscall:  "
+#else
+#define FAST_NAME "sysenter: "
+#endif
+
+static uint32_t measure(bool fast)
+{
+    uint32_t best = 0xffffffff;
+    for (int round = 0; round < ROUNDS; round++) {
+        uint32_t start = cycles();
+        for (int idx = 0; idx < CALLS; idx++) {
+            if (fast)
+                syscall(SYS_GETTID, 0, 0, 0);
+            else
+                syscall_int80(SYS_GETTID, 0, 0, 0);
+        }
+        uint32_t elapsed = cycles() - start;
+        if (elapsed < best)
+            best = elapsed;
+    }
+    return best / CALLS;
+}
+
+int main()
+{
+    print("Cycles per system call round trip\n" FAST_NAME);
+    print_uint(measure(true));
+    print("\nint 0x80: ");
+    print_uint(measure(false));
+    print("\n");
+    return 0;
+}
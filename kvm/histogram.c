@@ -0,0 +1,52 @@
+#include <string.h>
+
+#include "histogram.h"
+
+void histogram_reset(struct histogram* hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
+
+uint64_t histogram_percentile(const struct histogram* hist, double percentile)
+{
+    if (hist->count == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(hist->count * percentile / 100.0);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        seen += hist->buckets[bucket];
+        if (seen > target) {
+            uint64_t upper = bucket == 0 ? 0 : (1ULL << bucket) - 1;
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+void histogram_print(FILE* file, const char* name, const struct histogram* hist, const char* unit)
+{
+    fprintf(file, "%-24s count %10lu  mean %8lu  p50 %8lu  p99 %8lu  p99.9 %8lu  max %8lu %s\n",
+        name, hist->count, hist->count ? hist->sum / hist->count : 0,
+        histogram_percentile(hist, 50), histogram_percentile(hist, 99),
+        histogram_percentile(hist, 99.9), hist->max, unit);
+}
+
+void histogram_print_json(FILE* file, const struct histogram* hist)
+{
+    fprintf(file, "{\"count\": %lu, \"sum\": %lu, \"max\": %lu, \"p50\": %lu, \"p99\": %lu, \"p999\": %lu, \"buckets\": {",
+        hist->count, hist->sum, hist->max, histogram_percentile(hist, 50),
+        histogram_percentile(hist, 99), histogram_percentile(hist, 99.9));
+
+    const char* sep = "";
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+        if (hist->buckets[bucket] == 0)
+            continue;
+        // keyed by the bucket's upper bound
+        uint64_t upper = bucket == 0 ? 0 : (1ULL << bucket) - 1;
+        fprintf(file, "%s\"%lu\": %lu", sep, upper, hist->buckets[bucket]);
+        sep = ", ";
+    }
+    fprintf(file, "}}");
+}
@@ -0,0 +1,43 @@
+#ifndef _KVM_HISTOGRAM_H_
+#define _KVM_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define HISTOGRAM_BUCKETS 64
+
+/**
+ * Power of two histogram. Bucket n counts values in [2^(n-1), 2^n), so
+ * recording a value is a bit scan and an increment.
+ *
+ * Histograms are written by a single thread. Readers may see a slightly
+ * stale but never torn view on x86-64, which is fine for reporting.
+ */
+struct histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+};
+
+static inline void histogram_record(struct histogram* hist, uint64_t value)
+{
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= HISTOGRAM_BUCKETS)
+        bucket = HISTOGRAM_BUCKETS - 1;
+    hist->buckets[bucket]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max)
+        hist->max = value;
+}
+
+void histogram_reset(struct histogram* hist);
+/* Upper bound of the bucket containing the `percentile` (0-100) */
+uint64_t histogram_percentile(const struct histogram* hist, double percentile);
+/* One line summary: count, mean, p50, p99, p99.9 and max in `unit` */
+void histogram_print(FILE* file, const char* name, const struct histogram* hist, const char* unit);
+/* Summary and non-empty buckets as a JSON object */
+void histogram_print_json(FILE* file, const struct histogram* hist);
+
+#endif
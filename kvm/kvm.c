@@ -1,5 +1,8 @@
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/kvm_para.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -11,6 +14,17 @@
 
 #include "kvm.h"
 
+// Interrupts KVM_RUN, the handler does nothing
+#define VCPU_KICK_SIGNAL SIGUSR1
+
+#define CPUID_MAX_ENTRIES 128
+// Hyper-threading, makes the logical processor count in leaf 1 valid
+#define CPUID_EDX_HTT (1 << 28)
+// kvmclock, the paravirtual feature the guest uses. KVM handles its MSRs
+// and keeps the clock structures the guest registers up to date, also
+// when the host TSC rate changes.
+#define KVM_CLOCK_FEATURES ((1 << KVM_FEATURE_CLOCKSOURCE2) | (1 << KVM_FEATURE_CLOCKSOURCE_STABLE_BIT))
+
 int kvm_error(const char* pmsg, const char* efmt, ...)
 {
     if (efmt != NULL) {
@@ -30,27 +44,63 @@ int kvm_error(const char* pmsg, const char* efmt, ...)
     return errno;
 }
 
+void vcpu_init(struct vm* vm, struct vcpu* vcpu, int id)
+{
+    vcpu->vm = vm;
+    vcpu->id = id;
+    vcpu->fd = -1;
+    vcpu->kvm_run = NULL;
+    vcpu->kvm_run_size = 0;
+    vcpu->thread_running = false;
+    stats_init(&vcpu->stats);
+    trace_log_init(&vcpu->trace);
+}
+
+void vcpu_free(struct vcpu* vcpu)
+{
+    if (vcpu->kvm_run != NULL) {
+        munmap(vcpu->kvm_run, vcpu->kvm_run_size);
+    }
+
+    if (vcpu->fd != -1) {
+        close(vcpu->fd);
+    }
+
+    stats_free(&vcpu->stats);
+    trace_log_free(&vcpu->trace);
+    vcpu_init(vcpu->vm, vcpu, vcpu->id);
+}
+
 void vm_init(struct vm* vm)
 {
     vm->shared_memory = NULL;
     vm->shared_memory_size = 0;
-    vm->kvm_run = NULL;
-    vm->kvm_run_size = 0;
     vm->kvm_fd = -1;
     vm->vm_fd = -1;
-    vm->vcpu_fd = -1;
+    vm->vcpu_count = 0;
+    for (int idx = 0; idx < KVM_MAX_VCPUS; idx++)
+        vcpu_init(vm, &vm->vcpus[idx], idx);
+    pthread_mutex_init(&vm->io_lock, NULL);
+    vm->powered_off = false;
+    vm->vga.index = 0;
     vm->vga.cursor_location = 0;
+    vm->vga.start_address = 0;
     vm->irq.irq = -1;
+    vm->irq.data.keyboard.unread = false;
+    vm->irq.data.keyboard.head = 0;
+    vm->irq.data.keyboard.count = 0;
+    memset(&vm->key_latency, 0, sizeof(vm->key_latency));
+    vm->tracing = false;
+    trace_log_init(&vm->input_trace);
 }
 
 void vm_free(struct vm* vm)
 {
-    if (vm->kvm_run != NULL) {
-        munmap(vm->kvm_run, vm->kvm_run_size);
-    }
+    for (int idx = 0; idx < KVM_MAX_VCPUS; idx++)
+        vcpu_free(&vm->vcpus[idx]);
 
-    if (vm->kvm_run != NULL) {
-        munmap(vm->kvm_run, vm->kvm_run_size);
+    if (vm->shared_memory != NULL) {
+        munmap(vm->shared_memory, vm->shared_memory_size);
     }
 
     if (vm->kvm_fd != -1) {
@@ -61,10 +111,8 @@ void vm_free(struct vm* vm)
         close(vm->vm_fd);
     }
 
-    if (vm->vcpu_fd != -1) {
-        close(vm->vcpu_fd);
-    }
-
+    pthread_mutex_destroy(&vm->io_lock);
+    trace_log_free(&vm->input_trace);
     vm_init(vm);
 }
 
@@ -101,8 +149,7 @@ int create_kvm(struct vm* vm)
         return vm_create_error(vm, "KVM_CREATE_VM", NULL);
     }
 
-    // 0x200000 is the amount x86 real mode can use so lets use that for now
-    size_t mem_size = 0x200000;
+    size_t mem_size = GUEST_MEMORY_SIZE;
     vm->shared_memory = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (vm->shared_memory == MAP_FAILED) {
@@ -123,14 +170,65 @@ int create_kvm(struct vm* vm)
         return vm_create_error(vm, "KVM_SET_USER_MEMORY_REGION", NULL);
     }
 
+    // PIC, IOAPIC and a LAPIC per vCPU for IPIs, has to exist before the vCPUs
+    if (ioctl(vm->vm_fd, KVM_CREATE_IRQCHIP, 0) < 0) {
+        return vm_create_error(vm, "KVM_CREATE_IRQCHIP", NULL);
+    }
+
+    // the guest calibrates its TSC on channel 2, gated and read back
+    // through port 0x61 which the dummy speaker emulates
+    struct kvm_pit_config pit = { .flags = KVM_PIT_SPEAKER_DUMMY };
+    if (ioctl(vm->vm_fd, KVM_CREATE_PIT2, &pit) < 0) {
+        return vm_create_error(vm, "KVM_CREATE_PIT2", NULL);
+    }
+
     return 0;
 }
 
-int create_vcpu(struct vm* vm)
+int setup_cpuid(struct vm* vm, struct vcpu* vcpu)
 {
+    struct kvm_cpuid2* cpuid = calloc(1, sizeof(*cpuid) + CPUID_MAX_ENTRIES * sizeof(struct kvm_cpuid_entry2));
+    if (cpuid == NULL) {
+        return kvm_error("Cannot allocate CPUID entries", NULL);
+    }
+
+    cpuid->nent = CPUID_MAX_ENTRIES;
+    if (ioctl(vm->kvm_fd, KVM_GET_SUPPORTED_CPUID, cpuid) < 0) {
+        free(cpuid);
+        return kvm_error("KVM_GET_SUPPORTED_CPUID", NULL);
+    }
+
+    // the guest counts its processors from the logical processor count,
+    // APIC IDs are the vCPU ids which KVM also uses for the LAPIC
+    for (uint32_t idx = 0; idx < cpuid->nent; idx++) {
+        struct kvm_cpuid_entry2* entry = &cpuid->entries[idx];
+        if (entry->function == 1) {
+            entry->ebx = (entry->ebx & 0xffff) | (uint32_t)vm->vcpu_count << 16 | (uint32_t)vcpu->id << 24;
+            entry->edx |= CPUID_EDX_HTT;
+        } else if (entry->function == 0xb) {
+            entry->edx = vcpu->id;
+        } else if (entry->function == KVM_CPUID_FEATURES) {
+            // the other paravirtual features stay hidden, nothing here
+            // was tried with them
+            entry->eax &= KVM_CLOCK_FEATURES;
+        }
+    }
 
-    vm->vcpu_fd = ioctl(vm->vm_fd, KVM_CREATE_VCPU, 0);
-    if (vm->vcpu_fd < 0) {
+    int ret = ioctl(vcpu->fd, KVM_SET_CPUID2, cpuid);
+    free(cpuid);
+    if (ret < 0) {
+        return kvm_error("KVM_SET_CPUID2", NULL);
+    }
+
+    return 0;
+}
+
+int create_vcpu(struct vm* vm, struct vcpu* vcpu)
+{
+    int ret = 0;
+
+    vcpu->fd = ioctl(vm->vm_fd, KVM_CREATE_VCPU, vcpu->id);
+    if (vcpu->fd < 0) {
         return vm_create_error(vm, "KVM_CREATE_VCPU", NULL);
     }
 
@@ -139,25 +237,40 @@ int create_vcpu(struct vm* vm)
         return vm_create_error(vm, "KVM_GET_VCPU_MMAP_SIZE", NULL);
     }
 
-    vm->kvm_run = mmap(NULL, vcpu_mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
-        vm->vcpu_fd, 0);
-    if (vm->kvm_run == MAP_FAILED) {
+    vcpu->kvm_run = mmap(NULL, vcpu_mmap_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        vcpu->fd, 0);
+    if (vcpu->kvm_run == MAP_FAILED) {
+        vcpu->kvm_run = NULL;
         return vm_create_error(vm, "Failed to map kvm_run", NULL);
     }
-    vm->kvm_run_size = (size_t)vcpu_mmap_size;
+    vcpu->kvm_run_size = (size_t)vcpu_mmap_size;
+
+    if ((ret = setup_cpuid(vm, vcpu)) != 0) {
+        vm_free(vm);
+        return ret;
+    }
 
+    // the VM wide counters are only reported with the BSP
+    stats_open_kvm(&vcpu->stats, vcpu->id == 0 ? vm->vm_fd : -1, vcpu->fd);
     return 0;
 }
 
-int vm_create(struct vm* vm)
+int vm_create(struct vm* vm, int vcpu_count)
 {
     int ret = 0;
+    if (vcpu_count < 1 || vcpu_count > KVM_MAX_VCPUS) {
+        return kvm_error(NULL, "Between 1 and %d vCPUs are supported, got %d\n", KVM_MAX_VCPUS, vcpu_count);
+    }
+
     if ((ret = create_kvm(vm)) != 0) {
         return ret;
     }
 
-    if ((ret = create_vcpu(vm)) != 0) {
-        return ret;
+    vm->vcpu_count = vcpu_count;
+    for (int idx = 0; idx < vcpu_count; idx++) {
+        if ((ret = create_vcpu(vm, &vm->vcpus[idx])) != 0) {
+            return ret;
+        }
     }
 
     return 0;
@@ -207,6 +320,7 @@ int setup_real_mode(struct vm* vm)
         return kvm_error(NULL, "Cannot load MBR from executable\nNeeds to be at least 512 bytes, was: %d\n", vm->exec.size);
     }
 
+    // only the BSP, the APs are started by the guest through their LAPIC
     struct kvm_regs regs;
     // make sure all registers are 0
     memset(&regs, 0, sizeof(regs));
@@ -215,12 +329,12 @@ int setup_real_mode(struct vm* vm)
     // bios booloader exists in 0x7C00 - 0x7DFF
     regs.rip = 0x7c00;
 
-    if (ioctl(vm->vcpu_fd, KVM_SET_REGS, &regs) < 0) {
+    if (ioctl(vm->vcpus[0].fd, KVM_SET_REGS, &regs) < 0) {
         return kvm_error("KVM_SET_REGS", NULL);
     }
 
     struct kvm_sregs sregs;
-    if (ioctl(vm->vcpu_fd, KVM_GET_SREGS, &sregs) < 0) {
+    if (ioctl(vm->vcpus[0].fd, KVM_GET_SREGS, &sregs) < 0) {
         return kvm_error("KVM_GET_SREGS", NULL);
     }
 
@@ -229,7 +343,7 @@ int setup_real_mode(struct vm* vm)
     sregs.cs.selector = 0;
     sregs.cs.base = 0;
 
-    if (ioctl(vm->vcpu_fd, KVM_SET_SREGS, &sregs) < 0) {
+    if (ioctl(vm->vcpus[0].fd, KVM_SET_SREGS, &sregs) < 0) {
         return kvm_error("KVM_SET_SREGS", NULL);
     }
 
@@ -261,145 +375,493 @@ int setup_bios(struct vm* vm)
     // each 4 bytes is a far poiter
     memcpy(vm->shared_memory + (0x13 * 4), &far_pointer, sizeof(uint32_t));
 
+    /*
+        out 0x015, ax
+        retf 2 ; drops the flags iret would restore, the handler sets CF
+    */
+    const uint8_t memory_map_code[] = {
+        0xe7,
+        BIOS_MEMORY_MAP_PORT,
+        0xca,
+        0x02,
+        0x00
+    };
+    far_pointer = (0xf000 << 16) | 0x1240;
+    memcpy(vm->shared_memory + 0xf1240, memory_map_code, sizeof(memory_map_code));
+    memcpy(vm->shared_memory + (0x15 * 4), &far_pointer, sizeof(uint32_t));
+
     return 0;
 }
 
+/* The image is a 1.44 MB floppy, CHS addresses use its geometry */
+#define FLOPPY_SECTORS_PER_TRACK 18
+#define FLOPPY_HEADS 2
+#define SECTOR_SIZE 512
+
 // TODO: bios functions should be put somewhere else
-int bios_read(struct vm* vm)
+int bios_read(struct vcpu* vcpu)
 {
+    struct vm* vm = vcpu->vm;
     struct kvm_regs regs;
-    if (ioctl(vm->vcpu_fd, KVM_GET_REGS, &regs) < 0) {
+    struct kvm_sregs sregs;
+    if (ioctl(vcpu->fd, KVM_GET_REGS, &regs) < 0) {
         return kvm_error("KVM_GET_REGS", NULL);
     }
+    if (ioctl(vcpu->fd, KVM_GET_SREGS, &sregs) < 0) {
+        return kvm_error("KVM_GET_SREGS", NULL);
+    }
 
     // number of 512 bytes sectors (to be read)
     uint8_t al = regs.rax & 0xff;
     // mode = 0x2 read from disk
     uint8_t ah = (regs.rax >> 8) & 0xff;
-    // memory address, (ignoring es for now)
-    uint16_t bx = regs.rbx;
-    // sector: 0x1 boot loader, 0x2 start of kernel
-    uint8_t cl = regs.rcx & 0xff;
-    // cylinder, don't matter to us?
-    uint8_t ch = (regs.rcx >> 8) & 0xff;
-    // drive number, we can ignore this
-    uint8_t dl = regs.rdx & 0xff;
-    // head number
-    uint8_t dh = (regs.rdx >> 8) & 0xff;
+    // memory address es:bx
+    uint64_t dest = sregs.es.base + (regs.rbx & 0xffff);
+    // sector (1 based) in bits 0-5, bits 6-7 are the high bits of the cylinder
+    uint8_t sector = regs.rcx & 0x3f;
+    uint16_t cylinder = ((regs.rcx >> 8) & 0xff) | ((regs.rcx & 0xc0) << 2);
+    // head number, the drive number in dl is ignored
+    uint8_t head = (regs.rdx >> 8) & 0xff;
 
     if (ah != 0x2)
         return kvm_error(NULL, "Only BIOS read (0x02) is supported\n");
+    if (sector == 0)
+        return kvm_error(NULL, "BIOS read sectors start at 1\n");
+
+    size_t lba = (cylinder * FLOPPY_HEADS + head) * FLOPPY_SECTORS_PER_TRACK + sector - 1;
+    size_t offset = lba * SECTOR_SIZE;
+    size_t read_size = (size_t)al * SECTOR_SIZE;
+    if (dest + read_size > vm->shared_memory_size)
+        return kvm_error(NULL, "BIOS read past the end of guest memory\n");
+
+    // past the end of the image reads zeros, like the rest of a floppy would
+    size_t available = offset < vm->exec.size ? vm->exec.size - offset : 0;
+    size_t copy_size = available < read_size ? available : read_size;
+    memcpy(vm->shared_memory + dest, vm->exec.data + offset, copy_size);
+    memset(vm->shared_memory + dest + copy_size, 0, read_size - copy_size);
+    return 0;
+}
 
-    struct executable kernel;
-    kernel.data = vm->exec.data + (512 * (cl - 1));
-    kernel.size = vm->exec.size - (512 * (cl - 1));
+#define RFLAGS_CF (1 << 0)
 
-    int read_size = 512 * al;
-    if (kernel.size < read_size)
-        read_size = kernel.size;
+#define E820_SMAP 0x534d4150
+#define E820_RAM 1
+#define E820_RESERVED 2
 
-    memcpy(vm->shared_memory + bx, kernel.data, read_size);
+struct e820_entry {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+} __attribute__((packed));
+
+/* RAM around the legacy holes, and the APIC pages of the in-kernel irqchip */
+static int memory_map(struct vm* vm, struct e820_entry* entries)
+{
+    int count = 0;
+    entries[count++] = (struct e820_entry) { 0, 0x9fc00, E820_RAM };
+    entries[count++] = (struct e820_entry) { 0x9fc00, 0x400, E820_RESERVED };
+    entries[count++] = (struct e820_entry) { 0xf0000, 0x10000, E820_RESERVED };
+    entries[count++] = (struct e820_entry) { 0x100000, vm->shared_memory_size - 0x100000, E820_RAM };
+    entries[count++] = (struct e820_entry) { 0xfec00000, 0x1000, E820_RESERVED };
+    entries[count++] = (struct e820_entry) { 0xfee00000, 0x1000, E820_RESERVED };
+    return count;
+}
+
+/* int 0x15, eax = 0xE820: one map entry per call, ebx walks the entries */
+int bios_memory_map(struct vcpu* vcpu)
+{
+    struct vm* vm = vcpu->vm;
+    struct kvm_regs regs;
+    struct kvm_sregs sregs;
+    if (ioctl(vcpu->fd, KVM_GET_REGS, &regs) < 0)
+        return kvm_error("KVM_GET_REGS", NULL);
+    if (ioctl(vcpu->fd, KVM_GET_SREGS, &sregs) < 0)
+        return kvm_error("KVM_GET_SREGS", NULL);
+
+    struct e820_entry entries[8];
+    int count = memory_map(vm, entries);
+    uint32_t index = regs.rbx & 0xffffffff;
+    uint64_t dest = sregs.es.base + (regs.rdi & 0xffff);
+
+    // carry set is how the BIOS reports an unsupported call or the end
+    regs.rflags |= RFLAGS_CF;
+    if ((regs.rax & 0xffffffff) == 0xe820 && (regs.rdx & 0xffffffff) == E820_SMAP && index < (uint32_t)count
+        && dest + sizeof(struct e820_entry) <= vm->shared_memory_size) {
+        memcpy(vm->shared_memory + dest, &entries[index], sizeof(struct e820_entry));
+        regs.rax = E820_SMAP;
+        regs.rcx = sizeof(struct e820_entry);
+        regs.rbx = index + 1 < (uint32_t)count ? index + 1 : 0;
+        regs.rflags &= ~RFLAGS_CF;
+    }
+
+    if (ioctl(vcpu->fd, KVM_SET_REGS, &regs) < 0)
+        return kvm_error("KVM_SET_REGS", NULL);
     return 0;
 }
 
-int vga_cntl_register(struct vm* vm)
+/* Where the boot loader leaves things for the kernel: the memory map in
+ * MEMORY_MAP_ADDRESS's format (kernel/mm/memory_map.h), and the stack
+ * switch-to-32bit.asm sets up */
+#define BOOT_MEMORY_MAP 0x1000
+#define BOOT_MEMORY_MAP_ENTRY_SIZE 24
+#define BOOT_STACK 0x90000
+/* Free low memory for the flat GDT of a direct boot */
+#define BOOT_GDT 0x500
+#define BOOT_CODE_SEG 0x08
+#define BOOT_DATA_SEG 0x10
+#define CR0_PE (1 << 0)
+
+bool executable_is_elf(struct executable* exec)
 {
-    uint8_t* reg = (uint8_t*)vm->shared_memory + VGA_CTRL_REGISTER;
-    uint8_t io_value = *(uint8_t*)((void*)(vm->kvm_run) + vm->kvm_run->io.data_offset);
+    return exec->size >= EI_NIDENT && memcmp(exec->data, ELFMAG, SELFMAG) == 0;
+}
 
-    if (vm->kvm_run->io.direction != KVM_EXIT_IO_OUT)
-        return kvm_error(NULL, "Only OUT io direction is supported for VGA_CTRL_REGISTER\n");
+/* A PT_LOAD segment of either class */
+struct elf_segment {
+    uint64_t offset;
+    uint64_t paddr;
+    uint64_t filesz;
+    uint64_t memsz;
+};
+
+static int load_segment(struct vm* vm, struct elf_segment* segment)
+{
+    if (segment->filesz > segment->memsz || segment->offset > vm->exec.size
+        || segment->filesz > vm->exec.size - segment->offset)
+        return kvm_error(NULL, "ELF segment at 0x%lx is past the end of the file\n", segment->paddr);
+    if (segment->paddr > vm->shared_memory_size || segment->memsz > vm->shared_memory_size - segment->paddr)
+        return kvm_error(NULL, "ELF segment at 0x%lx is past the end of guest memory\n", segment->paddr);
+
+    memcpy(vm->shared_memory + segment->paddr, vm->exec.data + segment->offset, segment->filesz);
+    memset(vm->shared_memory + segment->paddr + segment->filesz, 0, segment->memsz - segment->filesz);
+    return 0;
+}
+
+/* Copies the PT_LOAD segments to their physical addresses, both classes
+ * start in 32-bit protected mode. `entry` gets the entry point. */
+static int load_elf(struct vm* vm, uint32_t* entry)
+{
+    const uint8_t* ident = vm->exec.data;
+    int ret = 0;
+
+    if (ident[EI_CLASS] == ELFCLASS32 && vm->exec.size >= sizeof(Elf32_Ehdr)) {
+        Elf32_Ehdr* header = (Elf32_Ehdr*)vm->exec.data;
+        if (header->e_machine != EM_386 || header->e_phentsize != sizeof(Elf32_Phdr)
+            || header->e_phoff + (uint64_t)header->e_phnum * sizeof(Elf32_Phdr) > vm->exec.size)
+            return kvm_error(NULL, "Not an i386 executable\n");
+        Elf32_Phdr* phdrs = (Elf32_Phdr*)(vm->exec.data + header->e_phoff);
+        for (int idx = 0; idx < header->e_phnum && ret == 0; idx++) {
+            if (phdrs[idx].p_type != PT_LOAD)
+                continue;
+            struct elf_segment segment = { phdrs[idx].p_offset, phdrs[idx].p_paddr, phdrs[idx].p_filesz, phdrs[idx].p_memsz };
+            ret = load_segment(vm, &segment);
+        }
+        *entry = header->e_entry;
+    } else if (ident[EI_CLASS] == ELFCLASS64 && vm->exec.size >= sizeof(Elf64_Ehdr)) {
+        Elf64_Ehdr* header = (Elf64_Ehdr*)vm->exec.data;
+        if (header->e_machine != EM_X86_64 || header->e_phentsize != sizeof(Elf64_Phdr) || header->e_phoff > vm->exec.size
+            || header->e_phnum > (vm->exec.size - header->e_phoff) / sizeof(Elf64_Phdr))
+            return kvm_error(NULL, "Not an x86-64 executable\n");
+        if (header->e_entry > UINT32_MAX)
+            return kvm_error(NULL, "The entry point 0x%lx is out of reach of protected mode\n", header->e_entry);
+        Elf64_Phdr* phdrs = (Elf64_Phdr*)(vm->exec.data + header->e_phoff);
+        for (int idx = 0; idx < header->e_phnum && ret == 0; idx++) {
+            if (phdrs[idx].p_type != PT_LOAD)
+                continue;
+            struct elf_segment segment = { phdrs[idx].p_offset, phdrs[idx].p_paddr, phdrs[idx].p_filesz, phdrs[idx].p_memsz };
+            ret = load_segment(vm, &segment);
+        }
+        *entry = header->e_entry;
+    } else {
+        return kvm_error(NULL, "Unknown ELF class %d\n", ident[EI_CLASS]);
+    }
 
-    if (io_value != VGA_OFFSET_HIGH && io_value != VGA_OFFSET_LOW)
-        return kvm_error(NULL, "Only cursor location registers are supported for CRT ports\n");
+    return ret;
+}
 
-    // probably not the best idea to save the value to the memory location itself
-    // but it shouldn't be used for anything else currently so we should be able to get away with it
-    *reg = io_value;
+static void set_flat_segment(struct kvm_segment* segment, uint16_t selector, uint8_t type)
+{
+    memset(segment, 0, sizeof(*segment));
+    segment->selector = selector;
+    segment->limit = 0xffffffff;
+    segment->type = type;
+    segment->present = 1;
+    segment->db = 1;
+    segment->s = 1;
+    segment->g = 1;
+}
+
+/**
+ * Starts the BSP where the boot loader would hand over to the kernel:
+ * in protected mode with the boot GDT's flat segments, the memory map at
+ * BOOT_MEMORY_MAP and the boot stack. No BIOS call or disk read happens.
+ */
+int setup_direct_boot(struct vm* vm)
+{
+    int ret = 0;
+    uint32_t entry;
+    if ((ret = load_elf(vm, &entry)) != 0) {
+        return ret;
+    }
+
+    struct e820_entry entries[8];
+    int count = memory_map(vm, entries);
+    uint8_t* map = vm->shared_memory + BOOT_MEMORY_MAP;
+    memcpy(map, &count, sizeof(uint32_t));
+    for (int idx = 0; idx < count; idx++) {
+        uint8_t* dest = map + sizeof(uint32_t) + idx * BOOT_MEMORY_MAP_ENTRY_SIZE;
+        // the ACPI 3.0 attributes after the entry, bit 0 means valid
+        uint32_t attributes = 1;
+        memcpy(dest, &entries[idx], sizeof(struct e820_entry));
+        memcpy(dest + sizeof(struct e820_entry), &attributes, sizeof(uint32_t));
+    }
+
+    // null, code and data, the same as boot/gdt.asm
+    const uint64_t gdt[] = { 0, 0x00cf9a000000ffff, 0x00cf92000000ffff };
+    memcpy(vm->shared_memory + BOOT_GDT, gdt, sizeof(gdt));
+
+    struct kvm_sregs sregs;
+    if (ioctl(vm->vcpus[0].fd, KVM_GET_SREGS, &sregs) < 0) {
+        return kvm_error("KVM_GET_SREGS", NULL);
+    }
+    sregs.gdt.base = BOOT_GDT;
+    sregs.gdt.limit = sizeof(gdt) - 1;
+    sregs.cr0 |= CR0_PE;
+    // execute/read and read/write, both accessed
+    set_flat_segment(&sregs.cs, BOOT_CODE_SEG, 0xb);
+    set_flat_segment(&sregs.ds, BOOT_DATA_SEG, 0x3);
+    sregs.es = sregs.fs = sregs.gs = sregs.ss = sregs.ds;
+    if (ioctl(vm->vcpus[0].fd, KVM_SET_SREGS, &sregs) < 0) {
+        return kvm_error("KVM_SET_SREGS", NULL);
+    }
+
+    struct kvm_regs regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.rflags = 2;
+    regs.rip = entry;
+    regs.rsp = BOOT_STACK;
+    regs.rbp = BOOT_STACK;
+    if (ioctl(vm->vcpus[0].fd, KVM_SET_REGS, &regs) < 0) {
+        return kvm_error("KVM_SET_REGS", NULL);
+    }
 
     return 0;
 }
 
-int vga_data_register(struct vm* vm)
+int vga_cntl_register(struct vcpu* vcpu)
 {
-    uint8_t ctrl_val = *((uint8_t*)vm->shared_memory + VGA_CTRL_REGISTER);
-    uint8_t* io_data = (uint8_t*)((void*)(vm->kvm_run) + vm->kvm_run->io.data_offset);
+    struct vm* vm = vcpu->vm;
+    uint8_t io_value = *(uint8_t*)((void*)(vcpu->kvm_run) + vcpu->kvm_run->io.data_offset);
+
+    if (vcpu->kvm_run->io.direction != KVM_EXIT_IO_OUT)
+        return kvm_error(NULL, "Only OUT io direction is supported for VGA_CTRL_REGISTER\n");
 
-    if (ctrl_val != VGA_OFFSET_HIGH && ctrl_val != VGA_OFFSET_LOW)
-        return kvm_error(NULL, "VGA cntrl register needs to be set to high or low, was 0x%02x\n", ctrl_val);
+    if (io_value < VGA_START_HIGH || io_value > VGA_OFFSET_LOW)
+        return kvm_error(NULL, "Only start address and cursor location registers are supported for CRT ports\n");
 
-    if (vm->kvm_run->io.direction == KVM_EXIT_IO_OUT) {
-        if (ctrl_val == VGA_OFFSET_HIGH)
-            vm->vga.cursor_location = (vm->vga.cursor_location & 0x00ff) | ((uint16_t)*io_data << 8);
+    vm->vga.index = io_value;
+    return 0;
+}
+
+/* The CRTC registers are 16 bit values split in a high and a low register */
+static uint16_t* vga_register_pair(struct kvm_vga* vga, bool* high)
+{
+    *high = vga->index == VGA_START_HIGH || vga->index == VGA_OFFSET_HIGH;
+    if (vga->index == VGA_START_HIGH || vga->index == VGA_START_LOW)
+        return &vga->start_address;
+    return &vga->cursor_location;
+}
+
+int vga_data_register(struct vcpu* vcpu)
+{
+    struct vm* vm = vcpu->vm;
+    uint8_t* io_data = (uint8_t*)((void*)(vcpu->kvm_run) + vcpu->kvm_run->io.data_offset);
+
+    if (vm->vga.index < VGA_START_HIGH || vm->vga.index > VGA_OFFSET_LOW)
+        return kvm_error(NULL, "VGA cntrl register needs to be a start address or cursor register, was 0x%02x\n", vm->vga.index);
+
+    bool high;
+    uint16_t* value = vga_register_pair(&vm->vga, &high);
+    if (vcpu->kvm_run->io.direction == KVM_EXIT_IO_OUT) {
+        if (high)
+            *value = (*value & 0x00ff) | ((uint16_t)*io_data << 8);
         else
-            vm->vga.cursor_location = (vm->vga.cursor_location & 0xff00) | *io_data;
+            *value = (*value & 0xff00) | *io_data;
     } else {
-        uint8_t in_value;
-        if (ctrl_val == VGA_OFFSET_HIGH)
-            in_value = vm->vga.cursor_location >> 8;
-        else
-            in_value = vm->vga.cursor_location & 0xff;
+        *io_data = high ? *value >> 8 : *value & 0xff;
+    }
+
+    return 0;
+}
 
-        *io_data = in_value;
+/**
+ * The PIC is edge triggered, pulse the line. The request latency ends
+ * once KVM has the interrupt, the caller holds io_lock so the guest's
+ * read of the scancode can't come before the injection is stamped.
+ */
+static int keyboard_raise(struct vm* vm, uint64_t request_ns)
+{
+    struct kvm_irq_level level = { .irq = KEYBOARD_IRQ, .level = 1 };
+    if (ioctl(vm->vm_fd, KVM_IRQ_LINE, &level) < 0) {
+        return kvm_error("KVM_IRQ_LINE", NULL);
+    }
+    level.level = 0;
+    if (ioctl(vm->vm_fd, KVM_IRQ_LINE, &level) < 0) {
+        return kvm_error("KVM_IRQ_LINE", NULL);
     }
 
+    struct irq_latency* latency = &vm->key_latency;
+    latency->inject_ns = latency_now_ns();
+    histogram_record(&latency->request, latency->inject_ns - request_ns);
     return 0;
 }
 
-int run_vm(struct vm* vm)
+int keyboard_data(struct vcpu* vcpu)
+{
+    struct vm* vm = vcpu->vm;
+    uint8_t* io_data = (uint8_t*)((void*)(vcpu->kvm_run) + vcpu->kvm_run->io.data_offset);
+    *io_data = vm->irq.data.keyboard.data;
+
+    // the handler reading the scancode ends the injection latency
+    struct irq_latency* latency = &vm->key_latency;
+    if (latency->inject_ns != 0) {
+        histogram_record(&latency->handler, latency_now_ns() - latency->inject_ns);
+        latency->inject_ns = 0;
+    }
+
+    // the next key is only raised once this one was read, a guest that
+    // falls behind doesn't lose keys until the queue fills up. Its request
+    // latency includes the time it waited.
+    if (vm->irq.data.keyboard.count == 0) {
+        vm->irq.data.keyboard.unread = false;
+        return 0;
+    }
+    int head = vm->irq.data.keyboard.head;
+    vm->irq.data.keyboard.data = vm->irq.data.keyboard.queue[head];
+    vm->irq.data.keyboard.head = (head + 1) % KEYBOARD_QUEUE_SIZE;
+    vm->irq.data.keyboard.count--;
+    return keyboard_raise(vm, vm->irq.data.keyboard.queued_ns[head]);
+}
+
+int power_off(struct vcpu* vcpu)
 {
+    struct vm* vm = vcpu->vm;
+    uint16_t value = *(uint16_t*)((void*)(vcpu->kvm_run) + vcpu->kvm_run->io.data_offset);
+
+    // the rest of the ACPI PM1 control register isn't emulated
+    if (vcpu->kvm_run->io.direction != KVM_EXIT_IO_OUT || value != POWER_OFF_VALUE)
+        return 0;
+
+    if (__atomic_exchange_n(&vm->powered_off, true, __ATOMIC_ACQ_REL))
+        return 0;
+
+    printf("VM powered off. exiting...\n");
+    // the other vCPUs are most likely halted inside KVM_RUN
+    for (int idx = 0; idx < vm->vcpu_count; idx++) {
+        if (idx != vcpu->id)
+            kvm_vcpu_kick(&vm->vcpus[idx]);
+    }
+
+    return 0;
+}
+
+int handle_io(struct vcpu* vcpu, enum stats_handler* handler)
+{
+    struct vm* vm = vcpu->vm;
+    uint16_t port = vcpu->kvm_run->io.port;
+    int ret = 0;
+    stats_port(&vcpu->stats, port, vcpu->kvm_run->io.direction);
+
+    if (port == POWER_OFF_PORT) {
+        *handler = STATS_HANDLER_POWER_OFF;
+        return power_off(vcpu);
+    }
+
+    // the devices are shared by every vCPU
+    pthread_mutex_lock(&vm->io_lock);
+    if (port == BIOS_DISK_PORT) {
+        *handler = STATS_HANDLER_BIOS;
+        ret = bios_read(vcpu);
+    } else if (port == BIOS_MEMORY_MAP_PORT) {
+        *handler = STATS_HANDLER_BIOS;
+        ret = bios_memory_map(vcpu);
+    } else if (port == VGA_CTRL_REGISTER) {
+        *handler = STATS_HANDLER_VGA_CTRL;
+        ret = vga_cntl_register(vcpu);
+    } else if (port == VGA_DATA_REGISTER) {
+        *handler = STATS_HANDLER_VGA_DATA;
+        ret = vga_data_register(vcpu);
+    } else if (port == 0x60) {
+        *handler = STATS_HANDLER_KEYBOARD;
+        ret = keyboard_data(vcpu);
+    } else {
+        *handler = STATS_HANDLER_IO_OTHER;
+    }
+    pthread_mutex_unlock(&vm->io_lock);
+
+    return ret;
+}
+
+int run_vcpu(struct vcpu* vcpu)
+{
+    struct vm* vm = vcpu->vm;
+    struct kvm_run* run = vcpu->kvm_run;
     int ret;
     while (1) {
-        if (ioctl(vm->vcpu_fd, KVM_RUN, 0) < 0)
+        uint64_t start = stats_cycles();
+        if (ioctl(vcpu->fd, KVM_RUN, 0) < 0) {
+            // kicked out of the guest, the only reason is a power off
+            if (errno == EINTR) {
+                if (__atomic_load_n(&vm->powered_off, __ATOMIC_ACQUIRE))
+                    return 0;
+                run->immediate_exit = 0;
+                continue;
+            }
+            // an AP waiting for its startup IPI got an INIT or SIPI
+            if (errno == EAGAIN)
+                continue;
             return kvm_error("KVM_RUN", NULL);
-
-        switch (vm->kvm_run->exit_reason) {
-        case KVM_EXIT_HLT:
-            printf("program halted. exiting...\n");
-            return 0;
+        }
+        stats_handler(&vcpu->stats, STATS_HANDLER_RUN, start);
+        stats_exit(&vcpu->stats, run->exit_reason);
+        if (vm->tracing)
+            trace_collect(vcpu);
+
+        // HLT and the interrupt controllers are handled inside KVM
+        enum stats_handler handler;
+        start = stats_cycles();
+        switch (run->exit_reason) {
         case KVM_EXIT_IO:
-            printf("IO port: %x, data: %x\n", vm->kvm_run->io.port,
-                *(int*)((char*)(vm->kvm_run) + vm->kvm_run->io.data_offset));
-            if (vm->kvm_run->io.port == 0x11) {
-                ret = bios_read(vm);
-                if (ret != 0)
-                    return ret;
-            } else if (vm->kvm_run->io.port == VGA_CTRL_REGISTER) {
-                if ((ret = vga_cntl_register(vm)) != 0)
-                    return ret;
-            } else if (vm->kvm_run->io.port == VGA_DATA_REGISTER) {
-                if ((ret = vga_data_register(vm)) != 0)
-                    return ret;
-            } else if (vm->kvm_run->io.port == 0x60) {
-                uint8_t* io_data = (uint8_t*)((void*)(vm->kvm_run) + vm->kvm_run->io.data_offset);
-                *io_data = vm->irq.data.keyboard.data;
-            }
-            break;
-        case KVM_EXIT_IRQ_WINDOW_OPEN: {
-            struct kvm_interrupt intr;
-            // TODO: get the offset mappings and set the irq to 1 on keyboard event
-            intr.irq = vm->irq.irq;
-            if (ioctl(vm->vcpu_fd, KVM_INTERRUPT, &intr) < 0) {
-                return kvm_error("KVM_INTERRUPT", NULL);
-            }
-            vm->kvm_run->request_interrupt_window = 0;
+            ret = handle_io(vcpu, &handler);
             break;
-        }
+        case KVM_EXIT_SHUTDOWN:
+            return kvm_error(NULL, "vCPU %d shut down (triple fault)\n", vcpu->id);
+        case KVM_EXIT_INTERNAL_ERROR:
+            return kvm_error(NULL, "KVM internal error %u on vCPU %d\n", run->internal.suberror, vcpu->id);
         default:
-            return kvm_error(NULL, "Got expected KVM_EXIT_HLT (%d)\n", vm->kvm_run->exit_reason);
+            return kvm_error(NULL, "Unexpected exit reason %d on vCPU %d\n", run->exit_reason, vcpu->id);
         }
+
+        if (ret != 0)
+            return ret;
+        stats_handler(&vcpu->stats, handler, start);
+        if (vm->tracing)
+            trace_exit(vcpu, handler, run->io.port, start, stats_cycles());
+
+        if (__atomic_load_n(&vm->powered_off, __ATOMIC_ACQUIRE))
+            return 0;
     }
 
     return 0;
 }
 
-int kvm_vm_setup(struct vm* vm, const char* exec_file)
+int kvm_vm_setup(struct vm* vm, const char* exec_file, int vcpu_count)
 {
     int ret = 0;
     vm_init(vm);
     executable_init(&vm->exec);
 
-    if ((ret = vm_create(vm)) != 0) {
+    if ((ret = vm_create(vm, vcpu_count)) != 0) {
         return ret;
     }
 
@@ -407,6 +869,11 @@ int kvm_vm_setup(struct vm* vm, const char* exec_file)
         return ret;
     }
 
+    // a kernel ELF skips the BIOS, the MBR and the boot loader
+    if (executable_is_elf(&vm->exec)) {
+        return setup_direct_boot(vm);
+    }
+
     if ((ret = setup_real_mode(vm)) != 0) {
         return ret;
     }
@@ -425,29 +892,69 @@ int kvm_vm_free(struct vm* vm)
     return 0;
 }
 
-int kvm_vm_run(struct vm* vm)
+static void vcpu_kick_handler(int signal)
+{
+}
+
+int kvm_vcpu_run(struct vcpu* vcpu)
 {
     int ret = 0;
-    if ((ret = run_vm(vm)) != 0) {
+
+    // no SA_RESTART, KVM_RUN needs to return with EINTR
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = vcpu_kick_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(VCPU_KICK_SIGNAL, &action, NULL);
+
+    vcpu->thread = pthread_self();
+    __atomic_store_n(&vcpu->thread_running, true, __ATOMIC_RELEASE);
+
+    if ((ret = run_vcpu(vcpu)) != 0) {
         return ret;
     }
 
     return 0;
 }
 
-int kvm_vm_interrupt(struct vm* vm, uint32_t irq)
+void kvm_vcpu_kick(struct vcpu* vcpu)
 {
-    vm->kvm_run->request_interrupt_window = 1;
-    return 0;
+    // immediate_exit makes KVM_RUN return right away if the vCPU enters
+    // it after the signal, so a kick is never lost
+    vcpu->kvm_run->immediate_exit = 1;
+    if (__atomic_load_n(&vcpu->thread_running, __ATOMIC_ACQUIRE))
+        pthread_kill(vcpu->thread, VCPU_KICK_SIGNAL);
 }
 
 int kvm_vm_send_key(struct vm* vm, enum ps2_scan_code key, bool released)
 {
-    vm->kvm_run->request_interrupt_window = 1;
-    // TODO: set this based in the IRQ remapping
-    vm->irq.irq = 33;
-    vm->irq.data.keyboard.data = key;
+    uint64_t request_ns = latency_now_ns();
+
+    uint8_t scancode = key;
     if (released)
-        vm->irq.data.keyboard.data += 0x80;
-    return 0;
+        scancode += 0x80;
+    if (vm->tracing)
+        trace_key(vm, scancode);
+
+    // the scancode needs to be in place before the interrupt is raised.
+    // While the guest hasn't read the last one it waits in the queue, and
+    // is dropped when that is full like a real keyboard would.
+    pthread_mutex_lock(&vm->io_lock);
+    vm->irq.irq = KEYBOARD_IRQ;
+    if (vm->irq.data.keyboard.unread) {
+        if (vm->irq.data.keyboard.count < KEYBOARD_QUEUE_SIZE) {
+            int tail = (vm->irq.data.keyboard.head + vm->irq.data.keyboard.count) % KEYBOARD_QUEUE_SIZE;
+            vm->irq.data.keyboard.queue[tail] = scancode;
+            vm->irq.data.keyboard.queued_ns[tail] = request_ns;
+            vm->irq.data.keyboard.count++;
+        }
+        pthread_mutex_unlock(&vm->io_lock);
+        return 0;
+    }
+    vm->irq.data.keyboard.data = scancode;
+    vm->irq.data.keyboard.unread = true;
+    int ret = keyboard_raise(vm, request_ns);
+    pthread_mutex_unlock(&vm->io_lock);
+
+    return ret;
 }
@@ -2,14 +2,44 @@
 #define _KVM_KVM_H_
 
 #include <linux/kvm.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
 
+#include "latency.h"
+#include "stats.h"
+#include "trace.h"
+
 #define VGA_CTRL_REGISTER 0x3d4
 #define VGA_DATA_REGISTER 0x3d5
-#define VGA_OFFSET_LOW 0x0f
+#define VGA_START_HIGH 0x0c
+#define VGA_START_LOW 0x0d
 #define VGA_OFFSET_HIGH 0x0e
+#define VGA_OFFSET_LOW 0x0f
+
+#define VGA_TEXT_ADDRESS 0xb8000
+#define VGA_TEXT_ROWS 25
+#define VGA_TEXT_COLS 80
+/* Cells in the 32 KiB text mode window */
+#define VGA_TEXT_CELLS 0x4000
+
+#define KVM_MAX_VCPUS 8
+
+/* Guest RAM from physical address 0, reported through the E820 map */
+#define GUEST_MEMORY_SIZE (64 << 20)
+
+/* The BIOS interrupt stubs forward to these ports */
+#define BIOS_DISK_PORT 0x11
+#define BIOS_MEMORY_MAP_PORT 0x15
+
+#define KEYBOARD_IRQ 1
+/* Scancodes the keyboard holds while the guest hasn't read the last one,
+ * like the buffer in a real keyboard */
+#define KEYBOARD_QUEUE_SIZE 16
+// Same port and value as QEMU's ACPI power off, so the guest works on both
+#define POWER_OFF_PORT 0x604
+#define POWER_OFF_VALUE 0x2000
 
 // https://wiki.osdev.org/PS/2_Keyboard#Scan_Code_Set_1
 enum ps2_scan_code {
@@ -71,6 +101,8 @@ enum ps2_scan_code {
     PS2_Keypad_Star = 0x37,
     PS2_LAlt = 0x38,
     PS2_Space = 0x39,
+    PS2_PageUp = 0x49,
+    PS2_PageDown = 0x51,
 };
 
 /**
@@ -79,7 +111,11 @@ enum ps2_scan_code {
  * 3D5h -- CRTC Controller Data Register
  */
 struct kvm_vga {
+    /* CRTC register selected through the address register */
+    uint8_t index;
     uint16_t cursor_location;
+    /* Cell shown in the top left corner */
+    uint16_t start_address;
 };
 
 struct executable {
@@ -88,14 +124,48 @@ struct executable {
 };
 
 struct vm_irq {
+    /* Line on the in-kernel PIC */
     int32_t irq;
     union {
         struct {
+            /* What port 0x60 reads */
             uint8_t data;
+            /* Raised and not read yet, new keys wait in the queue */
+            bool unread;
+            uint8_t queue[KEYBOARD_QUEUE_SIZE];
+            /* When each queued key was pressed, for the request latency */
+            uint64_t queued_ns[KEYBOARD_QUEUE_SIZE];
+            int head;
+            int count;
         } keyboard;
     } data;
 };
 
+struct vm;
+
+struct vcpu {
+    struct vm* vm;
+    int id;
+
+    /**
+     * fd for KVM_CREATE_VCPU
+     */
+    int fd;
+    struct kvm_run* kvm_run;
+    size_t kvm_run_size;
+
+    /**
+     * Thread running KVM_RUN. It is signaled to force an exit from the
+     * guest when the VM is powered off.
+     */
+    pthread_t thread;
+    bool thread_running;
+
+    /* Only written by the vCPU thread */
+    struct vm_stats stats;
+    struct trace_log trace;
+};
+
 struct vm {
     /**
      * fd for /dev/kvm
@@ -113,21 +183,39 @@ struct vm {
     size_t shared_memory_size;
 
     /**
-     * fd for KVM_CREATE_VCPU
+     * vCPU 0 is the bootstrap processor, the rest wait for a startup IPI
+     * from the guest in the in-kernel LAPIC
      */
-    int vcpu_fd;
-    struct kvm_run* kvm_run;
-    size_t kvm_run_size;
+    struct vcpu vcpus[KVM_MAX_VCPUS];
+    int vcpu_count;
+
+    /**
+     * Emulated devices are shared by every vCPU thread and the window
+     */
+    pthread_mutex_t io_lock;
+    bool powered_off;
 
     struct executable exec;
     struct kvm_vga vga;
     struct vm_irq irq;
+    struct irq_latency key_latency;
+    /* Guest tracepoints on, see trace.h */
+    bool tracing;
+    /* Keys sent and frames drawn */
+    struct trace_log input_trace;
 };
 
-int kvm_vm_setup(struct vm* vm, const char* exec_file);
+/**
+ * Print an error message, with perror() if `pmsg` is given, and return
+ * errno or 1 if errno is not set.
+ */
+int kvm_error(const char* pmsg, const char* efmt, ...);
+
+int kvm_vm_setup(struct vm* vm, const char* exec_file, int vcpu_count);
 int kvm_vm_free(struct vm* vm);
-int kvm_vm_run(struct vm* vm);
-int kvm_vm_interrupt(struct vm* vm, uint32_t irq);
+int kvm_vcpu_run(struct vcpu* vcpu);
+/* Force the vCPU out of the guest so the power off is seen */
+void kvm_vcpu_kick(struct vcpu* vcpu);
 int kvm_vm_send_key(struct vm* vm, enum ps2_scan_code key, bool released);
 
 #endif
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "kvm.h"
+#include "latency.h"
+
+void latency_profile_init(struct latency_profile* profile)
+{
+    memset(profile, 0, sizeof(*profile));
+    profile->render_cpu = -1;
+    profile->halt_poll_ns = -1;
+}
+
+int latency_parse_cpus(struct latency_profile* profile, const char* list)
+{
+    const char* pos = list;
+    profile->vcpu_cpu_count = 0;
+
+    while (*pos != '\0') {
+        char* end;
+        long cpu = strtol(pos, &end, 10);
+        if (end == pos || cpu < 0 || cpu >= CPU_SETSIZE || profile->vcpu_cpu_count == LATENCY_MAX_CPUS)
+            return kvm_error(NULL, "Invalid CPU list '%s'\n", list);
+        profile->vcpu_cpus[profile->vcpu_cpu_count++] = (int)cpu;
+        pos = *end == ',' ? end + 1 : end;
+        if (*end != ',' && *end != '\0')
+            return kvm_error(NULL, "Invalid CPU list '%s'\n", list);
+    }
+
+    return 0;
+}
+
+bool latency_profile_enabled(const struct latency_profile* profile)
+{
+    return profile->vcpu_cpu_count > 0 || profile->render_cpu >= 0 || profile->rt_priority > 0
+        || profile->lock_memory || profile->halt_poll_ns >= 0;
+}
+
+int latency_vcpu_attr(const struct latency_profile* profile, int index, pthread_attr_t* attr)
+{
+    int ret;
+    pthread_attr_init(attr);
+
+    if (profile->vcpu_cpu_count > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(profile->vcpu_cpus[index % profile->vcpu_cpu_count], &set);
+        if ((ret = pthread_attr_setaffinity_np(attr, sizeof(set), &set)) != 0) {
+            errno = ret;
+            return kvm_error("pthread_attr_setaffinity_np", NULL);
+        }
+    }
+
+    if (profile->rt_priority > 0) {
+        struct sched_param param = { .sched_priority = profile->rt_priority };
+        // the attributes are ignored unless the thread is told not to inherit them
+        pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        if ((ret = pthread_attr_setschedparam(attr, &param)) != 0) {
+            errno = ret;
+            return kvm_error("pthread_attr_setschedparam", NULL);
+        }
+    }
+
+    return 0;
+}
+
+int latency_apply_render(const struct latency_profile* profile)
+{
+    int ret;
+
+    if (profile->render_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(profile->render_cpu, &set);
+        if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0) {
+            errno = ret;
+            return kvm_error("pthread_setaffinity_np", NULL);
+        }
+    }
+
+    if (profile->rt_priority > 0) {
+        struct sched_param param = { .sched_priority = profile->rt_priority > 1 ? profile->rt_priority - 1 : 1 };
+        if ((ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+            errno = ret;
+            return kvm_error("pthread_setschedparam", NULL);
+        }
+    }
+
+    return 0;
+}
+
+int latency_apply_vm(const struct latency_profile* profile, struct vm* vm)
+{
+    if (profile->lock_memory) {
+        // KSM merges pages behind our back and the copy on write fault
+        // when they are split again is exactly the latency we want to avoid
+        madvise(vm->shared_memory, vm->shared_memory_size, MADV_UNMERGEABLE);
+        if (mlock(vm->shared_memory, vm->shared_memory_size) < 0)
+            return kvm_error("Cannot lock guest memory", NULL);
+        for (int idx = 0; idx < vm->vcpu_count; idx++) {
+            if (mlock(vm->vcpus[idx].kvm_run, vm->vcpus[idx].kvm_run_size) < 0)
+                return kvm_error("Cannot lock kvm_run", NULL);
+        }
+    }
+
+    if (profile->halt_poll_ns >= 0) {
+        if (ioctl(vm->vm_fd, KVM_CHECK_EXTENSION, KVM_CAP_HALT_POLL) <= 0)
+            return kvm_error(NULL, "KVM_CAP_HALT_POLL is not supported\n");
+
+        struct kvm_enable_cap cap;
+        memset(&cap, 0, sizeof(cap));
+        cap.cap = KVM_CAP_HALT_POLL;
+        cap.args[0] = (uint64_t)profile->halt_poll_ns;
+        if (ioctl(vm->vm_fd, KVM_ENABLE_CAP, &cap) < 0)
+            return kvm_error("KVM_ENABLE_CAP(KVM_CAP_HALT_POLL)", NULL);
+    }
+
+    return 0;
+}
+
+uint64_t latency_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void irq_latency_print(const struct irq_latency* latency, const char* name)
+{
+    char label[64];
+    snprintf(label, sizeof(label), "%s request->inject", name);
+    histogram_print(stderr, label, &latency->request, "ns");
+    snprintf(label, sizeof(label), "%s inject->handler", name);
+    histogram_print(stderr, label, &latency->handler, "ns");
+}
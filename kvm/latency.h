@@ -0,0 +1,63 @@
+#ifndef _KVM_LATENCY_H_
+#define _KVM_LATENCY_H_
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define LATENCY_MAX_CPUS 64
+
+struct vm;
+
+/**
+ * Host tuning for latency sensitive guests on dedicated hosts. Everything
+ * defaults to off, trading host CPU for guest tail latency only when asked.
+ */
+struct latency_profile {
+    /* vCPU threads are pinned round-robin to these CPUs */
+    int vcpu_cpus[LATENCY_MAX_CPUS];
+    int vcpu_cpu_count;
+    /* CPU for the render/input thread, -1 to leave it unpinned */
+    int render_cpu;
+    /**
+     * SCHED_FIFO priority for the vCPU threads, the render thread runs one
+     * below so it never preempts a vCPU. 0 keeps the default scheduler.
+     */
+    int rt_priority;
+    /* mlock guest RAM and kvm_run so they never fault or get swapped */
+    bool lock_memory;
+    /* KVM_CAP_HALT_POLL value in ns, -1 keeps the KVM default */
+    int64_t halt_poll_ns;
+};
+
+/**
+ * Interrupt delivery latency in ns, split at the point where the
+ * interrupt is handed to KVM:
+ *   request: key press until KVM_IRQ_LINE raised the interrupt, including
+ *            the time the key was queued behind unread ones
+ *   handler: injection until the guest handler reads the device
+ */
+struct irq_latency {
+    uint64_t inject_ns;
+    struct histogram request;
+    struct histogram handler;
+};
+
+void latency_profile_init(struct latency_profile* profile);
+/* Parse a comma separated CPU list such as "2,3,6" */
+int latency_parse_cpus(struct latency_profile* profile, const char* list);
+bool latency_profile_enabled(const struct latency_profile* profile);
+
+/* Thread attributes for the `index`th vCPU thread, counted across all VMs */
+int latency_vcpu_attr(const struct latency_profile* profile, int index, pthread_attr_t* attr);
+/* Pin and prioritize the calling thread as the render/input thread */
+int latency_apply_render(const struct latency_profile* profile);
+/* Memory locking and halt polling, after the VM is set up */
+int latency_apply_vm(const struct latency_profile* profile, struct vm* vm);
+
+uint64_t latency_now_ns();
+void irq_latency_print(const struct irq_latency* latency, const char* name);
+
+#endif
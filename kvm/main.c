@@ -1,47 +1,310 @@
+#include <errno.h>
+#include <getopt.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "kvm.h"
+#include "latency.h"
+#include "record.h"
+#include "stats.h"
+#include "trace.h"
 #include "window.h"
 
-void* kvm_vm_thread(void* arg)
+// Dumps a stats snapshot when sent to the process
+#define STATS_SIGNAL SIGUSR2
+
+struct stats_thread_args {
+    struct vm* vms;
+    int count;
+    /* Seconds between periodic dumps, 0 to only dump on STATS_SIGNAL */
+    int interval;
+    enum stats_format format;
+    FILE* file;
+};
+
+void* kvm_vcpu_thread(void* arg)
 {
-    struct vm* vm = (struct vm*)arg;
+    struct vcpu* vcpu = (struct vcpu*)arg;
     int ret = 0;
 
     // Handle the case where kvm exits
-    if ((ret = kvm_vm_run(vm)) != 0)
+    if ((ret = kvm_vcpu_run(vcpu)) != 0)
         return NULL;
 
     return NULL;
 };
 
-int main(int argc, const char* argv[])
+void* stats_thread(void* arg)
 {
-    if (argc < 2) {
+    struct stats_thread_args* args = (struct stats_thread_args*)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, STATS_SIGNAL);
+
+    while (1) {
+        int sig;
+        if (args->interval > 0) {
+            struct timespec timeout = { .tv_sec = args->interval };
+            sig = sigtimedwait(&set, NULL, &timeout);
+        } else {
+            sig = sigwaitinfo(&set, NULL);
+        }
+
+        // timeouts are the periodic dumps, anything else is a real error
+        if (sig < 0 && errno != EAGAIN)
+            continue;
+        stats_dump(args->file, args->format, args->vms, args->count);
+    }
+
+    return NULL;
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [options] executable\n"
+           "The executable is a boot disk image, or a kernel ELF which starts right in\n"
+           "protected mode without the BIOS and the boot loader.\n"
+           "\n"
+           "  --vms N                 run N copies of the guest in a tiled dashboard\n"
+           "  --cpus N                vCPUs per guest (default 1, at most %d)\n"
+           "  --record FILE           record the screen of the first guest to FILE\n"
+           "  --keyframe-interval MS  time between recording keyframes (default %d)\n"
+           "\n"
+           "Latency profile, for dedicated hosts:\n"
+           "  --pin-vcpu CPUS         pin vCPU threads round-robin to a comma separated CPU list\n"
+           "  --pin-render CPU        pin the render/input thread\n"
+           "  --rt-priority PRIO      run vCPUs SCHED_FIFO at PRIO, the render thread at PRIO-1\n"
+           "  --mlock                 lock guest RAM and kvm_run in memory\n"
+           "  --halt-poll NS          set KVM halt polling time (KVM_CAP_HALT_POLL)\n"
+           "  --latency-stats         print interrupt delivery latency on exit\n"
+           "\n"
+           "Exit statistics, also dumped on SIGUSR2:\n"
+           "  --stats-interval SEC    dump exit statistics every SEC seconds and on exit\n"
+           "  --stats-format FORMAT   text (default) or json\n"
+           "  --stats-file FILE       write statistics to FILE instead of stderr\n"
+           "\n"
+           "  --trace FILE            write guest tracepoints and host exits to FILE on exit,\n"
+           "                          as Chrome trace-event JSON\n",
+        name, KVM_MAX_VCPUS, RECORD_DEFAULT_KEYFRAME_MS);
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option options[] = {
+        { "vms", required_argument, NULL, 'n' },
+        { "cpus", required_argument, NULL, 'C' },
+        { "record", required_argument, NULL, 'r' },
+        { "keyframe-interval", required_argument, NULL, 'k' },
+        { "pin-vcpu", required_argument, NULL, 'c' },
+        { "pin-render", required_argument, NULL, 'R' },
+        { "rt-priority", required_argument, NULL, 'p' },
+        { "mlock", no_argument, NULL, 'm' },
+        { "halt-poll", required_argument, NULL, 'H' },
+        { "latency-stats", no_argument, NULL, 'L' },
+        { "stats-interval", required_argument, NULL, 'i' },
+        { "stats-format", required_argument, NULL, 'f' },
+        { "stats-file", required_argument, NULL, 'o' },
+        { "trace", required_argument, NULL, 't' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    struct latency_profile profile;
+    latency_profile_init(&profile);
+    bool latency_stats = false;
+    struct stats_thread_args stats_args = {
+        .interval = 0,
+        .format = STATS_FORMAT_TEXT,
+        .file = stderr,
+    };
+    const char* stats_file = NULL;
+    const char* record_file = NULL;
+    const char* trace_file = NULL;
+    uint32_t keyframe_interval = RECORD_DEFAULT_KEYFRAME_MS;
+    int vm_count = 1;
+    int vcpu_count = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:C:r:k:c:R:p:mH:Li:f:o:t:h", options, NULL)) != -1) {
+        switch (opt) {
+        case 'n':
+            vm_count = atoi(optarg);
+            if (vm_count < 1) {
+                printf("--vms needs to be at least 1\n");
+                return 1;
+            }
+            break;
+        case 'C':
+            vcpu_count = atoi(optarg);
+            if (vcpu_count < 1 || vcpu_count > KVM_MAX_VCPUS) {
+                printf("--cpus needs to be between 1 and %d\n", KVM_MAX_VCPUS);
+                return 1;
+            }
+            break;
+        case 'r':
+            record_file = optarg;
+            break;
+        case 'k':
+            keyframe_interval = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            if (latency_parse_cpus(&profile, optarg) != 0)
+                return 1;
+            break;
+        case 'R':
+            profile.render_cpu = atoi(optarg);
+            break;
+        case 'p':
+            profile.rt_priority = atoi(optarg);
+            break;
+        case 'm':
+            profile.lock_memory = true;
+            break;
+        case 'H':
+            profile.halt_poll_ns = strtoll(optarg, NULL, 10);
+            break;
+        case 'L':
+            latency_stats = true;
+            break;
+        case 'i':
+            stats_args.interval = atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, "json") == 0) {
+                stats_args.format = STATS_FORMAT_JSON;
+            } else if (strcmp(optarg, "text") != 0) {
+                printf("Unknown stats format '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            stats_file = optarg;
+            break;
+        case 't':
+            trace_file = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
         printf("Give executable as an argument\n");
         return 1;
     }
 
     int ret = 0;
-    struct vm vm;
+    struct vm* vms = calloc(vm_count, sizeof(struct vm));
     struct kvm_window window;
-    pthread_t kvm_thead;
+    struct recorder recorder;
+    int created = 0;
+    int running = 0;
 
-    if ((ret = kvm_window_init(&window, &vm)) != 0)
-        goto main_end;
-    if ((ret = kvm_vm_setup(&vm, argv[1])) != 0)
-        goto main_end;
+    if (vms == NULL) {
+        printf("Cannot allocate %d VMs\n", vm_count);
+        return 1;
+    }
+
+    if (stats_file != NULL && (stats_args.file = fopen(stats_file, "w")) == NULL)
+        return kvm_error("Cannot open stats file", "Cannot open stats file '%s'\n", stats_file);
 
-    pthread_create(&kvm_thead, NULL, kvm_vm_thread, &vm);
+    // only the stats thread waits for the snapshot signal, every thread
+    // inherits this mask so it needs to be set before any are created
+    sigset_t stats_set;
+    sigemptyset(&stats_set);
+    sigaddset(&stats_set, STATS_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &stats_set, NULL);
 
-    if ((ret = kvm_window_run(&window)) != 0)
+    if ((ret = kvm_window_init(&window, vms, vm_count)) != 0)
         goto main_end;
+    for (created = 0; created < vm_count; created++) {
+        // a failed setup leaves the VM initialized so it can be freed
+        if ((ret = kvm_vm_setup(&vms[created], argv[optind], vcpu_count)) != 0) {
+            created++;
+            goto main_end;
+        }
+        if ((ret = latency_apply_vm(&profile, &vms[created])) != 0) {
+            created++;
+            goto main_end;
+        }
+        if (trace_file != NULL && (ret = trace_enable(&vms[created])) != 0) {
+            created++;
+            goto main_end;
+        }
+    }
+
+    if (record_file != NULL) {
+        if ((ret = recorder_open(&recorder, record_file, keyframe_interval)) != 0)
+            goto main_end;
+        window.screens[0].recorder = &recorder;
+    }
+
+    for (running = 0; running < vm_count; running++) {
+        for (int cpu = 0; cpu < vcpu_count; cpu++) {
+            struct vcpu* vcpu = &vms[running].vcpus[cpu];
+            pthread_attr_t attr;
+            if ((ret = latency_vcpu_attr(&profile, running * vcpu_count + cpu, &attr)) != 0)
+                goto main_stop;
+            ret = pthread_create(&vcpu->thread, &attr, kvm_vcpu_thread, vcpu);
+            pthread_attr_destroy(&attr);
+            if (ret != 0) {
+                errno = ret;
+                ret = kvm_error("Cannot start vCPU thread", NULL);
+                // the VM's other vCPUs are already running
+                running++;
+                goto main_stop;
+            }
+        }
+    }
+
+    pthread_t stats_tid;
+    stats_args.vms = vms;
+    stats_args.count = vm_count;
+    pthread_create(&stats_tid, NULL, stats_thread, &stats_args);
+
+    if ((ret = latency_apply_render(&profile)) == 0)
+        ret = kvm_window_run(&window);
+
+main_stop:
+    if (stats_args.interval > 0 || stats_file != NULL)
+        stats_dump(stats_args.file, stats_args.format, vms, running);
+    if (trace_file != NULL) {
+        FILE* file = fopen(trace_file, "w");
+        if (file == NULL) {
+            ret = kvm_error("Cannot open trace file", "Cannot open trace file '%s'\n", trace_file);
+        } else {
+            if (trace_write(file, vms, running) != 0)
+                ret = 1;
+            fclose(file);
+        }
+    }
+    if (latency_stats) {
+        for (int idx = 0; idx < running; idx++) {
+            char name[32];
+            snprintf(name, sizeof(name), "vm%d key", idx);
+            irq_latency_print(&vms[idx].key_latency, name);
+        }
+    }
+
+    // close the recording before SIGTERM takes the process down
+    if (window.screens[0].recorder != NULL) {
+        recorder_close(window.screens[0].recorder);
+        window.screens[0].recorder = NULL;
+    }
 
-    pthread_kill(kvm_thead, SIGTERM);
+    // SIGTERM takes the whole process down, vCPU threads included
+    if (running > 0)
+        pthread_kill(vms[0].vcpus[0].thread, SIGTERM);
 
 main_end:
-    kvm_vm_free(&vm);
+    if (window.screens != NULL && window.screens[0].recorder != NULL)
+        recorder_close(window.screens[0].recorder);
+    for (int idx = 0; idx < created; idx++)
+        kvm_vm_free(&vms[idx]);
+    free(vms);
     if ((ret = kvm_window_free(&window)) != 0)
         return ret;
     return 0;
@@ -0,0 +1,257 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "record.h"
+#include "window.h"
+
+// seek step of the arrow keys in the SDL player
+#define SEEK_STEP_MS 10000
+
+struct player_clock {
+    /* Recording time at `base_ms` */
+    uint64_t position_ms;
+    uint64_t base_ms;
+    double speed;
+    bool paused;
+};
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t clock_position(struct player_clock* clock)
+{
+    if (clock->paused)
+        return clock->position_ms;
+    return clock->position_ms + (uint64_t)((monotonic_ms() - clock->base_ms) * clock->speed);
+}
+
+static void clock_set(struct player_clock* clock, uint64_t position_ms)
+{
+    clock->position_ms = position_ms;
+    clock->base_ms = monotonic_ms();
+}
+
+/* Apply every record up to `time_ms`, seeking if the time went backwards */
+static int advance(struct playback* play, uint64_t time_ms)
+{
+    uint64_t next;
+
+    if (time_ms < play->time_ms)
+        return playback_seek(play, time_ms);
+
+    while (playback_peek(play, &next) && next <= time_ms) {
+        if (!playback_next(play))
+            break;
+    }
+    return 0;
+}
+
+// VGA color order is BGR, ANSI is RGB
+static const uint8_t vga_to_ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+
+static void term_cell(uint8_t character, uint8_t attribute)
+{
+    uint8_t fg = attribute & 0x0f;
+    uint8_t bg = (attribute >> 4) & 0x07;
+    int fg_code = (fg & 0x8 ? 90 : 30) + vga_to_ansi[fg & 0x7];
+    int bg_code = 40 + vga_to_ansi[bg];
+
+    if (character < 0x20 || character > 0x7e)
+        character = ' ';
+    printf("\x1b[%d;%dm%c", fg_code, bg_code, character);
+}
+
+/* Draw the cells that differ from `shown` and update it */
+static void term_draw(struct playback* play, uint8_t* shown, bool full)
+{
+    int last = -2;
+    for (int cell = 0; cell < VGA_TEXT_ROWS * VGA_TEXT_COLS; cell++) {
+        uint8_t ch = play->screen[cell * 2];
+        uint8_t attr = play->screen[cell * 2 + 1];
+        if (!full && shown[cell * 2] == ch && shown[cell * 2 + 1] == attr)
+            continue;
+
+        // consecutive cells don't need the cursor to be moved
+        if (cell != last + 1 || cell % VGA_TEXT_COLS == 0)
+            printf("\x1b[%d;%dH", cell / VGA_TEXT_COLS + 1, cell % VGA_TEXT_COLS + 1);
+        term_cell(ch, attr);
+        shown[cell * 2] = ch;
+        shown[cell * 2 + 1] = attr;
+        last = cell;
+    }
+
+    int cursor = play->cursor < VGA_TEXT_ROWS * VGA_TEXT_COLS ? play->cursor : 0;
+    printf("\x1b[0m\x1b[%d;%dH", cursor / VGA_TEXT_COLS + 1, cursor % VGA_TEXT_COLS + 1);
+    fflush(stdout);
+}
+
+static void dump_screen(struct playback* play)
+{
+    for (int row = 0; row < VGA_TEXT_ROWS; row++) {
+        char line[VGA_TEXT_COLS + 1];
+        for (int col = 0; col < VGA_TEXT_COLS; col++) {
+            char ch = play->screen[(row * VGA_TEXT_COLS + col) * 2];
+            line[col] = ch >= 0x20 && ch <= 0x7e ? ch : ' ';
+        }
+        line[VGA_TEXT_COLS] = '\0';
+        printf("%s\n", line);
+    }
+    printf("time: %lu.%03lu s, cursor: %d,%d\n", play->time_ms / 1000, play->time_ms % 1000,
+        play->cursor % VGA_TEXT_COLS, play->cursor / VGA_TEXT_COLS);
+}
+
+static int play_terminal(struct playback* play, struct player_clock* clock)
+{
+    uint8_t shown[RECORD_SCREEN_SIZE];
+    uint64_t next;
+
+    printf("\x1b[2J");
+    term_draw(play, shown, true);
+
+    while (playback_peek(play, &next)) {
+        uint64_t now = clock_position(clock);
+        if (next > now) {
+            uint64_t wait_ms = (uint64_t)((next - now) / clock->speed);
+            struct timespec ts = { .tv_sec = wait_ms / 1000, .tv_nsec = (wait_ms % 1000) * 1000000 };
+            nanosleep(&ts, NULL);
+        }
+        advance(play, clock_position(clock));
+        term_draw(play, shown, false);
+    }
+
+    printf("\x1b[0m\x1b[%d;1H\n", VGA_TEXT_ROWS + 1);
+    return 0;
+}
+
+static int play_sdl(struct playback* play, struct player_clock* clock)
+{
+    struct kvm_window window;
+    int ret = 0;
+
+    if ((ret = kvm_window_init(&window, NULL, 1)) != 0)
+        return ret;
+    window.screens[0].vga_memory = play->screen;
+    window.screens[0].cursor_location = &play->cursor;
+
+    uint64_t duration = playback_duration(play);
+    int quit = 0;
+    SDL_Event event;
+    while (!quit) {
+        while (SDL_PollEvent(&event) == 1) {
+            uint64_t position = clock_position(clock);
+            if (event.type == SDL_QUIT) {
+                quit = 1;
+            } else if (event.type == SDL_KEYDOWN) {
+                switch (event.key.keysym.sym) {
+                case SDLK_SPACE:
+                    clock_set(clock, position);
+                    clock->paused = !clock->paused;
+                    break;
+                case SDLK_LEFT:
+                    clock_set(clock, position > SEEK_STEP_MS ? position - SEEK_STEP_MS : 0);
+                    break;
+                case SDLK_RIGHT:
+                    clock_set(clock, position + SEEK_STEP_MS);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+
+        uint64_t position = clock_position(clock);
+        if (position > duration) {
+            clock_set(clock, duration);
+            position = duration;
+        }
+        if ((ret = advance(play, position)) != 0)
+            break;
+        if ((ret = kvm_window_draw(&window)) != 0)
+            break;
+        SDL_Delay(33);
+    }
+
+    kvm_window_free(&window);
+    return ret;
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [options] recording\n"
+           "  --sdl         play in an SDL window (arrows seek, space pauses)\n"
+           "  --seek SEC    start playing at SEC seconds\n"
+           "  --speed X     playback speed multiplier\n"
+           "  --dump        print the screen at the seek position and exit\n",
+        name);
+}
+
+int main(int argc, char* argv[])
+{
+    static const struct option options[] = {
+        { "sdl", no_argument, NULL, 'S' },
+        { "seek", required_argument, NULL, 's' },
+        { "speed", required_argument, NULL, 'x' },
+        { "dump", no_argument, NULL, 'd' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+
+    bool sdl = false;
+    bool dump = false;
+    uint64_t seek_ms = 0;
+    struct player_clock clock = { .speed = 1.0 };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "Ss:x:dh", options, NULL)) != -1) {
+        switch (opt) {
+        case 'S':
+            sdl = true;
+            break;
+        case 's':
+            seek_ms = (uint64_t)(strtod(optarg, NULL) * 1000);
+            break;
+        case 'x':
+            clock.speed = strtod(optarg, NULL);
+            if (clock.speed <= 0)
+                clock.speed = 1.0;
+            break;
+        case 'd':
+            dump = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    struct playback play;
+    if ((ret = playback_open(&play, argv[optind])) != 0)
+        return ret;
+
+    if ((ret = playback_seek(&play, seek_ms)) != 0)
+        goto player_end;
+    clock_set(&clock, seek_ms);
+
+    if (dump)
+        dump_screen(&play);
+    else if (sdl)
+        ret = play_sdl(&play, &clock);
+    else
+        ret = play_terminal(&play, &clock);
+
+player_end:
+    playback_close(&play);
+    return ret;
+}
@@ -0,0 +1,500 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "record.h"
+
+static uint64_t monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t wall_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t encode_varint(uint8_t* buf, uint64_t value)
+{
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (uint8_t)value;
+    return len;
+}
+
+static int write_varint(FILE* file, uint64_t value)
+{
+    uint8_t buf[10];
+    size_t len = encode_varint(buf, value);
+    return fwrite(buf, 1, len, file) == len ? 0 : -1;
+}
+
+static void put_le(uint8_t* buf, uint64_t value, int bytes)
+{
+    for (int idx = 0; idx < bytes; idx++)
+        buf[idx] = (uint8_t)(value >> (8 * idx));
+}
+
+static uint64_t get_le(const uint8_t* buf, int bytes)
+{
+    uint64_t value = 0;
+    for (int idx = 0; idx < bytes; idx++)
+        value |= (uint64_t)buf[idx] << (8 * idx);
+    return value;
+}
+
+static int index_push(struct record_index* index, uint64_t time_ms, uint64_t offset)
+{
+    if (index->len == index->cap) {
+        size_t cap = index->cap ? index->cap * 2 : 64;
+        struct record_index_entry* entries = realloc(index->entries, cap * sizeof(*entries));
+        if (entries == NULL)
+            return -1;
+        index->entries = entries;
+        index->cap = cap;
+    }
+
+    index->entries[index->len].time_ms = time_ms;
+    index->entries[index->len].offset = offset;
+    index->len++;
+    return 0;
+}
+
+static void index_free(struct record_index* index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->len = 0;
+    index->cap = 0;
+}
+
+int recorder_open(struct recorder* rec, const char* path, uint32_t keyframe_interval_ms)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->keyframe_interval_ms = keyframe_interval_ms ? keyframe_interval_ms : RECORD_DEFAULT_KEYFRAME_MS;
+    rec->last_cell = -1;
+
+    rec->file = fopen(path, "wb");
+    if (rec->file == NULL)
+        return kvm_error("Cannot open recording", "Cannot open recording '%s'\n", path);
+
+    uint8_t header[RECORD_HEADER_SIZE] = { 0 };
+    memcpy(header, RECORD_MAGIC, 8);
+    put_le(header + 8, VGA_TEXT_COLS, 2);
+    put_le(header + 10, VGA_TEXT_ROWS, 2);
+    put_le(header + 12, rec->keyframe_interval_ms, 4);
+    put_le(header + 16, wall_clock_ms(), 8);
+
+    if (fwrite(header, 1, sizeof(header), rec->file) != sizeof(header))
+        return kvm_error("Cannot write recording", NULL);
+
+    rec->start_ms = monotonic_ms();
+    return 0;
+}
+
+void recorder_cell(struct recorder* rec, int cell, uint8_t character, uint8_t attribute)
+{
+    if (rec->screen[cell * 2] == character && rec->screen[cell * 2 + 1] == attribute)
+        return;
+
+    rec->screen[cell * 2] = character;
+    rec->screen[cell * 2 + 1] = attribute;
+
+    // gap varint + character + attribute
+    if (rec->pending_size + 12 > rec->pending_cap) {
+        size_t cap = rec->pending_cap ? rec->pending_cap * 2 : 1024;
+        uint8_t* pending = realloc(rec->pending, cap);
+        if (pending == NULL) {
+            // the screen already has the cell, a keyframe carries it
+            rec->has_keyframe = false;
+            return;
+        }
+        rec->pending = pending;
+        rec->pending_cap = cap;
+    }
+
+    // cells are reported in ascending order by the renderer so the gap
+    // is small and usually fits in a single byte
+    uint64_t gap = (uint64_t)(cell - (rec->last_cell + 1));
+    if (cell <= rec->last_cell) {
+        // out of order report, fall back to a keyframe for this frame
+        rec->has_keyframe = false;
+        gap = 0;
+    }
+
+    rec->pending_size += encode_varint(rec->pending + rec->pending_size, gap);
+    rec->pending[rec->pending_size++] = character;
+    rec->pending[rec->pending_size++] = attribute;
+    rec->pending_cells++;
+    rec->last_cell = cell;
+}
+
+static int write_keyframe(struct recorder* rec, uint64_t now)
+{
+    long offset = ftell(rec->file);
+    if (offset < 0 || index_push(&rec->index, now, (uint64_t)offset) != 0)
+        return kvm_error("Cannot index recording", NULL);
+
+    if (fputc(RECORD_KEYFRAME, rec->file) == EOF
+        || write_varint(rec->file, now) != 0
+        || write_varint(rec->file, rec->cursor) != 0
+        || fwrite(rec->screen, 1, sizeof(rec->screen), rec->file) != sizeof(rec->screen))
+        return kvm_error("Cannot write recording", NULL);
+
+    rec->last_keyframe_ms = now;
+    rec->has_keyframe = true;
+    return 0;
+}
+
+int recorder_frame(struct recorder* rec, uint16_t cursor)
+{
+    if (rec->pending_cells == 0 && cursor == rec->cursor && rec->has_keyframe)
+        return 0;
+
+    uint64_t now = monotonic_ms() - rec->start_ms;
+    int ret = 0;
+    rec->cursor = cursor;
+
+    if (!rec->has_keyframe || now - rec->last_keyframe_ms >= rec->keyframe_interval_ms) {
+        ret = write_keyframe(rec, now);
+    } else if (fputc(RECORD_DELTA, rec->file) == EOF
+        || write_varint(rec->file, now - rec->last_ms) != 0
+        || write_varint(rec->file, cursor) != 0
+        || write_varint(rec->file, rec->pending_cells) != 0
+        || fwrite(rec->pending, 1, rec->pending_size, rec->file) != rec->pending_size) {
+        ret = kvm_error("Cannot write recording", NULL);
+    }
+
+    rec->last_ms = now;
+    rec->pending_size = 0;
+    rec->pending_cells = 0;
+    rec->last_cell = -1;
+    return ret;
+}
+
+int recorder_close(struct recorder* rec)
+{
+    int ret = 0;
+    if (rec->file == NULL)
+        return 0;
+
+    long offset = ftell(rec->file);
+    if (offset < 0 || fputc(RECORD_INDEX, rec->file) == EOF
+        || write_varint(rec->file, rec->index.len) != 0) {
+        ret = kvm_error("Cannot write recording index", NULL);
+    }
+
+    for (size_t idx = 0; ret == 0 && idx < rec->index.len; idx++) {
+        if (write_varint(rec->file, rec->index.entries[idx].time_ms) != 0
+            || write_varint(rec->file, rec->index.entries[idx].offset) != 0)
+            ret = kvm_error("Cannot write recording index", NULL);
+    }
+
+    if (ret == 0) {
+        uint8_t trailer[RECORD_TRAILER_SIZE];
+        put_le(trailer, (uint64_t)offset, 8);
+        memcpy(trailer + 8, RECORD_INDEX_MAGIC, 4);
+        if (fwrite(trailer, 1, sizeof(trailer), rec->file) != sizeof(trailer))
+            ret = kvm_error("Cannot write recording index", NULL);
+    }
+
+    if (fclose(rec->file) != 0 && ret == 0)
+        ret = kvm_error("Cannot close recording", NULL);
+
+    rec->file = NULL;
+    free(rec->pending);
+    rec->pending = NULL;
+    index_free(&rec->index);
+    return ret;
+}
+
+/* Returns 0 when the varint runs past `end` */
+static size_t decode_varint(const uint8_t* buf, size_t pos, size_t end, uint64_t* value)
+{
+    uint64_t result = 0;
+    int shift = 0;
+    size_t start = pos;
+
+    while (pos < end && shift < 64) {
+        uint8_t byte = buf[pos++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return pos - start;
+        }
+        shift += 7;
+    }
+
+    return 0;
+}
+
+/**
+ * Decode a single record at `pos`, applying it to the screen if `apply`
+ * is set. Returns the record size or 0 if the record is truncated or unknown.
+ */
+static size_t decode_record(struct playback* play, size_t pos, bool apply)
+{
+    const uint8_t* data = play->data;
+    size_t start = pos;
+    size_t len;
+    uint64_t time, cursor, count;
+
+    if (pos >= play->end)
+        return 0;
+
+    uint8_t type = data[pos++];
+    if (type != RECORD_KEYFRAME && type != RECORD_DELTA)
+        return 0;
+
+    if ((len = decode_varint(data, pos, play->end, &time)) == 0)
+        return 0;
+    pos += len;
+    if ((len = decode_varint(data, pos, play->end, &cursor)) == 0)
+        return 0;
+    pos += len;
+
+    if (type == RECORD_KEYFRAME) {
+        if (pos + RECORD_SCREEN_SIZE > play->end)
+            return 0;
+        if (apply) {
+            memcpy(play->screen, data + pos, RECORD_SCREEN_SIZE);
+            play->time_ms = time;
+            play->cursor = cursor;
+        }
+        return pos + RECORD_SCREEN_SIZE - start;
+    }
+
+    if ((len = decode_varint(data, pos, play->end, &count)) == 0)
+        return 0;
+    pos += len;
+
+    int cell = -1;
+    for (uint64_t idx = 0; idx < count; idx++) {
+        uint64_t gap;
+        if ((len = decode_varint(data, pos, play->end, &gap)) == 0 || pos + len + 2 > play->end)
+            return 0;
+        pos += len;
+        cell += gap + 1;
+        if (apply && cell >= 0 && cell < VGA_TEXT_ROWS * VGA_TEXT_COLS) {
+            play->screen[cell * 2] = data[pos];
+            play->screen[cell * 2 + 1] = data[pos + 1];
+        }
+        pos += 2;
+    }
+
+    if (apply) {
+        play->time_ms += time;
+        play->cursor = cursor;
+    }
+    return pos - start;
+}
+
+static int read_index(struct playback* play)
+{
+    const uint8_t* data = play->data;
+
+    if (play->size < RECORD_HEADER_SIZE + RECORD_TRAILER_SIZE
+        || memcmp(data + play->size - 4, RECORD_INDEX_MAGIC, 4) != 0)
+        return -1;
+
+    uint64_t offset = get_le(data + play->size - RECORD_TRAILER_SIZE, 8);
+    size_t end = play->size - RECORD_TRAILER_SIZE;
+    if (offset < RECORD_HEADER_SIZE || offset >= end || data[offset] != RECORD_INDEX)
+        return -1;
+
+    size_t pos = offset + 1, len;
+    uint64_t count;
+    if ((len = decode_varint(data, pos, end, &count)) == 0)
+        return -1;
+    pos += len;
+
+    for (uint64_t idx = 0; idx < count; idx++) {
+        uint64_t time, kf_offset;
+        if ((len = decode_varint(data, pos, end, &time)) == 0)
+            return -1;
+        pos += len;
+        if ((len = decode_varint(data, pos, end, &kf_offset)) == 0)
+            return -1;
+        pos += len;
+        // seeking trusts the offsets, keyframes all come before the index
+        if (kf_offset < RECORD_HEADER_SIZE || kf_offset >= offset || data[kf_offset] != RECORD_KEYFRAME)
+            return -1;
+        if (index_push(&play->index, time, kf_offset) != 0)
+            return -1;
+    }
+
+    play->end = offset;
+    return 0;
+}
+
+/* Recordings cut short (crash, kill -9) have no index, rebuild it */
+static int scan_index(struct playback* play)
+{
+    size_t pos = RECORD_HEADER_SIZE;
+    size_t len;
+
+    play->end = play->size;
+    while ((len = decode_record(play, pos, false)) != 0) {
+        if (play->data[pos] == RECORD_KEYFRAME) {
+            uint64_t time;
+            decode_varint(play->data, pos + 1, play->end, &time);
+            if (index_push(&play->index, time, pos) != 0)
+                return -1;
+        }
+        pos += len;
+    }
+
+    // ignore the truncated tail
+    play->end = pos;
+    return 0;
+}
+
+int playback_open(struct playback* play, const char* path)
+{
+    memset(play, 0, sizeof(*play));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return kvm_error("Cannot open recording", "Cannot open recording '%s'\n", path);
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return kvm_error("Cannot stat recording", "Cannot stat recording '%s'\n", path);
+    }
+
+    if ((size_t)st.st_size < RECORD_HEADER_SIZE) {
+        close(fd);
+        return kvm_error(NULL, "'%s' is not a recording\n", path);
+    }
+
+    // map the whole file, seeking is then just pointer arithmetic
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return kvm_error("Cannot map recording", NULL);
+
+    play->data = data;
+    play->size = st.st_size;
+
+    if (memcmp(play->data, RECORD_MAGIC, 8) != 0
+        || get_le(play->data + 8, 2) != VGA_TEXT_COLS
+        || get_le(play->data + 10, 2) != VGA_TEXT_ROWS) {
+        playback_close(play);
+        return kvm_error(NULL, "'%s' is not a %dx%d recording\n", path, VGA_TEXT_COLS, VGA_TEXT_ROWS);
+    }
+
+    play->keyframe_interval_ms = get_le(play->data + 12, 4);
+    play->wall_start_ms = get_le(play->data + 16, 8);
+
+    if (read_index(play) != 0) {
+        index_free(&play->index);
+        if (scan_index(play) != 0) {
+            playback_close(play);
+            return kvm_error(NULL, "Cannot index recording '%s'\n", path);
+        }
+    }
+
+    play->pos = RECORD_HEADER_SIZE;
+    return 0;
+}
+
+void playback_close(struct playback* play)
+{
+    if (play->data != NULL)
+        munmap((void*)play->data, play->size);
+    index_free(&play->index);
+    memset(play, 0, sizeof(*play));
+}
+
+bool playback_peek(struct playback* play, uint64_t* time_ms)
+{
+    uint64_t time;
+    size_t pos = play->pos;
+
+    // a truncated or corrupt record ends the stream, the loops peeking
+    // would never get past it otherwise
+    if (decode_record(play, pos, false) == 0)
+        return false;
+    decode_varint(play->data, pos + 1, play->end, &time);
+
+    *time_ms = play->data[pos] == RECORD_KEYFRAME ? time : play->time_ms + time;
+    return true;
+}
+
+int playback_next(struct playback* play)
+{
+    size_t len = decode_record(play, play->pos, true);
+    if (len == 0)
+        return 0;
+    play->pos += len;
+    return 1;
+}
+
+uint64_t playback_duration(struct playback* play)
+{
+    struct playback tmp = *play;
+    uint64_t time;
+
+    // only the records after the last keyframe need to be decoded
+    if (tmp.index.len > 0)
+        tmp.pos = tmp.index.entries[tmp.index.len - 1].offset;
+
+    while (playback_peek(&tmp, &time)) {
+        // a corrupt record ends the stream
+        size_t len = decode_record(&tmp, tmp.pos, false);
+        if (len == 0)
+            break;
+        tmp.time_ms = time;
+        tmp.pos += len;
+    }
+
+    return tmp.time_ms;
+}
+
+int playback_seek(struct playback* play, uint64_t time_ms)
+{
+    struct record_index* index = &play->index;
+
+    if (index->len == 0 || index->entries[0].time_ms > time_ms) {
+        // only happens before the first keyframe, which is the first record
+        play->pos = RECORD_HEADER_SIZE;
+        play->time_ms = 0;
+        play->cursor = 0;
+        memset(play->screen, 0, sizeof(play->screen));
+        return 0;
+    }
+
+    // binary search the last keyframe at or before time_ms
+    size_t low = 0, high = index->len;
+    while (high - low > 1) {
+        size_t mid = low + (high - low) / 2;
+        if (index->entries[mid].time_ms <= time_ms)
+            low = mid;
+        else
+            high = mid;
+    }
+
+    play->pos = index->entries[low].offset;
+    if (!playback_next(play))
+        return kvm_error(NULL, "Corrupted keyframe at offset %zu\n", play->pos);
+
+    uint64_t next;
+    while (playback_peek(play, &next) && next <= time_ms) {
+        if (!playback_next(play))
+            break;
+    }
+
+    return 0;
+}
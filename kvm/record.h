@@ -0,0 +1,112 @@
+#ifndef _KVM_RECORD_H_
+#define _KVM_RECORD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "kvm.h"
+
+/**
+ * Screen recordings are a stream of records following a fixed header:
+ *
+ *   header   "DUCKREC1", u16 cols, u16 rows, u32 keyframe interval (ms),
+ *            u64 wall clock start (ms since epoch), 8 reserved bytes
+ *   'K'      varint time (ms since start), varint cursor, cols * rows * 2
+ *            bytes of raw text mode memory
+ *   'D'      varint time (ms since previous record), varint cursor,
+ *            varint cell count, then per cell: varint gap to the previous
+ *            changed cell, u8 character, u8 attribute
+ *   'X'      varint entry count, per entry: varint time, varint file offset
+ *            of a keyframe. Followed by u64 offset of the 'X' record and
+ *            the trailer magic "DRIX"
+ *
+ * Nothing is written for frames where the screen did not change, so the
+ * file size grows with the screen change rate rather than with time.
+ * Keyframes are only emitted with a change, at most once per interval.
+ */
+#define RECORD_MAGIC "DUCKREC1"
+#define RECORD_INDEX_MAGIC "DRIX"
+#define RECORD_HEADER_SIZE 32
+#define RECORD_TRAILER_SIZE 12
+#define RECORD_KEYFRAME 'K'
+#define RECORD_DELTA 'D'
+#define RECORD_INDEX 'X'
+
+#define RECORD_DEFAULT_KEYFRAME_MS 10000
+
+#define RECORD_SCREEN_SIZE (VGA_TEXT_ROWS * VGA_TEXT_COLS * 2)
+
+struct record_index_entry {
+    uint64_t time_ms;
+    uint64_t offset;
+};
+
+struct record_index {
+    struct record_index_entry* entries;
+    size_t len;
+    size_t cap;
+};
+
+struct recorder {
+    FILE* file;
+    uint64_t start_ms;
+    uint64_t last_ms;
+    uint64_t last_keyframe_ms;
+    uint32_t keyframe_interval_ms;
+    bool has_keyframe;
+
+    /* The screen as it is described by the stream so far */
+    uint8_t screen[RECORD_SCREEN_SIZE];
+    uint16_t cursor;
+
+    /* Cell deltas of the frame that is being built */
+    uint8_t* pending;
+    size_t pending_size;
+    size_t pending_cap;
+    uint32_t pending_cells;
+    int last_cell;
+
+    struct record_index index;
+};
+
+int recorder_open(struct recorder* rec, const char* path, uint32_t keyframe_interval_ms);
+/* Report a changed cell. `cell` is the index of the character cell (not the byte offset) */
+void recorder_cell(struct recorder* rec, int cell, uint8_t character, uint8_t attribute);
+/* Commit the cells reported since the previous frame */
+int recorder_frame(struct recorder* rec, uint16_t cursor);
+int recorder_close(struct recorder* rec);
+
+struct playback {
+    const uint8_t* data;
+    size_t size;
+    /* End of the record stream, excluding the index */
+    size_t end;
+    uint32_t keyframe_interval_ms;
+    uint64_t wall_start_ms;
+
+    struct record_index index;
+
+    /* Decoder state */
+    size_t pos;
+    uint64_t time_ms;
+    uint8_t screen[RECORD_SCREEN_SIZE];
+    uint16_t cursor;
+};
+
+int playback_open(struct playback* play, const char* path);
+void playback_close(struct playback* play);
+/* Time of the last record in the stream */
+uint64_t playback_duration(struct playback* play);
+/* Position the screen at `time_ms`, jumping to the closest keyframe first */
+int playback_seek(struct playback* play, uint64_t time_ms);
+/**
+ * Time of the next record without applying it. Returns false at the end
+ * of the stream, which a truncated or corrupt record is too.
+ */
+bool playback_peek(struct playback* play, uint64_t* time_ms);
+/* Apply the next record. Returns 1 on success, 0 at the end of the stream */
+int playback_next(struct playback* play);
+
+#endif
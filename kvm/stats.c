@@ -0,0 +1,294 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#include "kvm.h"
+#include "stats.h"
+
+static const char* exit_reason_names[STATS_EXIT_REASONS] = {
+    [KVM_EXIT_UNKNOWN] = "unknown",
+    [KVM_EXIT_EXCEPTION] = "exception",
+    [KVM_EXIT_IO] = "io",
+    [KVM_EXIT_HYPERCALL] = "hypercall",
+    [KVM_EXIT_DEBUG] = "debug",
+    [KVM_EXIT_HLT] = "hlt",
+    [KVM_EXIT_MMIO] = "mmio",
+    [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq_window_open",
+    [KVM_EXIT_SHUTDOWN] = "shutdown",
+    [KVM_EXIT_FAIL_ENTRY] = "fail_entry",
+    [KVM_EXIT_INTR] = "intr",
+    [KVM_EXIT_SET_TPR] = "set_tpr",
+    [KVM_EXIT_TPR_ACCESS] = "tpr_access",
+    [KVM_EXIT_NMI] = "nmi",
+    [KVM_EXIT_INTERNAL_ERROR] = "internal_error",
+    [KVM_EXIT_SYSTEM_EVENT] = "system_event",
+    [KVM_EXIT_IOAPIC_EOI] = "ioapic_eoi",
+    [KVM_EXIT_X86_RDMSR] = "x86_rdmsr",
+    [KVM_EXIT_X86_WRMSR] = "x86_wrmsr",
+    [KVM_EXIT_DIRTY_RING_FULL] = "dirty_ring_full",
+    [KVM_EXIT_X86_BUS_LOCK] = "x86_bus_lock",
+    [KVM_EXIT_NOTIFY] = "notify",
+};
+
+static const char* handler_names[STATS_HANDLER_COUNT] = {
+    [STATS_HANDLER_RUN] = "kvm_run",
+    [STATS_HANDLER_BIOS] = "bios",
+    [STATS_HANDLER_VGA_CTRL] = "vga_ctrl",
+    [STATS_HANDLER_VGA_DATA] = "vga_data",
+    [STATS_HANDLER_KEYBOARD] = "keyboard",
+    [STATS_HANDLER_IO_OTHER] = "io_other",
+    [STATS_HANDLER_POWER_OFF] = "power_off",
+};
+
+static void binary_stats_init(struct kvm_binary_stats* bin)
+{
+    memset(bin, 0, sizeof(*bin));
+    bin->fd = -1;
+}
+
+static void binary_stats_free(struct kvm_binary_stats* bin)
+{
+    if (bin->fd != -1)
+        close(bin->fd);
+    free(bin->descriptors);
+    free(bin->data);
+    binary_stats_init(bin);
+}
+
+static void binary_stats_open(struct kvm_binary_stats* bin, int fd)
+{
+    bin->fd = ioctl(fd, KVM_GET_STATS_FD, NULL);
+    if (bin->fd < 0) {
+        bin->fd = -1;
+        return;
+    }
+
+    if (pread(bin->fd, &bin->header, sizeof(bin->header), 0) != sizeof(bin->header))
+        goto error;
+
+    // descriptors are fixed for the lifetime of the fd, only data is re-read
+    bin->descriptor_size = sizeof(struct kvm_stats_desc) + bin->header.name_size;
+    size_t size = bin->descriptor_size * bin->header.num_desc;
+    bin->descriptors = malloc(size);
+    if (bin->descriptors == NULL
+        || pread(bin->fd, bin->descriptors, size, bin->header.desc_offset) != (ssize_t)size)
+        goto error;
+
+    for (uint32_t idx = 0; idx < bin->header.num_desc; idx++) {
+        struct kvm_stats_desc* desc = (void*)(bin->descriptors + idx * bin->descriptor_size);
+        size_t end = desc->offset / sizeof(uint64_t) + desc->size;
+        if (end > bin->data_count)
+            bin->data_count = end;
+    }
+
+    bin->data = calloc(bin->data_count, sizeof(uint64_t));
+    if (bin->data == NULL)
+        goto error;
+    return;
+
+error:
+    kvm_error("Cannot read KVM binary stats", NULL);
+    binary_stats_free(bin);
+}
+
+static bool binary_stats_read(struct kvm_binary_stats* bin)
+{
+    if (bin->fd == -1)
+        return false;
+    size_t size = bin->data_count * sizeof(uint64_t);
+    return pread(bin->fd, bin->data, size, bin->header.data_offset) == (ssize_t)size;
+}
+
+void stats_init(struct vm_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    binary_stats_init(&stats->vm_stats);
+    binary_stats_init(&stats->vcpu_stats);
+}
+
+void stats_free(struct vm_stats* stats)
+{
+    binary_stats_free(&stats->vm_stats);
+    binary_stats_free(&stats->vcpu_stats);
+    stats_init(stats);
+}
+
+void stats_open_kvm(struct vm_stats* stats, int vm_fd, int vcpu_fd)
+{
+    if (vm_fd != -1)
+        binary_stats_open(&stats->vm_stats, vm_fd);
+    binary_stats_open(&stats->vcpu_stats, vcpu_fd);
+}
+
+const char* stats_handler_name(enum stats_handler handler)
+{
+    return handler < STATS_HANDLER_COUNT ? handler_names[handler] : "unknown";
+}
+
+void stats_port(struct vm_stats* stats, uint16_t port, uint8_t direction)
+{
+    uint32_t key = port | (uint32_t)direction << 16 | STATS_PORT_USED;
+    // multiplicative hash, the VGA ports are next to each other
+    uint32_t slot = (key * 2654435761u) >> 24;
+
+    for (int probe = 0; probe < STATS_PORT_SLOTS; probe++) {
+        struct stats_port* entry = &stats->ports[(slot + probe) % STATS_PORT_SLOTS];
+        if (entry->key == key) {
+            entry->count++;
+            return;
+        }
+        if (entry->key == 0) {
+            entry->key = key;
+            entry->count = 1;
+            return;
+        }
+    }
+
+    stats->ports_dropped++;
+}
+
+static const char* exit_name(int reason, char* buf, size_t size)
+{
+    if (exit_reason_names[reason] != NULL)
+        return exit_reason_names[reason];
+    snprintf(buf, size, "exit_%d", reason);
+    return buf;
+}
+
+static void dump_binary_text(FILE* file, const char* scope, struct kvm_binary_stats* bin)
+{
+    if (!binary_stats_read(bin))
+        return;
+
+    for (uint32_t idx = 0; idx < bin->header.num_desc; idx++) {
+        struct kvm_stats_desc* desc = (void*)(bin->descriptors + idx * bin->descriptor_size);
+        uint64_t* values = bin->data + desc->offset / sizeof(uint64_t);
+        // histograms are skipped in text mode unless they have data
+        if (desc->size == 1) {
+            fprintf(file, "  kvm.%s.%s %lu\n", scope, desc->name, values[0]);
+            continue;
+        }
+        for (uint16_t bucket = 0; bucket < desc->size; bucket++) {
+            if (values[bucket] != 0)
+                fprintf(file, "  kvm.%s.%s[%u] %lu\n", scope, desc->name, bucket, values[bucket]);
+        }
+    }
+}
+
+static void dump_binary_json(FILE* file, struct kvm_binary_stats* bin)
+{
+    fprintf(file, "{");
+    if (binary_stats_read(bin)) {
+        for (uint32_t idx = 0; idx < bin->header.num_desc; idx++) {
+            struct kvm_stats_desc* desc = (void*)(bin->descriptors + idx * bin->descriptor_size);
+            uint64_t* values = bin->data + desc->offset / sizeof(uint64_t);
+            fprintf(file, "%s\"%s\": ", idx ? ", " : "", desc->name);
+            if (desc->size == 1) {
+                fprintf(file, "%lu", values[0]);
+                continue;
+            }
+            fprintf(file, "[");
+            for (uint16_t bucket = 0; bucket < desc->size; bucket++)
+                fprintf(file, "%s%lu", bucket ? ", " : "", values[bucket]);
+            fprintf(file, "]");
+        }
+    }
+    fprintf(file, "}");
+}
+
+static void dump_text(FILE* file, int index, int cpu, struct vm_stats* stats)
+{
+    char buf[32];
+
+    fprintf(file, "vm%d.cpu%d exits:\n", index, cpu);
+    for (int reason = 0; reason < STATS_EXIT_REASONS; reason++) {
+        if (stats->exits[reason] != 0)
+            fprintf(file, "  %-24s %lu\n", exit_name(reason, buf, sizeof(buf)), stats->exits[reason]);
+    }
+
+    fprintf(file, "vm%d.cpu%d ports:\n", index, cpu);
+    for (int slot = 0; slot < STATS_PORT_SLOTS; slot++) {
+        struct stats_port* entry = &stats->ports[slot];
+        if (entry->key != 0) {
+            fprintf(file, "  0x%04x %-3s %lu\n", entry->key & 0xffff,
+                entry->key >> 16 & KVM_EXIT_IO_OUT ? "out" : "in", entry->count);
+        }
+    }
+    if (stats->ports_dropped != 0)
+        fprintf(file, "  untracked %lu\n", stats->ports_dropped);
+
+    fprintf(file, "vm%d.cpu%d handlers:\n", index, cpu);
+    for (int handler = 0; handler < STATS_HANDLER_COUNT; handler++) {
+        if (stats->handlers[handler].count != 0)
+            histogram_print(file, handler_names[handler], &stats->handlers[handler], "cycles");
+    }
+
+    dump_binary_text(file, "vm", &stats->vm_stats);
+    dump_binary_text(file, "vcpu", &stats->vcpu_stats);
+}
+
+static void dump_json(FILE* file, int index, int cpu, struct vm_stats* stats)
+{
+    char buf[32];
+    const char* sep = "";
+
+    fprintf(file, "{\"vm\": %d, \"cpu\": %d, \"exits\": {", index, cpu);
+    for (int reason = 0; reason < STATS_EXIT_REASONS; reason++) {
+        if (stats->exits[reason] != 0) {
+            fprintf(file, "%s\"%s\": %lu", sep, exit_name(reason, buf, sizeof(buf)), stats->exits[reason]);
+            sep = ", ";
+        }
+    }
+
+    fprintf(file, "}, \"ports\": [");
+    sep = "";
+    for (int slot = 0; slot < STATS_PORT_SLOTS; slot++) {
+        struct stats_port* entry = &stats->ports[slot];
+        if (entry->key != 0) {
+            fprintf(file, "%s{\"port\": %u, \"direction\": \"%s\", \"count\": %lu}", sep,
+                entry->key & 0xffff, entry->key >> 16 & KVM_EXIT_IO_OUT ? "out" : "in", entry->count);
+            sep = ", ";
+        }
+    }
+
+    fprintf(file, "], \"ports_untracked\": %lu, \"handler_cycles\": {", stats->ports_dropped);
+    for (int handler = 0; handler < STATS_HANDLER_COUNT; handler++) {
+        fprintf(file, "%s\"%s\": ", handler ? ", " : "", handler_names[handler]);
+        histogram_print_json(file, &stats->handlers[handler]);
+    }
+
+    fprintf(file, "}, \"kvm_vm\": ");
+    dump_binary_json(file, &stats->vm_stats);
+    fprintf(file, ", \"kvm_vcpu\": ");
+    dump_binary_json(file, &stats->vcpu_stats);
+    fprintf(file, "}");
+}
+
+void stats_dump(FILE* file, enum stats_format format, struct vm* vms, int count)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    if (format == STATS_FORMAT_JSON) {
+        fprintf(file, "{\"time\": %ld.%03ld, \"vms\": [", ts.tv_sec, ts.tv_nsec / 1000000);
+        const char* sep = "";
+        for (int idx = 0; idx < count; idx++) {
+            for (int cpu = 0; cpu < vms[idx].vcpu_count; cpu++) {
+                fprintf(file, "%s", sep);
+                dump_json(file, idx, cpu, &vms[idx].vcpus[cpu].stats);
+                sep = ", ";
+            }
+        }
+        fprintf(file, "]}\n");
+    } else {
+        fprintf(file, "--- stats at %ld.%03ld\n", ts.tv_sec, ts.tv_nsec / 1000000);
+        for (int idx = 0; idx < count; idx++) {
+            for (int cpu = 0; cpu < vms[idx].vcpu_count; cpu++)
+                dump_text(file, idx, cpu, &vms[idx].vcpus[cpu].stats);
+        }
+    }
+
+    fflush(file);
+}
@@ -0,0 +1,101 @@
+#ifndef _KVM_STATS_H_
+#define _KVM_STATS_H_
+
+#include <linux/kvm.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <x86intrin.h>
+
+#include "histogram.h"
+
+struct vm;
+
+#define STATS_EXIT_REASONS 64
+/* Open addressed, guests only touch a handful of ports */
+#define STATS_PORT_SLOTS 256
+#define STATS_PORT_USED (1 << 17)
+
+/**
+ * Userspace exit handlers that are timed
+ */
+enum stats_handler {
+    STATS_HANDLER_RUN, /* KVM_RUN itself: guest time plus in-kernel exits */
+    STATS_HANDLER_BIOS,
+    STATS_HANDLER_VGA_CTRL,
+    STATS_HANDLER_VGA_DATA,
+    STATS_HANDLER_KEYBOARD,
+    STATS_HANDLER_IO_OTHER,
+    STATS_HANDLER_POWER_OFF,
+    STATS_HANDLER_COUNT,
+};
+
+struct stats_port {
+    /* port | direction << 16 | STATS_PORT_USED, 0 marks a free slot */
+    uint32_t key;
+    uint64_t count;
+};
+
+/**
+ * KVM's own counters read from a KVM_GET_STATS_FD file descriptor
+ */
+struct kvm_binary_stats {
+    int fd;
+    struct kvm_stats_header header;
+    /* descriptors, each followed by header.name_size bytes of name */
+    uint8_t* descriptors;
+    size_t descriptor_size;
+    uint64_t* data;
+    size_t data_count;
+};
+
+/**
+ * One per vCPU, written only by its thread. Other threads read the counters
+ * without locking which gives a slightly stale but consistent enough
+ * view for reporting, 64 bit loads don't tear on x86-64.
+ */
+struct vm_stats {
+    uint64_t exits[STATS_EXIT_REASONS];
+    struct stats_port ports[STATS_PORT_SLOTS];
+    /* ports that didn't fit in the table */
+    uint64_t ports_dropped;
+    /* Handler time in TSC cycles */
+    struct histogram handlers[STATS_HANDLER_COUNT];
+
+    struct kvm_binary_stats vm_stats;
+    struct kvm_binary_stats vcpu_stats;
+};
+
+enum stats_format {
+    STATS_FORMAT_TEXT,
+    STATS_FORMAT_JSON,
+};
+
+static inline uint64_t stats_cycles()
+{
+    return __rdtsc();
+}
+
+static inline void stats_exit(struct vm_stats* stats, uint32_t reason)
+{
+    stats->exits[reason < STATS_EXIT_REASONS ? reason : STATS_EXIT_REASONS - 1]++;
+}
+
+static inline void stats_handler(struct vm_stats* stats, enum stats_handler handler, uint64_t start)
+{
+    histogram_record(&stats->handlers[handler], stats_cycles() - start);
+}
+
+void stats_init(struct vm_stats* stats);
+void stats_free(struct vm_stats* stats);
+/**
+ * Open KVM's binary stats, missing support is not an error. `vm_fd` is -1
+ * for vCPUs that don't report the VM wide counters.
+ */
+void stats_open_kvm(struct vm_stats* stats, int vm_fd, int vcpu_fd);
+void stats_port(struct vm_stats* stats, uint16_t port, uint8_t direction);
+const char* stats_handler_name(enum stats_handler handler);
+/* Dump the stats of every vCPU of `count` VMs */
+void stats_dump(FILE* file, enum stats_format format, struct vm* vms, int count);
+
+#endif
@@ -0,0 +1,291 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+
+#include "kvm.h"
+#include "trace.h"
+
+#define MSR_IA32_TSC 0x10
+
+/* Pairs of host TSC and CLOCK_MONOTONIC, the TSC rate comes from the
+ * first and the one taken when the trace is written */
+static uint64_t base_tsc = 0;
+static uint64_t base_ns = 0;
+
+static uint64_t monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void trace_log_init(struct trace_log* log)
+{
+    memset(log, 0, sizeof(*log));
+}
+
+void trace_log_free(struct trace_log* log)
+{
+    free(log->records);
+    trace_log_init(log);
+}
+
+static int trace_log_alloc(struct trace_log* log)
+{
+    log->records = malloc(TRACE_LOG_RECORDS * sizeof(struct trace_record));
+    if (log->records == NULL)
+        return kvm_error("Cannot allocate the trace log", NULL);
+    return 0;
+}
+
+static void append(struct trace_log* log, uint64_t start, uint64_t end, uint16_t id, uint16_t arg0, uint32_t arg1)
+{
+    if (log->count == TRACE_LOG_RECORDS) {
+        log->lost++;
+        return;
+    }
+    log->records[log->count] = (struct trace_record) { start, end, id, arg0, arg1 };
+    __atomic_store_n(&log->count, log->count + 1, __ATOMIC_RELEASE);
+}
+
+static struct trace_buffer* guest_buffer(struct vm* vm)
+{
+    return (struct trace_buffer*)((uint8_t*)vm->shared_memory + TRACE_ADDRESS);
+}
+
+int trace_enable(struct vm* vm)
+{
+    int ret;
+    if ((ret = trace_log_alloc(&vm->input_trace)) != 0)
+        return ret;
+    for (int idx = 0; idx < vm->vcpu_count; idx++) {
+        if ((ret = trace_log_alloc(&vm->vcpus[idx].trace)) != 0)
+            return ret;
+    }
+
+    if (base_tsc == 0) {
+        base_tsc = stats_cycles();
+        base_ns = monotonic_ns();
+    }
+    // the guest kernel sets up the rings but leaves this alone
+    guest_buffer(vm)->enabled = 1;
+    vm->tracing = true;
+    return 0;
+}
+
+/* KVM runs the guest TSC at an offset from the host's. The MSR keeps
+ * counting while the vCPU is out of the guest, so reading both right
+ * after each other gives the offset up to the ioctl's latency. TSC
+ * scaling isn't accounted for. */
+static bool read_tsc_offset(struct vcpu* vcpu, int64_t* offset)
+{
+    struct {
+        struct kvm_msrs header;
+        struct kvm_msr_entry entry;
+    } msrs;
+    memset(&msrs, 0, sizeof(msrs));
+    msrs.header.nmsrs = 1;
+    msrs.entry.index = MSR_IA32_TSC;
+
+    if (ioctl(vcpu->fd, KVM_GET_MSRS, &msrs) != 1)
+        return false;
+    *offset = (int64_t)(msrs.entry.data - stats_cycles());
+    return true;
+}
+
+void trace_collect(struct vcpu* vcpu)
+{
+    struct trace_buffer* buffer = guest_buffer(vcpu->vm);
+    struct trace_log* log = &vcpu->trace;
+    if (buffer->magic != TRACE_MAGIC || vcpu->id >= TRACE_MAX_CPUS)
+        return;
+
+    struct trace_cpu* cpu = &buffer->cpus[vcpu->id];
+    uint32_t head = __atomic_load_n(&cpu->head, __ATOMIC_ACQUIRE);
+    if (head == log->guest_head)
+        return;
+    if (!log->has_offset) {
+        if (!read_tsc_offset(vcpu, &log->tsc_offset))
+            log->tsc_offset = 0;
+        log->has_offset = true;
+    }
+    if (head - log->guest_head > TRACE_EVENTS) {
+        log->lost += head - log->guest_head - TRACE_EVENTS;
+        log->guest_head = head - TRACE_EVENTS;
+    }
+
+    for (; log->guest_head != head; log->guest_head++) {
+        const struct trace_event* event = &cpu->events[log->guest_head % TRACE_EVENTS];
+        append(log, event->tsc - log->tsc_offset, 0, event->id, event->arg0, event->arg1);
+    }
+}
+
+void trace_exit(struct vcpu* vcpu, enum stats_handler handler, uint16_t port, uint64_t start, uint64_t end)
+{
+    append(&vcpu->trace, start, end, TRACE_HOST_EXIT, handler, port);
+}
+
+void trace_key(struct vm* vm, uint8_t scancode)
+{
+    append(&vm->input_trace, stats_cycles(), 0, TRACE_HOST_KEY, 0, scancode);
+}
+
+void trace_frame(struct vm* vm, uint64_t start, uint64_t end)
+{
+    append(&vm->input_trace, start, end, TRACE_HOST_FRAME, 0, 0);
+}
+
+struct trace_writer {
+    FILE* file;
+    bool first;
+    double cycles_per_us;
+};
+
+static double to_us(struct trace_writer* writer, uint64_t tsc)
+{
+    return (double)(int64_t)(tsc - base_tsc) / writer->cycles_per_us;
+}
+
+static void begin_event(struct trace_writer* writer)
+{
+    fprintf(writer->file, writer->first ? "\n" : ",\n");
+    writer->first = false;
+}
+
+static void write_name(struct trace_writer* writer, const char* kind, int pid, int tid, const char* name)
+{
+    begin_event(writer);
+    fprintf(writer->file, "{\"name\": \"%s\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+        kind, pid, tid, name);
+}
+
+static void write_record(struct trace_writer* writer, const struct trace_record* record, int pid, int tid)
+{
+    FILE* file = writer->file;
+    char name[32];
+    const char* phase;
+
+    switch (record->id) {
+    case TRACE_IRQ_ENTER:
+    case TRACE_IRQ_EXIT:
+        snprintf(name, sizeof(name), "irq %u", record->arg0);
+        phase = record->id == TRACE_IRQ_ENTER ? "B" : "E";
+        break;
+    case TRACE_SOFTIRQ_ENTER:
+    case TRACE_SOFTIRQ_EXIT:
+        snprintf(name, sizeof(name), "softirq");
+        phase = record->id == TRACE_SOFTIRQ_ENTER ? "B" : "E";
+        break;
+    case TRACE_SCHED_SWITCH:
+        snprintf(name, sizeof(name), "switch");
+        phase = "i";
+        break;
+    case TRACE_SCHED_WAKEUP:
+        snprintf(name, sizeof(name), "wakeup");
+        phase = "i";
+        break;
+    case TRACE_CONSOLE_FLUSH_BEGIN:
+    case TRACE_CONSOLE_FLUSH_END:
+        snprintf(name, sizeof(name), "console flush");
+        phase = record->id == TRACE_CONSOLE_FLUSH_BEGIN ? "B" : "E";
+        break;
+    case TRACE_HOST_EXIT:
+        snprintf(name, sizeof(name), "%s", stats_handler_name(record->arg0));
+        phase = "X";
+        break;
+    case TRACE_HOST_KEY:
+        snprintf(name, sizeof(name), "key");
+        phase = "i";
+        break;
+    case TRACE_HOST_FRAME:
+        snprintf(name, sizeof(name), "frame");
+        phase = "X";
+        break;
+    default:
+        snprintf(name, sizeof(name), "event %u", record->id);
+        phase = "i";
+        break;
+    }
+
+    begin_event(writer);
+    fprintf(file, "{\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d", name, phase,
+        to_us(writer, record->start), pid, tid);
+    if (phase[0] == 'X')
+        fprintf(file, ", \"dur\": %.3f", to_us(writer, record->end) - to_us(writer, record->start));
+    else if (phase[0] == 'i')
+        fprintf(file, ", \"s\": \"t\"");
+
+    switch (record->id) {
+    case TRACE_SOFTIRQ_ENTER:
+        fprintf(file, ", \"args\": {\"pending\": %u}", record->arg1);
+        break;
+    case TRACE_SCHED_SWITCH:
+        fprintf(file, ", \"args\": {\"prev\": %u, \"next\": %u}", record->arg0, record->arg1);
+        break;
+    case TRACE_SCHED_WAKEUP:
+        fprintf(file, ", \"args\": {\"cpu\": %u, \"thread\": %u}", record->arg0, record->arg1);
+        break;
+    case TRACE_CONSOLE_FLUSH_BEGIN:
+        fprintf(file, ", \"args\": {\"rows\": %d}", __builtin_popcount(record->arg1));
+        break;
+    case TRACE_HOST_EXIT:
+        fprintf(file, ", \"args\": {\"port\": \"0x%x\"}", record->arg1);
+        break;
+    case TRACE_HOST_KEY:
+        fprintf(file, ", \"args\": {\"scancode\": \"0x%02x\"}", record->arg1);
+        break;
+    default:
+        break;
+    }
+    fprintf(file, "}");
+}
+
+/* Guest events go to the guest process, host ones to the host process */
+static uint64_t write_log(struct trace_writer* writer, const struct trace_log* log, int host_pid, int tid)
+{
+    size_t count = __atomic_load_n(&log->count, __ATOMIC_ACQUIRE);
+    for (size_t idx = 0; idx < count; idx++) {
+        const struct trace_record* record = &log->records[idx];
+        write_record(writer, record, record->id >= TRACE_HOST_EXIT ? host_pid : host_pid + 1, tid);
+    }
+    return __atomic_load_n(&log->lost, __ATOMIC_RELAXED);
+}
+
+int trace_write(FILE* file, struct vm* vms, int count)
+{
+    struct trace_writer writer = { file, true, 1.0 };
+    uint64_t elapsed_ns = monotonic_ns() - base_ns;
+    if (elapsed_ns > 0)
+        writer.cycles_per_us = (double)(stats_cycles() - base_tsc) * 1000.0 / elapsed_ns;
+
+    fprintf(file, "{\"traceEvents\": [");
+    uint64_t lost = 0;
+    for (int idx = 0; idx < count; idx++) {
+        struct vm* vm = &vms[idx];
+        if (!vm->tracing)
+            continue;
+        int host_pid = idx * 2 + 1;
+        char name[32];
+
+        snprintf(name, sizeof(name), "vm%d host", idx);
+        write_name(&writer, "process_name", host_pid, 0, name);
+        snprintf(name, sizeof(name), "vm%d guest", idx);
+        write_name(&writer, "process_name", host_pid + 1, 0, name);
+        write_name(&writer, "thread_name", host_pid, KVM_MAX_VCPUS, "input and render");
+        lost += write_log(&writer, &vm->input_trace, host_pid, KVM_MAX_VCPUS);
+
+        for (int cpu = 0; cpu < vm->vcpu_count; cpu++) {
+            snprintf(name, sizeof(name), "vCPU %d", cpu);
+            write_name(&writer, "thread_name", host_pid, cpu, name);
+            snprintf(name, sizeof(name), "CPU %d", cpu);
+            write_name(&writer, "thread_name", host_pid + 1, cpu, name);
+            lost += write_log(&writer, &vm->vcpus[cpu].trace, host_pid, cpu);
+        }
+    }
+    fprintf(file, "\n], \"otherData\": {\"lost_events\": \"%llu\"}}\n", (unsigned long long)lost);
+
+    if (ferror(file))
+        return kvm_error(NULL, "Cannot write the trace\n");
+    return 0;
+}
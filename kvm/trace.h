@@ -0,0 +1,113 @@
+#ifndef _KVM_TRACE_H_
+#define _KVM_TRACE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "stats.h"
+
+struct vm;
+struct vcpu;
+
+/**
+ * The guest kernel's tracepoint rings, one per CPU at a fixed guest
+ * physical address. Same layout as kernel/kernel/trace.h.
+ */
+#define TRACE_ADDRESS 0x90000
+#define TRACE_MAGIC 0x45435254
+#define TRACE_MAX_CPUS 8
+#define TRACE_EVENTS 256
+
+enum trace_id {
+    TRACE_IRQ_ENTER = 1,
+    TRACE_IRQ_EXIT,
+    TRACE_SOFTIRQ_ENTER,
+    TRACE_SOFTIRQ_EXIT,
+    TRACE_SCHED_SWITCH,
+    TRACE_SCHED_WAKEUP,
+    TRACE_CONSOLE_FLUSH_BEGIN,
+    TRACE_CONSOLE_FLUSH_END,
+
+    /* Host side, after the guest's ids */
+    TRACE_HOST_EXIT = 0x100, /* arg0 handler, arg1 port */
+    TRACE_HOST_KEY, /* arg1 scancode */
+    TRACE_HOST_FRAME, /* the window presented a changed screen */
+};
+
+struct trace_event {
+    uint64_t tsc;
+    uint16_t id;
+    uint16_t arg0;
+    uint32_t arg1;
+};
+
+struct trace_cpu {
+    uint32_t head;
+    uint32_t reserved[15];
+    struct trace_event events[TRACE_EVENTS];
+};
+
+struct trace_buffer {
+    uint32_t magic;
+    uint32_t enabled;
+    uint32_t reserved[14];
+    struct trace_cpu cpus[TRACE_MAX_CPUS];
+};
+
+/* Records kept per vCPU and for the input thread, the rest is counted */
+#define TRACE_LOG_RECORDS (1 << 18)
+
+struct trace_record {
+    /* Host TSC, guest events are moved over by the vCPU's TSC offset */
+    uint64_t start;
+    /* 0 for an instant */
+    uint64_t end;
+    uint16_t id;
+    uint16_t arg0;
+    uint32_t arg1;
+};
+
+/**
+ * Filled by one thread only. The trace is written from another while the
+ * guest may still run, it reads `count` with acquire and only the records
+ * below it.
+ */
+struct trace_log {
+    struct trace_record* records;
+    size_t count;
+    /* Didn't fit, or guest events written over before they were read */
+    uint64_t lost;
+    /* Next guest event to read */
+    uint32_t guest_head;
+    /* Guest TSC minus host TSC, read once the guest has events */
+    int64_t tsc_offset;
+    bool has_offset;
+};
+
+void trace_log_init(struct trace_log* log);
+void trace_log_free(struct trace_log* log);
+
+/* Allocates the logs and turns on the guest tracepoints, before the vCPUs run */
+int trace_enable(struct vm* vm);
+/**
+ * Copies the guest events of the vCPU's ring, zero-copy out of guest
+ * memory. From the vCPU thread after KVM_RUN returned, the guest CPU
+ * writing the ring is stopped then.
+ */
+void trace_collect(struct vcpu* vcpu);
+void trace_exit(struct vcpu* vcpu, enum stats_handler handler, uint16_t port, uint64_t start, uint64_t end);
+/* From the thread sending keys */
+void trace_key(struct vm* vm, uint8_t scancode);
+/* From the render thread, a frame with a changed screen of `vm` */
+void trace_frame(struct vm* vm, uint64_t start, uint64_t end);
+
+/**
+ * Chrome trace-event JSON of `count` VMs, for chrome://tracing or
+ * Perfetto. Each VM is a host process with a thread per vCPU and one for
+ * input and rendering, and a guest process with a thread per CPU. Guest
+ * events since a vCPU's last exit to userspace aren't in it.
+ */
+int trace_write(FILE* file, struct vm* vms, int count);
+
+#endif
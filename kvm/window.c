@@ -4,8 +4,8 @@
 
 #include "window.h"
 
-#define MAX_ROWS 25
-#define MAX_COLS 80
+#define MAX_ROWS VGA_TEXT_ROWS
+#define MAX_COLS VGA_TEXT_COLS
 
 #define VGA_BLACK 0x0
 #define VGA_BLUE 0x1
@@ -65,76 +65,373 @@ SDL_Color vga_color_to_sdl(uint8_t color)
     return (SDL_Color) { 0, 0, 0, 0 };
 }
 
-struct vga_char {
-    SDL_Texture* texture;
+#define ATLAS_COLUMNS 16
+// 256 glyphs and a row for the solid block
+#define ATLAS_ROWS 17
+// transparent border around each glyph so filtering doesn't bleed between glyphs
+#define ATLAS_PADDING 1
+// space between screens when several are shown
+#define SCREEN_GAP 4
 
-    SDL_Rect rect;
-    char character;
-    uint8_t fg_color;
-    uint8_t bg_color;
-};
+#define DASHBOARD_WIDTH 1600
+#define DASHBOARD_HEIGHT 900
+
+static SDL_Color vertex_color(uint8_t color)
+{
+    SDL_Color sdl = vga_color_to_sdl(color);
+    sdl.a = 0xff;
+    return sdl;
+}
 
-struct vga_char vga_sdl[MAX_ROWS][MAX_COLS];
+int glyph_cache_init(struct glyph_cache* cache, SDL_Renderer* renderer, TTF_Font* font)
+{
+    SDL_Color white = { 0xff, 0xff, 0xff, 0xff };
+
+    // Create a single char temporarily to calculate our dimensions
+    SDL_Surface* surface = TTF_RenderUTF8_Solid(font, "O", white);
+    cache->glyph_width = surface->w;
+    cache->glyph_height = surface->h;
+    SDL_FreeSurface(surface);
 
-int font_width = 0;
-int font_height = 0;
+    int cell_width = cache->glyph_width + 2 * ATLAS_PADDING;
+    int cell_height = cache->glyph_height + 2 * ATLAS_PADDING;
+    int width = cell_width * ATLAS_COLUMNS;
+    int height = cell_height * ATLAS_ROWS;
+
+    SDL_Surface* atlas = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (atlas == NULL) {
+        fprintf(stderr, "error: cannot create glyph atlas: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_FillRect(atlas, NULL, 0);
+
+    for (int ch = 0; ch < 256; ch++) {
+        int x = (ch % ATLAS_COLUMNS) * cell_width + ATLAS_PADDING;
+        int y = (ch / ATLAS_COLUMNS) * cell_height + ATLAS_PADDING;
+        cache->uv[ch] = (SDL_FPoint) { (float)x / width, (float)y / height };
+        // the font only covers printable ASCII
+        cache->empty[ch] = ch <= ' ' || ch > '~';
+        if (cache->empty[ch])
+            continue;
+
+        SDL_Surface* glyph = TTF_RenderGlyph_Blended(font, ch, white);
+        if (glyph == NULL) {
+            cache->empty[ch] = true;
+            continue;
+        }
+        SDL_Rect src = { 0, 0, cache->glyph_width, cache->glyph_height };
+        SDL_Rect dst = { x, y, cache->glyph_width, cache->glyph_height };
+        // copy the alpha coverage as is instead of blending it on the atlas
+        SDL_SetSurfaceBlendMode(glyph, SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(glyph, &src, atlas, &dst);
+        SDL_FreeSurface(glyph);
+    }
 
-void vga_char_init(struct vga_char* vga_char)
+    SDL_Rect solid = { 0, (ATLAS_ROWS - 1) * cell_height, cell_width, cell_height };
+    SDL_FillRect(atlas, &solid, 0xffffffff);
+    cache->solid = (SDL_FPoint) {
+        (solid.x + solid.w / 2.0f) / width,
+        (solid.y + solid.h / 2.0f) / height,
+    };
+    cache->uv_size = (SDL_FPoint) {
+        (float)cache->glyph_width / width,
+        (float)cache->glyph_height / height,
+    };
+
+    cache->atlas = SDL_CreateTextureFromSurface(renderer, atlas);
+    SDL_FreeSurface(atlas);
+    if (cache->atlas == NULL) {
+        fprintf(stderr, "error: cannot create glyph atlas texture: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_SetTextureBlendMode(cache->atlas, SDL_BLENDMODE_BLEND);
+    return 0;
+}
+
+void glyph_cache_free(struct glyph_cache* cache)
 {
-    vga_char->texture = NULL;
-    vga_char->character = ' ';
-    vga_char->fg_color = 0xf;
-    vga_char->bg_color = 0x0;
-    vga_char->rect.x = 0;
-    vga_char->rect.y = 0;
-    // TODO: get h and w from actual render
-    vga_char->rect.h = font_height;
-    vga_char->rect.w = font_width;
+    if (cache->atlas != NULL)
+        SDL_DestroyTexture(cache->atlas);
+    cache->atlas = NULL;
 }
 
-void vga_char_free(struct vga_char* vga_char)
+static void vga_screen_init(struct vga_screen* screen, struct vm* vm)
 {
-    if (vga_char->texture != NULL)
-        SDL_DestroyTexture(vga_char->texture);
-    vga_char_init(vga_char);
+    memset(screen, 0, sizeof(*screen));
+    screen->vm = vm;
+    screen->dirty = true;
 }
 
-void get_font_dimensions(TTF_Font* font)
+static void vga_screen_free(struct vga_screen* screen)
 {
-    SDL_Color tmpColor = { 0, 0, 0, 0 };
-    // Create a single char temporarily to calculate our dimensions
-    SDL_Surface* surface = TTF_RenderUTF8_Solid(font, "O", tmpColor);
-    font_width = surface->w;
-    font_height = surface->h;
+    free(screen->vertices);
+    vga_screen_init(screen, NULL);
+}
 
-    SDL_FreeSurface(surface);
+/* The guest's CRTC start address, kept inside the text window instead of
+ * wrapping around like real hardware would */
+static uint16_t screen_start(struct vga_screen* screen)
+{
+    uint16_t start = screen->vm->vga.start_address;
+    if (start > VGA_TEXT_CELLS - VGA_TEXT_ROWS * VGA_TEXT_COLS)
+        start = VGA_TEXT_CELLS - VGA_TEXT_ROWS * VGA_TEXT_COLS;
+    return start;
 }
 
-void set_character(SDL_Renderer* renderer, struct vga_char* vgac, TTF_Font* font, int col, int row)
+static const uint8_t* screen_vga_memory(struct vga_screen* screen)
 {
-    char text[2] = {
-        vgac->character,
-        0,
-    };
+    if (screen->vga_memory != NULL)
+        return screen->vga_memory;
+    return (uint8_t*)screen->vm->shared_memory + VGA_TEXT_ADDRESS + screen_start(screen) * 2;
+}
 
-    SDL_Color fgColor = vga_color_to_sdl(vgac->fg_color);
-    SDL_Color bgColor = vga_color_to_sdl(vgac->bg_color);
+/* Cursor relative to the screen, off the screen and hidden if it is above
+ * the start address */
+static uint16_t screen_cursor(struct vga_screen* screen)
+{
+    if (screen->cursor_location != NULL)
+        return *screen->cursor_location;
+    uint16_t start = screen_start(screen);
+    uint16_t cursor = screen->vm->vga.cursor_location;
+    return cursor >= start ? cursor - start : UINT16_MAX;
+}
+
+/**
+ * Copy the screen contents and report changed cells to the recorder.
+ * Marks the screen dirty only when something changed.
+ */
+static void read_vga_memory(struct vga_screen* screen)
+{
+    const uint8_t* vga_memory = screen_vga_memory(screen);
+    uint16_t cursor = screen_cursor(screen);
 
-    if (vgac->texture != NULL) {
-        SDL_DestroyTexture(vgac->texture);
-        vgac->texture = NULL;
+    if (screen->has_cells && cursor == screen->cursor
+        && memcmp(vga_memory, screen->cells, sizeof(screen->cells)) == 0)
+        return;
+
+    // the guest keeps writing while we read, compare and copy each cell
+    // once so the recorder sees exactly what gets drawn
+    for (int cell = 0; cell < VGA_TEXT_ROWS * VGA_TEXT_COLS; cell++) {
+        uint8_t ch = vga_memory[cell * 2];
+        uint8_t color = vga_memory[cell * 2 + 1];
+        if (screen->has_cells && screen->cells[cell * 2] == ch && screen->cells[cell * 2 + 1] == color)
+            continue;
+
+        screen->cells[cell * 2] = ch;
+        screen->cells[cell * 2 + 1] = color;
+        if (screen->recorder != NULL)
+            recorder_cell(screen->recorder, cell, ch, color);
     }
 
-    SDL_Surface* surface = TTF_RenderText_Shaded(font, text, fgColor, bgColor);
-    vgac->texture = SDL_CreateTextureFromSurface(renderer, surface);
-    vgac->rect.x = vgac->rect.w * col;
-    vgac->rect.y = vgac->rect.h * row;
-    SDL_FreeSurface(surface);
+    screen->cursor = cursor;
+    screen->has_cells = true;
+    screen->dirty = true;
+}
+
+static SDL_Vertex* reserve_quads(SDL_Vertex** vertices, int* count, int* cap, int quads)
+{
+    if (*count + quads * 4 > *cap) {
+        int new_cap = *cap ? *cap : 1024;
+        while (*count + quads * 4 > new_cap)
+            new_cap *= 2;
+        SDL_Vertex* new_vertices = realloc(*vertices, new_cap * sizeof(SDL_Vertex));
+        if (new_vertices == NULL)
+            return NULL;
+        *vertices = new_vertices;
+        *cap = new_cap;
+    }
+
+    SDL_Vertex* quad = *vertices + *count;
+    *count += quads * 4;
+    return quad;
+}
+
+static void set_quad(SDL_Vertex* quad, SDL_FRect rect, SDL_FPoint uv, SDL_FPoint uv_size, SDL_Color color)
+{
+    quad[0] = (SDL_Vertex) { { rect.x, rect.y }, color, { uv.x, uv.y } };
+    quad[1] = (SDL_Vertex) { { rect.x + rect.w, rect.y }, color, { uv.x + uv_size.x, uv.y } };
+    quad[2] = (SDL_Vertex) { { rect.x + rect.w, rect.y + rect.h }, color, { uv.x + uv_size.x, uv.y + uv_size.y } };
+    quad[3] = (SDL_Vertex) { { rect.x, rect.y + rect.h }, color, { uv.x, uv.y + uv_size.y } };
+}
+
+static void push_quad(struct vga_screen* screen, SDL_FRect rect, SDL_FPoint uv, SDL_FPoint uv_size, SDL_Color color)
+{
+    SDL_Vertex* quad = reserve_quads(&screen->vertices, &screen->vertex_count, &screen->vertex_cap, 1);
+    if (quad != NULL)
+        set_quad(quad, rect, uv, uv_size, color);
+}
+
+/**
+ * Build the quads of a screen. Black backgrounds and blank glyphs are
+ * skipped since the window is cleared to black, so mostly empty screens
+ * are cheap to draw.
+ */
+static void tessellate_screen(struct glyph_cache* glyphs, struct vga_screen* screen)
+{
+    float cell_width = screen->rect.w / VGA_TEXT_COLS;
+    float cell_height = screen->rect.h / VGA_TEXT_ROWS;
+    SDL_FPoint no_size = { 0, 0 };
+
+    screen->vertex_count = 0;
+    for (int row = 0; row < VGA_TEXT_ROWS; row++) {
+        for (int col = 0; col < VGA_TEXT_COLS; col++) {
+            int cell = row * VGA_TEXT_COLS + col;
+            uint8_t ch = screen->cells[cell * 2];
+            uint8_t color = screen->cells[cell * 2 + 1];
+            SDL_FRect rect = {
+                screen->rect.x + col * cell_width,
+                screen->rect.y + row * cell_height,
+                cell_width,
+                cell_height,
+            };
+
+            if ((color >> 4) != VGA_BLACK)
+                push_quad(screen, rect, glyphs->solid, no_size, vertex_color(color >> 4));
+            if (!glyphs->empty[ch])
+                push_quad(screen, rect, glyphs->uv[ch], glyphs->uv_size, vertex_color(color & 0x0f));
+        }
+    }
+
+    if (screen->cursor < VGA_TEXT_ROWS * VGA_TEXT_COLS) {
+        int row = screen->cursor / VGA_TEXT_COLS;
+        int col = screen->cursor % VGA_TEXT_COLS;
+        uint8_t color = screen->cells[screen->cursor * 2 + 1];
+        // underline cursor, like the default VGA cursor shape
+        SDL_FRect rect = {
+            screen->rect.x + col * cell_width,
+            screen->rect.y + (row + 1) * cell_height - cell_height / 8,
+            cell_width,
+            cell_height / 8,
+        };
+        push_quad(screen, rect, glyphs->solid, no_size, vertex_color(color & 0x0f));
+    }
+
+    screen->dirty = false;
+}
+
+/* Tile the screens in a grid that fits the window */
+static void layout_screens(struct kvm_window* window)
+{
+    int width, height;
+    SDL_GetRendererOutputSize(window->renderer, &width, &height);
+
+    int count = window->screen_count;
+    int columns = 1;
+    while (columns * columns < count)
+        columns++;
+    int rows = (count + columns - 1) / columns;
+    float gap = count > 1 ? SCREEN_GAP : 0;
+
+    float screen_width = VGA_TEXT_COLS * window->glyphs.glyph_width;
+    float screen_height = VGA_TEXT_ROWS * window->glyphs.glyph_height;
+    float scale_x = (width - gap * (columns + 1)) / (columns * screen_width);
+    float scale_y = (height - gap * (rows + 1)) / (rows * screen_height);
+    float scale = scale_x < scale_y ? scale_x : scale_y;
+    // glyphs are rendered at their native size, don't blow them up
+    if (scale > 1.0f)
+        scale = 1.0f;
+
+    for (int idx = 0; idx < count; idx++) {
+        struct vga_screen* screen = &window->screens[idx];
+        screen->rect = (SDL_FRect) {
+            gap + (idx % columns) * (screen_width * scale + gap),
+            gap + (idx / columns) * (screen_height * scale + gap),
+            screen_width * scale,
+            screen_height * scale,
+        };
+        screen->dirty = true;
+    }
+
+    window->frame_dirty = true;
 }
 
-int kvm_window_init(struct kvm_window* window, struct vm* vm)
+static int screen_at(struct kvm_window* window, int x, int y)
 {
-    window->vm = vm;
+    for (int idx = 0; idx < window->screen_count; idx++) {
+        SDL_FRect* rect = &window->screens[idx].rect;
+        if (x >= rect->x && x < rect->x + rect->w && y >= rect->y && y < rect->y + rect->h)
+            return idx;
+    }
+    return -1;
+}
+
+static void set_focus(struct kvm_window* window, int focus)
+{
+    char title[64];
+    window->focus = focus;
+    window->frame_dirty = true;
+    if (window->screen_count > 1)
+        snprintf(title, sizeof(title), "duck-os [%d/%d]", focus + 1, window->screen_count);
+    else
+        snprintf(title, sizeof(title), "duck-os");
+    SDL_SetWindowTitle(window->window, title);
+}
+
+/* Concatenate the vertices of every screen and the focus frame */
+static int build_frame(struct kvm_window* window)
+{
+    window->frame_vertex_count = 0;
+    for (int idx = 0; idx < window->screen_count; idx++) {
+        struct vga_screen* screen = &window->screens[idx];
+        SDL_Vertex* dst = reserve_quads(&window->frame_vertices, &window->frame_vertex_count,
+            &window->frame_vertex_cap, screen->vertex_count / 4);
+        if (dst == NULL)
+            return 1;
+        memcpy(dst, screen->vertices, screen->vertex_count * sizeof(SDL_Vertex));
+    }
+
+    if (window->screen_count > 1) {
+        SDL_FRect rect = window->screens[window->focus].rect;
+        SDL_Color color = vertex_color(VGA_LIGHT_GRAY);
+        SDL_FPoint no_size = { 0, 0 };
+        float border = SCREEN_GAP / 2;
+        SDL_FRect edges[4] = {
+            { rect.x - border, rect.y - border, rect.w + 2 * border, border },
+            { rect.x - border, rect.y + rect.h, rect.w + 2 * border, border },
+            { rect.x - border, rect.y, border, rect.h },
+            { rect.x + rect.w, rect.y, border, rect.h },
+        };
+        SDL_Vertex* quads = reserve_quads(&window->frame_vertices, &window->frame_vertex_count,
+            &window->frame_vertex_cap, 4);
+        if (quads == NULL)
+            return 1;
+        for (int edge = 0; edge < 4; edge++)
+            set_quad(quads + edge * 4, edges[edge], window->glyphs.solid, no_size, color);
+    }
+
+    // every quad uses the same index pattern, grow the shared index buffer as needed
+    int quads = window->frame_vertex_count / 4;
+    if (quads * 6 > window->index_cap) {
+        int* indices = realloc(window->indices, quads * 6 * sizeof(int));
+        if (indices == NULL)
+            return 1;
+        for (int quad = window->index_cap / 6; quad < quads; quad++) {
+            indices[quad * 6 + 0] = quad * 4 + 0;
+            indices[quad * 6 + 1] = quad * 4 + 1;
+            indices[quad * 6 + 2] = quad * 4 + 2;
+            indices[quad * 6 + 3] = quad * 4 + 0;
+            indices[quad * 6 + 4] = quad * 4 + 2;
+            indices[quad * 6 + 5] = quad * 4 + 3;
+        }
+        window->indices = indices;
+        window->index_cap = quads * 6;
+    }
+
+    window->frame_dirty = false;
+    return 0;
+}
+
+int kvm_window_init(struct kvm_window* window, struct vm* vms, int count)
+{
+    memset(window, 0, sizeof(*window));
+
+    window->screens = calloc(count, sizeof(struct vga_screen));
+    if (window->screens == NULL)
+        return kvm_error("Cannot allocate screens", NULL);
+    window->screen_count = count;
+    for (int idx = 0; idx < count; idx++)
+        vga_screen_init(&window->screens[idx], vms != NULL ? &vms[idx] : NULL);
+
     /* Inint TTF. */
     SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO);
     TTF_Init();
@@ -144,29 +441,41 @@ int kvm_window_init(struct kvm_window* window, struct vm* vm)
         return 1;
     }
 
-    get_font_dimensions(window->font);
-    SDL_CreateWindowAndRenderer(font_width * (MAX_COLS + 1), font_height * (MAX_ROWS + 1), 0, &window->window, &window->renderer);
+    // scaled down screens need filtering to stay readable
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1");
 
-    for (int row = 0; row < MAX_ROWS; row++) {
-        for (int col = 0; col < MAX_COLS; col++) {
-            int val = (row * MAX_COLS) + col + row;
-            char c = (val % 10) + '0';
-            vga_char_init(&vga_sdl[row][col]);
-            vga_sdl[row][col].character = c;
-            set_character(window->renderer, &vga_sdl[row][col], window->font, col, row);
-        }
+    SDL_Color tmp_color = { 0, 0, 0, 0 };
+    SDL_Surface* surface = TTF_RenderUTF8_Solid(window->font, "O", tmp_color);
+    int width = surface->w * (VGA_TEXT_COLS + 1);
+    int height = surface->h * (VGA_TEXT_ROWS + 1);
+    SDL_FreeSurface(surface);
+    if (count > 1) {
+        width = DASHBOARD_WIDTH;
+        height = DASHBOARD_HEIGHT;
     }
+
+    SDL_CreateWindowAndRenderer(width, height, count > 1 ? SDL_WINDOW_RESIZABLE : 0, &window->window, &window->renderer);
+
+    int ret;
+    if ((ret = glyph_cache_init(&window->glyphs, window->renderer, window->font)) != 0)
+        return ret;
+
+    layout_screens(window);
+    set_focus(window, 0);
     return 0;
 }
 
 int kvm_window_free(struct kvm_window* window)
 {
-    for (int row = 0; row < MAX_ROWS; row++) {
-        for (int col = 0; col < MAX_COLS; col++) {
-            vga_char_free(&vga_sdl[row][col]);
-        }
-    }
+    for (int idx = 0; idx < window->screen_count; idx++)
+        vga_screen_free(&window->screens[idx]);
+    free(window->screens);
+    free(window->frame_vertices);
+    free(window->indices);
+    glyph_cache_free(&window->glyphs);
 
+    if (window->font != NULL)
+        TTF_CloseFont(window->font);
     TTF_Quit();
 
     SDL_DestroyRenderer(window->renderer);
@@ -175,27 +484,6 @@ int kvm_window_free(struct kvm_window* window)
     return 0;
 }
 
-void read_vga_memory(struct kvm_window* window)
-{
-    for (int row = 0; row < MAX_ROWS; row++) {
-        for (int col = 0; col < MAX_COLS; col++) {
-            int offset = (row * MAX_COLS + col) * 2;
-            char ch = *(char*)(window->vm->shared_memory + 0xb8000 + offset);
-            uint8_t color = *(uint8_t*)(window->vm->shared_memory + 0xb8000 + offset + 1);
-            uint8_t bg = color >> 4;
-            uint8_t fg = color & 0x0f;
-
-            struct vga_char* vchar = &vga_sdl[row][col];
-            if (ch != 0 && (vchar->character != ch || fg != vchar->fg_color || bg != vchar->bg_color)) {
-                vchar->bg_color = bg;
-                vchar->fg_color = fg;
-                vchar->character = ch;
-                set_character(window->renderer, vchar, window->font, col, row);
-            }
-        }
-    }
-}
-
 enum ps2_scan_code sdlkey_to_ps2(SDL_Keycode code)
 {
     switch (code) {
@@ -277,43 +565,89 @@ enum ps2_scan_code sdlkey_to_ps2(SDL_Keycode code)
         return PS2_ENTER;
     case SDLK_SPACE:
         return PS2_Space;
+    case SDLK_PAGEUP:
+        return PS2_PageUp;
+    case SDLK_PAGEDOWN:
+        return PS2_PageDown;
     default:
         printf("Unmapped SDL key: '0x%02x'\n", code);
         return PS2_ERROR;
     }
 };
 
+int kvm_window_draw(struct kvm_window* window)
+{
+    uint64_t start = stats_cycles();
+    int ret = 0;
+
+    for (int idx = 0; idx < window->screen_count; idx++) {
+        struct vga_screen* screen = &window->screens[idx];
+        read_vga_memory(screen);
+        if (screen->dirty) {
+            tessellate_screen(&window->glyphs, screen);
+            window->frame_dirty = true;
+            screen->changed = true;
+        }
+        if (screen->recorder != NULL && (ret = recorder_frame(screen->recorder, screen->cursor)) != 0)
+            return ret;
+    }
+
+    if (window->frame_dirty && (ret = build_frame(window)) != 0)
+        return kvm_error("Cannot build frame", NULL);
+
+    SDL_SetRenderDrawColor(window->renderer, 0, 0, 0, 0);
+    SDL_RenderClear(window->renderer);
+    if (window->frame_vertex_count > 0) {
+        SDL_RenderGeometry(window->renderer, window->glyphs.atlas, window->frame_vertices,
+            window->frame_vertex_count, window->indices, window->frame_vertex_count / 4 * 6);
+    }
+    SDL_RenderPresent(window->renderer);
+
+    // the new glyphs are up, where a keypress ends in the trace
+    for (int idx = 0; idx < window->screen_count; idx++) {
+        struct vga_screen* screen = &window->screens[idx];
+        if (screen->changed && screen->vm != NULL && screen->vm->tracing)
+            trace_frame(screen->vm, start, stats_cycles());
+        screen->changed = false;
+    }
+    return 0;
+}
+
 int kvm_window_run(struct kvm_window* window)
 {
     int quit = 0;
+    int ret = 0;
     SDL_Event event;
     while (!quit) {
+        struct vm* vm = window->screens[window->focus].vm;
         while (SDL_PollEvent(&event) == 1) {
             switch (event.type) {
             case SDL_QUIT:
                 quit = 1;
                 break;
             case SDL_KEYUP:
-                kvm_vm_send_key(window->vm, sdlkey_to_ps2(event.key.keysym.sym), true);
+                kvm_vm_send_key(vm, sdlkey_to_ps2(event.key.keysym.sym), true);
                 break;
             case SDL_KEYDOWN:
-                kvm_vm_send_key(window->vm, sdlkey_to_ps2(event.key.keysym.sym), false);
+                kvm_vm_send_key(vm, sdlkey_to_ps2(event.key.keysym.sym), false);
                 break;
-            default:
+            case SDL_MOUSEBUTTONDOWN: {
+                int focus = screen_at(window, event.button.x, event.button.y);
+                if (focus >= 0)
+                    set_focus(window, focus);
                 break;
             }
-        }
-        SDL_SetRenderDrawColor(window->renderer, 0, 0, 0, 0);
-        SDL_RenderClear(window->renderer);
-        read_vga_memory(window);
-
-        for (int row = 0; row < MAX_ROWS; row++) {
-            for (int col = 0; col < MAX_COLS; col++) {
-                SDL_RenderCopy(window->renderer, vga_sdl[row][col].texture, NULL, &vga_sdl[row][col].rect);
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED)
+                    layout_screens(window);
+                break;
+            default:
+                break;
             }
         }
 
-        SDL_RenderPresent(window->renderer);
+        if ((ret = kvm_window_draw(window)) != 0)
+            return ret;
         SDL_Delay(33);
     }
 
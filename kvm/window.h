@@ -2,21 +2,95 @@
 #define _KVM_WINDOW_H_
 
 #include "kvm.h"
+#include "record.h"
 
 #include <stdint.h>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+/**
+ * Every glyph is rendered once, white on transparent, into a single atlas
+ * texture. Cells are drawn as textured quads colored through the vertex
+ * color, so all screens share the atlas and a frame is a single draw call.
+ */
+struct glyph_cache {
+    SDL_Texture* atlas;
+    /* Size of a glyph in pixels, without the padding between atlas cells */
+    int glyph_width;
+    int glyph_height;
+    /* Top left texture coordinate of each glyph, and the size of a glyph */
+    SDL_FPoint uv[256];
+    SDL_FPoint uv_size;
+    /* Glyphs that have nothing to draw */
+    bool empty[256];
+    /* Texture coordinate of a fully opaque texel, used for solid quads */
+    SDL_FPoint solid;
+};
+
+/**
+ * A single guest console shown in the window
+ */
+struct vga_screen {
+    struct vm* vm;
+
+    /**
+     * Text mode memory and cursor of the screen. Point to the guest when
+     * NULL, the player points them to the decoded recording instead.
+     */
+    const uint8_t* vga_memory;
+    const uint16_t* cursor_location;
+    /**
+     * Changed cells are fed to the recorder, if any
+     */
+    struct recorder* recorder;
+
+    /* Screen contents the vertices were built from */
+    uint8_t cells[VGA_TEXT_ROWS * VGA_TEXT_COLS * 2];
+    uint16_t cursor;
+    bool has_cells;
+    /* Vertices need to be rebuilt */
+    bool dirty;
+    /* Changed in the frame being drawn, for the trace */
+    bool changed;
+
+    /* Position and size of the screen in the window */
+    SDL_FRect rect;
+
+    /* Four vertices per quad */
+    SDL_Vertex* vertices;
+    int vertex_count;
+    int vertex_cap;
+};
+
 struct kvm_window {
     SDL_Renderer* renderer;
     SDL_Window* window;
     TTF_Font* font;
-    struct vm* vm;
+    struct glyph_cache glyphs;
+
+    struct vga_screen* screens;
+    int screen_count;
+    /* Screen receiving keyboard input */
+    int focus;
+
+    /* Vertices of every screen, rebuilt only when a screen changes */
+    SDL_Vertex* frame_vertices;
+    int frame_vertex_count;
+    int frame_vertex_cap;
+    bool frame_dirty;
+    int* indices;
+    int index_cap;
 };
 
-int kvm_window_init(struct kvm_window* window, struct vm* vm);
+/**
+ * Create a window showing `count` screens tiled in a grid. `vms` may be
+ * NULL, in which case each screen's vga_memory needs to be set before drawing.
+ */
+int kvm_window_init(struct kvm_window* window, struct vm* vms, int count);
 int kvm_window_free(struct kvm_window* window);
 int kvm_window_run(struct kvm_window* window);
+/* Render a single frame without handling events */
+int kvm_window_draw(struct kvm_window* window);
 
 #endif